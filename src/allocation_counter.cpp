@@ -0,0 +1,117 @@
+/**
+ * @file allocation_counter.cpp
+ *
+ * @brief heap allocation counting
+ *
+ * Per thread allocation counters behind the interposed glibc allocator
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "allocation_counter.h"
+#include <stddef.h>
+#include <errno.h>
+
+// Initial exec TLS is part of the thread control block, reading it never allocates,
+// which matters since the counter is touched from inside malloc
+static thread_local uint64_t allocation_count __attribute__((tls_model("initial-exec"))) = 0;
+static thread_local uint64_t allocation_bytes __attribute__((tls_model("initial-exec"))) = 0;
+
+static inline void count_allocation(size_t size)
+{
+	allocation_count++;
+	allocation_bytes += size;
+}
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+	count_allocation(size);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+	count_allocation(count*size);
+	return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+	count_allocation(size);
+	return __libc_realloc(pointer, size);
+}
+
+// Armadillo allocates its matrices here
+int posix_memalign(void **pointer, size_t alignment, size_t size)
+{
+	count_allocation(size);
+	void *result = __libc_memalign(alignment, size);
+	if(result == nullptr)
+	{
+		return ENOMEM;
+	}
+	*pointer = result;
+	return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	count_allocation(size);
+	return __libc_memalign(alignment, size);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+	count_allocation(size);
+	return __libc_memalign(alignment, size);
+}
+}
+#endif
+
+Allocation_Count thread_allocations()
+{
+	Allocation_Count count;
+	count.allocations = allocation_count;
+	count.bytes = allocation_bytes;
+	return count;
+}
+
+bool allocation_counting()
+{
+#ifdef __GLIBC__
+	return true;
+#else
+	return false;
+#endif
+}
+
+// ------------------------------------------------------------------------------
+//   Allocation Scope
+// ------------------------------------------------------------------------------
+Allocation_Scope::
+Allocation_Scope()
+{
+	start = thread_allocations();
+}
+
+Allocation_Count Allocation_Scope::
+elapsed() const
+{
+	Allocation_Count now = thread_allocations();
+	Allocation_Count count;
+	count.allocations = now.allocations - start.allocations;
+	count.bytes = now.bytes - start.bytes;
+	return count;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file allocation_counter.h
+ *
+ * @brief heap allocation counting definition
+ *
+ * Every heap allocation of the process is counted per thread, so a stage can measure
+ * the allocations of one window by reading its own counter before and after.
+ *
+ * Counting replaces malloc, calloc, realloc and the aligned allocators with wrappers
+ * around glibc's internal entry points. operator new, std::vector and Armadillo all
+ * end up there, free() is left untouched. A count is a thread local increment, cheap
+ * enough to stay enabled in flight. On other C libraries nothing is counted and
+ * allocation_counting() returns false.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef ALLOCATION_COUNTER_H_
+#define ALLOCATION_COUNTER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <cstdint>
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+struct Allocation_Count {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0; // Requested bytes, reallocations count their new size
+};
+
+// Allocations of the calling thread since it started
+Allocation_Count thread_allocations();
+
+// True if allocations are counted in this build
+bool allocation_counting();
+
+// ----------------------------------------------------------------------------------
+//   Allocation Scope Class
+// ----------------------------------------------------------------------------------
+// Allocations of the calling thread since construction
+class Allocation_Scope
+{
+    Allocation_Count start;
+
+public:
+    Allocation_Scope();
+
+    Allocation_Count elapsed() const;
+};
+
+#endif
@@ -14,6 +14,19 @@
 // ------------------------------------------------------------------------------
 
 #include "buffer.h"
+#include "flight_recorder.h"
+#include "trace.h"
+
+// Interpolation needs ascending times, a sample stamped before its predecessor is moved up to it
+// Happens when the clock estimate steps between two samples of the same stream
+static void push_time(std::vector<uint64_t> &times, uint64_t timestamp)
+{
+	if(!times.empty() && timestamp < times.back())
+	{
+		timestamp = times.back();
+	}
+	times.push_back(timestamp);
+}
 
 // ------------------------------------------------------------------------------
 //   Con/De structors
@@ -46,20 +59,28 @@ Buffer::
 // Insert an angular velocity message into the buffer
 void Buffer::insert(mavsdk::Telemetry::Odometry message, uint64_t timestamp)
 {
+	TRACE_SPAN("insert_odometry");
+	// Arrival statistics first, so neither the recorder nor a full buffer skews the inter-arrival times
+	Stream_Health &stream = ingestion.streams[odometry_stream];
+	stream.arrived(steady_clock_ns(), ingestion.gap_threshold_ns.load(std::memory_order_relaxed));
+	// Record the raw message on arrival, also when the insert then has to wait for the consumer
+	if(recorder != nullptr)
+	{
+		recorder->record(insert_odometry, recorder_source, timestamp, {message.position_body.x_m, message.position_body.y_m, message.position_body.z_m,
+																	   message.velocity_body.x_m_s, message.velocity_body.y_m_s, message.velocity_body.z_m_s});
+	}
+
 	// thread safe insertion into the buffer, ensures that no insertion occurs when buffer is full
 	// will cause the calling thread to wait if it is full
 
 	std::unique_lock<std::mutex> unique_lock(mtx);
-
-	// use lambda function to determine if the buffer is currently full
-	// the calling thread waits on the not_full condition variable until the consumer notifies it is empty
-	// in summary, if the buffer is full, wait to insert until it has been emptied
-	not_full.wait(unique_lock, [this]()
+	uint64_t locked_ns = wait_not_full(unique_lock, stream);
+	if(closed)
 	{
-		return buffer_counter < buffer_length; 
-	});
+		return;
+	}
 
-	buffer.position_time_boot_ms.push_back(timestamp);
+	push_time(buffer.position_time_us, timestamp);
 
 	buffer.x.push_back(message.position_body.x_m);
 	buffer.y.push_back(message.position_body.y_m);
@@ -68,7 +89,9 @@ void Buffer::insert(mavsdk::Telemetry::Odometry message, uint64_t timestamp)
 	buffer.x_m_s.push_back(message.velocity_body.x_m_s);
 	buffer.y_m_s.push_back(message.velocity_body.y_m_s);
 	buffer.z_m_s.push_back(message.velocity_body.z_m_s);
-
+	// Despite the field name the velocities are in the child frame, estimators may report them in NED
+	buffer.velocity_ned = message.child_frame_id == mavsdk::Telemetry::Odometry::MavFrame::VisionNed
+						  || message.child_frame_id == mavsdk::Telemetry::Odometry::MavFrame::EstimNed;
 
 	if(mode == buffer_mode::length_mode)
 	{
@@ -88,6 +111,7 @@ void Buffer::insert(mavsdk::Telemetry::Odometry message, uint64_t timestamp)
 		// Notify blocked thread that buffer is full
 		full.notify_one();
 	}
+	stream.held(steady_clock_ns() - locked_ns);
 	//unlock mutex
 	unique_lock.unlock();
 }
@@ -96,20 +120,25 @@ void Buffer::insert(mavsdk::Telemetry::Odometry message, uint64_t timestamp)
 // Insert an angular velocity message into the buffer
 void Buffer::insert(mavsdk::Telemetry::AngularVelocityBody message, uint64_t timestamp)
 {
+	TRACE_SPAN("insert_angular_velocity");
+	Stream_Health &stream = ingestion.streams[angular_velocity_stream];
+	stream.arrived(steady_clock_ns(), ingestion.gap_threshold_ns.load(std::memory_order_relaxed));
+	if(recorder != nullptr)
+	{
+		recorder->record(insert_angular_velocity, recorder_source, timestamp, {message.roll_rad_s, message.pitch_rad_s, message.yaw_rad_s});
+	}
+
 	// thread safe insertion into the buffer, ensures that no insertion occurs when buffer is full
 	// will cause the calling thread to wait if it is full
 
 	std::unique_lock<std::mutex> unique_lock(mtx);
-
-	// use lambda function to determine if the buffer is currently full
-	// the calling thread waits on the not_full condition variable until the consumer notifies it is empty
-	// in summary, if the buffer is full, wait to insert until it has been emptied
-	not_full.wait(unique_lock, [this]()
+	uint64_t locked_ns = wait_not_full(unique_lock, stream);
+	if(closed)
 	{
-		return buffer_counter < buffer_length; 
-	});
+		return;
+	}
 
-	buffer.angular_velocity_time_boot_ms.push_back(timestamp);
+	push_time(buffer.angular_velocity_time_us, timestamp);
 	buffer.pitchspeed.push_back(message.pitch_rad_s);
 	buffer.rollspeed.push_back(message.roll_rad_s);
 	buffer.yawspeed.push_back(message.yaw_rad_s);
@@ -132,6 +161,7 @@ void Buffer::insert(mavsdk::Telemetry::AngularVelocityBody message, uint64_t tim
 		// Notify blocked thread that buffer is full
 		full.notify_one();
 	}
+	stream.held(steady_clock_ns() - locked_ns);
 	//unlock mutex
 	unique_lock.unlock();
 }
@@ -139,20 +169,25 @@ void Buffer::insert(mavsdk::Telemetry::AngularVelocityBody message, uint64_t tim
 // Insert an angular attitude message into the buffer
 void Buffer::insert(mavsdk::Telemetry::EulerAngle message, uint64_t timestamp)
 {
+	TRACE_SPAN("insert_attitude");
+	Stream_Health &stream = ingestion.streams[attitude_stream];
+	stream.arrived(steady_clock_ns(), ingestion.gap_threshold_ns.load(std::memory_order_relaxed));
+	if(recorder != nullptr)
+	{
+		recorder->record(insert_attitude, recorder_source, timestamp, {message.roll_deg, message.pitch_deg, message.yaw_deg});
+	}
+
 	// thread safe insertion into the buffer, ensures that no insertion occurs when buffer is full
 	// will cause the calling thread to wait if it is full
 
 	std::unique_lock<std::mutex> unique_lock(mtx);
-
-	// use lambda function to determine if the buffer is currently full
-	// the calling thread waits on the not_full condition variable until the consumer notifies it is empty
-	// in summary, if the buffer is full, wait to insert until it has been emptied
-	not_full.wait(unique_lock, [this]()
+	uint64_t locked_ns = wait_not_full(unique_lock, stream);
+	if(closed)
 	{
-		return buffer_counter < buffer_length; 
-	});
+		return;
+	}
 
-	buffer.attitude_time_boot_ms.push_back(timestamp);
+	push_time(buffer.attitude_time_us, timestamp);
 	buffer.roll.push_back(message.roll_deg);
 	buffer.pitch.push_back(message.pitch_deg);
 	buffer.yaw.push_back(message.yaw_deg);
@@ -175,6 +210,7 @@ void Buffer::insert(mavsdk::Telemetry::EulerAngle message, uint64_t timestamp)
 		// Notify blocked thread that buffer is full
 		full.notify_one();
 	}
+	stream.held(steady_clock_ns() - locked_ns);
 	//unlock mutex
 	unique_lock.unlock();
 }
@@ -182,20 +218,28 @@ void Buffer::insert(mavsdk::Telemetry::EulerAngle message, uint64_t timestamp)
 // Insert an ActuatorControlTarget into the buffer
 void Buffer::insert(mavsdk::Telemetry::ActuatorControlTarget actuator_message, uint64_t timestamp)
 {
+	TRACE_SPAN("insert_actuator");
+	Stream_Health &stream = ingestion.streams[actuator_stream];
+	stream.arrived(steady_clock_ns(), ingestion.gap_threshold_ns.load(std::memory_order_relaxed));
+	if(recorder != nullptr)
+	{
+		const std::vector<float> &controls = actuator_message.controls;
+		auto control = [&controls](size_t i){ return i < controls.size() ? controls[i] : 0.0f; };
+		recorder->record(insert_actuator, recorder_source, timestamp, {control(0), control(1), control(2), control(3),
+																	   control(4), control(5), control(6), control(7)});
+	}
+
 	// thread safe insertion into the buffer, ensures that no insertion occurs when buffer is full
 	// will cause the calling thread to wait if it is full
 
 	std::unique_lock<std::mutex> unique_lock(mtx);
-
-	// use lambda function to determine if the buffer is currently full
-	// the calling thread waits on the not_full condition variable until the consumer notifies it is empty
-	// in summary, if the buffer is full, wait to insert until it has been emptied
-	not_full.wait(unique_lock, [this]()
+	uint64_t locked_ns = wait_not_full(unique_lock, stream);
+	if(closed)
 	{
-		return buffer_counter < buffer_length; 
-	});
+		return;
+	}
 
-	buffer.actuator_output_ms.push_back(timestamp);
+	push_time(buffer.actuator_time_us, timestamp);
 	//Insert the first four actuator outputs into respective actuators
 	buffer.actuator0.push_back(actuator_message.controls.at(0));
 	buffer.actuator1.push_back(actuator_message.controls.at(1));
@@ -220,14 +264,51 @@ void Buffer::insert(mavsdk::Telemetry::ActuatorControlTarget actuator_message, u
 		// Notify blocked thread that buffer is full
 		full.notify_one();
 	}
+	stream.held(steady_clock_ns() - locked_ns);
 	//unlock mutex
 	unique_lock.unlock();
 }
 
+// Wait until the buffer has room, returns the time from which the insert holds the lock
+uint64_t
+Buffer::wait_not_full(std::unique_lock<std::mutex> &lock, Stream_Health &stream)
+{
+	uint64_t locked_ns = steady_clock_ns();
+	if(closed || buffer_counter < buffer_length)
+	{
+		return locked_ns;
+	}
+
+	// use lambda function to determine if the buffer is currently full
+	// the calling thread waits on the not_full condition variable until the consumer notifies it is empty
+	// in summary, if the buffer is full, wait to insert until it has been emptied
+	not_full.wait(lock, [this]()
+	{
+		return closed || buffer_counter < buffer_length; 
+	});
+	uint64_t woken_ns = steady_clock_ns();
+	stream.waited(woken_ns - locked_ns);
+	return woken_ns;
+}
+
 // Give the accessing thread a copy of the data buffer then empty it
 Data_Buffer
 Buffer::clear()
 {
+	Data_Buffer data;
+	clear(data);
+	return data;
+}
+
+// Hand the buffer contents to the accessing thread in exchange for the vectors of data
+// data is emptied and becomes the next buffer, both keep their capacity, so once the
+// window length has settled neither the producers nor the consumer allocate
+void
+Buffer::clear(Data_Buffer &data)
+{
+	TRACE_SPAN("buffer_clear");
+	data.clear_buffers();
+
 	// This block of code is locked to the calling thread
 	// ie. the buffer is emptied without having any data added
 
@@ -237,15 +318,16 @@ Buffer::clear()
     // Wait if buffer is not full
 	// Will wait as long as predicate is false
 	// buffer will not notify consumer until it has filled up
-    full.wait(unique_lock, [this]{return buffer_counter == buffer_length;});
+    full.wait(unique_lock, [this]{return closed || buffer_counter >= buffer_length;});
+	if(closed)
+	{
+		return;
+	}
     
-    // Copy buffer contents to new vector, because we will unlock the mutex
-	// before returning the buffer
-	Data_Buffer *data = new Data_Buffer;
-	*data = buffer;
-	
-	// Empty buffer
-	buffer.clear_buffers();
+	// Swap instead of copying, the buffer continues in the emptied vectors of data
+	std::swap(buffer, data);
+	buffer.velocity_ned = data.velocity_ned; // The frame carries over until the next odometry says otherwise
+	clears++;
 	if(mode == buffer_mode::length_mode)
 	{
 		buffer_counter = 0;
@@ -258,15 +340,70 @@ Buffer::clear()
 		buffer_counter = 0;
 	}
 
+	if(recorder != nullptr)
+	{
+		recorder->record(buffer_clear, recorder_source, clears, {(float)data.find_max_length(), (float)data.find_min_length()});
+	}
+
     // Notify a single thread that the buffer isn't full
 	not_full.notify_one();
 
     // Unlock unique lock
     unique_lock.unlock();
-    
-	// Return copy of buffer, shouldn't need to deallocate because the compiler does this on function return
-	return *data;
 }
 
+// Release every thread blocked in insert or clear, later calls return immediately
+// clear() then returns an empty buffer and inserts are discarded
+void
+Buffer::shutdown()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	closed = true;
+	full.notify_all();
+	not_full.notify_all();
+}
+
+// Record every insert and clear in a flight recorder, the recorder must outlive the buffer
+void
+Buffer::set_recorder(Flight_Recorder *recorder_, uint8_t source)
+{
+	recorder = recorder_;
+	recorder_source = source;
+}
 
+// Inter-arrival times above the threshold are counted as gaps
+void
+Buffer::set_gap_threshold(std::chrono::microseconds threshold)
+{
+	ingestion.gap_threshold_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(threshold).count(), std::memory_order_relaxed);
+}
+
+// Change the window while producers and the consumer are running, returns false if it was already set this way
+// A shorter window that is already full is handed out by the next clear, a longer one lets blocked producers continue
+bool
+Buffer::set_window(int buffer_length_, buffer_mode mode_)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if(buffer_length_ == buffer_length && mode_ == mode)
+	{
+		return false;
+	}
+	if(mode_ != mode)
+	{
+		// The collected samples count towards the new window from now on
+		auto now = std::chrono::high_resolution_clock::now();
+		clear_time = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+		buffer_counter = mode_ == buffer_mode::length_mode ? buffer.find_max_length() : 0;
+	}
+	buffer_length = buffer_length_;
+	mode = mode_;
+	full.notify_one();
+	not_full.notify_all();
+	return true;
+}
 
+const Ingestion_Metrics &
+Buffer::get_ingestion() const
+{
+	return ingestion;
+}
@@ -25,6 +25,7 @@
 #include <mavsdk/mavsdk.h> // general mavlink header
 #include <mavsdk/plugins/telemetry/telemetry.h> // telemetry plugin
 #include <iostream>
+#include "metrics.h"
 
 // ------------------------------------------------------------------------------
 //   Data structures
@@ -33,27 +34,29 @@
 // Contains separate vectors for each telemetry parameter of interest
 // Vectors containing time stamps are associated with data of each telemetry type
 struct Data_Buffer {
-    std::vector<uint64_t> time_boot_ms; /*< [ms] Common Timestamp (time since system boot) used after interpolation.*/
+    // Timestamps are host time since the program epoch in microseconds, see Clock_Sync
+    std::vector<uint64_t> time_us; /*< [us] Common Timestamp used after interpolation.*/
 
-    std::vector<uint64_t> attitude_time_boot_ms;    
-    std::vector<float> roll; /*< [rad] Roll angle (-pi..+pi)*/
-    std::vector<float> pitch; /*< [rad] Pitch angle (-pi..+pi)*/
-    std::vector<float> yaw; /*< [rad] Yaw angle (-pi..+pi)*/
+    std::vector<uint64_t> attitude_time_us;    
+    std::vector<float> roll; /*< [deg] Roll angle, converted to radians by transform_states*/
+    std::vector<float> pitch; /*< [deg] Pitch angle*/
+    std::vector<float> yaw; /*< [deg] Yaw angle*/
 
-    std::vector<uint64_t> angular_velocity_time_boot_ms;
+    std::vector<uint64_t> angular_velocity_time_us;
     std::vector<float> rollspeed; /*< [rad/s] Roll angular speed*/
     std::vector<float> pitchspeed; /*< [rad/s] Pitch angular speed*/
     std::vector<float> yawspeed; /*< [rad/s] Yaw angular speed*/
 
-    std::vector<uint64_t> position_time_boot_ms;
+    std::vector<uint64_t> position_time_us;
     std::vector<float> x; /*< [m] X Position*/
     std::vector<float> y; /*< [m] Y Position*/
     std::vector<float> z; /*< [m] Z Position*/
     std::vector<float> x_m_s; /*< [m/s] X Speed*/
     std::vector<float> y_m_s; /*< [m/s] Y Speed*/
     std::vector<float> z_m_s; /*< [m/s] Z Speed*/
+    bool velocity_ned = false; /*< x_m_s, y_m_s, z_m_s are north, east, down instead of body frame*/
 
-    std::vector<uint64_t> actuator_output_ms;
+    std::vector<uint64_t> actuator_time_us;
     std::vector<float> actuator0; /**/    
     std::vector<float> actuator1; /*< */
     std::vector<float> actuator2; /*< */
@@ -61,14 +64,14 @@ struct Data_Buffer {
 
     void clear_buffers()
     {
-        time_boot_ms.clear();
-        attitude_time_boot_ms.clear();
-        angular_velocity_time_boot_ms.clear();
-        position_time_boot_ms.clear();
-
-        roll.clear(); /*< [rad] Roll angle (-pi..+pi)*/
-        pitch.clear(); /*< [rad] Pitch angle (-pi..+pi)*/
-        yaw.clear(); /*< [rad] Yaw angle (-pi..+pi)*/
+        time_us.clear();
+        attitude_time_us.clear();
+        angular_velocity_time_us.clear();
+        position_time_us.clear();
+
+        roll.clear(); /*< [deg] Roll angle*/
+        pitch.clear(); /*< [deg] Pitch angle*/
+        yaw.clear(); /*< [deg] Yaw angle*/
         rollspeed.clear(); /*< [rad/s] Roll angular speed*/
         pitchspeed.clear(); /*< [rad/s] Pitch angular speed*/
         yawspeed.clear(); /*< [rad/s] Yaw angular speed*/
@@ -79,50 +82,58 @@ struct Data_Buffer {
         x_m_s.clear(); /*< [m/s] X Speed*/
         y_m_s.clear(); /*< [m/s] Y Speed*/
         z_m_s.clear(); /*< [m/s] Z Speed*/
+
+        actuator_time_us.clear();
+        actuator0.clear();
+        actuator1.clear();
+        actuator2.clear();
+        actuator3.clear();
     }
 
-    int find_max_length()
+    int find_max_length() const
     {
         int max_length = 0;
-        if(attitude_time_boot_ms.size() > max_length)
+        if(attitude_time_us.size() > max_length)
         {
-            max_length = attitude_time_boot_ms.size();
+            max_length = attitude_time_us.size();
         }
-        if(angular_velocity_time_boot_ms.size() > max_length)
+        if(angular_velocity_time_us.size() > max_length)
         {
-            max_length = angular_velocity_time_boot_ms.size();
+            max_length = angular_velocity_time_us.size();
         }
-        if(position_time_boot_ms.size() > max_length)
+        if(position_time_us.size() > max_length)
         {
-            max_length = position_time_boot_ms.size();
+            max_length = position_time_us.size();
         }
-        if(actuator_output_ms.size() > max_length)
+        if(actuator_time_us.size() > max_length)
         {
-            max_length = actuator_output_ms.size();
+            max_length = actuator_time_us.size();
         }
         return max_length;
     }
 
-    int find_min_length()
+    int find_min_length() const
     {
-        int min_length = attitude_time_boot_ms.size();
+        int min_length = attitude_time_us.size();
 
-        if(angular_velocity_time_boot_ms.size() < min_length)
+        if(angular_velocity_time_us.size() < min_length)
         {
-            min_length = angular_velocity_time_boot_ms.size();
+            min_length = angular_velocity_time_us.size();
         }
-        if(position_time_boot_ms.size() < min_length)
+        if(position_time_us.size() < min_length)
         {
-            min_length = position_time_boot_ms.size();
+            min_length = position_time_us.size();
         }
-        if(actuator_output_ms.size() < min_length)
+        if(actuator_time_us.size() < min_length)
         {
-            min_length = actuator_output_ms.size();
+            min_length = actuator_time_us.size();
         }
         return min_length;
     }
 };
 
+class Flight_Recorder;
+
 // Enumerate the modes which the buffer may operate in
 enum buffer_mode {
     time_mode,
@@ -148,6 +159,14 @@ class Buffer
     std::condition_variable full;
     std::condition_variable not_full;
 
+    Flight_Recorder *recorder = nullptr; // Raw inserts are recorded here if set
+    uint8_t recorder_source = 0;
+    uint64_t clears = 0;
+    bool closed = false; // Set by shutdown()
+    Ingestion_Metrics ingestion; // Per stream health, updated by the inserts
+
+    uint64_t wait_not_full(std::unique_lock<std::mutex> &lock, Stream_Health &stream);
+
 public:
     Buffer();
     Buffer(int buffer_length_, buffer_mode mode_);
@@ -159,6 +178,12 @@ public:
     void insert(mavsdk::Telemetry::ActuatorControlTarget, uint64_t timestamp);
 
     Data_Buffer clear();
+    void clear(Data_Buffer &data);
+    void shutdown();
+    void set_recorder(Flight_Recorder *recorder_, uint8_t source);
+    void set_gap_threshold(std::chrono::microseconds threshold);
+    bool set_window(int buffer_length_, buffer_mode mode_);
+    const Ingestion_Metrics &get_ingestion() const;
 };
 
 #endif  //Buffer_H_
\ No newline at end of file
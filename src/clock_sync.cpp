@@ -0,0 +1,177 @@
+/**
+ * @file clock_sync.cpp
+ *
+ * @brief autopilot clock synchronization
+ *
+ * Offset and drift of the autopilot clock from the lower envelope of the arrival times
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "clock_sync.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Clock_Sync::
+Clock_Sync(bool enabled_)
+{
+	enabled = enabled_;
+}
+
+// ------------------------------------------------------------------------------
+//   Stamping
+// ------------------------------------------------------------------------------
+/**
+ * Host time of a sample in microseconds since the program epoch
+ *
+ * @param autopilot_us autopilot timestamp of the sample, 0 if the message has none
+ * @param arrival_us host time at which the sample arrived
+ * @return the arrival time if disabled
+ */
+uint64_t Clock_Sync::
+stamp(uint64_t autopilot_us, uint64_t arrival_us)
+{
+	if(!enabled)
+	{
+		return arrival_us;
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	if(autopilot_us == 0)
+	{
+		double compensated = std::round(arrival_us - estimate.delay_us);
+		return compensated > 0 ? (uint64_t)compensated : 0;
+	}
+
+	// A rebooted autopilot starts its clock again
+	if(last_autopilot_us > autopilot_us + CLOCK_SYNC_REBOOT_US)
+	{
+		restart();
+	}
+	last_autopilot_us = autopilot_us;
+
+	// Arrival minus autopilot time is the offset plus a delay which is never negative
+	double autopilot = autopilot_us;
+	double offset = (double)((int64_t)arrival_us - (int64_t)autopilot_us);
+	if(!segment_open || offset < segment.offset_us)
+	{
+		segment = {autopilot, offset};
+	}
+	if(!segment_open)
+	{
+		segment_start_us = autopilot;
+		segment_open = true;
+	}
+	if(autopilot - segment_start_us >= CLOCK_SYNC_SEGMENT_US)
+	{
+		envelope[next_point] = segment;
+		next_point = (next_point + 1) % CLOCK_SYNC_SEGMENTS;
+		num_points = std::min(num_points + 1, CLOCK_SYNC_SEGMENTS);
+		segment_open = false;
+		fit();
+	}
+	else if(!estimate.synchronized)
+	{
+		// Until the first segment is complete the running minimum is the best there is
+		estimate.offset_us = segment.offset_us;
+		estimate.reference_us = segment.autopilot_us;
+	}
+
+	double envelope_offset = offset_at(autopilot);
+	estimate.delay_us += (offset - envelope_offset - estimate.delay_us)*CLOCK_SYNC_DELAY_GAIN;
+	publish();
+
+	// The fitted line passes above some of the minima, a sample is never placed after its arrival
+	double host = std::min(std::round(autopilot + envelope_offset), (double)arrival_us);
+	return host > 0 ? (uint64_t)host : 0;
+}
+
+// Forget the envelope, keeps counting the restarts
+void Clock_Sync::
+restart()
+{
+	uint64_t resets = estimate.resets + 1;
+	estimate = Clock_Estimate();
+	estimate.resets = resets;
+	num_points = 0;
+	next_point = 0;
+	segment_open = false;
+}
+
+// Least squares line through the envelope points, centred on their mean so the large autopilot times cancel
+void Clock_Sync::
+fit()
+{
+	double mean_time = 0, mean_offset = 0;
+	for(int i = 0; i < num_points; i++)
+	{
+		mean_time += envelope[i].autopilot_us/num_points;
+		mean_offset += envelope[i].offset_us/num_points;
+	}
+	double covariance = 0, variance = 0;
+	for(int i = 0; i < num_points; i++)
+	{
+		double time = envelope[i].autopilot_us - mean_time;
+		covariance += time*(envelope[i].offset_us - mean_offset);
+		variance += time*time;
+	}
+	double drift = variance > 0 ? covariance/variance : 0;
+	estimate.drift = std::max(-CLOCK_SYNC_MAX_DRIFT, std::min(CLOCK_SYNC_MAX_DRIFT, drift));
+	estimate.offset_us = mean_offset;
+	estimate.reference_us = mean_time;
+	estimate.synchronized = true;
+}
+
+double Clock_Sync::
+offset_at(double autopilot_us) const
+{
+	return estimate.offset_us + estimate.drift*(autopilot_us - estimate.reference_us);
+}
+
+void Clock_Sync::
+publish()
+{
+	published_offset_us.store(estimate.offset_us, std::memory_order_relaxed);
+	published_drift.store(estimate.drift, std::memory_order_relaxed);
+	published_reference_us.store(estimate.reference_us, std::memory_order_relaxed);
+	published_delay_us.store(estimate.delay_us, std::memory_order_relaxed);
+	published_synchronized.store(estimate.synchronized, std::memory_order_relaxed);
+	published_resets.store(estimate.resets, std::memory_order_relaxed);
+}
+
+// ------------------------------------------------------------------------------
+//   Reporting
+// ------------------------------------------------------------------------------
+// The fields are read one by one, so they may come from consecutive samples
+Clock_Estimate Clock_Sync::
+get_estimate() const
+{
+	Clock_Estimate current;
+	current.offset_us = published_offset_us.load(std::memory_order_relaxed);
+	current.drift = published_drift.load(std::memory_order_relaxed);
+	current.reference_us = published_reference_us.load(std::memory_order_relaxed);
+	current.delay_us = published_delay_us.load(std::memory_order_relaxed);
+	current.synchronized = published_synchronized.load(std::memory_order_relaxed);
+	current.resets = published_resets.load(std::memory_order_relaxed);
+	return current;
+}
+
+// Prometheus text format, see Metrics_Server
+void Clock_Sync::
+write(std::string &out, const std::string &labels) const
+{
+	Clock_Estimate current = get_estimate();
+	write_gauge(out, "sindy_clock_offset_us", labels, current.offset_us);
+	write_gauge(out, "sindy_clock_drift_ppm", labels, current.drift*1e6);
+	write_gauge(out, "sindy_clock_delay_us", labels, current.delay_us);
+	write_gauge(out, "sindy_clock_synchronized", labels, current.synchronized ? 1 : 0);
+	write_counter(out, "sindy_clock_resets_total", labels, current.resets);
+}
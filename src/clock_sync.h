@@ -0,0 +1,98 @@
+/**
+ * @file clock_sync.h
+ *
+ * @brief autopilot clock synchronization definition
+ *
+ * Maps the autopilot's sample timestamps onto the host clock.
+ *
+ * The difference between the host arrival time and the autopilot timestamp of a sample
+ * is the clock offset plus the transport delay, which is never negative. The lower
+ * envelope of the differences therefore follows the offset: the minimum of every
+ * segment of autopilot time is kept, and a line fitted through the recent minima gives
+ * the offset and its drift. A sample is placed at its autopilot time plus the fitted
+ * offset, which is its arrival time without the jitter of MAVLink batching, the link
+ * and the callback scheduling. Streams without an autopilot timestamp are placed at
+ * their arrival time less the mean delay above the envelope, so they share the time base.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef CLOCK_SYNC_H_
+#define CLOCK_SYNC_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#define CLOCK_SYNC_SEGMENT_US 1000000 // Autopilot time spanned by one envelope point
+#define CLOCK_SYNC_SEGMENTS 16 // Envelope points in the offset and drift fit
+#define CLOCK_SYNC_MAX_DRIFT 1e-3 // Fitted drifts are limited to 1000ppm, crystals stay well below
+#define CLOCK_SYNC_REBOOT_US 1000000 // The autopilot clock going back further than this restarts the estimate
+#define CLOCK_SYNC_DELAY_GAIN (1.0/64) // Weight of a new sample in the mean delay above the envelope
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+// Current estimate, host time = autopilot time + offset + drift*(autopilot time - reference)
+struct Clock_Estimate {
+    double offset_us = 0;
+    double drift = 0; // Host microseconds gained per autopilot microsecond
+    double reference_us = 0; // Autopilot time at which offset_us holds
+    double delay_us = 0; // Mean transport delay above the envelope
+    bool synchronized = false; // Set once the first segment has completed
+    uint64_t resets = 0; // Autopilot clock restarts seen
+};
+
+// ----------------------------------------------------------------------------------
+//   Clock Sync Class
+// ----------------------------------------------------------------------------------
+/*
+ * One per vehicle, shared by its telemetry subscriptions. stamp() takes a short lock,
+ * the published estimate is read through relaxed atomics so the metrics endpoint
+ * never waits on the ingestion threads.
+ */
+class Clock_Sync
+{
+    struct Envelope_Point {
+        double autopilot_us;
+        double offset_us; // Smallest arrival minus autopilot time of the segment
+    };
+
+    bool enabled;
+    std::mutex mtx;
+    std::array<Envelope_Point, CLOCK_SYNC_SEGMENTS> envelope;
+    int num_points = 0;
+    int next_point = 0;
+    Envelope_Point segment; // Minimum of the open segment
+    double segment_start_us = 0;
+    bool segment_open = false;
+    uint64_t last_autopilot_us = 0;
+    Clock_Estimate estimate;
+
+    std::atomic<double> published_offset_us{0};
+    std::atomic<double> published_drift{0};
+    std::atomic<double> published_reference_us{0};
+    std::atomic<double> published_delay_us{0};
+    std::atomic<bool> published_synchronized{false};
+    std::atomic<uint64_t> published_resets{0};
+
+    void restart();
+    void fit();
+    double offset_at(double autopilot_us) const;
+    void publish();
+
+public:
+    Clock_Sync(bool enabled_ = true);
+
+    uint64_t stamp(uint64_t autopilot_us, uint64_t arrival_us);
+    Clock_Estimate get_estimate() const;
+    void write(std::string &out, const std::string &labels) const;
+};
+
+#endif
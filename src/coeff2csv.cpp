@@ -0,0 +1,66 @@
+/**
+ * @file coeff2csv.cpp
+ *
+ * @brief binary coefficient log converter
+ *
+ * Converts a binary coefficient log written by SINDy_offboard into the CSV layout
+ * of the original text coefficient log
+ *
+ * usage: SINDy_coeff2csv <coefficients.bin> <coefficients.csv>
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "coefficient_logger.h"
+#include <iostream>
+#include <fstream>
+
+int main(int argc, char **argv)
+{
+	if(argc != 3)
+	{
+		std::cout << "usage: SINDy_coeff2csv <binary coefficient log> <csv output>\n";
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		Coefficient_Reader reader(argv[1]);
+		std::ofstream csv(argv[2], std::ios_base::trunc);
+		csv << reader.get_header() << "\n";
+
+		uint64_t sample_time_us;
+		arma::mat coefficients;
+		std::vector<double> statistics;
+		uint64_t rows = 0;
+		while(reader.next(sample_time_us, coefficients, statistics))
+		{
+			// Same row layout as the text log, row-wise coefficients followed by the window statistics
+			csv << sample_time_us << ",";
+			for(arma::uword row = 0; row < coefficients.n_rows; row++)
+			{
+				for(arma::uword column = 0; column < coefficients.n_cols; column++)
+				{
+					csv << coefficients(row, column) << ",";
+				}
+			}
+			for(double statistic : statistics)
+			{
+				csv << statistic << ",";
+			}
+			csv << "\n";
+			rows++;
+		}
+		std::cout << "Converted " << rows << " windows\n";
+	}
+	catch(int error)
+	{
+		return error;
+	}
+	return 0;
+}
@@ -0,0 +1,625 @@
+/**
+ * @file coefficient_logger.cpp
+ *
+ * @brief binary coefficient log
+ *
+ * Asynchronous batched writer and reader for the binary coefficient log
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "coefficient_logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+#include <algorithm>
+
+// Append a plain value to a byte buffer
+template <typename T>
+static void append(std::vector<char> &buffer, const T &value)
+{
+	const char *bytes = reinterpret_cast<const char *>(&value);
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Coefficient_Logger::
+Coefficient_Logger(std::string filename_, std::string header, int num_features_, int num_states_, int num_statistics_,
+				   int fsync_interval_, int keyframe_interval_, int ring_capacity)
+	: ring(ring_capacity)
+{
+	filename = filename_;
+	num_features = num_features_;
+	num_states = num_states_;
+	num_statistics = num_statistics_;
+	fsync_interval = fsync_interval_;
+	keyframe_interval = keyframe_interval_ > 0 ? keyframe_interval_ : 0;
+	batch_size = 64*1024;
+	batch.reserve(batch_size + sizeof(double)*(num_features*num_states + num_statistics + 2) + 2*(num_features*num_states/8 + 1));
+	previous.assign(num_features*num_states, 0.0);
+	support.assign((num_features*num_states + 7)/8, 0);
+	previous_support.assign(support.size(), 0);
+
+	file_descriptor = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(file_descriptor < 0)
+	{
+		std::cerr << "Could not open coefficient log " << filename << ": " << strerror(errno) << "\n";
+		throw EXIT_FAILURE;
+	}
+
+	// File header, written before the writer thread starts
+	batch.insert(batch.end(), COEFFICIENT_LOG_MAGIC, COEFFICIENT_LOG_MAGIC + 8);
+	append<uint32_t>(batch, COEFFICIENT_LOG_VERSION);
+	append<uint32_t>(batch, num_features);
+	append<uint32_t>(batch, num_states);
+	append<uint32_t>(batch, num_statistics);
+	append<uint32_t>(batch, keyframe_interval);
+	append<uint32_t>(batch, header.size());
+	batch.insert(batch.end(), header.begin(), header.end());
+	flush();
+
+	writer_thread = std::thread(&Coefficient_Logger::writer, this);
+}
+
+Coefficient_Logger::
+~Coefficient_Logger()
+{
+	stop();
+}
+
+// Copy a window into the ring, returns false if it had to be dropped
+bool Coefficient_Logger::
+log(const arma::mat &coefficients, std::chrono::microseconds sample_time, const std::vector<double> &statistics)
+{
+	if((int)coefficients.n_rows != num_features || (int)coefficients.n_cols != num_states || (int)statistics.size() != num_statistics)
+	{
+		records_dropped++;
+		return false;
+	}
+
+	bool queued = ring.try_push([&](Coefficient_Record &record)
+	{
+		record.sample_time_us = sample_time.count();
+		// Slots keep their capacity, so this only allocates the first time a slot is used
+		record.coefficients.resize(num_features*num_states);
+		record.statistics.assign(statistics.begin(), statistics.end());
+		for(int row = 0; row < num_features; row++)
+		{
+			for(int column = 0; column < num_states; column++)
+			{
+				record.coefficients[row*num_states + column] = coefficients(row, column);
+			}
+		}
+	});
+
+	if(!queued)
+	{
+		records_dropped++;
+	}
+	return queued;
+}
+
+// Drain the ring, write out what is left and close the file
+void Coefficient_Logger::
+stop()
+{
+	time_to_exit = true;
+	if(writer_thread.joinable())
+	{
+		writer_thread.join();
+	}
+	if(file_descriptor >= 0)
+	{
+		flush();
+		fsync(file_descriptor);
+		close(file_descriptor);
+		file_descriptor = -1;
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Writer
+// ------------------------------------------------------------------------------
+void Coefficient_Logger::
+writer()
+{
+	while(true)
+	{
+		bool exiting = time_to_exit;
+		bool popped = false;
+		while(ring.try_pop([this](Coefficient_Record &record){ encode(record); }))
+		{
+			popped = true;
+			records_logged++;
+			if(batch.size() >= batch_size)
+			{
+				flush();
+			}
+		}
+
+		// Write out whenever the ring runs dry, so a record never waits on the next window
+		if(!batch.empty())
+		{
+			flush();
+		}
+
+		if(exiting)
+		{
+			return;
+		}
+		if(!popped)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	}
+}
+
+void Coefficient_Logger::
+encode(const Coefficient_Record &record)
+{
+	if(keyframe_interval == 0)
+	{
+		encode_dense(record);
+	}
+	else if(records_since_keyframe == 0)
+	{
+		encode_keyframe(record);
+	}
+	else
+	{
+		encode_delta(record);
+	}
+	if(keyframe_interval > 0)
+	{
+		records_since_keyframe = (records_since_keyframe + 1) % keyframe_interval;
+	}
+	records_since_fsync++;
+}
+
+void Coefficient_Logger::
+encode_dense(const Coefficient_Record &record)
+{
+	uint32_t length = sizeof(uint8_t) + sizeof(uint64_t) + sizeof(double)*(record.coefficients.size() + record.statistics.size());
+	append<uint32_t>(batch, length);
+	append<uint8_t>(batch, record_dense);
+	append<uint64_t>(batch, record.sample_time_us);
+	const char *coefficients = reinterpret_cast<const char *>(record.coefficients.data());
+	batch.insert(batch.end(), coefficients, coefficients + sizeof(double)*record.coefficients.size());
+	const char *statistics = reinterpret_cast<const char *>(record.statistics.data());
+	batch.insert(batch.end(), statistics, statistics + sizeof(double)*record.statistics.size());
+}
+
+void Coefficient_Logger::
+encode_keyframe(const Coefficient_Record &record)
+{
+	size_t start = batch.size();
+	append<uint32_t>(batch, 0); // Length is patched once the record is complete
+	append<uint8_t>(batch, record_keyframe);
+	append<uint64_t>(batch, record.sample_time_us);
+
+	std::fill(support.begin(), support.end(), 0);
+	for(size_t i = 0; i < record.coefficients.size(); i++)
+	{
+		if(record.coefficients[i] != 0.0)
+		{
+			support[i/8] |= 1 << (i%8);
+		}
+	}
+	batch.insert(batch.end(), support.begin(), support.end());
+	for(size_t i = 0; i < record.coefficients.size(); i++)
+	{
+		if(record.coefficients[i] != 0.0)
+		{
+			append<double>(batch, record.coefficients[i]);
+		}
+		previous[i] = record.coefficients[i];
+	}
+	const char *statistics = reinterpret_cast<const char *>(record.statistics.data());
+	batch.insert(batch.end(), statistics, statistics + sizeof(double)*record.statistics.size());
+
+	uint32_t length = batch.size() - start - sizeof(uint32_t);
+	memcpy(batch.data() + start, &length, sizeof(length));
+	previous_support.swap(support);
+}
+
+void Coefficient_Logger::
+encode_delta(const Coefficient_Record &record)
+{
+	size_t start = batch.size();
+	append<uint32_t>(batch, 0);
+	append<uint8_t>(batch, record_delta);
+	append<uint64_t>(batch, record.sample_time_us);
+
+	std::fill(support.begin(), support.end(), 0);
+	int count = 0;
+	for(size_t i = 0; i < record.coefficients.size(); i++)
+	{
+		if(record.coefficients[i] != 0.0)
+		{
+			support[i/8] |= 1 << (i%8);
+			count++;
+		}
+	}
+
+	// The support rarely changes between windows, so its XOR is only stored when it does
+	bool support_changed = support != previous_support;
+	append<uint8_t>(batch, support_changed);
+	if(support_changed)
+	{
+		for(size_t i = 0; i < support.size(); i++)
+		{
+			batch.push_back(support[i] ^ previous_support[i]);
+		}
+	}
+
+	// Widths are written ahead of the value bytes, fill them in as the values are encoded
+	size_t widths = batch.size();
+	batch.insert(batch.end(), (count + 1)/2, 0);
+	int value = 0;
+	for(size_t i = 0; i < record.coefficients.size(); i++)
+	{
+		if(record.coefficients[i] != 0.0)
+		{
+			uint64_t current_bits, previous_bits;
+			memcpy(&current_bits, &record.coefficients[i], sizeof(uint64_t));
+			memcpy(&previous_bits, &previous[i], sizeof(uint64_t));
+			uint64_t difference = current_bits ^ previous_bits;
+			uint8_t width = 0;
+			while(width < 8 && (difference >> (8*width)))
+			{
+				batch.push_back((difference >> (8*width)) & 0xff);
+				width++;
+			}
+			batch[widths + value/2] |= width << (4*(value%2));
+			value++;
+		}
+		previous[i] = record.coefficients[i];
+	}
+	const char *statistics = reinterpret_cast<const char *>(record.statistics.data());
+	batch.insert(batch.end(), statistics, statistics + sizeof(double)*record.statistics.size());
+
+	uint32_t length = batch.size() - start - sizeof(uint32_t);
+	memcpy(batch.data() + start, &length, sizeof(length));
+	previous_support.swap(support);
+}
+
+// Write the batch buffer to the file, syncing at the configured cadence
+void Coefficient_Logger::
+flush()
+{
+	size_t written = 0;
+	while(written < batch.size())
+	{
+		ssize_t result = write(file_descriptor, batch.data() + written, batch.size() - written);
+		if(result < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			std::cerr << "Coefficient log write failed: " << strerror(errno) << "\n";
+			break;
+		}
+		written += result;
+	}
+	bytes_written += written;
+	batch.clear();
+
+	if(fsync_interval > 0 && records_since_fsync >= fsync_interval)
+	{
+		fsync(file_descriptor);
+		records_since_fsync = 0;
+	}
+}
+
+uint64_t Coefficient_Logger::
+get_logged() const
+{
+	return records_logged;
+}
+
+uint64_t Coefficient_Logger::
+get_dropped() const
+{
+	return records_dropped;
+}
+
+uint64_t Coefficient_Logger::
+get_bytes_written() const
+{
+	return bytes_written;
+}
+
+size_t Coefficient_Logger::
+get_depth() const
+{
+	return ring.depth();
+}
+
+// ------------------------------------------------------------------------------
+//   Reader
+// ------------------------------------------------------------------------------
+Coefficient_Reader::
+Coefficient_Reader(std::string filename)
+{
+	file.open(filename, std::ios_base::binary);
+	char magic[8];
+	uint32_t features, states, statistics, keyframes_every = 0, header_length;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char *>(&version), sizeof(version));
+	if(!file || memcmp(magic, COEFFICIENT_LOG_MAGIC, 8) != 0 || version < 1 || version > COEFFICIENT_LOG_VERSION)
+	{
+		std::cerr << filename << " is not a coefficient log\n";
+		throw EXIT_FAILURE;
+	}
+	file.read(reinterpret_cast<char *>(&features), sizeof(features));
+	file.read(reinterpret_cast<char *>(&states), sizeof(states));
+	file.read(reinterpret_cast<char *>(&statistics), sizeof(statistics));
+	if(version >= 2)
+	{
+		file.read(reinterpret_cast<char *>(&keyframes_every), sizeof(keyframes_every));
+	}
+	file.read(reinterpret_cast<char *>(&header_length), sizeof(header_length));
+	header.resize(header_length);
+	file.read(&header[0], header_length);
+	num_features = features;
+	num_states = states;
+	num_statistics = statistics;
+	keyframe_interval = keyframes_every;
+	first_record = file.tellg();
+	previous.assign(num_features*num_states, 0.0);
+	support.assign((num_features*num_states + 7)/8, 0);
+}
+
+// Read the next record, returns false at the end of the file or on a truncated record
+bool Coefficient_Reader::
+next(uint64_t &sample_time_us, arma::mat &coefficients, std::vector<double> &statistics)
+{
+	while(true)
+	{
+		uint32_t length;
+		if(!file.read(reinterpret_cast<char *>(&length), sizeof(length)))
+		{
+			return false;
+		}
+		record.resize(length);
+		if(!file.read(record.data(), length))
+		{
+			return false; // Truncated by a crash mid-write
+		}
+		if(length < sizeof(uint8_t) + sizeof(uint64_t) + sizeof(double)*num_statistics)
+		{
+			continue;
+		}
+
+		const char *position = record.data();
+		const char *end = record.data() + length - sizeof(double)*num_statistics;
+		uint8_t type = *position;
+		position += sizeof(uint8_t);
+		memcpy(&sample_time_us, position, sizeof(sample_time_us));
+		position += sizeof(sample_time_us);
+
+		// Skip record types this reader does not know, and deltas without a reference window
+		if(!decode(type, position, end))
+		{
+			continue;
+		}
+
+		coefficients.set_size(num_features, num_states);
+		for(int row = 0; row < num_features; row++)
+		{
+			for(int column = 0; column < num_states; column++)
+			{
+				coefficients(row, column) = previous[row*num_states + column];
+			}
+		}
+		statistics.resize(num_statistics);
+		memcpy(statistics.data(), end, sizeof(double)*num_statistics);
+		return true;
+	}
+}
+
+// Decode a record payload into previous, returns false if the record can not be decoded
+bool Coefficient_Reader::
+decode(uint8_t type, const char *position, const char *end)
+{
+	size_t num_coefficients = previous.size();
+	if(type == record_dense)
+	{
+		if(end - position != (ptrdiff_t)(sizeof(double)*num_coefficients))
+		{
+			return false;
+		}
+		memcpy(previous.data(), position, sizeof(double)*num_coefficients);
+		for(size_t i = 0; i < num_coefficients; i++)
+		{
+			if(previous[i] != 0.0)
+			{
+				support[i/8] |= 1 << (i%8);
+			}
+			else
+			{
+				support[i/8] &= ~(1 << (i%8));
+			}
+		}
+		have_reference = true;
+		return true;
+	}
+
+	if(type == record_keyframe)
+	{
+		if(end - position < (ptrdiff_t)support.size())
+		{
+			return false;
+		}
+		memcpy(support.data(), position, support.size());
+		position += support.size();
+		for(size_t i = 0; i < num_coefficients; i++)
+		{
+			previous[i] = 0.0;
+			if(support[i/8] & (1 << (i%8)))
+			{
+				if(end - position < (ptrdiff_t)sizeof(double))
+				{
+					return false;
+				}
+				memcpy(&previous[i], position, sizeof(double));
+				position += sizeof(double);
+			}
+		}
+		have_reference = true;
+		return true;
+	}
+
+	if(type == record_delta && have_reference)
+	{
+		if(end - position < 1)
+		{
+			return false;
+		}
+		bool support_changed = *position;
+		position += sizeof(uint8_t);
+		if(support_changed)
+		{
+			if(end - position < (ptrdiff_t)support.size())
+			{
+				return false;
+			}
+			for(size_t i = 0; i < support.size(); i++)
+			{
+				support[i] ^= position[i];
+			}
+			position += support.size();
+		}
+
+		int count = 0;
+		for(uint8_t byte : support)
+		{
+			count += __builtin_popcount(byte);
+		}
+		const char *widths = position;
+		position += (count + 1)/2;
+		if(position > end)
+		{
+			return false;
+		}
+
+		int value = 0;
+		for(size_t i = 0; i < num_coefficients; i++)
+		{
+			if(!(support[i/8] & (1 << (i%8))))
+			{
+				previous[i] = 0.0;
+				continue;
+			}
+			uint8_t width = (widths[value/2] >> (4*(value%2))) & 0x0f;
+			if(width > 8 || end - position < width)
+			{
+				return false;
+			}
+			uint64_t difference = 0;
+			for(int byte = 0; byte < width; byte++)
+			{
+				difference |= (uint64_t)(uint8_t)position[byte] << (8*byte);
+			}
+			position += width;
+			uint64_t bits;
+			memcpy(&bits, &previous[i], sizeof(bits));
+			bits ^= difference;
+			memcpy(&previous[i], &bits, sizeof(bits));
+			value++;
+		}
+		return true;
+	}
+	return false;
+}
+
+// Record the position of every keyframe, reading only the record headers
+void Coefficient_Reader::
+build_index()
+{
+	keyframes.clear();
+	file.clear();
+	file.seekg(first_record);
+	while(true)
+	{
+		std::streampos offset = file.tellg();
+		uint32_t length;
+		uint8_t type;
+		uint64_t sample_time_us;
+		if(!file.read(reinterpret_cast<char *>(&length), sizeof(length)) || length < sizeof(type) + sizeof(sample_time_us)
+		   || !file.read(reinterpret_cast<char *>(&type), sizeof(type))
+		   || !file.read(reinterpret_cast<char *>(&sample_time_us), sizeof(sample_time_us)))
+		{
+			break;
+		}
+		if(type == record_keyframe || type == record_dense)
+		{
+			keyframes.push_back({sample_time_us, offset});
+		}
+		file.seekg(length - sizeof(type) - sizeof(sample_time_us), std::ios_base::cur);
+	}
+	file.clear();
+}
+
+// Position the reader at the last keyframe at or before sample_time_us, next() continues from there
+bool Coefficient_Reader::
+seek(uint64_t sample_time_us)
+{
+	if(keyframes.empty())
+	{
+		build_index();
+	}
+	if(keyframes.empty() || keyframes.front().sample_time_us > sample_time_us)
+	{
+		return false;
+	}
+	size_t selected = 0;
+	while(selected + 1 < keyframes.size() && keyframes[selected + 1].sample_time_us <= sample_time_us)
+	{
+		selected++;
+	}
+	file.clear();
+	file.seekg(keyframes[selected].offset);
+	have_reference = false;
+	return true;
+}
+
+const std::string &Coefficient_Reader::
+get_header() const
+{
+	return header;
+}
+
+int Coefficient_Reader::
+get_num_features() const
+{
+	return num_features;
+}
+
+int Coefficient_Reader::
+get_num_states() const
+{
+	return num_states;
+}
+
+int Coefficient_Reader::
+get_num_statistics() const
+{
+	return num_statistics;
+}
+
+int Coefficient_Reader::
+get_keyframe_interval() const
+{
+	return keyframe_interval;
+}
@@ -0,0 +1,183 @@
+/**
+ * @file coefficient_logger.h
+ *
+ * @brief binary coefficient log definition
+ *
+ * Background writer for the model coefficients and a reader for the resulting files
+ *
+ * File layout, all fields in host byte order:
+ *
+ *   char     magic[8]          "SINDYCF" and a terminating zero
+ *   uint32   version
+ *   uint32   num_features      rows of the coefficient matrix
+ *   uint32   num_states        columns of the coefficient matrix
+ *   uint32   num_statistics    per window statistics following the coefficients
+ *   uint32   keyframe_interval windows between keyframes, 0 for dense records (version 2 only)
+ *   uint32   header_length
+ *   char     header[header_length]   CSV header of the equivalent text log
+ *
+ * followed by records of
+ *
+ *   uint32   length            bytes following this field
+ *   uint8    type              record_dense, record_keyframe or record_delta
+ *   uint64   sample_time_us
+ *   ...      payload
+ *   double   statistics[num_statistics]
+ *
+ * Coefficients are indexed row-wise, as in the CSV. The support mask holds one bit per
+ * coefficient, set for nonzero coefficients, least significant bit first. Payloads are
+ *
+ *   record_dense     double coefficients[num_features*num_states]
+ *   record_keyframe  uint8 support[(num_features*num_states + 7)/8]
+ *                    double values[support count]
+ *   record_delta     uint8 support_changed
+ *                    uint8 support_xor[(num_features*num_states + 7)/8]   only if support_changed
+ *                    uint8 widths[(support count + 1)/2]
+ *                    uint8 bytes[sum of widths]
+ *
+ * A delta record XORs the bits of every supported value with the same coefficient of
+ * the previous window (zero if it was not supported). The 4 bit width, low nibble
+ * first, is the number of significant bytes of that XOR, which are stored least
+ * significant byte first. Every keyframe_interval-th window is a keyframe, readers can
+ * seek to any keyframe and decode from there.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef COEFFICIENT_LOGGER_H_
+#define COEFFICIENT_LOGGER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "ring.h"
+#include <armadillo>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <chrono>
+
+#define COEFFICIENT_LOG_MAGIC "SINDYCF"
+#define COEFFICIENT_LOG_VERSION 2
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+
+enum coefficient_record_type : uint8_t {
+    record_dense = 0,
+    record_keyframe = 1,
+    record_delta = 2
+};
+
+// One logged window, slots of the logger ring hold these and reuse their buffers
+struct Coefficient_Record {
+    uint64_t sample_time_us = 0;
+    std::vector<double> coefficients; // Row-wise vectorised coefficient matrix
+    std::vector<double> statistics;
+};
+
+// ----------------------------------------------------------------------------------
+//   Coefficient Logger Class
+// ----------------------------------------------------------------------------------
+/*
+ * log() copies a window into a preallocated ring slot and returns, the writer thread
+ * encodes records into a batch buffer and writes it out through a persistent file
+ * descriptor. The calling thread never touches the filesystem and never blocks; when
+ * the writer falls behind and the ring is full the record is dropped and counted.
+ */
+class Coefficient_Logger
+{
+    std::string filename;
+    int num_features;
+    int num_states;
+    int num_statistics;
+    int fsync_interval; // records between fsync calls, 0 leaves flushing to the OS
+    int keyframe_interval; // records between keyframes, 0 writes dense records
+    size_t batch_size; // bytes buffered before a write
+
+    Lockfree_Ring<Coefficient_Record> ring;
+    std::vector<char> batch;
+    int file_descriptor = -1;
+    int records_since_fsync = 0;
+    int records_since_keyframe = 0;
+    std::vector<double> previous; // Last encoded window, reference of the next delta record
+    std::vector<uint8_t> previous_support;
+    std::vector<uint8_t> support;
+
+    std::thread writer_thread;
+    std::atomic<bool> time_to_exit{false};
+    std::atomic<uint64_t> records_logged{0};
+    std::atomic<uint64_t> records_dropped{0};
+    std::atomic<uint64_t> bytes_written{0};
+
+    void writer();
+    void encode(const Coefficient_Record &record);
+    void encode_dense(const Coefficient_Record &record);
+    void encode_keyframe(const Coefficient_Record &record);
+    void encode_delta(const Coefficient_Record &record);
+    void flush();
+
+public:
+    Coefficient_Logger(std::string filename_, std::string header, int num_features_, int num_states_, int num_statistics_,
+                       int fsync_interval_ = 10, int keyframe_interval_ = 50, int ring_capacity = 64);
+    ~Coefficient_Logger();
+
+    bool log(const arma::mat &coefficients, std::chrono::microseconds sample_time, const std::vector<double> &statistics);
+    void stop();
+
+    uint64_t get_logged() const;
+    uint64_t get_dropped() const;
+    uint64_t get_bytes_written() const;
+    size_t get_depth() const;
+};
+
+// ----------------------------------------------------------------------------------
+//   Coefficient Reader Class
+// ----------------------------------------------------------------------------------
+/*
+ * Reads a binary coefficient log back into dense coefficient matrices, decoding
+ * keyframe and delta records against the previously read window
+ */
+class Coefficient_Reader
+{
+    struct Keyframe {
+        uint64_t sample_time_us;
+        std::streampos offset;
+    };
+
+    std::ifstream file;
+    std::string header;
+    uint32_t version = 0;
+    int num_features = 0;
+    int num_states = 0;
+    int num_statistics = 0;
+    int keyframe_interval = 0;
+    std::streampos first_record;
+    std::vector<char> record;
+    std::vector<double> previous; // Last decoded window, row-wise
+    std::vector<uint8_t> support;
+    bool have_reference = false; // A delta record can only be decoded after a keyframe
+    std::vector<Keyframe> keyframes;
+
+    bool decode(uint8_t type, const char *position, const char *end);
+    void build_index();
+
+public:
+    Coefficient_Reader(std::string filename);
+
+    bool next(uint64_t &sample_time_us, arma::mat &coefficients, std::vector<double> &statistics);
+    bool seek(uint64_t sample_time_us);
+
+    const std::string &get_header() const;
+    int get_num_features() const;
+    int get_num_states() const;
+    int get_num_statistics() const;
+    int get_keyframe_interval() const;
+};
+
+#endif
@@ -0,0 +1,399 @@
+/**
+ * @file coefficient_stream.cpp
+ *
+ * @brief UDP coefficient stream
+ *
+ * Keyframe and delta encoding of the coefficients of every window and its decoder
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "coefficient_stream.h"
+#include <netdb.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+// Append a plain value to a byte buffer
+template <typename T>
+static void append(std::vector<char> &buffer, const T &value)
+{
+	const char *bytes = reinterpret_cast<const char *>(&value);
+	buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+}
+
+// Read a plain value from a datagram, false if it ends first
+template <typename T>
+static bool extract(const char *&position, const char *end, T &value)
+{
+	if(end - position < (ptrdiff_t)sizeof(T))
+	{
+		return false;
+	}
+	memcpy(&value, position, sizeof(T));
+	position += sizeof(T);
+	return true;
+}
+
+static bool support_bit(const std::vector<uint8_t> &support, int bit)
+{
+	return (support[bit/8] >> (bit%8)) & 1;
+}
+
+// Resolve host:port, IPv6 addresses in brackets, returns false with the reason if it is not a destination
+// Opens nothing, so a destination can be checked before a streamer is created for it
+bool resolve_stream_destination(const std::string &destination, sockaddr_storage &address, socklen_t &length, std::string &error)
+{
+	size_t separator = destination.rfind(':');
+	if(separator == std::string::npos || separator == 0 || separator + 1 == destination.size())
+	{
+		error = "Coefficient stream destination " + destination + " is not host:port";
+		return false;
+	}
+	std::string host = destination.substr(0, separator);
+	std::string port = destination.substr(separator + 1);
+	if(host.size() > 2 && host.front() == '[' && host.back() == ']')
+	{
+		host = host.substr(1, host.size() - 2);
+	}
+
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	addrinfo *addresses = nullptr;
+	int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+	if(status != 0)
+	{
+		error = "Could not resolve coefficient stream destination " + destination + ": " + gai_strerror(status);
+		return false;
+	}
+	memcpy(&address, addresses->ai_addr, addresses->ai_addrlen);
+	length = addresses->ai_addrlen;
+	freeaddrinfo(addresses);
+	return true;
+}
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+// destination_ is host:port, IPv6 addresses in brackets, eg. [::1]:14600
+Coefficient_Streamer::
+Coefficient_Streamer(std::string destination_, uint8_t vehicle_, size_t num_models, double bandwidth_, int keyframe_interval_,
+					 double quantum_)
+{
+	vehicle = vehicle_;
+	bandwidth = bandwidth_;
+	keyframe_interval = keyframe_interval_;
+	quantum = quantum_;
+	streams.resize(num_models);
+
+	std::string error;
+	if(!resolve_stream_destination(destination_, destination, destination_length, error))
+	{
+		std::cerr << error << "\n";
+		throw EXIT_FAILURE;
+	}
+	socket_fd = socket(destination.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(socket_fd < 0)
+	{
+		std::cerr << "Could not open coefficient stream socket: " << strerror(errno) << "\n";
+		throw EXIT_FAILURE;
+	}
+
+	// The bucket starts full, the first keyframes go out at once
+	tokens = bandwidth;
+	last_refill = std::chrono::steady_clock::now();
+}
+
+Coefficient_Streamer::
+~Coefficient_Streamer()
+{
+	if(socket_fd >= 0)
+	{
+		close(socket_fd);
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Streaming
+// ------------------------------------------------------------------------------
+// Send the first bytes of the datagram if the bandwidth cap allows it, never blocks
+bool Coefficient_Streamer::
+send(size_t bytes)
+{
+	if(bandwidth > 0)
+	{
+		auto now = std::chrono::steady_clock::now();
+		tokens = std::min(bandwidth, tokens + std::chrono::duration<double>(now - last_refill).count()*bandwidth);
+		last_refill = now;
+		if(tokens < bytes)
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+	}
+	ssize_t result = sendto(socket_fd, datagram.data(), bytes, MSG_DONTWAIT | MSG_NOSIGNAL, reinterpret_cast<const sockaddr *>(&destination),
+							destination_length);
+	if(result != (ssize_t)bytes)
+	{
+		dropped.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	tokens -= bytes;
+	sent.fetch_add(1, std::memory_order_relaxed);
+	sent_bytes.fetch_add(bytes, std::memory_order_relaxed);
+	return true;
+}
+
+// Send every model of a window, coefficients have features as rows and states as columns
+// timings are the stage timings in us, in stage_timing_names order
+void Coefficient_Streamer::
+publish(uint64_t index, std::chrono::microseconds sample_time, const std::vector<arma::mat> &coefficients, const std::vector<double> &timings)
+{
+	float step = quantum;
+	for(size_t m = 0; m < streams.size() && m < coefficients.size(); m++)
+	{
+		Stream &stream = streams[m];
+		const arma::mat &model = coefficients[m];
+		int num_values = model.n_rows*model.n_cols;
+		if(stream.keyframe.size() != (size_t)num_values)
+		{
+			stream.keyframe.assign(num_values, 0);
+			stream.support.assign((num_values + 7)/8, 0);
+			stream.has_keyframe = false;
+		}
+
+		// Row-wise support, like the coefficient log
+		support.assign((num_values + 7)/8, 0);
+		bool keyframe = !stream.has_keyframe || ++stream.windows_since_keyframe >= keyframe_interval;
+		for(arma::uword row = 0; row < model.n_rows; row++)
+		{
+			for(arma::uword column = 0; column < model.n_cols; column++)
+			{
+				int bit = row*model.n_cols + column;
+				double value = model(row, column);
+				if(value == 0)
+				{
+					continue;
+				}
+				support[bit/8] |= 1 << (bit%8);
+				keyframe = keyframe || !(std::fabs(std::round((value - stream.keyframe[bit])/step)) <= INT16_MAX);
+			}
+		}
+		uint8_t type = keyframe ? stream_keyframe : support != stream.support ? stream_support_delta : stream_delta;
+		datagram.clear();
+		append<uint32_t>(datagram, COEFFICIENT_STREAM_MAGIC);
+		append<uint8_t>(datagram, COEFFICIENT_STREAM_VERSION);
+		append<uint8_t>(datagram, type);
+		append<uint8_t>(datagram, vehicle);
+		append<uint8_t>(datagram, m);
+		append<uint32_t>(datagram, stream.sequence);
+		append<uint32_t>(datagram, keyframe ? stream.sequence : stream.keyframe_sequence);
+		append<uint64_t>(datagram, index);
+		append<int64_t>(datagram, sample_time.count());
+		append<uint16_t>(datagram, model.n_rows);
+		append<uint8_t>(datagram, model.n_cols);
+		uint8_t num_timings = std::min<size_t>(timings.size(), UINT8_MAX);
+		append<uint8_t>(datagram, num_timings);
+		for(int i = 0; i < num_timings; i++)
+		{
+			append<float>(datagram, timings[i]);
+		}
+		if(type != stream_delta)
+		{
+			datagram.insert(datagram.end(), support.begin(), support.end());
+		}
+		if(!keyframe)
+		{
+			append<float>(datagram, step);
+		}
+		for(arma::uword row = 0; row < model.n_rows; row++)
+		{
+			for(arma::uword column = 0; column < model.n_cols; column++)
+			{
+				int bit = row*model.n_cols + column;
+				double value = model(row, column);
+				if(value == 0)
+				{
+					continue;
+				}
+				if(keyframe)
+				{
+					append<float>(datagram, value);
+				}
+				else
+				{
+					append<int16_t>(datagram, std::round((value - stream.keyframe[bit])/step));
+				}
+			}
+		}
+
+		if(!send(datagram.size()))
+		{
+			continue;
+		}
+		if(keyframe)
+		{
+			// Later deltas are taken against the values the receiver holds
+			for(int bit = 0; bit < num_values; bit++)
+			{
+				stream.keyframe[bit] = (float)model(bit/model.n_cols, bit%model.n_cols);
+			}
+			stream.support = support;
+			stream.has_keyframe = true;
+			stream.keyframe_sequence = stream.sequence;
+			stream.windows_since_keyframe = 0;
+		}
+		stream.sequence++;
+	}
+}
+
+uint64_t Coefficient_Streamer::
+get_sent() const
+{
+	return sent.load(std::memory_order_relaxed);
+}
+
+uint64_t Coefficient_Streamer::
+get_sent_bytes() const
+{
+	return sent_bytes.load(std::memory_order_relaxed);
+}
+
+// Datagrams over the bandwidth cap or refused by the socket
+uint64_t Coefficient_Streamer::
+get_dropped() const
+{
+	return dropped.load(std::memory_order_relaxed);
+}
+
+// ------------------------------------------------------------------------------
+//   Decoding
+// ------------------------------------------------------------------------------
+// Decode one datagram, false if it is malformed or a delta against a keyframe that was not received
+bool Coefficient_Stream_Decoder::
+decode(const char *data, size_t length, Streamed_Model &model)
+{
+	const char *position = data;
+	const char *end = data + length;
+	uint32_t magic, keyframe_sequence;
+	uint8_t version, num_states, num_timings;
+	uint16_t num_features;
+	if(!extract(position, end, magic) || !extract(position, end, version) || !extract(position, end, model.type) ||
+	   !extract(position, end, model.vehicle) || !extract(position, end, model.model) || !extract(position, end, model.sequence) ||
+	   !extract(position, end, keyframe_sequence) || !extract(position, end, model.window_index) ||
+	   !extract(position, end, model.sample_time_us) || !extract(position, end, num_features) || !extract(position, end, num_states) ||
+	   !extract(position, end, num_timings) || magic != COEFFICIENT_STREAM_MAGIC || version != COEFFICIENT_STREAM_VERSION ||
+	   model.type > stream_support_delta)
+	{
+		malformed++;
+		return false;
+	}
+	model.num_features = num_features;
+	model.num_states = num_states;
+	model.timings.resize(num_timings);
+	for(float &timing : model.timings)
+	{
+		if(!extract(position, end, timing))
+		{
+			malformed++;
+			return false;
+		}
+	}
+
+	// Gaps are counted even if the datagram turns out undecodable, it did arrive
+	Stream &stream = streams[(uint16_t)model.vehicle << 8 | model.model];
+	model.lost = 0;
+	if(!stream.has_sequence || (int32_t)(model.sequence - stream.last_sequence) > 0)
+	{
+		if(stream.has_sequence)
+		{
+			model.lost = model.sequence - stream.last_sequence - 1;
+			lost += model.lost;
+		}
+		stream.has_sequence = true;
+		stream.last_sequence = model.sequence;
+	}
+
+	int num_values = num_features*num_states;
+	if(model.type != stream_keyframe &&
+	   (!stream.has_keyframe || stream.keyframe_sequence != keyframe_sequence || stream.keyframe.size() != (size_t)num_values))
+	{
+		undecodable++;
+		return false;
+	}
+	std::vector<uint8_t> support((num_values + 7)/8);
+	if(model.type == stream_delta)
+	{
+		support = stream.support;
+	}
+	else if(end - position < (ptrdiff_t)support.size())
+	{
+		malformed++;
+		return false;
+	}
+	else
+	{
+		memcpy(support.data(), position, support.size());
+		position += support.size();
+	}
+
+	model.coefficients.assign(num_values, 0);
+	float step = 0;
+	if(model.type != stream_keyframe && !extract(position, end, step))
+	{
+		malformed++;
+		return false;
+	}
+	for(int bit = 0; bit < num_values; bit++)
+	{
+		if(!support_bit(support, bit))
+		{
+			continue;
+		}
+		float value;
+		int16_t delta;
+		if(model.type == stream_keyframe ? !extract(position, end, value) : !extract(position, end, delta))
+		{
+			malformed++;
+			return false;
+		}
+		model.coefficients[bit] = model.type == stream_keyframe ? value : stream.keyframe[bit] + (double)delta*step;
+	}
+	if(model.type == stream_keyframe)
+	{
+		stream.has_keyframe = true;
+		stream.keyframe_sequence = model.sequence;
+		stream.support = support;
+		stream.keyframe.assign(model.coefficients.begin(), model.coefficients.end());
+	}
+	return true;
+}
+
+// Datagrams missing from the sequence numbers of all streams
+uint64_t Coefficient_Stream_Decoder::
+get_lost() const
+{
+	return lost;
+}
+
+uint64_t Coefficient_Stream_Decoder::
+get_malformed() const
+{
+	return malformed;
+}
+
+// Deltas whose keyframe was not received
+uint64_t Coefficient_Stream_Decoder::
+get_undecodable() const
+{
+	return undecodable;
+}
@@ -0,0 +1,162 @@
+/**
+ * @file coefficient_stream.h
+ *
+ * @brief UDP coefficient stream definition
+ *
+ * Streams the sparse coefficients and stage timings of every window to a ground station
+ * over UDP, and decodes the stream on the receiving side.
+ *
+ * Every model of a window is one datagram. A keyframe holds the support bitmask and the
+ * supported coefficients as floats. Deltas hold the supported coefficients as 16 bit
+ * multiples of a quantum relative to the last keyframe of the model, not the previous
+ * datagram, so each delta can be decoded on its own and a lost datagram only costs its
+ * window. A delta repeats the support bitmask only if the support changed since the
+ * keyframe. A keyframe is sent every keyframe interval, and earlier when a coefficient
+ * moved too far for a delta. Sequence numbers count the datagrams of each model, the
+ * receiver reports the gaps. Datagrams dropped by the bandwidth cap take no sequence
+ * number, they show as skipped window indices instead.
+ *
+ * Datagram layout, in host byte order like the binary coefficient log:
+ *
+ *   uint32 magic, uint8 version, uint8 type, uint8 vehicle, uint8 model
+ *   uint32 sequence, uint32 keyframe sequence (the datagram's own for keyframes)
+ *   uint64 window index, int64 sample time (us)
+ *   uint16 features, uint8 states, uint8 timings, float timings[timings] (us)
+ *   uint8 support[(features*states + 7)/8] (keyframes and support deltas)
+ *   keyframe: float coefficients[supported]
+ *   delta: float quantum, int16 deltas[supported]
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef COEFFICIENT_STREAM_H_
+#define COEFFICIENT_STREAM_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <armadillo>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#define COEFFICIENT_STREAM_MAGIC 0x54534353 // "SCST"
+#define COEFFICIENT_STREAM_VERSION 1
+#define COEFFICIENT_STREAM_HEADER 36 // Bytes before the timings
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+enum stream_packet_type {
+    stream_keyframe = 0,
+    stream_delta = 1, // Support of the keyframe
+    stream_support_delta = 2 // Support bitmask follows the timings
+};
+
+// One decoded datagram
+struct Streamed_Model {
+    uint8_t vehicle = 0;
+    uint8_t model = 0;
+    uint8_t type = stream_keyframe;
+    uint32_t sequence = 0;
+    uint32_t lost = 0; // Datagrams of this model missing before this one
+    uint64_t window_index = 0;
+    int64_t sample_time_us = 0;
+    int num_features = 0;
+    int num_states = 0;
+    std::vector<float> timings; // Stage timings in us, stage_timing_names order
+    std::vector<double> coefficients; // [feature*num_states + state], zero outside the support
+};
+
+// ----------------------------------------------------------------------------------
+//   Coefficient Streamer Class
+// ----------------------------------------------------------------------------------
+/*
+ * Sends on a non-blocking socket from the logging stage, a full socket buffer or an
+ * unreachable ground station drops the datagram instead of stalling the pipeline.
+ * The bandwidth cap is a token bucket holding up to one second of traffic, datagrams
+ * that do not fit are dropped. A dropped keyframe is retried on the next window, deltas
+ * are only sent against a keyframe that left the socket.
+ */
+class Coefficient_Streamer
+{
+    struct Stream {
+        uint32_t sequence = 0;
+        bool has_keyframe = false;
+        uint32_t keyframe_sequence = 0;
+        int windows_since_keyframe = 0;
+        std::vector<uint8_t> support; // Support bitmask of the keyframe
+        std::vector<float> keyframe; // Dense coefficients as the receiver decoded them
+    };
+
+    int socket_fd = -1;
+    sockaddr_storage destination;
+    socklen_t destination_length = 0;
+    uint8_t vehicle;
+    double bandwidth; // Bytes per second, unlimited if 0
+    int keyframe_interval;
+    double quantum; // Resolution of the deltas
+    double tokens = 0;
+    std::chrono::steady_clock::time_point last_refill;
+    std::vector<Stream> streams; // One per model
+    std::vector<char> datagram; // Reused for every send
+    std::vector<uint8_t> support;
+
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> sent_bytes{0};
+    std::atomic<uint64_t> dropped{0};
+
+    bool send(size_t bytes);
+
+public:
+    Coefficient_Streamer(std::string destination_, uint8_t vehicle_, size_t num_models, double bandwidth_, int keyframe_interval_ = 10,
+                         double quantum_ = 1e-5);
+    ~Coefficient_Streamer();
+    Coefficient_Streamer(const Coefficient_Streamer &) = delete;
+    Coefficient_Streamer &operator=(const Coefficient_Streamer &) = delete;
+
+    void publish(uint64_t index, std::chrono::microseconds sample_time, const std::vector<arma::mat> &coefficients,
+                 const std::vector<double> &timings);
+    uint64_t get_sent() const;
+    uint64_t get_sent_bytes() const;
+    uint64_t get_dropped() const;
+};
+
+// ----------------------------------------------------------------------------------
+//   Coefficient Stream Decoder Class
+// ----------------------------------------------------------------------------------
+/*
+ * Keeps the last keyframe of every vehicle and model. Deltas against a keyframe that
+ * was not received are counted and skipped until the next keyframe arrives.
+ */
+class Coefficient_Stream_Decoder
+{
+    struct Stream {
+        bool has_sequence = false;
+        uint32_t last_sequence = 0;
+        bool has_keyframe = false;
+        uint32_t keyframe_sequence = 0;
+        std::vector<uint8_t> support;
+        std::vector<float> keyframe;
+    };
+
+    std::map<uint16_t, Stream> streams; // Keyed by vehicle and model
+    uint64_t lost = 0;
+    uint64_t malformed = 0;
+    uint64_t undecodable = 0;
+
+public:
+    bool decode(const char *data, size_t length, Streamed_Model &model);
+    uint64_t get_lost() const;
+    uint64_t get_malformed() const;
+    uint64_t get_undecodable() const;
+};
+
+bool resolve_stream_destination(const std::string &destination, sockaddr_storage &address, socklen_t &length, std::string &error);
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ * @file config.cpp
+ *
+ * @brief runtime configuration parsing
+ *
+ * Parses and validates configuration files and control socket requests
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "config.h"
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <set>
+#include <sstream>
+
+// ------------------------------------------------------------------------------
+//   Helpers
+// ------------------------------------------------------------------------------
+
+// Whitespace at either end removed
+static std::string trim(const std::string &text)
+{
+	size_t begin = text.find_first_not_of(" \t\r\n");
+	if(begin == std::string::npos)
+	{
+		return "";
+	}
+	size_t end = text.find_last_not_of(" \t\r\n");
+	return text.substr(begin, end - begin + 1);
+}
+
+// A finite float taking up the whole text, unlike atoi/atof nothing is silently truncated
+bool parse_float(const std::string &text, float &value)
+{
+	if(text.empty())
+	{
+		return false;
+	}
+	char *end;
+	errno = 0;
+	float parsed = strtof(text.c_str(), &end);
+	if(*end != '\0' || errno == ERANGE || !std::isfinite(parsed))
+	{
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+// A decimal int taking up the whole text
+bool parse_int(const std::string &text, int &value)
+{
+	if(text.empty())
+	{
+		return false;
+	}
+	char *end;
+	errno = 0;
+	long parsed = strtol(text.c_str(), &end, 10);
+	if(*end != '\0' || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+	{
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+// ------------------------------------------------------------------------------
+//   Parsing
+// ------------------------------------------------------------------------------
+
+// Apply one "key = value" line, blank lines and comments are accepted and change nothing
+// config is left unchanged if the line is invalid
+bool apply_config_line(const std::string &line, Runtime_Config &config, std::string &error)
+{
+	std::string text = trim(line.substr(0, line.find('#')));
+	if(text.empty())
+	{
+		return true;
+	}
+	size_t equals = text.find('=');
+	if(equals == std::string::npos)
+	{
+		error = "expected <key> = <value>: " + text;
+		return false;
+	}
+	std::string key = trim(text.substr(0, equals));
+	std::string value = trim(text.substr(equals + 1));
+
+	if(key == "threshold" || key == "lambda")
+	{
+		float parsed;
+		if(!parse_float(value, parsed))
+		{
+			error = "invalid " + key + ": " + value;
+			return false;
+		}
+		(key == "threshold" ? config.stlsq_threshold : config.ridge_regression_penalty) = parsed;
+		// Configured models are solved with their own values, which would otherwise ignore the line
+		for(Model_Config &model : config.models)
+		{
+			(key == "threshold" ? model.threshold : model.lambda) = parsed;
+		}
+	}
+	else if(key == "excitation")
+	{
+		if(!parse_float(value, config.min_excitation))
+		{
+			error = "invalid excitation: " + value;
+			return false;
+		}
+	}
+	else if(key == "model")
+	{
+		Model_Config model;
+		try
+		{
+			model = parse_model_config(value);
+		}
+		catch(int error_code)
+		{
+			error = "invalid model: " + value;
+			return false;
+		}
+		// A model of the same name is replaced, so a reload can retune the models given on the command line
+		bool replaced = false;
+		for(Model_Config &existing : config.models)
+		{
+			if(existing.name == model.name)
+			{
+				existing = model;
+				replaced = true;
+			}
+		}
+		if(!replaced)
+		{
+			config.models.push_back(model);
+		}
+	}
+	else if(key == "buffer")
+	{
+		if(!parse_int(value, config.buffer_length))
+		{
+			error = "invalid buffer: " + value;
+			return false;
+		}
+	}
+	else if(key == "mode")
+	{
+		if(value == "length")
+		{
+			config.mode = buffer_mode::length_mode;
+		}
+		else if(value == "time")
+		{
+			config.mode = buffer_mode::time_mode;
+		}
+		else
+		{
+			error = "invalid mode " + value + ", use length or time";
+			return false;
+		}
+	}
+	else if(key == "log")
+	{
+		config.coefficient_logfile_path = value;
+	}
+	else if(key == "hdf5")
+	{
+		config.hdf5_path = value == "none" ? "" : value;
+	}
+	else if(key == "udp")
+	{
+		config.stream_destination = value == "none" ? "" : value;
+	}
+	else if(key == "debug")
+	{
+		if(value == "on" || value == "true" || value == "1")
+		{
+			config.debug = true;
+		}
+		else if(value == "off" || value == "false" || value == "0")
+		{
+			config.debug = false;
+		}
+		else
+		{
+			error = "invalid debug " + value + ", use on or off";
+			return false;
+		}
+	}
+	else
+	{
+		error = "unknown key " + key;
+		return false;
+	}
+	return true;
+}
+
+// Apply every line of a configuration, stops at the first invalid line
+bool parse_config(std::istream &input, Runtime_Config &config, std::string &error)
+{
+	std::string line;
+	int line_number = 0;
+	while(std::getline(input, line))
+	{
+		line_number++;
+		if(!apply_config_line(line, config, error))
+		{
+			error = "line " + std::to_string(line_number) + ": " + error;
+			return false;
+		}
+	}
+	return true;
+}
+
+bool load_config_file(const std::string &path, Runtime_Config &config, std::string &error)
+{
+	std::ifstream file(path);
+	if(!file.is_open())
+	{
+		error = "could not open " + path;
+		return false;
+	}
+	if(!parse_config(file, config, error))
+	{
+		error = path + " " + error;
+		return false;
+	}
+	return true;
+}
+
+// Checks that do not depend on a running pipeline, see SID::prepare_reconfiguration for the rest
+bool validate_config(const Runtime_Config &config, std::string &error)
+{
+	if(config.buffer_length <= 0)
+	{
+		error = "buffer length must be positive";
+		return false;
+	}
+	if(config.stlsq_threshold < 0 || config.ridge_regression_penalty < 0)
+	{
+		error = "threshold and lambda must not be negative";
+		return false;
+	}
+	if(config.min_excitation < 0)
+	{
+		error = "excitation must not be negative";
+		return false;
+	}
+	if(config.coefficient_logfile_path.empty())
+	{
+		error = "the coefficient log can not be disabled";
+		return false;
+	}
+	std::set<std::string> names;
+	for(const Model_Config &model : config.models)
+	{
+		if(model.threshold < 0 || model.lambda < 0)
+		{
+			error = "threshold and lambda of model " + model.name + " must not be negative";
+			return false;
+		}
+		if(!names.insert(model.name).second)
+		{
+			error = "model " + model.name + " is configured twice";
+			return false;
+		}
+	}
+	return true;
+}
+
+// The configuration in the file format, so a "show" can be saved and reloaded
+// Floats are printed with enough digits to read back exactly, the flight loop compares descriptions
+std::string describe_config(const Runtime_Config &config)
+{
+	std::stringstream out;
+	out << std::setprecision(std::numeric_limits<float>::max_digits10);
+	out << "threshold = " << config.stlsq_threshold << "\n";
+	out << "lambda = " << config.ridge_regression_penalty << "\n";
+	for(const Model_Config &model : config.models)
+	{
+		out << "model = " << model.name << ":" << model.threshold << ":" << model.lambda << ":" << model.library_order << "\n";
+	}
+	out << "buffer = " << config.buffer_length << "\n";
+	out << "mode = " << (config.mode == buffer_mode::time_mode ? "time" : "length") << "\n";
+	out << "log = " << config.coefficient_logfile_path << "\n";
+	out << "hdf5 = " << (config.hdf5_path.empty() ? "none" : config.hdf5_path) << "\n";
+	out << "udp = " << (config.stream_destination.empty() ? "none" : config.stream_destination) << "\n";
+	out << "debug = " << (config.debug ? "on" : "off") << "\n";
+	out << "excitation = " << config.min_excitation << "\n";
+	return out.str();
+}
@@ -0,0 +1,61 @@
+/**
+ * @file config.h
+ *
+ * @brief runtime configuration definition
+ *
+ * Settings that can be given in a configuration file and changed while the pipelines run,
+ * through the control socket or by sending SIGHUP to reload the file.
+ *
+ * The file holds one "key = value" per line, # starts a comment. Keys:
+ *
+ *   threshold = <STLSQ threshold>          lambda = <ridge regression penalty>
+ *   model = <name>:<threshold>:<lambda>[:<library order>], replaces the model of the same name
+ *   buffer = <buffer length>               mode = time or length
+ *   log = <coefficient log file>           hdf5 = <HDF5 log file, none to disable>
+ *   udp = <host:port, none to disable>     debug = on or off
+ *   excitation = <minimum excitation of a solved window, 0 to solve all>
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "system_identification.h"
+#include <istream>
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+
+// Settings shared by the command line, the configuration file and the control socket
+struct Runtime_Config {
+    std::string coefficient_logfile_path = "../logs/coefficients.bin"; // Binary log, per vehicle files are derived from this path
+    std::string hdf5_path; // Columnar HDF5 log, per vehicle files are derived from this path, disabled if empty
+    std::string stream_destination; // host:port receiving the UDP coefficient stream of every vehicle, disabled if empty
+
+    buffer_mode mode = buffer_mode::length_mode;
+    int buffer_length = 100;
+    float ridge_regression_penalty = 0.1;
+    float stlsq_threshold = 0.1;
+    bool debug = false;
+    float min_excitation = 0; // Windows less excited are skipped, see window_excitation, 0 disables the check
+
+    std::vector<Model_Config> models; // Model configurations from -M, empty solves a single model from -t and -r
+};
+
+bool parse_float(const std::string &text, float &value);
+bool parse_int(const std::string &text, int &value);
+bool apply_config_line(const std::string &line, Runtime_Config &config, std::string &error);
+bool parse_config(std::istream &input, Runtime_Config &config, std::string &error);
+bool load_config_file(const std::string &path, Runtime_Config &config, std::string &error);
+bool validate_config(const Runtime_Config &config, std::string &error);
+std::string describe_config(const Runtime_Config &config);
+
+#endif
@@ -0,0 +1,144 @@
+/**
+ * @file control_socket.cpp
+ *
+ * @brief local control socket
+ *
+ * Hands requests arriving on a unix domain socket to a handler and returns its reply
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "control_socket.h"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Control_Socket::
+Control_Socket(std::string path_, std::function<std::string(const std::string &)> handler_)
+{
+	path = path_;
+	handler = handler_;
+
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if(path.size() >= sizeof(address.sun_path))
+	{
+		std::cerr << "Control socket path " << path << " is too long\n";
+		throw EXIT_FAILURE;
+	}
+	strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+	// A socket left behind by an earlier run would fail the bind
+	unlink(path.c_str());
+	listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listen_socket < 0 || bind(listen_socket, (sockaddr *)&address, sizeof(address)) != 0 || chmod(path.c_str(), 0600) != 0
+	   || listen(listen_socket, 4) != 0)
+	{
+		std::cerr << "Could not open the control socket " << path << ": " << strerror(errno) << "\n";
+		if(listen_socket >= 0)
+		{
+			close(listen_socket);
+		}
+		throw EXIT_FAILURE;
+	}
+	server_thread = std::thread(&Control_Socket::serve, this);
+}
+
+Control_Socket::
+~Control_Socket()
+{
+	stop();
+}
+
+// ------------------------------------------------------------------------------
+//   Serving
+// ------------------------------------------------------------------------------
+void Control_Socket::
+serve()
+{
+	while(!time_to_exit)
+	{
+		// Wake up regularly to notice stop()
+		pollfd listener = {listen_socket, POLLIN, 0};
+		if(poll(&listener, 1, 200) <= 0)
+		{
+			continue;
+		}
+		int connection = accept(listen_socket, nullptr, nullptr);
+		if(connection < 0)
+		{
+			continue;
+		}
+
+		// Read until the client is done, a stalled client is dropped after a second
+		timeval timeout = {1, 0};
+		setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		std::string request;
+		char chunk[1024];
+		bool complete = false;
+		while(request.size() <= CONTROL_REQUEST_LIMIT)
+		{
+			ssize_t received = recv(connection, chunk, sizeof(chunk), 0);
+			if(received == 0)
+			{
+				complete = true;
+				break;
+			}
+			if(received < 0)
+			{
+				break;
+			}
+			request.append(chunk, received);
+			size_t blank_line = ("\n" + request).find("\n\n");
+			if(blank_line != std::string::npos)
+			{
+				request.resize(blank_line);
+				complete = true;
+				break;
+			}
+		}
+
+		std::string reply = complete ? handler(request) : "error: incomplete request\n";
+		size_t sent = 0;
+		while(sent < reply.size())
+		{
+			ssize_t result = send(connection, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+			if(result <= 0)
+			{
+				break;
+			}
+			sent += result;
+		}
+		close(connection);
+	}
+}
+
+void Control_Socket::
+stop()
+{
+	time_to_exit = true;
+	if(server_thread.joinable())
+	{
+		server_thread.join();
+	}
+	if(listen_socket >= 0)
+	{
+		close(listen_socket);
+		listen_socket = -1;
+		unlink(path.c_str());
+	}
+}
@@ -0,0 +1,53 @@
+/**
+ * @file control_socket.h
+ *
+ * @brief local control socket definition
+ *
+ * A unix domain socket through which the configuration of the running pipelines is
+ * shown and changed, eg.
+ *
+ *   printf 'threshold = 0.2\nbuffer = 150\n' | socat - UNIX-CONNECT:/tmp/sindy.sock
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef CONTROL_SOCKET_H_
+#define CONTROL_SOCKET_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+
+#define CONTROL_REQUEST_LIMIT 65536 // Bytes, longer requests are rejected
+
+// ----------------------------------------------------------------------------------
+//   Control Socket Class
+// ----------------------------------------------------------------------------------
+/*
+ * Serves one connection at a time. A request is read until the client closes its end
+ * or sends an empty line, the handler's reply is written back and the connection closed.
+ * The socket is only accessible to the user running the process.
+ */
+class Control_Socket
+{
+    std::string path;
+    int listen_socket = -1;
+    std::function<std::string(const std::string &)> handler;
+    std::thread server_thread;
+    std::atomic<bool> time_to_exit{false};
+
+    void serve();
+
+public:
+    Control_Socket(std::string path_, std::function<std::string(const std::string &)> handler_);
+    ~Control_Socket();
+
+    void stop();
+};
+
+#endif
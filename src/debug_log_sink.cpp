@@ -0,0 +1,207 @@
+/**
+ * @file debug_log_sink.cpp
+ *
+ * @brief asynchronous debug log
+ *
+ * Ring buffered, batched and rotated writer for the MAVSDK log messages
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "debug_log_sink.h"
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Debug_Log_Sink::
+Debug_Log_Sink(std::string filename_, size_t max_file_size_, int max_files_, int ring_capacity)
+	: ring(ring_capacity)
+{
+	filename = filename_;
+	max_file_size = max_file_size_;
+	max_files = max_files_ > 0 ? max_files_ : 1;
+	batch.reserve(16*1024 + DEBUG_MESSAGE_LENGTH + 64);
+
+	// Append, like the previous per message open, so a restart does not lose the last run
+	file = fopen(filename.c_str(), "a");
+	if(file == nullptr)
+	{
+		std::cerr << "Could not open debug log " << filename << ": " << strerror(errno) << "\n";
+		throw EXIT_FAILURE;
+	}
+	fseek(file, 0, SEEK_END);
+	file_size = ftell(file);
+
+	writer_thread = std::thread(&Debug_Log_Sink::writer, this);
+}
+
+Debug_Log_Sink::
+~Debug_Log_Sink()
+{
+	stop();
+}
+
+// Copy a message into the ring, returns false if it had to be dropped
+bool Debug_Log_Sink::
+log(int level, const std::string &message)
+{
+	bool queued = ring.try_push([&](Debug_Message &slot)
+	{
+		slot.level = level;
+		slot.length = message.size() < DEBUG_MESSAGE_LENGTH ? message.size() : DEBUG_MESSAGE_LENGTH;
+		memcpy(slot.text, message.data(), slot.length);
+	});
+
+	if(!queued)
+	{
+		messages_dropped++;
+	}
+	return queued;
+}
+
+// Drain the ring, write out what is left and close the file
+void Debug_Log_Sink::
+stop()
+{
+	time_to_exit = true;
+	if(writer_thread.joinable())
+	{
+		writer_thread.join();
+	}
+	if(file != nullptr)
+	{
+		flush();
+		fclose(file);
+		file = nullptr;
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Writer
+// ------------------------------------------------------------------------------
+void Debug_Log_Sink::
+writer()
+{
+	while(true)
+	{
+		bool exiting = time_to_exit;
+		bool popped = false;
+		while(ring.try_pop([this](Debug_Message &message){ encode(message); }))
+		{
+			popped = true;
+			messages_logged++;
+			if(batch.size() >= 16*1024)
+			{
+				flush();
+			}
+		}
+
+		if(!batch.empty() || messages_dropped != dropped_reported)
+		{
+			flush();
+		}
+
+		if(exiting)
+		{
+			return;
+		}
+		if(!popped)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+	}
+}
+
+void Debug_Log_Sink::
+encode(const Debug_Message &message)
+{
+	char level[16];
+	int level_length = snprintf(level, sizeof(level), "%d,", message.level);
+	batch.insert(batch.end(), level, level + level_length);
+	batch.insert(batch.end(), message.text, message.text + message.length);
+	batch.push_back('\n');
+}
+
+// Write the batch to the file and rotate once it has grown past the size limit
+void Debug_Log_Sink::
+flush()
+{
+	// Note overload in the log itself, so gaps in the messages can be explained
+	uint64_t dropped = messages_dropped;
+	if(dropped != dropped_reported)
+	{
+		char note[64];
+		int note_length = snprintf(note, sizeof(note), "-1,%llu debug messages dropped\n", (unsigned long long)(dropped - dropped_reported));
+		batch.insert(batch.end(), note, note + note_length);
+		dropped_reported = dropped;
+	}
+
+	if(file == nullptr)
+	{
+		batch.clear();
+		return;
+	}
+	if(fwrite(batch.data(), 1, batch.size(), file) != batch.size())
+	{
+		std::cerr << "Debug log write failed: " << strerror(errno) << "\n";
+	}
+	fflush(file);
+	file_size += batch.size();
+	batch.clear();
+
+	if(max_file_size > 0 && file_size >= max_file_size)
+	{
+		rotate();
+	}
+}
+
+// Shift <file>.1 .. <file>.(max_files - 2) up by one and start a fresh file
+void Debug_Log_Sink::
+rotate()
+{
+	fclose(file);
+	if(max_files > 1)
+	{
+		for(int i = max_files - 2; i >= 1; i--)
+		{
+			std::string from = filename + "." + std::to_string(i);
+			std::string to = filename + "." + std::to_string(i + 1);
+			rename(from.c_str(), to.c_str());
+		}
+		rename(filename.c_str(), (filename + ".1").c_str());
+	}
+	file = fopen(filename.c_str(), "w");
+	if(file == nullptr)
+	{
+		// Runs on the writer thread, so give up on the log rather than the program
+		std::cerr << "Could not reopen debug log " << filename << ": " << strerror(errno) << "\n";
+	}
+	file_size = 0;
+	rotations++;
+}
+
+uint64_t Debug_Log_Sink::
+get_logged() const
+{
+	return messages_logged;
+}
+
+uint64_t Debug_Log_Sink::
+get_dropped() const
+{
+	return messages_dropped;
+}
+
+uint64_t Debug_Log_Sink::
+get_rotations() const
+{
+	return rotations;
+}
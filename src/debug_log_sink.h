@@ -0,0 +1,87 @@
+/**
+ * @file debug_log_sink.h
+ *
+ * @brief asynchronous debug log definition
+ *
+ * Non-blocking sink for the MAVSDK log messages, written as "<level>,<message>" lines
+ * to a rotating set of files
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef DEBUG_LOG_SINK_H_
+#define DEBUG_LOG_SINK_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "ring.h"
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+
+#define DEBUG_MESSAGE_LENGTH 256
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+
+// Fixed size ring slot, messages longer than DEBUG_MESSAGE_LENGTH are truncated
+struct Debug_Message {
+    int level = 0;
+    uint16_t length = 0;
+    char text[DEBUG_MESSAGE_LENGTH];
+};
+
+// ----------------------------------------------------------------------------------
+//   Debug Log Sink Class
+// ----------------------------------------------------------------------------------
+/*
+ * log() copies a message into a preallocated ring slot and returns without allocating
+ * or touching the filesystem, so it is safe to call from the MAVSDK callback threads.
+ * A writer thread batches messages to a file handle held open for the whole run. Once
+ * the file exceeds max_file_size it is rotated to <file>.1, <file>.1 to <file>.2 and so
+ * on, keeping max_files files in total. Messages arriving while the ring is full are
+ * dropped and counted, the writer notes the number of dropped messages in the log.
+ */
+class Debug_Log_Sink
+{
+    std::string filename;
+    size_t max_file_size; // bytes, 0 disables rotation
+    int max_files;
+
+    Lockfree_Ring<Debug_Message> ring;
+    std::vector<char> batch;
+    FILE *file = nullptr;
+    size_t file_size = 0;
+    uint64_t dropped_reported = 0;
+
+    std::thread writer_thread;
+    std::atomic<bool> time_to_exit{false};
+    std::atomic<uint64_t> messages_logged{0};
+    std::atomic<uint64_t> messages_dropped{0};
+    std::atomic<uint64_t> rotations{0};
+
+    void writer();
+    void encode(const Debug_Message &message);
+    void flush();
+    void rotate();
+
+public:
+    Debug_Log_Sink(std::string filename_, size_t max_file_size_ = 10*1024*1024, int max_files_ = 3, int ring_capacity = 1024);
+    ~Debug_Log_Sink();
+
+    bool log(int level, const std::string &message);
+    void stop();
+
+    uint64_t get_logged() const;
+    uint64_t get_dropped() const;
+    uint64_t get_rotations() const;
+};
+
+#endif
@@ -0,0 +1,195 @@
+/**
+ * @file flight_recorder.cpp
+ *
+ * @brief flight data recorder
+ *
+ * Memory mapped ring of recent telemetry and stage events, and its reader
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "flight_recorder.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <new>
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Flight_Recorder::
+Flight_Recorder(std::string filename_, size_t size_bytes)
+{
+	filename = filename_;
+	capacity = size_bytes/sizeof(Recorder_Entry);
+	if(capacity < 64)
+	{
+		capacity = 64;
+	}
+	mapping_size = sizeof(Recorder_Header) + capacity*sizeof(Recorder_Entry);
+
+	// Keep the recording of the previous run, it may hold the lead up to a crash
+	rename(filename.c_str(), (filename + ".1").c_str());
+
+	int file_descriptor = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(file_descriptor < 0)
+	{
+		std::cerr << "Could not open flight recorder " << filename << ": " << strerror(errno) << "\n";
+		throw EXIT_FAILURE;
+	}
+	if(ftruncate(file_descriptor, mapping_size) != 0)
+	{
+		std::cerr << "Could not size flight recorder " << filename << ": " << strerror(errno) << "\n";
+		close(file_descriptor);
+		throw EXIT_FAILURE;
+	}
+	void *mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+	close(file_descriptor); // The mapping keeps the file referenced
+	if(mapping == MAP_FAILED)
+	{
+		std::cerr << "Could not map flight recorder " << filename << ": " << strerror(errno) << "\n";
+		throw EXIT_FAILURE;
+	}
+
+	// The file is zero filled, so every slot starts out empty
+	header = new (mapping) Recorder_Header;
+	memcpy(header->magic, FLIGHT_RECORDER_MAGIC, 8);
+	header->version = FLIGHT_RECORDER_VERSION;
+	header->entry_size = sizeof(Recorder_Entry);
+	header->capacity = capacity;
+	header->start_time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	header->start_steady_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	header->next.store(0, std::memory_order_relaxed);
+	entries = reinterpret_cast<Recorder_Entry *>(static_cast<char *>(mapping) + sizeof(Recorder_Header));
+}
+
+Flight_Recorder::
+~Flight_Recorder()
+{
+	if(header != nullptr)
+	{
+		munmap(header, mapping_size);
+		header = nullptr;
+	}
+}
+
+// Store an event in the next slot, safe to call from any thread
+void Flight_Recorder::
+record(recorder_event type, uint8_t source, uint64_t argument, std::initializer_list<float> values)
+{
+	uint64_t sequence = header->next.fetch_add(1, std::memory_order_relaxed);
+	Recorder_Entry &entry = entries[sequence % capacity];
+
+	// Invalidate the slot while it is rewritten, a crash in between leaves it empty rather than torn
+	entry.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_signal_fence(std::memory_order_seq_cst);
+	entry.time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	entry.argument = argument;
+	entry.type = type;
+	entry.source = source;
+	size_t i = 0;
+	for(float value : values)
+	{
+		if(i == FLIGHT_RECORDER_VALUES)
+		{
+			break;
+		}
+		entry.values[i++] = value;
+	}
+	for(; i < FLIGHT_RECORDER_VALUES; i++)
+	{
+		entry.values[i] = 0;
+	}
+	entry.sequence.store(sequence + 1, std::memory_order_release);
+}
+
+// Write the mapping back to disk now, eg. on a clean shutdown
+void Flight_Recorder::
+sync()
+{
+	msync(header, mapping_size, MS_SYNC);
+}
+
+uint64_t Flight_Recorder::
+get_capacity() const
+{
+	return capacity;
+}
+
+uint64_t Flight_Recorder::
+get_recorded() const
+{
+	return header->next.load(std::memory_order_relaxed);
+}
+
+// ------------------------------------------------------------------------------
+//   Reader
+// ------------------------------------------------------------------------------
+// Read the complete entries of a recorder file, oldest first
+std::vector<Recorded_Event> read_flight_recorder(std::string filename, uint64_t &start_time_us, uint64_t &start_steady_us)
+{
+	std::ifstream file(filename, std::ios_base::binary);
+	char header[sizeof(Recorder_Header)];
+	if(!file.read(header, sizeof(header)) || memcmp(header, FLIGHT_RECORDER_MAGIC, 8) != 0)
+	{
+		std::cerr << filename << " is not a flight recorder file\n";
+		throw EXIT_FAILURE;
+	}
+	uint32_t version, entry_size;
+	uint64_t capacity;
+	memcpy(&version, header + offsetof(Recorder_Header, version), sizeof(version));
+	memcpy(&entry_size, header + offsetof(Recorder_Header, entry_size), sizeof(entry_size));
+	memcpy(&capacity, header + offsetof(Recorder_Header, capacity), sizeof(capacity));
+	memcpy(&start_time_us, header + offsetof(Recorder_Header, start_time_us), sizeof(start_time_us));
+	memcpy(&start_steady_us, header + offsetof(Recorder_Header, start_steady_us), sizeof(start_steady_us));
+	if(version != FLIGHT_RECORDER_VERSION || entry_size != sizeof(Recorder_Entry))
+	{
+		std::cerr << filename << " has an unsupported flight recorder version\n";
+		throw EXIT_FAILURE;
+	}
+
+	std::vector<Recorded_Event> events;
+	char raw[sizeof(Recorder_Entry)];
+	for(uint64_t slot = 0; slot < capacity && file.read(raw, sizeof(raw)); slot++)
+	{
+		Recorded_Event event;
+		memcpy(&event.sequence, raw + offsetof(Recorder_Entry, sequence), sizeof(event.sequence));
+		// Skip empty slots and slots whose sequence does not belong there
+		if(event.sequence == 0 || (event.sequence - 1) % capacity != slot)
+		{
+			continue;
+		}
+		memcpy(&event.time_us, raw + offsetof(Recorder_Entry, time_us), sizeof(event.time_us));
+		memcpy(&event.argument, raw + offsetof(Recorder_Entry, argument), sizeof(event.argument));
+		event.type = raw[offsetof(Recorder_Entry, type)];
+		event.source = raw[offsetof(Recorder_Entry, source)];
+		event.values.resize(FLIGHT_RECORDER_VALUES);
+		memcpy(event.values.data(), raw + offsetof(Recorder_Entry, values), sizeof(float)*FLIGHT_RECORDER_VALUES);
+		events.push_back(event);
+	}
+	std::sort(events.begin(), events.end(), [](const Recorded_Event &a, const Recorded_Event &b){ return a.sequence < b.sequence; });
+	return events;
+}
+
+std::string recorder_event_name(uint8_t type)
+{
+	static const char *names[] = {"insert_attitude", "insert_angular_velocity", "insert_odometry", "insert_actuator", "buffer_clear",
+								  "window_skipped", "window_incomplete", "preprocess_done", "regression_done", "window_logged",
+								  "window_uninformative"};
+	if(type < recorder_event_count)
+	{
+		return names[type];
+	}
+	return "unknown_" + std::to_string(type);
+}
@@ -0,0 +1,126 @@
+/**
+ * @file flight_recorder.h
+ *
+ * @brief flight data recorder definition
+ *
+ * Fixed size ring of raw telemetry inserts and SID stage events in a memory mapped
+ * file, so the last moments before a crash or latency spike can be examined afterwards
+ *
+ * File layout, all fields in host byte order:
+ *
+ *   Recorder_Header                       64 bytes
+ *   Recorder_Entry   entries[capacity]    64 bytes each
+ *
+ * Entry n of the run is stored in slot n % capacity with sequence n + 1. A slot holding
+ * sequence 0 is empty or was being written when the process died.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <initializer_list>
+
+#define FLIGHT_RECORDER_MAGIC "SINDYFR"
+#define FLIGHT_RECORDER_VERSION 2 // 2: insert timestamps in microseconds
+#define FLIGHT_RECORDER_VALUES 8
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+
+enum recorder_event : uint8_t {
+    insert_attitude = 0, // values roll, pitch, yaw [deg], argument sample timestamp [us]
+    insert_angular_velocity = 1, // values roll, pitch, yaw rate [rad/s], argument sample timestamp [us]
+    insert_odometry = 2, // values x, y, z [m], vx, vy, vz [m/s], argument sample timestamp [us]
+    insert_actuator = 3, // values first eight controls, argument sample timestamp [us]
+    buffer_clear = 4, // values longest, shortest stream, argument number of clears
+    window_skipped = 5, // values governor level, argument window index
+    window_incomplete = 6, // values length of each stream, argument window index
+    preprocess_done = 7, // values interpolation, candidates, gram [us], samples, frame transform [us], argument window index
+    regression_done = 8, // values SINDy [us], deadline missed, governor level, argument window index
+    window_logged = 9, // values models logged, argument window index
+    window_uninformative = 10, // values excitation, threshold, argument window index
+    recorder_event_count
+};
+
+struct Recorder_Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t capacity;
+    uint64_t start_time_us; // Wall clock when recording started
+    uint64_t start_steady_us; // Steady clock when recording started, entry times use this clock
+    std::atomic<uint64_t> next; // Sequence number of the next entry
+    uint64_t reserved[2];
+};
+
+struct Recorder_Entry {
+    std::atomic<uint64_t> sequence;
+    uint64_t time_us; // Steady clock
+    uint64_t argument;
+    uint8_t type;
+    uint8_t source; // Vehicle system id
+    uint16_t reserved;
+    uint32_t reserved2;
+    float values[FLIGHT_RECORDER_VALUES];
+};
+
+static_assert(sizeof(Recorder_Header) == 64, "Recorder_Header must stay 64 bytes");
+static_assert(sizeof(Recorder_Entry) == 64, "Recorder_Entry must stay 64 bytes");
+
+// A copy of one entry read back from a recorder file
+struct Recorded_Event {
+    uint64_t sequence;
+    uint64_t time_us;
+    uint64_t argument;
+    uint8_t type;
+    uint8_t source;
+    std::vector<float> values;
+};
+
+// ----------------------------------------------------------------------------------
+//   Flight Recorder Class
+// ----------------------------------------------------------------------------------
+/*
+ * The file is mapped shared, so a record() is a handful of stores into the page cache:
+ * no system calls, no locks and no allocation. The kernel writes the pages back on its
+ * own schedule, also after the process died. A file left over from the previous run is
+ * kept as <file>.1 so a restart after a crash does not overwrite the evidence.
+ */
+class Flight_Recorder
+{
+    std::string filename;
+    size_t mapping_size = 0;
+    Recorder_Header *header = nullptr;
+    Recorder_Entry *entries = nullptr;
+    uint64_t capacity = 0;
+
+public:
+    Flight_Recorder(std::string filename_, size_t size_bytes);
+    ~Flight_Recorder();
+
+    Flight_Recorder(const Flight_Recorder &) = delete;
+    Flight_Recorder &operator=(const Flight_Recorder &) = delete;
+
+    void record(recorder_event type, uint8_t source, uint64_t argument, std::initializer_list<float> values);
+    void sync();
+
+    uint64_t get_capacity() const;
+    uint64_t get_recorded() const;
+};
+
+std::vector<Recorded_Event> read_flight_recorder(std::string filename, uint64_t &start_time_us, uint64_t &start_steady_us);
+std::string recorder_event_name(uint8_t type);
+
+#endif
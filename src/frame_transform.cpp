@@ -0,0 +1,192 @@
+/**
+ * @file frame_transform.cpp
+ *
+ * @brief frame transformation
+ *
+ * Unit conversion, NED to body rotation and aerodynamic states over whole rows of samples
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "frame_transform.h"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#define DEG_TO_RAD (M_PI/180)
+
+// Rows of SID_Workspace::transform_storage
+#define ANGLE_ROW 0 // roll, pitch, yaw [rad]
+#define SINE_ROW 3
+#define COSINE_ROW 6
+#define VELOCITY_ROW 9 // u, v, w as resampled, NED or body frame
+
+// Cody-Waite split of pi/2, k*PIO2_HI is exact for the quadrants of any attitude
+#define PIO2_HI 1.57079632673412561417e+00
+#define PIO2_LO 6.07710050650619224932e-11
+#define ROUNDING_SHIFT 6755399441055744.0 // 1.5*2^52, adding it rounds to an integer held in the low mantissa bits
+#define TAN_PI_8 0.41421356237309504880
+
+// ------------------------------------------------------------------------------
+//   Row kernels
+// ------------------------------------------------------------------------------
+/*
+ * The kernels have no calls and no data dependent branches, so each loop vectorizes
+ * over the samples. The build compiles this file with -fno-math-errno and
+ * -fno-trapping-math, otherwise the square roots and the selects between computed
+ * values stay scalar. Range reduced Taylor polynomials are accurate to about 1e-15 for
+ * sine and cosine and 1e-14 for atan2, well below the float precision of the telemetry.
+ */
+
+// Sine and cosine of every angle
+void sincos_row(const double *angles, int count, double *sines, double *cosines)
+{
+	for(int i = 0; i < count; i++)
+	{
+		// Reduce to r in [-pi/4, pi/4] around the nearest multiple k of pi/2
+		double x = angles[i];
+		double shifted = x*M_2_PI + ROUNDING_SHIFT;
+		uint64_t bits;
+		memcpy(&bits, &shifted, sizeof(bits));
+		double k = shifted - ROUNDING_SHIFT;
+		double r = (x - k*PIO2_HI) - k*PIO2_LO;
+		double r2 = r*r;
+
+		double s = r + r*r2*(-1.0/6 + r2*(1.0/120 + r2*(-1.0/5040 + r2*(1.0/362880 + r2*(-1.0/39916800 + r2*(1.0/6227020800
+				   + r2*(-1.0/1307674368000)))))));
+		double c = 1 + r2*(-1.0/2 + r2*(1.0/24 + r2*(-1.0/720 + r2*(1.0/40320 + r2*(-1.0/3628800 + r2*(1.0/479001600
+				   + r2*(-1.0/87178291200 + r2*(1.0/20922789888000))))))));
+
+		// Quadrant k mod 4, odd quadrants swap sine and cosine
+		int quadrant = bits & 3;
+		double sine = (quadrant & 1) ? c : s;
+		double cosine = (quadrant & 1) ? s : c;
+		sines[i] = (quadrant & 2) ? -sine : sine;
+		cosines[i] = ((quadrant + 1) & 2) ? -cosine : cosine;
+	}
+}
+
+// Four quadrant arctangent of y/x, like std::atan2 for finite inputs
+void atan2_row(const double *y, const double *x, int count, double *angles)
+{
+	for(int i = 0; i < count; i++)
+	{
+		double ax = std::fabs(x[i]);
+		double ay = std::fabs(y[i]);
+		double larger = ax > ay ? ax : ay;
+		double smaller = ax > ay ? ay : ax;
+		double a = smaller/(larger > 0 ? larger : 1); // In [0, 1], atan2(0, 0) is 0
+
+		// atan(a) = pi/4 + atan((a - 1)/(a + 1)) leaves |t| <= tan(pi/8) for the series
+		bool upper = a > TAN_PI_8;
+		double t = upper ? (a - 1)/(a + 1) : a;
+		double t2 = t*t;
+		double series = t2*(-1.0/3 + t2*(1.0/5 + t2*(-1.0/7 + t2*(1.0/9 + t2*(-1.0/11 + t2*(1.0/13 + t2*(-1.0/15 + t2*(1.0/17 + t2*(-1.0/19
+						+ t2*(1.0/21 + t2*(-1.0/23 + t2*(1.0/25 + t2*(-1.0/27 + t2*(1.0/29 + t2*(-1.0/31)))))))))))))));
+		double angle = (upper ? M_PI_4 : 0) + t + t*series;
+
+		// Undo the octant and quadrant folding
+		angle = ay > ax ? M_PI_2 - angle : angle;
+		angle = x[i] < 0 ? M_PI - angle : angle;
+		angles[i] = std::copysign(angle, y[i]);
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Frame transformation
+// ------------------------------------------------------------------------------
+/**
+ * Transform the resampled window of the workspace
+ *
+ * Converts the attitude rows of the basis states from degrees to radians, rotates the
+ * velocity derivatives into the body frame if they are in NED and fills aero_storage
+ *
+ * @param workspace resampled window, see linear_interpolate
+ * @param velocity_ned true if the velocities are in the local NED frame, see Data_Buffer
+ */
+void transform_states(SID_Workspace &workspace, bool velocity_ned)
+{
+	int count = workspace.num_samples;
+	double *basis = workspace.basis_storage.data();
+	double *derivatives = workspace.derivative_storage.data();
+	double *rows = workspace.transform_storage.data();
+	double *aero = workspace.aero_storage.data();
+	auto row = [rows, &workspace](int index){ return rows + index*workspace.capacity; };
+
+	// Gather the attitude and velocities into contiguous rows, the basis keeps the attitude in radians
+	for(int axis = 0; axis < 3; axis++)
+	{
+		double *angle = row(ANGLE_ROW + axis);
+		double *velocity = row(VELOCITY_ROW + axis);
+		for(int i = 0; i < count; i++)
+		{
+			angle[i] = basis[i*NUM_BASIS_STATES + 3 + axis]*DEG_TO_RAD;
+			basis[i*NUM_BASIS_STATES + 3 + axis] = angle[i];
+			velocity[i] = derivatives[i*NUM_DERIVATIVES + 3 + axis];
+		}
+	}
+
+	double *u = row(VELOCITY_ROW);
+	double *v = row(VELOCITY_ROW + 1);
+	double *w = row(VELOCITY_ROW + 2);
+	if(velocity_ned)
+	{
+		for(int axis = 0; axis < 3; axis++)
+		{
+			sincos_row(row(ANGLE_ROW + axis), count, row(SINE_ROW + axis), row(COSINE_ROW + axis));
+		}
+
+		// Transpose of the ZYX body to NED rotation, phi roll, theta pitch, psi yaw
+		// One loop per body axis, so each writes a single row and the compiler's aliasing checks stay few
+		// The angles are no longer needed, their rows receive the body velocities
+		const double *sin_phi = row(SINE_ROW), *sin_theta = row(SINE_ROW + 1), *sin_psi = row(SINE_ROW + 2);
+		const double *cos_phi = row(COSINE_ROW), *cos_theta = row(COSINE_ROW + 1), *cos_psi = row(COSINE_ROW + 2);
+		const double *north = u, *east = v, *down = w;
+		u = row(ANGLE_ROW);
+		v = row(ANGLE_ROW + 1);
+		w = row(ANGLE_ROW + 2);
+		for(int i = 0; i < count; i++)
+		{
+			u[i] = cos_theta[i]*cos_psi[i]*north[i] + cos_theta[i]*sin_psi[i]*east[i] - sin_theta[i]*down[i];
+		}
+		for(int i = 0; i < count; i++)
+		{
+			double sin_phi_sin_theta = sin_phi[i]*sin_theta[i];
+			v[i] = (sin_phi_sin_theta*cos_psi[i] - cos_phi[i]*sin_psi[i])*north[i] + (sin_phi_sin_theta*sin_psi[i] + cos_phi[i]*cos_psi[i])*east[i]
+				   + sin_phi[i]*cos_theta[i]*down[i];
+		}
+		for(int i = 0; i < count; i++)
+		{
+			double cos_phi_sin_theta = cos_phi[i]*sin_theta[i];
+			w[i] = (cos_phi_sin_theta*cos_psi[i] + sin_phi[i]*sin_psi[i])*north[i] + (cos_phi_sin_theta*sin_psi[i] - sin_phi[i]*cos_psi[i])*east[i]
+				   + cos_phi[i]*cos_theta[i]*down[i];
+		}
+		for(int axis = 0; axis < 3; axis++)
+		{
+			const double *velocity = row(ANGLE_ROW + axis);
+			for(int i = 0; i < count; i++)
+			{
+				derivatives[i*NUM_DERIVATIVES + 3 + axis] = velocity[i];
+			}
+		}
+	}
+
+	// alpha = atan2(w, u), beta = atan2(v, sqrt(u^2 + w^2)), a sine row is reused for the longitudinal speed
+	double *alpha = aero + aero_alpha*workspace.capacity;
+	double *beta = aero + aero_beta*workspace.capacity;
+	double *airspeed = aero + aero_airspeed*workspace.capacity;
+	double *longitudinal = row(SINE_ROW);
+	for(int i = 0; i < count; i++)
+	{
+		double uw = u[i]*u[i] + w[i]*w[i];
+		longitudinal[i] = std::sqrt(uw);
+		airspeed[i] = std::sqrt(uw + v[i]*v[i]);
+	}
+	atan2_row(w, u, count, alpha);
+	atan2_row(v, longitudinal, count, beta);
+}
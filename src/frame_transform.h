@@ -0,0 +1,40 @@
+/**
+ * @file frame_transform.h
+ *
+ * @brief frame transformation definition
+ *
+ * Unit conversion, body frame velocities and aerodynamic states of a resampled window.
+ *
+ * The attitude arrives in degrees from the EulerAngle telemetry and is converted to
+ * radians in place, so the candidate functions and the validation see radians. If the
+ * odometry reports its velocities in the local NED frame they are rotated into the
+ * body frame with the window's attitude. Angle of attack, sideslip and airspeed are
+ * then derived from the body velocities, without wind the airspeed is the ground speed.
+ *
+ * Every pass runs over whole rows of samples. The trigonometric functions are
+ * branch-free polynomials instead of libm calls, so the loops can be vectorized.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef FRAME_TRANSFORM_H_
+#define FRAME_TRANSFORM_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "workspace.h"
+
+// Rows of SID_Workspace::aero_storage
+enum aero_state {
+    aero_alpha = 0, // Angle of attack [rad]
+    aero_beta = 1, // Sideslip angle [rad]
+    aero_airspeed = 2 // [m/s]
+};
+
+void transform_states(SID_Workspace &workspace, bool velocity_ned);
+void sincos_row(const double *angles, int count, double *sines, double *cosines);
+void atan2_row(const double *y, const double *x, int count, double *angles);
+
+#endif
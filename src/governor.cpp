@@ -0,0 +1,213 @@
+/**
+ * @file governor.cpp
+ *
+ * @brief compute governor
+ *
+ * Deadline tracking and graceful degradation of the SINDy pipeline
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "governor.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Governor::
+Governor()
+{
+}
+
+Governor::
+Governor(Governor_Settings settings_)
+{
+	settings = settings_;
+}
+
+// Called by the preprocessing stage as soon as a window has been taken from the buffer
+// Returns how the window should be processed at the current degradation level
+Governor_Decision Governor::
+window_ready(std::chrono::steady_clock::time_point clear_time, int backlog)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	// Track the window period from successive buffer clears
+	if(have_last_clear)
+	{
+		double interval = std::chrono::duration_cast<std::chrono::microseconds>(clear_time - last_clear).count();
+		measured_period_us = (measured_period_us == 0) ? interval : 0.8*measured_period_us + 0.2*interval;
+	}
+	last_clear = clear_time;
+	have_last_clear = true;
+
+	Governor_Decision decision;
+	decision.level = level;
+	for(int i = 0; i < level && i < (int)settings.degradations.size(); i++)
+	{
+		switch(settings.degradations[i])
+		{
+			case skip_window:
+				// Only drop the window if older windows are still waiting for regression
+				decision.skip = backlog > 0;
+				break;
+			case shrink_library:
+				decision.library_order = 1;
+				break;
+			case subsample_rows:
+				decision.sample_rate_divisor = settings.subsample_factor;
+				break;
+			case reduce_iterations:
+				decision.max_iterations = settings.reduced_iterations;
+				break;
+		}
+	}
+	if(decision.skip)
+	{
+		skipped_windows++;
+	}
+	return decision;
+}
+
+// Called once a window has been solved, returns true if its deadline was missed
+bool Governor::
+window_complete(std::chrono::steady_clock::time_point clear_time, std::chrono::steady_clock::time_point finish_time)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	double period_us = settings.window_period.count() > 0 ? settings.window_period.count()*1000.0 : measured_period_us;
+	if(period_us <= 0)
+	{
+		return false; // Period not known yet
+	}
+
+	double elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(finish_time - clear_time).count();
+	bool missed = elapsed_us > period_us;
+	if(missed)
+	{
+		deadline_misses++;
+		windows_with_slack = 0;
+		if(level < (int)settings.degradations.size())
+		{
+			level++;
+		}
+	}
+	else if(elapsed_us < 0.5*period_us)
+	{
+		windows_with_slack++;
+		if(windows_with_slack >= settings.recovery_windows && level > 0)
+		{
+			level--;
+			windows_with_slack = 0;
+		}
+	}
+	return missed;
+}
+
+// The window changed while running, 0 measures the new period from the following buffer clears
+void Governor::
+set_window_period(std::chrono::milliseconds window_period)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	settings.window_period = window_period;
+	measured_period_us = 0;
+	have_last_clear = false;
+	windows_with_slack = 0;
+}
+
+std::chrono::microseconds Governor::
+get_window_period() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if(settings.window_period.count() > 0)
+	{
+		return settings.window_period;
+	}
+	return std::chrono::microseconds((int64_t)measured_period_us);
+}
+
+uint64_t Governor::
+get_deadline_misses() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return deadline_misses;
+}
+
+uint64_t Governor::
+get_skipped_windows() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return skipped_windows;
+}
+
+int Governor::
+get_level() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return level;
+}
+
+// ------------------------------------------------------------------------------
+//   Helpers
+// ------------------------------------------------------------------------------
+
+// Parse a comma separated list of degradations, eg. "skip,subsample,iterations,library"
+std::vector<degradation> parse_degradations(const std::string &list)
+{
+	std::vector<degradation> degradations;
+	std::stringstream stream(list);
+	std::string item;
+	while(std::getline(stream, item, ','))
+	{
+		if(item == "skip")
+		{
+			degradations.push_back(skip_window);
+		}
+		else if(item == "library")
+		{
+			degradations.push_back(shrink_library);
+		}
+		else if(item == "subsample")
+		{
+			degradations.push_back(subsample_rows);
+		}
+		else if(item == "iterations")
+		{
+			degradations.push_back(reduce_iterations);
+		}
+		else if(!item.empty())
+		{
+			std::cout << "Invalid degradation " << item << ", use skip, library, subsample or iterations\n";
+			throw EXIT_FAILURE;
+		}
+	}
+	return degradations;
+}
+
+// Read the current cpu0 frequency and SoC temperature from sysfs
+Platform_Status read_platform_status()
+{
+	Platform_Status status;
+	double value;
+
+	std::ifstream frequency_file("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq");
+	if(frequency_file >> value)
+	{
+		status.cpu_frequency_mhz = value/1000.0; // reported in kHz
+	}
+
+	std::ifstream temperature_file("/sys/class/thermal/thermal_zone0/temp");
+	if(temperature_file >> value)
+	{
+		status.cpu_temperature_c = value/1000.0; // reported in millidegrees
+	}
+	return status;
+}
@@ -0,0 +1,97 @@
+/**
+ * @file governor.h
+ *
+ * @brief compute governor definition
+ *
+ * Tracks a deadline for every buffer window and degrades the computation when
+ * the pipeline can no longer keep up with the rate at which windows fill
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef GOVERNOR_H_
+#define GOVERNOR_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+
+// Degradations which may be applied under overrun, in the order they are listed on the command line
+enum degradation {
+    skip_window, // Drop windows while the regression stage is still behind
+    shrink_library, // Use first order candidate functions only
+    subsample_rows, // Resample the window at a reduced rate
+    reduce_iterations // Lower the STLSQ iteration budget
+};
+
+struct Governor_Settings {
+    std::vector<degradation> degradations; // Escalation order, empty disables degradation
+    std::chrono::milliseconds window_period{0}; // Known window period, 0 to measure it from buffer clears
+    int subsample_factor = 2; // Sample rate divisor when subsampling
+    int reduced_iterations = 3; // STLSQ iteration budget when reducing iterations
+    int recovery_windows = 5; // Consecutive windows with slack required to relax one level
+};
+
+// How the pipeline should process a given window
+struct Governor_Decision {
+    int level = 0; // Number of degradations applied
+    bool skip = false;
+    int library_order = 2;
+    int sample_rate_divisor = 1;
+    int max_iterations = 10;
+};
+
+// Platform state sampled alongside each coefficient row
+struct Platform_Status {
+    double cpu_frequency_mhz = -1; // -1 when unavailable
+    double cpu_temperature_c = -1; // -1 when unavailable
+};
+
+// ----------------------------------------------------------------------------------
+//   Governor Class
+// ----------------------------------------------------------------------------------
+/*
+ * Window N is due one window period after its buffer was cleared, since by then
+ * window N+1 is ready to be processed. A late window raises the degradation level,
+ * a run of windows finishing with at least half a period of slack lowers it.
+ */
+class Governor
+{
+    Governor_Settings settings;
+    int level = 0;
+    int windows_with_slack = 0;
+    uint64_t deadline_misses = 0;
+    uint64_t skipped_windows = 0;
+    double measured_period_us = 0; // exponentially weighted inter-clear interval
+    std::chrono::steady_clock::time_point last_clear;
+    bool have_last_clear = false;
+    mutable std::mutex mtx;
+
+public:
+    Governor();
+    Governor(Governor_Settings settings_);
+
+    Governor_Decision window_ready(std::chrono::steady_clock::time_point clear_time, int backlog);
+    bool window_complete(std::chrono::steady_clock::time_point clear_time, std::chrono::steady_clock::time_point finish_time);
+
+    void set_window_period(std::chrono::milliseconds window_period);
+    std::chrono::microseconds get_window_period() const;
+    uint64_t get_deadline_misses() const;
+    uint64_t get_skipped_windows() const;
+    int get_level() const;
+};
+
+std::vector<degradation> parse_degradations(const std::string &list);
+Platform_Status read_platform_status();
+
+#endif
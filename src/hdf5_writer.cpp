@@ -0,0 +1,366 @@
+/**
+ * @file hdf5_writer.cpp
+ *
+ * @brief columnar HDF5 output
+ *
+ * Asynchronous chunked writer of coefficients, window timing and resampled states
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "hdf5_writer.h"
+#include <iostream>
+#include <limits>
+
+// Names of the resampled states, in the order of resampled_state_columns
+std::vector<std::string> resampled_state_names()
+{
+	return {"time_us", "u", "v", "w", "x", "y", "z", "p", "q", "r", "psi", "theta", "phi",
+			"actuator0", "actuator1", "actuator2", "actuator3", "alpha", "beta", "airspeed"};
+}
+
+std::vector<const arma::rowvec *> resampled_state_columns(const Vehicle_States &states)
+{
+	return {&states.time_us, &states.u, &states.v, &states.w, &states.x, &states.y, &states.z, &states.p, &states.q, &states.r,
+			&states.psi, &states.theta, &states.phi, &states.actuator0, &states.actuator1, &states.actuator2, &states.actuator3,
+			&states.alpha, &states.beta, &states.airspeed};
+}
+
+#ifdef SINDY_USE_HDF5
+// Create an empty dataset which is extendable along its first dimension
+static hid_t create_dataset(hid_t location, const std::string &name, hid_t type, std::vector<hsize_t> row_shape, hsize_t chunk_rows)
+{
+	std::vector<hsize_t> dims(1, 0), max_dims(1, H5S_UNLIMITED), chunk(1, chunk_rows);
+	for(hsize_t extent : row_shape)
+	{
+		dims.push_back(extent);
+		max_dims.push_back(extent);
+		chunk.push_back(extent);
+	}
+	hid_t space = H5Screate_simple(dims.size(), dims.data(), max_dims.data());
+	hid_t properties = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_chunk(properties, chunk.size(), chunk.data());
+	H5Pset_shuffle(properties);
+	H5Pset_deflate(properties, 4);
+	hid_t dataset = H5Dcreate2(location, name.c_str(), type, space, H5P_DEFAULT, properties, H5P_DEFAULT);
+	H5Pclose(properties);
+	H5Sclose(space);
+	return dataset;
+}
+
+// Append rows to a dataset created by create_dataset
+static void append_rows(hid_t dataset, hid_t type, const void *data, hsize_t rows)
+{
+	if(rows == 0)
+	{
+		return;
+	}
+	hid_t space = H5Dget_space(dataset);
+	int rank = H5Sget_simple_extent_ndims(space);
+	std::vector<hsize_t> dims(rank);
+	H5Sget_simple_extent_dims(space, dims.data(), nullptr);
+	H5Sclose(space);
+
+	std::vector<hsize_t> start(rank, 0), count(dims);
+	start[0] = dims[0];
+	count[0] = rows;
+	dims[0] += rows;
+	H5Dset_extent(dataset, dims.data());
+
+	space = H5Dget_space(dataset);
+	H5Sselect_hyperslab(space, H5S_SELECT_SET, start.data(), nullptr, count.data(), nullptr);
+	hid_t memory = H5Screate_simple(rank, count.data(), nullptr);
+	H5Dwrite(dataset, type, memory, space, H5P_DEFAULT, data);
+	H5Sclose(memory);
+	H5Sclose(space);
+}
+
+// Store a list of names as a variable length string attribute
+static void write_names(hid_t location, const std::string &name, const std::vector<std::string> &names)
+{
+	std::vector<const char *> strings;
+	for(const std::string &entry : names)
+	{
+		strings.push_back(entry.c_str());
+	}
+	hsize_t count = strings.size();
+	hid_t type = H5Tcopy(H5T_C_S1);
+	H5Tset_size(type, H5T_VARIABLE);
+	hid_t space = H5Screate_simple(1, &count, nullptr);
+	hid_t attribute = H5Acreate2(location, name.c_str(), type, space, H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(attribute, type, strings.data());
+	H5Aclose(attribute);
+	H5Sclose(space);
+	H5Tclose(type);
+}
+#endif
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Hdf5_Writer::
+Hdf5_Writer(std::string filename_, const std::vector<std::string> &model_names, const std::vector<std::string> &feature_names,
+			const std::vector<std::string> &state_names, const std::vector<std::string> &timing_names,
+			const std::vector<std::string> &statistic_names, bool log_states_, int ring_capacity)
+	: ring(ring_capacity)
+{
+	filename = filename_;
+	num_models = model_names.size();
+	num_features = feature_names.size();
+	num_states = state_names.size();
+	num_timings = timing_names.size();
+	num_statistics = statistic_names.size();
+	log_states = log_states_;
+	chunk_windows = 16;
+
+#ifdef SINDY_USE_HDF5
+	file = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	if(file < 0)
+	{
+		std::cerr << "Could not create HDF5 log " << filename << "\n";
+		throw EXIT_FAILURE;
+	}
+
+	coefficients_dataset = create_dataset(file, "coefficients", H5T_NATIVE_DOUBLE, {(hsize_t)num_models, (hsize_t)num_features, (hsize_t)num_states}, chunk_windows);
+	write_names(coefficients_dataset, "model_names", model_names);
+	write_names(coefficients_dataset, "feature_names", feature_names);
+	write_names(coefficients_dataset, "state_names", state_names);
+	index_dataset = create_dataset(file, "window_index", H5T_NATIVE_UINT64, {}, 1024);
+	sample_time_dataset = create_dataset(file, "sample_time_us", H5T_NATIVE_INT64, {}, 1024);
+	clear_time_dataset = create_dataset(file, "clear_time_us", H5T_NATIVE_INT64, {}, 1024);
+	timings_dataset = create_dataset(file, "timings_us", H5T_NATIVE_DOUBLE, {(hsize_t)num_timings}, 1024);
+	write_names(timings_dataset, "stage_names", timing_names);
+	statistics_dataset = create_dataset(file, "statistics", H5T_NATIVE_DOUBLE, {(hsize_t)num_statistics}, 1024);
+	write_names(statistics_dataset, "statistic_names", statistic_names);
+
+	if(log_states)
+	{
+		hid_t group = H5Gcreate2(file, "states", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+		window_start_dataset = create_dataset(group, "window_start", H5T_NATIVE_UINT64, {}, 1024);
+		window_length_dataset = create_dataset(group, "window_length", H5T_NATIVE_UINT64, {}, 1024);
+		for(const std::string &name : resampled_state_names())
+		{
+			state_datasets.push_back(create_dataset(group, name, H5T_NATIVE_DOUBLE, {}, 4096));
+		}
+		H5Gclose(group);
+	}
+	pending_states.resize(state_datasets.size());
+
+	writer_thread = std::thread(&Hdf5_Writer::writer, this);
+#else
+	std::cerr << "HDF5 output requested for " << filename << ", but SINDy was built without SINDY_USE_HDF5\n";
+	throw EXIT_FAILURE;
+#endif
+}
+
+Hdf5_Writer::
+~Hdf5_Writer()
+{
+	stop();
+}
+
+// Copy a window into the ring, returns false if it had to be dropped
+bool Hdf5_Writer::
+log(uint64_t index, std::chrono::microseconds sample_time, std::chrono::steady_clock::time_point clear_time,
+	const std::vector<arma::mat> &coefficients, const std::vector<double> &timings, const std::vector<double> &statistics,
+	const Vehicle_States &states)
+{
+	if((int)coefficients.size() != num_models || (int)timings.size() != num_timings || (int)statistics.size() != num_statistics)
+	{
+		windows_dropped++;
+		return false;
+	}
+	for(const arma::mat &model : coefficients)
+	{
+		if((int)model.n_rows != num_features || (int)model.n_cols != num_states)
+		{
+			windows_dropped++;
+			return false;
+		}
+	}
+
+	bool queued = ring.try_push([&](Hdf5_Record &record)
+	{
+		record.index = index;
+		record.sample_time_us = sample_time.count();
+		record.clear_time_us = std::chrono::duration_cast<std::chrono::microseconds>(clear_time.time_since_epoch()).count();
+		record.coefficients.resize(num_models*num_features*num_states);
+		size_t position = 0;
+		for(const arma::mat &model : coefficients)
+		{
+			for(int row = 0; row < num_features; row++)
+			{
+				for(int column = 0; column < num_states; column++)
+				{
+					record.coefficients[position++] = model(row, column);
+				}
+			}
+		}
+		record.timings.assign(timings.begin(), timings.end());
+		record.statistics.assign(statistics.begin(), statistics.end());
+
+		record.num_samples = 0;
+		if(log_states)
+		{
+			// States not computed for this window are stored as NaN so all columns stay aligned
+			record.num_samples = states.num_samples;
+			std::vector<const arma::rowvec *> columns = resampled_state_columns(states);
+			record.states.resize(columns.size()*record.num_samples);
+			for(size_t state = 0; state < columns.size(); state++)
+			{
+				for(uint64_t sample = 0; sample < record.num_samples; sample++)
+				{
+					record.states[state*record.num_samples + sample] = sample < columns[state]->n_elem ? (*columns[state])(sample)
+																								: std::numeric_limits<double>::quiet_NaN();
+				}
+			}
+		}
+	});
+
+	if(!queued)
+	{
+		windows_dropped++;
+	}
+	return queued;
+}
+
+// Drain the ring, append what is left and close the file
+void Hdf5_Writer::
+stop()
+{
+	time_to_exit = true;
+	if(writer_thread.joinable())
+	{
+		writer_thread.join();
+	}
+#ifdef SINDY_USE_HDF5
+	if(file >= 0)
+	{
+		flush();
+		for(hid_t dataset : state_datasets)
+		{
+			H5Dclose(dataset);
+		}
+		state_datasets.clear();
+		for(hid_t dataset : {coefficients_dataset, index_dataset, sample_time_dataset, clear_time_dataset, timings_dataset,
+							 statistics_dataset, window_start_dataset, window_length_dataset})
+		{
+			if(dataset >= 0)
+			{
+				H5Dclose(dataset);
+			}
+		}
+		H5Fclose(file);
+		file = -1;
+	}
+#endif
+}
+
+// ------------------------------------------------------------------------------
+//   Writer
+// ------------------------------------------------------------------------------
+void Hdf5_Writer::
+writer()
+{
+	while(true)
+	{
+		bool exiting = time_to_exit;
+		bool popped = false;
+		while(ring.try_pop([this](Hdf5_Record &record){ gather(record); }))
+		{
+			popped = true;
+			windows_logged++;
+			if(pending_windows >= chunk_windows)
+			{
+				flush();
+			}
+		}
+
+		if(exiting)
+		{
+			return;
+		}
+		if(!popped)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+	}
+}
+
+void Hdf5_Writer::
+gather(const Hdf5_Record &record)
+{
+	pending_index.push_back(record.index);
+	pending_sample_time.push_back(record.sample_time_us);
+	pending_clear_time.push_back(record.clear_time_us);
+	pending_coefficients.insert(pending_coefficients.end(), record.coefficients.begin(), record.coefficients.end());
+	pending_timings.insert(pending_timings.end(), record.timings.begin(), record.timings.end());
+	pending_statistics.insert(pending_statistics.end(), record.statistics.begin(), record.statistics.end());
+	if(log_states)
+	{
+		pending_window_start.push_back(state_samples);
+		pending_window_length.push_back(record.num_samples);
+		for(size_t state = 0; state < pending_states.size(); state++)
+		{
+			auto column = record.states.begin() + state*record.num_samples;
+			pending_states[state].insert(pending_states[state].end(), column, column + record.num_samples);
+		}
+		state_samples += record.num_samples;
+	}
+	pending_windows++;
+}
+
+// Append the gathered windows to every dataset
+void Hdf5_Writer::
+flush()
+{
+#ifdef SINDY_USE_HDF5
+	append_rows(coefficients_dataset, H5T_NATIVE_DOUBLE, pending_coefficients.data(), pending_windows);
+	append_rows(index_dataset, H5T_NATIVE_UINT64, pending_index.data(), pending_windows);
+	append_rows(sample_time_dataset, H5T_NATIVE_INT64, pending_sample_time.data(), pending_windows);
+	append_rows(clear_time_dataset, H5T_NATIVE_INT64, pending_clear_time.data(), pending_windows);
+	append_rows(timings_dataset, H5T_NATIVE_DOUBLE, pending_timings.data(), pending_windows);
+	append_rows(statistics_dataset, H5T_NATIVE_DOUBLE, pending_statistics.data(), pending_windows);
+	if(log_states)
+	{
+		append_rows(window_start_dataset, H5T_NATIVE_UINT64, pending_window_start.data(), pending_windows);
+		append_rows(window_length_dataset, H5T_NATIVE_UINT64, pending_window_length.data(), pending_windows);
+		for(size_t state = 0; state < state_datasets.size(); state++)
+		{
+			append_rows(state_datasets[state], H5T_NATIVE_DOUBLE, pending_states[state].data(), pending_states[state].size());
+		}
+	}
+	H5Fflush(file, H5F_SCOPE_LOCAL);
+#endif
+
+	pending_windows = 0;
+	pending_index.clear();
+	pending_sample_time.clear();
+	pending_clear_time.clear();
+	pending_coefficients.clear();
+	pending_timings.clear();
+	pending_statistics.clear();
+	pending_window_start.clear();
+	pending_window_length.clear();
+	for(std::vector<double> &column : pending_states)
+	{
+		column.clear();
+	}
+}
+
+uint64_t Hdf5_Writer::
+get_logged() const
+{
+	return windows_logged;
+}
+
+uint64_t Hdf5_Writer::
+get_dropped() const
+{
+	return windows_dropped;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file hdf5_writer.h
+ *
+ * @brief columnar HDF5 output definition
+ *
+ * Background writer storing the identification results of one vehicle in a single
+ * HDF5 file with chunked, compressed datasets which grow by one entry per window
+ *
+ * File layout, W windows, M models, F candidate functions, S derivatives:
+ *
+ *   /coefficients     double [W][M][F][S]   attributes model_names, feature_names, state_names
+ *   /window_index     uint64 [W]
+ *   /sample_time_us   int64  [W]            time since the program epoch at which the window was solved
+ *   /clear_time_us    int64  [W]            monotonic time the window was taken from the buffer
+ *   /timings_us       double [W][T]         attribute stage_names
+ *   /statistics       double [W][K]         attribute statistic_names
+ *   /states/<name>    double [N]            resampled states of all windows back to back (optional)
+ *   /states/window_start   uint64 [W]       first sample of each window in /states/<name>
+ *   /states/window_length  uint64 [W]
+ *
+ * Only available when built with -DSINDY_USE_HDF5=ON, otherwise the constructor fails.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef HDF5_WRITER_H_
+#define HDF5_WRITER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "ring.h"
+#include "interpolate.h"
+#include <armadillo>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+
+#ifdef SINDY_USE_HDF5
+#include <hdf5.h>
+#endif
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+
+// One window of every model, slots of the writer ring hold these and reuse their buffers
+struct Hdf5_Record {
+    uint64_t index = 0;
+    int64_t sample_time_us = 0;
+    int64_t clear_time_us = 0;
+    std::vector<double> coefficients; // [model][feature][state]
+    std::vector<double> timings;
+    std::vector<double> statistics;
+    uint64_t num_samples = 0;
+    std::vector<double> states; // [state][sample]
+};
+
+// ----------------------------------------------------------------------------------
+//   HDF5 Writer Class
+// ----------------------------------------------------------------------------------
+/*
+ * log() copies a window into a preallocated ring slot and returns, the writer thread
+ * gathers windows column by column and appends a full chunk to every dataset at once.
+ * Windows arriving while the ring is full are dropped and counted.
+ */
+class Hdf5_Writer
+{
+    std::string filename;
+    int num_models;
+    int num_features;
+    int num_states;
+    int num_timings;
+    int num_statistics;
+    bool log_states;
+    size_t chunk_windows; // Windows gathered before they are appended
+
+    Lockfree_Ring<Hdf5_Record> ring;
+
+    // Columns of the windows gathered for the next append
+    size_t pending_windows = 0;
+    std::vector<uint64_t> pending_index;
+    std::vector<int64_t> pending_sample_time;
+    std::vector<int64_t> pending_clear_time;
+    std::vector<double> pending_coefficients;
+    std::vector<double> pending_timings;
+    std::vector<double> pending_statistics;
+    std::vector<uint64_t> pending_window_start;
+    std::vector<uint64_t> pending_window_length;
+    std::vector<std::vector<double>> pending_states;
+    uint64_t state_samples = 0; // Samples appended to /states so far, including pending ones
+
+#ifdef SINDY_USE_HDF5
+    hid_t file = -1;
+    hid_t coefficients_dataset = -1;
+    hid_t index_dataset = -1;
+    hid_t sample_time_dataset = -1;
+    hid_t clear_time_dataset = -1;
+    hid_t timings_dataset = -1;
+    hid_t statistics_dataset = -1;
+    hid_t window_start_dataset = -1;
+    hid_t window_length_dataset = -1;
+    std::vector<hid_t> state_datasets;
+#endif
+
+    std::thread writer_thread;
+    std::atomic<bool> time_to_exit{false};
+    std::atomic<uint64_t> windows_logged{0};
+    std::atomic<uint64_t> windows_dropped{0};
+
+    void writer();
+    void gather(const Hdf5_Record &record);
+    void flush();
+
+public:
+    Hdf5_Writer(std::string filename_, const std::vector<std::string> &model_names, const std::vector<std::string> &feature_names,
+                const std::vector<std::string> &state_names, const std::vector<std::string> &timing_names,
+                const std::vector<std::string> &statistic_names, bool log_states_ = false, int ring_capacity = 32);
+    ~Hdf5_Writer();
+
+    bool log(uint64_t index, std::chrono::microseconds sample_time, std::chrono::steady_clock::time_point clear_time,
+             const std::vector<arma::mat> &coefficients, const std::vector<double> &timings, const std::vector<double> &statistics,
+             const Vehicle_States &states);
+    void stop();
+
+    uint64_t get_logged() const;
+    uint64_t get_dropped() const;
+};
+
+std::vector<std::string> resampled_state_names();
+std::vector<const arma::rowvec *> resampled_state_columns(const Vehicle_States &states);
+
+#endif
@@ -1,145 +1,170 @@
 #include "interpolate.h"
+#include <math.h>
+
+// Linear interpolation of one telemetry stream at the samples of time_base
+// Consecutive samples of out are stride doubles apart, times outside the stream are NaN like arma::interp1
+static void interpolate_stream(const std::vector<uint64_t> &time, const std::vector<float> &values, const double *time_base, int num_samples,
+							   double *out, int stride)
+{
+	size_t count = time.size();
+	size_t j = 0;
+	for(int i = 0; i < num_samples; i++)
+	{
+		double t = time_base[i];
+		// Both time bases are ascending, so the bracketing pair only ever moves forward
+		while(j + 1 < count && (double)time[j + 1] < t)
+		{
+			j++;
+		}
+		double value;
+		if(t < (double)time.front() || t > (double)time.back())
+		{
+			value = NAN;
+		}
+		else if(j + 1 == count || (double)time[j] >= t)
+		{
+			value = values[j];
+		}
+		else
+		{
+			double t0 = time[j];
+			double t1 = time[j + 1];
+			value = values[j] + (t - t0)*((double)values[j + 1] - values[j])/(t1 - t0);
+		}
+		out[i*stride] = value;
+	}
+}
 
 /**
  * Interpolate the samples in Mavlink Message Buffer
  *
  * @param data Struct containing vectors of mavlink messages
  * @param sample_rate rate for resampling data buffer
- * @return void
+ * @param workspace receives the time base, basis states and derivatives
+ * @return true if the workspace had to grow to hold the window
  */
-// Interpolates the data buffer and performs state transformations
-Vehicle_States linear_interpolate(Data_Buffer data, int sample_rate)
+// Interpolates the data buffer straight into the workspace, without temporaries
+bool linear_interpolate(const Data_Buffer &data, int sample_rate, SID_Workspace &workspace)
 {
-	//Perform the coordinate conversions to obtain the desired states
-
 	//Ensure all telem sources have been arriving 
 	assert(data.find_min_length() > 0);
 
-	//Euler angles
-	arma::rowvec psi = arma::conv_to<arma::rowvec>::from(data.roll);
-	arma::rowvec theta = arma::conv_to<arma::rowvec>::from(data.pitch);
-	arma::rowvec phi = arma::conv_to<arma::rowvec>::from(data.yaw);
-	arma::rowvec attitude_time_ms = arma::conv_to<arma::rowvec>::from(data.attitude_time_boot_ms);
-
-	//Angular Velocities
-	arma::rowvec p = arma::conv_to<arma::rowvec>::from(data.rollspeed);
-	arma::rowvec q = arma::conv_to<arma::rowvec>::from(data.pitchspeed);
-	arma::rowvec r = arma::conv_to<arma::rowvec>::from(data.yawspeed);
-	arma::rowvec angular_velocity_time_boot_ms = arma::conv_to<arma::rowvec>::from(data.angular_velocity_time_boot_ms);
-
-	//Linear Velocities
-	arma::rowvec x_m_s = arma::conv_to<arma::rowvec>::from(data.x_m_s);
-	arma::rowvec y_m_s = arma::conv_to<arma::rowvec>::from(data.y_m_s);
-	arma::rowvec z_m_s = arma::conv_to<arma::rowvec>::from(data.z_m_s);
-
-	//Linear Positions
-	arma::rowvec x = arma::conv_to<arma::rowvec>::from(data.x);
-	arma::rowvec y = arma::conv_to<arma::rowvec>::from(data.y);
-	arma::rowvec z = arma::conv_to<arma::rowvec>::from(data.z);
-	arma::rowvec position_time_boot_ms = arma::conv_to<arma::rowvec>::from(data.position_time_boot_ms);
-
-	//Actuator Outputs
-	arma::rowvec actuator0 = arma::conv_to<arma::rowvec>::from(data.actuator0);
-	arma::rowvec actuator1 = arma::conv_to<arma::rowvec>::from(data.actuator1);
-	arma::rowvec actuator2 = arma::conv_to<arma::rowvec>::from(data.actuator2);
-	arma::rowvec actuator3 = arma::conv_to<arma::rowvec>::from(data.actuator3);
-
-	arma::rowvec actuator_time_boot_ms = arma::conv_to<arma::rowvec>::from(data.actuator_output_ms);
-
 	// Find latest first sample sample time, this will be the time origin
 	// Using latest so no extrapolation occurs
- 	uint64_t first_sample_time = data.attitude_time_boot_ms.front();
+ 	uint64_t first_sample_time = data.attitude_time_us.front();
 
-	if(data.angular_velocity_time_boot_ms.front() > first_sample_time)
+	if(data.angular_velocity_time_us.front() > first_sample_time)
 	{
-		first_sample_time = data.angular_velocity_time_boot_ms.front();
+		first_sample_time = data.angular_velocity_time_us.front();
 	}
 
-	if((data.position_time_boot_ms.front()) > first_sample_time)
+	if((data.position_time_us.front()) > first_sample_time)
 	{
-		first_sample_time = data.position_time_boot_ms.front();
+		first_sample_time = data.position_time_us.front();
 	}
-	if((data.actuator_output_ms.front()) > first_sample_time)
+	if((data.actuator_time_us.front()) > first_sample_time)
 	{
-		first_sample_time = data.actuator_output_ms.front();
+		first_sample_time = data.actuator_time_us.front();
 	}
 
     // Find the buffer with the earliest last sample to avoid extrapolation
- 	uint64_t last_sample_time = data.attitude_time_boot_ms.back();
+ 	uint64_t last_sample_time = data.attitude_time_us.back();
 
-	if(data.angular_velocity_time_boot_ms.back() < last_sample_time)
+	if(data.angular_velocity_time_us.back() < last_sample_time)
 	{
-		last_sample_time = data.angular_velocity_time_boot_ms.back();
+		last_sample_time = data.angular_velocity_time_us.back();
 	}
 
-	if((data.position_time_boot_ms.back()) < last_sample_time)
+	if((data.position_time_us.back()) < last_sample_time)
 	{
-		last_sample_time = data.position_time_boot_ms.back();
+		last_sample_time = data.position_time_us.back();
 	}
-	if((data.actuator_output_ms.back()) < last_sample_time)
+	if((data.actuator_time_us.back()) < last_sample_time)
 	{
-		last_sample_time = data.actuator_output_ms.back();
+		last_sample_time = data.actuator_time_us.back();
 	}
 
-	int number_of_samples = (last_sample_time-first_sample_time)*(sample_rate)/1000;
-	
-	// Generate a common time base
-	arma::rowvec time_ms = arma::linspace<arma::rowvec>(first_sample_time, last_sample_time, number_of_samples);
-
-	arma::rowvec psi_interp(number_of_samples);
-	arma::rowvec theta_interp(number_of_samples);
-	arma::rowvec phi_interp(number_of_samples);
-	arma::rowvec p_interp(number_of_samples);
-	arma::rowvec q_interp(number_of_samples);
-	arma::rowvec r_interp(number_of_samples);
-	arma::rowvec lvx_interp(number_of_samples);
-	arma::rowvec lvy_interp(number_of_samples);
-	arma::rowvec lvz_interp(number_of_samples);
-	arma::rowvec x_interp(number_of_samples);
-	arma::rowvec y_interp(number_of_samples);
-	arma::rowvec z_interp(number_of_samples);
-	arma::rowvec actuator0_interp(number_of_samples);
-	arma::rowvec actuator1_interp(number_of_samples);
-	arma::rowvec actuator2_interp(number_of_samples);
-	arma::rowvec actuator3_interp(number_of_samples);
-
-	arma::interp1(attitude_time_ms, psi, time_ms, psi_interp);
-	arma::interp1(attitude_time_ms, theta, time_ms, theta_interp);
-	arma::interp1(attitude_time_ms, phi, time_ms, phi_interp);
-	arma::interp1(angular_velocity_time_boot_ms, p, time_ms, p_interp);
-	arma::interp1(angular_velocity_time_boot_ms, q, time_ms, q_interp);
-	arma::interp1(angular_velocity_time_boot_ms, r, time_ms, r_interp);
-	arma::interp1(position_time_boot_ms, x_m_s, time_ms, lvx_interp);
-	arma::interp1(position_time_boot_ms, y_m_s, time_ms, lvy_interp);
-	arma::interp1(position_time_boot_ms, z_m_s, time_ms, lvz_interp);
-	arma::interp1(position_time_boot_ms, x, time_ms, x_interp);
-	arma::interp1(position_time_boot_ms, y, time_ms, y_interp);
-	arma::interp1(position_time_boot_ms, z, time_ms, z_interp);
-	arma::interp1(actuator_time_boot_ms, actuator0, time_ms, actuator0_interp);
-	arma::interp1(actuator_time_boot_ms, actuator1, time_ms, actuator1_interp);
-	arma::interp1(actuator_time_boot_ms, actuator2, time_ms, actuator2_interp);
-	arma::interp1(actuator_time_boot_ms, actuator3, time_ms, actuator3_interp);
-	
-	Vehicle_States state_buffer;
+	// Streams that do not overlap leave nothing to interpolate
+	int number_of_samples = 0;
+	if(last_sample_time > first_sample_time)
+	{
+		number_of_samples = (last_sample_time-first_sample_time)*(sample_rate)/1000000;
+	}
+	bool grown = workspace.resize(number_of_samples);
 
-	state_buffer.time_boot_ms = time_ms;
-	state_buffer.p = p_interp;
-	state_buffer.q = q_interp;
-	state_buffer.r = r_interp;
-	state_buffer.psi = psi_interp;
-	state_buffer.theta = theta_interp;
-	state_buffer.phi = phi_interp;
-	state_buffer.u = lvx_interp;
-	state_buffer.v = lvy_interp;
-	state_buffer.w = lvz_interp;
-	state_buffer.x = x_interp;
-	state_buffer.y = y_interp;
-	state_buffer.z = z_interp;
-	state_buffer.actuator0 = actuator0_interp;
-	state_buffer.actuator1 = actuator1_interp;
-	state_buffer.actuator2 = actuator2_interp;
-	state_buffer.actuator3 = actuator3_interp;
-	state_buffer.num_samples = number_of_samples;
+	// Generate a common time base, spaced like arma::linspace
+	double *time_us = workspace.time_storage.data();
+	double delta = number_of_samples > 1 ? ((double)last_sample_time - first_sample_time)/(number_of_samples - 1) : 0;
+	for(int i = 0; i < number_of_samples - 1; i++)
+	{
+		time_us[i] = first_sample_time + i*delta;
+	}
+	if(number_of_samples > 0)
+	{
+		time_us[number_of_samples - 1] = last_sample_time;
+	}
+
+	// Basis states in candidate function order, x, y, z, psi, theta, phi, u0..u3
+	double *basis = workspace.basis_storage.data();
+	interpolate_stream(data.position_time_us, data.x, time_us, number_of_samples, basis + 0, NUM_BASIS_STATES);
+	interpolate_stream(data.position_time_us, data.y, time_us, number_of_samples, basis + 1, NUM_BASIS_STATES);
+	interpolate_stream(data.position_time_us, data.z, time_us, number_of_samples, basis + 2, NUM_BASIS_STATES);
+	interpolate_stream(data.attitude_time_us, data.roll, time_us, number_of_samples, basis + 3, NUM_BASIS_STATES);
+	interpolate_stream(data.attitude_time_us, data.pitch, time_us, number_of_samples, basis + 4, NUM_BASIS_STATES);
+	interpolate_stream(data.attitude_time_us, data.yaw, time_us, number_of_samples, basis + 5, NUM_BASIS_STATES);
+	interpolate_stream(data.actuator_time_us, data.actuator0, time_us, number_of_samples, basis + 6, NUM_BASIS_STATES);
+	interpolate_stream(data.actuator_time_us, data.actuator1, time_us, number_of_samples, basis + 7, NUM_BASIS_STATES);
+	interpolate_stream(data.actuator_time_us, data.actuator2, time_us, number_of_samples, basis + 8, NUM_BASIS_STATES);
+	interpolate_stream(data.actuator_time_us, data.actuator3, time_us, number_of_samples, basis + 9, NUM_BASIS_STATES);
+
+	// Derivatives in derivative_names order, p, q, r, u, v, w
+	double *derivatives = workspace.derivative_storage.data();
+	interpolate_stream(data.angular_velocity_time_us, data.rollspeed, time_us, number_of_samples, derivatives + 0, NUM_DERIVATIVES);
+	interpolate_stream(data.angular_velocity_time_us, data.pitchspeed, time_us, number_of_samples, derivatives + 1, NUM_DERIVATIVES);
+	interpolate_stream(data.angular_velocity_time_us, data.yawspeed, time_us, number_of_samples, derivatives + 2, NUM_DERIVATIVES);
+	interpolate_stream(data.position_time_us, data.x_m_s, time_us, number_of_samples, derivatives + 3, NUM_DERIVATIVES);
+	interpolate_stream(data.position_time_us, data.y_m_s, time_us, number_of_samples, derivatives + 4, NUM_DERIVATIVES);
+	interpolate_stream(data.position_time_us, data.z_m_s, time_us, number_of_samples, derivatives + 5, NUM_DERIVATIVES);
+
+	return grown;
+}
+
+// Copy the resampled window out of the workspace, the aerodynamic states are only valid after transform_states
+Vehicle_States resampled_states(SID_Workspace &workspace)
+{
+	arma::mat basis = workspace.basis_states();
+	arma::mat derivatives = workspace.derivatives();
 
+	Vehicle_States state_buffer;
+	state_buffer.num_samples = workspace.num_samples;
+	state_buffer.time_us = workspace.time_us();
+	state_buffer.x = basis.row(0);
+	state_buffer.y = basis.row(1);
+	state_buffer.z = basis.row(2);
+	state_buffer.psi = basis.row(3);
+	state_buffer.theta = basis.row(4);
+	state_buffer.phi = basis.row(5);
+	state_buffer.actuator0 = basis.row(6);
+	state_buffer.actuator1 = basis.row(7);
+	state_buffer.actuator2 = basis.row(8);
+	state_buffer.actuator3 = basis.row(9);
+	state_buffer.p = derivatives.row(0);
+	state_buffer.q = derivatives.row(1);
+	state_buffer.r = derivatives.row(2);
+	state_buffer.u = derivatives.row(3);
+	state_buffer.v = derivatives.row(4);
+	state_buffer.w = derivatives.row(5);
+	state_buffer.alpha = workspace.aero_state(aero_alpha);
+	state_buffer.beta = workspace.aero_state(aero_beta);
+	state_buffer.airspeed = workspace.aero_state(aero_airspeed);
 	return state_buffer;
-}
\ No newline at end of file
+}
+
+// Interpolates the data buffer and performs state transformations
+Vehicle_States linear_interpolate(const Data_Buffer &data, int sample_rate)
+{
+	SID_Workspace workspace;
+	linear_interpolate(data, sample_rate, workspace);
+	transform_states(workspace, data.velocity_ned);
+	return resampled_states(workspace);
+}
@@ -16,6 +16,8 @@
 //   Includes
 // ------------------------------------------------------------------------------
 #include "buffer.h"
+#include "workspace.h"
+#include "frame_transform.h"
 #include <vector>       // std::vector
 #include <armadillo>    // std::copy
 #include <mavsdk/mavsdk.h> // general mavlink header
@@ -26,7 +28,7 @@ struct Vehicle_States{
     int num_samples;
 
     //Common time base
-    arma::rowvec time_boot_ms;
+    arma::rowvec time_us;
 
     //Bias
     arma::rowvec bias; //Body velocity in X
@@ -57,10 +59,14 @@ struct Vehicle_States{
     arma::rowvec actuator2; //Actuator 2 duty cycle [us]
     arma::rowvec actuator3; //Actuator 3 duty cycle [us]
 
+    //Aerodynamic states, from the body velocities without wind
     arma::rowvec alpha; //Angle of attack [rad]
     arma::rowvec beta; //Sideslip angle [rad]
+    arma::rowvec airspeed; //Airspeed [m/s]
 };
 
-Vehicle_States linear_interpolate(Data_Buffer data, int sample_rate);
+Vehicle_States linear_interpolate(const Data_Buffer &data, int sample_rate);
+bool linear_interpolate(const Data_Buffer &data, int sample_rate, SID_Workspace &workspace);
+Vehicle_States resampled_states(SID_Workspace &workspace);
 
 #endif
\ No newline at end of file
@@ -8,6 +8,7 @@
  */
 
 #include "logging.h"
+#include <unistd.h>
 
 void log_buffer_to_csv(Data_Buffer telemetry, std::string filename){
 /*
@@ -74,15 +75,7 @@ void log_buffer_to_csv(Data_Buffer telemetry, std::string filename){
 */
 }
 
-void log_mavlink_info(mavsdk::log::Level level, const std::string& message, const std::string &filename){
-	using namespace std;
-	ofstream myfile;
-    myfile.open (filename, ios_base::app);
-	myfile << static_cast<int>(level) << ',' << message << '\n';
-	myfile.close();
-}
-
-void log_coeff(arma::mat matrix, std::string filename, std::chrono::microseconds sample_time)
+void log_coeff(arma::mat matrix, std::string filename, std::chrono::microseconds sample_time, std::vector<double> window_statistics)
 {
 	using namespace std;
 	ofstream myfile;
@@ -95,6 +88,35 @@ void log_coeff(arma::mat matrix, std::string filename, std::chrono::microseconds
 	{
 		myfile << (*coefficient_iterator) << ",";
 	}
+	//Per window statistics are appended after the coefficients
+	for(auto statistic_iterator = window_statistics.begin(); statistic_iterator != window_statistics.end(); ++statistic_iterator)
+	{
+		myfile << (*statistic_iterator) << ",";
+	}
 	myfile << "\n";
 	myfile.close();
-}
\ No newline at end of file
+}
+
+// Insert a suffix before the file extension, eg. coefficients.csv -> coefficients_1.csv
+std::string insert_path_suffix(const std::string &path, const std::string &suffix)
+{
+	size_t extension = path.find_last_of('.');
+	size_t directory = path.find_last_of('/');
+	if(extension == std::string::npos || (directory != std::string::npos && extension < directory))
+	{
+		return path + "_" + suffix;
+	}
+	return path.substr(0, extension) + "_" + suffix + path.substr(extension);
+}
+
+// True if path is a writable file or can be created in its directory, neither is touched
+bool writable_path(const std::string &path)
+{
+	if(access(path.c_str(), F_OK) == 0)
+	{
+		return access(path.c_str(), W_OK) == 0;
+	}
+	size_t directory = path.find_last_of('/');
+	std::string parent = directory == std::string::npos ? "." : path.substr(0, directory == 0 ? 1 : directory);
+	return access(parent.c_str(), W_OK | X_OK) == 0;
+}
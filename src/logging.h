@@ -18,10 +18,10 @@
 #include <string>
 #include <fstream>
 #include <iostream>
-#include <mavsdk/log_callback.h>
 #include <armadillo>
 
 void log_buffer_to_csv(Data_Buffer telemetry, std::string filename);
-void log_mavlink_info(mavsdk::log::Level level, const std::string& message, const std::string &filename);
-void log_coeff(arma::mat matrix, std::string filename, std::chrono::microseconds sample_time);
+std::string insert_path_suffix(const std::string &path, const std::string &suffix);
+bool writable_path(const std::string &path);
+void log_coeff(arma::mat matrix, std::string filename, std::chrono::microseconds sample_time, std::vector<double> window_statistics);
 #endif
\ No newline at end of file
@@ -0,0 +1,456 @@
+/**
+ * @file metrics.cpp
+ *
+ * @brief runtime metrics
+ *
+ * Latency histograms, counters and their Prometheus text endpoint
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "metrics.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+#include <utility>
+
+// ------------------------------------------------------------------------------
+//   Latency Histogram
+// ------------------------------------------------------------------------------
+Latency_Histogram::
+Latency_Histogram()
+{
+	for(auto &bucket : buckets)
+	{
+		bucket.store(0, std::memory_order_relaxed);
+	}
+}
+
+// Values below 16 get a bucket each, above that every power of two has 16 buckets
+int Latency_Histogram::
+bucket_index(uint64_t value)
+{
+	if(value < HISTOGRAM_SUB_BUCKETS)
+	{
+		return value;
+	}
+	int exponent = 63 - __builtin_clzll(value);
+	if(exponent >= HISTOGRAM_MAGNITUDES + 3)
+	{
+		return HISTOGRAM_MAGNITUDES*HISTOGRAM_SUB_BUCKETS - 1;
+	}
+	int shift = exponent - 4;
+	return (exponent - 3)*HISTOGRAM_SUB_BUCKETS + (value >> shift) - HISTOGRAM_SUB_BUCKETS;
+}
+
+uint64_t Latency_Histogram::
+bucket_upper_bound(int index)
+{
+	if(index < HISTOGRAM_SUB_BUCKETS)
+	{
+		return index;
+	}
+	int shift = index/HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t lower = (uint64_t)(HISTOGRAM_SUB_BUCKETS + index%HISTOGRAM_SUB_BUCKETS) << shift;
+	return lower + ((uint64_t)1 << shift) - 1;
+}
+
+void Latency_Histogram::
+record(uint64_t value)
+{
+	buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(value, std::memory_order_relaxed);
+	uint64_t current = max.load(std::memory_order_relaxed);
+	while(value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+void Latency_Histogram::
+record(std::chrono::microseconds duration)
+{
+	record(duration.count() > 0 ? (uint64_t)duration.count() : 0);
+}
+
+uint64_t Latency_Histogram::
+get_count() const
+{
+	return count.load(std::memory_order_relaxed);
+}
+
+uint64_t Latency_Histogram::
+get_sum() const
+{
+	return sum.load(std::memory_order_relaxed);
+}
+
+uint64_t Latency_Histogram::
+get_max() const
+{
+	return max.load(std::memory_order_relaxed);
+}
+
+// Upper bound of the bucket holding the q-th quantile, 0 if nothing was recorded
+uint64_t Latency_Histogram::
+quantile(double q) const
+{
+	uint64_t total = 0;
+	for(const auto &bucket : buckets)
+	{
+		total += bucket.load(std::memory_order_relaxed);
+	}
+	if(total == 0)
+	{
+		return 0;
+	}
+	uint64_t rank = q*total;
+	if(rank >= total)
+	{
+		rank = total - 1;
+	}
+	uint64_t seen = 0;
+	for(int i = 0; i < HISTOGRAM_MAGNITUDES*HISTOGRAM_SUB_BUCKETS; i++)
+	{
+		seen += buckets[i].load(std::memory_order_relaxed);
+		if(seen > rank)
+		{
+			uint64_t bound = bucket_upper_bound(i);
+			uint64_t maximum = get_max();
+			return bound < maximum ? bound : maximum;
+		}
+	}
+	return get_max();
+}
+
+// ------------------------------------------------------------------------------
+//   Allocation Metrics
+// ------------------------------------------------------------------------------
+void Allocation_Metrics::
+record(uint64_t window_allocations, uint64_t window_bytes)
+{
+	allocations.fetch_add(window_allocations, std::memory_order_relaxed);
+	bytes.fetch_add(window_bytes, std::memory_order_relaxed);
+	if(window_allocations > 0)
+	{
+		windows.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Ingestion Metrics
+// ------------------------------------------------------------------------------
+// Called on arrival, before the insert takes the buffer lock
+void Stream_Health::
+arrived(uint64_t now_ns, uint64_t gap_threshold_ns)
+{
+	messages.fetch_add(1, std::memory_order_relaxed);
+	uint64_t previous_ns = last_arrival_ns.exchange(now_ns, std::memory_order_relaxed);
+	if(previous_ns == 0 || now_ns < previous_ns)
+	{
+		return;
+	}
+	uint64_t interval_ns = now_ns - previous_ns;
+	inter_arrival.record(interval_ns/1000);
+	if(interval_ns > gap_threshold_ns)
+	{
+		gaps.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	uint64_t previous_interval_ns = last_interval_ns.exchange(interval_ns, std::memory_order_relaxed);
+	if(previous_interval_ns == 0)
+	{
+		return;
+	}
+	uint64_t jitter_sample_ns = interval_ns > previous_interval_ns ? interval_ns - previous_interval_ns : previous_interval_ns - interval_ns;
+	jitter.record(jitter_sample_ns/1000);
+	jitter_ns.fetch_add(jitter_sample_ns, std::memory_order_relaxed);
+	jitter_samples.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Time an insert waited for the consumer to empty the buffer
+void Stream_Health::
+waited(uint64_t wait_ns)
+{
+	blocked.record(wait_ns/1000);
+	blocked_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+}
+
+// Time an insert held the buffer lock after it had room
+void Stream_Health::
+held(uint64_t hold_ns)
+{
+	lock_hold.record(hold_ns);
+	lock_held_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+	locks.fetch_add(1, std::memory_order_relaxed);
+}
+
+Stream_Snapshot Stream_Health::
+snapshot() const
+{
+	Stream_Snapshot snapshot;
+	snapshot.messages = messages.load(std::memory_order_relaxed);
+	snapshot.gaps = gaps.load(std::memory_order_relaxed);
+	snapshot.jitter_ns = jitter_ns.load(std::memory_order_relaxed);
+	snapshot.jitter_samples = jitter_samples.load(std::memory_order_relaxed);
+	snapshot.blocked_ns = blocked_ns.load(std::memory_order_relaxed);
+	snapshot.lock_held_ns = lock_held_ns.load(std::memory_order_relaxed);
+	snapshot.locks = locks.load(std::memory_order_relaxed);
+	return snapshot;
+}
+
+Ingestion_Snapshot Ingestion_Metrics::
+snapshot() const
+{
+	Ingestion_Snapshot snapshot;
+	snapshot.time_ns = steady_clock_ns();
+	for(int s = 0; s < NUM_TELEMETRY_STREAMS; s++)
+	{
+		snapshot.streams[s] = streams[s].snapshot();
+	}
+	return snapshot;
+}
+
+// Prometheus label value of a stream
+const char *telemetry_stream_name(int stream)
+{
+	static const char *names[NUM_TELEMETRY_STREAMS] = {"attitude", "angular_velocity", "odometry", "actuator"};
+	return stream >= 0 && stream < NUM_TELEMETRY_STREAMS ? names[stream] : "unknown";
+}
+
+// Names of the per window stream statistics, in the order ingestion_statistics writes them
+std::vector<std::string> ingestion_statistic_names()
+{
+	std::vector<std::string> names;
+	for(std::string stream : {"Attitude", "Angular Velocity", "Odometry", "Actuator"})
+	{
+		names.push_back(stream + " Rate (Hz)");
+		names.push_back(stream + " Jitter (us)");
+		names.push_back(stream + " Gaps");
+		names.push_back(stream + " Blocked (ms)");
+		names.push_back(stream + " Lock Hold (us)");
+	}
+	return names;
+}
+
+// Stream statistics of the time between two snapshots, NUM_INGESTION_STATISTICS values
+// Jitter and lock hold time are means over the interval, gaps and blocked time are totals
+void ingestion_statistics(const Ingestion_Snapshot &previous, const Ingestion_Snapshot &current, double *statistics)
+{
+	double seconds = (current.time_ns - previous.time_ns)*1e-9;
+	for(int s = 0; s < NUM_TELEMETRY_STREAMS; s++)
+	{
+		const Stream_Snapshot &before = previous.streams[s];
+		const Stream_Snapshot &after = current.streams[s];
+		uint64_t jitter_samples = after.jitter_samples - before.jitter_samples;
+		uint64_t locks = after.locks - before.locks;
+		double *stream = statistics + s*NUM_STREAM_STATISTICS;
+		stream[0] = seconds > 0 ? (after.messages - before.messages)/seconds : 0;
+		stream[1] = jitter_samples > 0 ? (after.jitter_ns - before.jitter_ns)*1e-3/jitter_samples : 0;
+		stream[2] = after.gaps - before.gaps;
+		stream[3] = (after.blocked_ns - before.blocked_ns)*1e-6;
+		stream[4] = locks > 0 ? (after.lock_held_ns - before.lock_held_ns)*1e-3/locks : 0;
+	}
+}
+
+// One series per stream
+void Ingestion_Metrics::
+write(std::string &out, const std::string &labels) const
+{
+	std::string separator = labels.empty() ? "" : ",";
+	for(int s = 0; s < NUM_TELEMETRY_STREAMS; s++)
+	{
+		const Stream_Health &stream = streams[s];
+		std::string stream_labels = labels + separator + "stream=\"" + telemetry_stream_name(s) + "\"";
+		write_counter(out, "sindy_ingest_messages_total", stream_labels, stream.messages);
+		write_counter(out, "sindy_ingest_gaps_total", stream_labels, stream.gaps);
+		write_counter(out, "sindy_ingest_blocked_ns_total", stream_labels, stream.blocked_ns);
+		write_histogram(out, "sindy_ingest_interarrival_us", stream_labels, stream.inter_arrival);
+		write_histogram(out, "sindy_ingest_jitter_us", stream_labels, stream.jitter);
+		write_histogram(out, "sindy_ingest_blocked_us", stream_labels, stream.blocked);
+		write_histogram(out, "sindy_ingest_lock_hold_ns", stream_labels, stream.lock_hold);
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Prometheus text format
+// ------------------------------------------------------------------------------
+// Histograms are exported as summaries, the quantiles show the tail directly
+void write_histogram(std::string &out, const std::string &name, const std::string &labels, const Latency_Histogram &histogram)
+{
+	std::string separator = labels.empty() ? "" : ",";
+	for(double q : {0.5, 0.9, 0.99, 0.999})
+	{
+		char quantile[16];
+		snprintf(quantile, sizeof(quantile), "%g", q);
+		out += name + "{" + labels + separator + "quantile=\"" + quantile + "\"} " + std::to_string(histogram.quantile(q)) + "\n";
+	}
+	std::string label_set = labels.empty() ? "" : "{" + labels + "}";
+	out += name + "_sum" + label_set + " " + std::to_string(histogram.get_sum()) + "\n";
+	out += name + "_count" + label_set + " " + std::to_string(histogram.get_count()) + "\n";
+	out += name + "_max" + label_set + " " + std::to_string(histogram.get_max()) + "\n";
+}
+
+void write_counter(std::string &out, const std::string &name, const std::string &labels, uint64_t value)
+{
+	out += name + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(value) + "\n";
+}
+
+void write_gauge(std::string &out, const std::string &name, const std::string &labels, double value)
+{
+	out += name + (labels.empty() ? "" : "{" + labels + "}") + " " + std::to_string(value) + "\n";
+}
+
+void Pipeline_Metrics::
+write(std::string &out, const std::string &labels) const
+{
+	write_histogram(out, "sindy_buffer_wait_us", labels, buffer_wait);
+	write_histogram(out, "sindy_interpolation_us", labels, interpolation);
+	write_histogram(out, "sindy_transform_us", labels, transform);
+	write_histogram(out, "sindy_candidate_functions_us", labels, candidate_functions);
+	write_histogram(out, "sindy_gram_us", labels, gram);
+	write_histogram(out, "sindy_stlsq_us", labels, stlsq);
+	write_histogram(out, "sindy_validation_us", labels, validation);
+	write_histogram(out, "sindy_logging_us", labels, logging);
+	write_histogram(out, "sindy_window_latency_us", labels, end_to_end);
+	write_counter(out, "sindy_windows_total", labels, windows);
+	write_counter(out, "sindy_samples_total", labels, samples);
+	write_counter(out, "sindy_skipped_windows_total", labels, skipped_windows);
+	write_counter(out, "sindy_uninformative_windows_total", labels, uninformative_windows);
+	write_gauge(out, "sindy_excitation", labels, excitation.load(std::memory_order_relaxed));
+	write_counter(out, "sindy_incomplete_windows_total", labels, incomplete_windows);
+	write_counter(out, "sindy_dropped_records_total", labels, dropped_records);
+	write_counter(out, "sindy_stlsq_iterations_total", labels, stlsq_iterations);
+	write_counter(out, "sindy_deadline_misses_total", labels, deadline_misses);
+
+	// One series per stage, the steady state compute stages should stay at zero allocating windows
+	std::string separator = labels.empty() ? "" : ",";
+	for(auto stage : {std::make_pair("preprocess", &preprocess_allocations), std::make_pair("regression", &regression_allocations),
+					  std::make_pair("logging", &logging_allocations)})
+	{
+		std::string stage_labels = labels + separator + "stage=\"" + stage.first + "\"";
+		write_counter(out, "sindy_allocations_total", stage_labels, stage.second->allocations);
+		write_counter(out, "sindy_allocated_bytes_total", stage_labels, stage.second->bytes);
+		write_counter(out, "sindy_allocating_windows_total", stage_labels, stage.second->windows);
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Metrics Server
+// ------------------------------------------------------------------------------
+Metrics_Server::
+Metrics_Server(int port_)
+{
+	port = port_;
+	listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+	int reuse = 1;
+	setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	// Localhost only, the endpoint is meant for a scraper on the companion computer
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(listen_socket < 0 || bind(listen_socket, (sockaddr *)&address, sizeof(address)) != 0 || listen(listen_socket, 4) != 0)
+	{
+		std::cerr << "Could not serve metrics on 127.0.0.1:" << port << ": " << strerror(errno) << "\n";
+		if(listen_socket >= 0)
+		{
+			close(listen_socket);
+		}
+		throw EXIT_FAILURE;
+	}
+	server_thread = std::thread(&Metrics_Server::serve, this);
+}
+
+Metrics_Server::
+~Metrics_Server()
+{
+	stop();
+}
+
+void Metrics_Server::
+add_source(std::function<void(std::string &)> source)
+{
+	std::lock_guard<std::mutex> lock(sources_mutex);
+	sources.push_back(source);
+}
+
+std::string Metrics_Server::
+render()
+{
+	std::string out;
+	std::lock_guard<std::mutex> lock(sources_mutex);
+	for(auto &source : sources)
+	{
+		source(out);
+	}
+	return out;
+}
+
+void Metrics_Server::
+serve()
+{
+	while(!time_to_exit)
+	{
+		// Wake up regularly to notice stop()
+		pollfd listener = {listen_socket, POLLIN, 0};
+		if(poll(&listener, 1, 200) <= 0)
+		{
+			continue;
+		}
+		int connection = accept(listen_socket, nullptr, nullptr);
+		if(connection < 0)
+		{
+			continue;
+		}
+
+		// Any request gets the metrics, the request itself is read and ignored
+		timeval timeout = {1, 0};
+		setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		char request[1024];
+		ssize_t received = recv(connection, request, sizeof(request), 0);
+		(void)received;
+
+		std::string body = render();
+		std::string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size())
+							 + "\r\nConnection: close\r\n\r\n" + body;
+		size_t sent = 0;
+		while(sent < response.size())
+		{
+			ssize_t result = send(connection, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if(result <= 0)
+			{
+				break;
+			}
+			sent += result;
+		}
+		close(connection);
+	}
+}
+
+void Metrics_Server::
+stop()
+{
+	time_to_exit = true;
+	if(server_thread.joinable())
+	{
+		server_thread.join();
+	}
+	if(listen_socket >= 0)
+	{
+		close(listen_socket);
+		listen_socket = -1;
+	}
+}
@@ -0,0 +1,213 @@
+/**
+ * @file metrics.h
+ *
+ * @brief runtime metrics definition
+ *
+ * Latency histograms and counters updated by the pipeline threads, and a localhost
+ * HTTP endpoint serving them in the Prometheus text format
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <atomic>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <cstdint>
+#include <chrono>
+#include <array>
+
+#define HISTOGRAM_SUB_BUCKETS 16 // Per power of two, about 6% resolution
+#define HISTOGRAM_MAGNITUDES 40 // Values up to 2^40
+
+// ----------------------------------------------------------------------------------
+//   Latency Histogram Class
+// ----------------------------------------------------------------------------------
+/*
+ * Log-linear (HDR style) histogram: every power of two is split into 16 linear buckets,
+ * so the relative error of a quantile is bounded over the whole range. Recording is a
+ * few relaxed atomic increments and never blocks, reading takes a snapshot of the
+ * buckets which may be off by the values recorded concurrently.
+ */
+class Latency_Histogram
+{
+    std::atomic<uint64_t> buckets[HISTOGRAM_MAGNITUDES*HISTOGRAM_SUB_BUCKETS];
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+
+    static int bucket_index(uint64_t value);
+    static uint64_t bucket_upper_bound(int index);
+
+public:
+    Latency_Histogram();
+
+    void record(uint64_t value);
+    void record(std::chrono::microseconds duration);
+
+    uint64_t get_count() const;
+    uint64_t get_sum() const;
+    uint64_t get_max() const;
+    uint64_t quantile(double q) const;
+};
+
+// Heap allocations of one pipeline stage, from the per thread allocation counters
+struct Allocation_Metrics {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> windows{0}; // Windows during which the stage allocated at all
+
+    void record(uint64_t window_allocations, uint64_t window_bytes);
+};
+
+// ----------------------------------------------------------------------------------
+//   Pipeline Metrics
+// ----------------------------------------------------------------------------------
+// Durations in microseconds, updated by the SID stages of one vehicle
+struct Pipeline_Metrics {
+    Latency_Histogram buffer_wait;
+    Latency_Histogram interpolation;
+    Latency_Histogram transform; // Frame transformation and aerodynamic states
+    Latency_Histogram candidate_functions;
+    Latency_Histogram gram;
+    Latency_Histogram stlsq;
+    Latency_Histogram validation; // Forward simulation of one model
+    Latency_Histogram logging;
+    Latency_Histogram end_to_end; // Buffer clear to logged
+
+    std::atomic<uint64_t> windows{0};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> skipped_windows{0};
+    std::atomic<uint64_t> incomplete_windows{0};
+    std::atomic<uint64_t> dropped_records{0};
+    std::atomic<uint64_t> stlsq_iterations{0};
+    std::atomic<uint64_t> deadline_misses{0};
+    std::atomic<uint64_t> uninformative_windows{0}; // Skipped below the excitation threshold
+    std::atomic<double> excitation{0}; // Of the last preprocessed window
+
+    Allocation_Metrics preprocess_allocations;
+    Allocation_Metrics regression_allocations;
+    Allocation_Metrics logging_allocations;
+
+    void write(std::string &out, const std::string &labels) const;
+};
+
+// ----------------------------------------------------------------------------------
+//   Ingestion Metrics
+// ----------------------------------------------------------------------------------
+// Telemetry streams of the input buffer
+enum telemetry_stream {
+    attitude_stream,
+    angular_velocity_stream,
+    odometry_stream,
+    actuator_stream,
+    NUM_TELEMETRY_STREAMS
+};
+
+#define NUM_STREAM_STATISTICS 5 // Rate, jitter, gaps, blocked time and lock hold time
+#define NUM_INGESTION_STATISTICS (NUM_TELEMETRY_STREAMS*NUM_STREAM_STATISTICS)
+
+// Running totals of one stream, the difference of two snapshots covers the time between them
+struct Stream_Snapshot {
+    uint64_t messages = 0;
+    uint64_t gaps = 0;
+    uint64_t jitter_ns = 0; // Sum over the jitter samples
+    uint64_t jitter_samples = 0;
+    uint64_t blocked_ns = 0;
+    uint64_t lock_held_ns = 0; // Sum over the inserts which reached the buffer
+    uint64_t locks = 0;
+};
+
+struct Ingestion_Snapshot {
+    uint64_t time_ns = 0; // Steady clock
+    std::array<Stream_Snapshot, NUM_TELEMETRY_STREAMS> streams;
+};
+
+/*
+ * Ingestion health of one telemetry stream. Only the stream's own insert writes it, so
+ * every update is a relaxed atomic operation and a reader never blocks the producer.
+ * Jitter is the change of the inter-arrival time from one message to the next, a gap
+ * is an inter-arrival time above the threshold of the buffer.
+ */
+struct Stream_Health {
+    std::atomic<uint64_t> messages{0};
+    std::atomic<uint64_t> gaps{0};
+    std::atomic<uint64_t> jitter_ns{0};
+    std::atomic<uint64_t> jitter_samples{0};
+    std::atomic<uint64_t> blocked_ns{0}; // Time spent waiting on not_full
+    std::atomic<uint64_t> lock_held_ns{0};
+    std::atomic<uint64_t> locks{0};
+    std::atomic<uint64_t> last_arrival_ns{0}; // 0 before the first message
+    std::atomic<uint64_t> last_interval_ns{0}; // 0 before the second message
+
+    Latency_Histogram inter_arrival; // us
+    Latency_Histogram jitter; // us
+    Latency_Histogram blocked; // us, only the inserts which had to wait
+    Latency_Histogram lock_hold; // ns
+
+    void arrived(uint64_t now_ns, uint64_t gap_threshold_ns);
+    void waited(uint64_t wait_ns);
+    void held(uint64_t hold_ns);
+    Stream_Snapshot snapshot() const;
+};
+
+// Ingestion health of every stream of one input buffer
+struct Ingestion_Metrics {
+    std::array<Stream_Health, NUM_TELEMETRY_STREAMS> streams;
+    std::atomic<uint64_t> gap_threshold_ns{100000000};
+
+    Ingestion_Snapshot snapshot() const;
+    void write(std::string &out, const std::string &labels) const;
+};
+
+// Monotonic time stamp of the ingestion metrics
+inline uint64_t steady_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char *telemetry_stream_name(int stream);
+std::vector<std::string> ingestion_statistic_names();
+void ingestion_statistics(const Ingestion_Snapshot &previous, const Ingestion_Snapshot &current, double *statistics);
+
+void write_histogram(std::string &out, const std::string &name, const std::string &labels, const Latency_Histogram &histogram);
+void write_counter(std::string &out, const std::string &name, const std::string &labels, uint64_t value);
+void write_gauge(std::string &out, const std::string &name, const std::string &labels, double value);
+
+// ----------------------------------------------------------------------------------
+//   Metrics Server Class
+// ----------------------------------------------------------------------------------
+/*
+ * Serves GET requests on 127.0.0.1:<port> with the output of every registered source.
+ * Sources only read atomics, so a scrape never takes a lock the pipeline holds.
+ */
+class Metrics_Server
+{
+    int port;
+    int listen_socket = -1;
+    std::vector<std::function<void(std::string &)>> sources;
+    std::mutex sources_mutex;
+    std::thread server_thread;
+    std::atomic<bool> time_to_exit{false};
+
+    void serve();
+
+public:
+    Metrics_Server(int port_);
+    ~Metrics_Server();
+
+    void add_source(std::function<void(std::string &)> source);
+    std::string render();
+    void stop();
+};
+
+#endif
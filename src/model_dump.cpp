@@ -0,0 +1,83 @@
+/**
+ * @file model_dump.cpp
+ *
+ * @brief shared memory model reader
+ *
+ * Prints the newest models of a shared memory segment, a minimal consumer of shared_model.h
+ *
+ * usage: SINDy_model_dump <shared memory name> [model name]
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "shared_model.h"
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <time.h>
+
+int main(int argc, char **argv)
+{
+	if(argc != 2 && argc != 3)
+	{
+		std::cout << "usage: SINDy_model_dump <shared memory name> [model name]\n";
+		return EXIT_FAILURE;
+	}
+
+	Shared_Model_Reader reader;
+	if(!reader.open(argv[1]))
+	{
+		std::cerr << "No shared memory model " << argv[1] << "\n";
+		return EXIT_FAILURE;
+	}
+
+	for(int m = 0; m < reader.num_models(); m++)
+	{
+		if(argc == 3 && reader.find_model(argv[2]) != m)
+		{
+			continue;
+		}
+		auto start = std::chrono::steady_clock::now();
+		Shared_Model model;
+		bool published = reader.read(m, model);
+		auto read_time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+		if(!published)
+		{
+			std::cout << "Model " << m << ": nothing published yet\n";
+			continue;
+		}
+
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		int64_t age_ns = (int64_t)now.tv_sec*1000000000 + now.tv_nsec - model.publish_time_ns;
+		std::cout << "Model " << m << ", window " << model.window_index << ", published " << age_ns/1000 << "us ago, read in "
+				  << read_time.count() << "ns, names hash " << std::hex << reader.names_hash() << std::dec << "\n";
+		for(int feature = 0; feature < SHARED_MODEL_FEATURES; feature++)
+		{
+			for(int state = 0; state < SHARED_MODEL_STATES; state++)
+			{
+				if(shared_model_supported(model, feature, state))
+				{
+					std::cout << "  feature " << feature << ", state " << state << ": " << model.coefficients[feature][state];
+					if(!std::isnan(model.standard_errors[feature][state]))
+					{
+						std::cout << " +/- " << model.standard_errors[feature][state];
+					}
+					std::cout << "\n";
+				}
+			}
+		}
+		std::cout << "  validation:";
+		for(double error : model.validation)
+		{
+			std::cout << " " << error;
+		}
+		std::cout << "\n";
+	}
+	return 0;
+}
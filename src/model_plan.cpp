@@ -0,0 +1,127 @@
+/**
+ * @file model_plan.cpp
+ *
+ * @brief compiled sparse model
+ *
+ * Compilation of identified models into support-only evaluation plans
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "model_plan.h"
+#include <string.h>
+
+// ------------------------------------------------------------------------------
+//   Model Plan
+// ------------------------------------------------------------------------------
+Model_Plan::
+Model_Plan()
+{
+	memset(coefficients, 0, sizeof(coefficients));
+}
+
+// Keep the candidates with a nonzero coefficient in any derivative, candidates are in compute_candidate_functions order
+void Model_Plan::
+compile(const arma::mat &coefficients_)
+{
+	num_monomials = 0;
+	num_terms = 0;
+	int num_factors = NUM_BASIS_STATES + 1; // Including the bias
+	int num_derivatives = coefficients_.n_cols < NUM_DERIVATIVES ? coefficients_.n_cols : NUM_DERIVATIVES;
+	int row = 0;
+	for(int j = 0; j < num_factors; j++)
+	{
+		for(int k = j; k < num_factors && row < (int)coefficients_.n_rows; k++, row++)
+		{
+			double *lanes = coefficients[num_monomials];
+			int terms = 0;
+			for(int lane = 0; lane < PLAN_LANES; lane++)
+			{
+				lanes[lane] = lane < num_derivatives ? coefficients_(row, lane) : 0;
+				terms += lanes[lane] != 0;
+			}
+			if(terms == 0)
+			{
+				continue;
+			}
+			first[num_monomials] = j;
+			second[num_monomials] = k;
+			candidate[num_monomials] = row;
+			num_monomials++;
+			num_terms += terms;
+		}
+	}
+}
+
+// The lane loop has a fixed trip count, the compiler turns it into vector multiply-adds
+static inline void evaluate_plan(int num_monomials, const uint8_t *first, const uint8_t *second, const double (*coefficients)[PLAN_LANES],
+								 const double *basis, double *derivatives)
+{
+	double factors[NUM_BASIS_STATES + 1];
+	factors[0] = 1;
+	for(int i = 0; i < NUM_BASIS_STATES; i++)
+	{
+		factors[i + 1] = basis[i];
+	}
+
+	double sums[PLAN_LANES] = {0};
+	for(int m = 0; m < num_monomials; m++)
+	{
+		double monomial = factors[first[m]]*factors[second[m]];
+		for(int lane = 0; lane < PLAN_LANES; lane++)
+		{
+			sums[lane] += monomial*coefficients[m][lane];
+		}
+	}
+	for(int d = 0; d < NUM_DERIVATIVES; d++)
+	{
+		derivatives[d] = sums[d];
+	}
+}
+
+// Derivatives of one sample, basis holds NUM_BASIS_STATES values and derivatives NUM_DERIVATIVES
+void Model_Plan::
+evaluate(const double *basis, double *derivatives) const
+{
+	evaluate_plan(num_monomials, first, second, coefficients, basis, derivatives);
+}
+
+// Derivatives of count samples, laid out like the workspace, basis [sample][basis state] and derivatives [sample][derivative]
+void Model_Plan::
+evaluate(const double *basis, int count, double *derivatives) const
+{
+	for(int sample = 0; sample < count; sample++)
+	{
+		evaluate_plan(num_monomials, first, second, coefficients, basis + sample*NUM_BASIS_STATES, derivatives + sample*NUM_DERIVATIVES);
+	}
+}
+
+int Model_Plan::
+get_monomials() const
+{
+	return num_monomials;
+}
+
+int Model_Plan::
+get_terms() const
+{
+	return num_terms;
+}
+
+int Model_Plan::
+get_candidate(int monomial) const
+{
+	return candidate[monomial];
+}
+
+// Floating point operations of one evaluation, a product per monomial and a multiply-add per lane
+double Model_Plan::
+flops() const
+{
+	return num_monomials*(1 + 2*PLAN_LANES);
+}
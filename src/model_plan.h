@@ -0,0 +1,63 @@
+/**
+ * @file model_plan.h
+ *
+ * @brief compiled sparse model definition
+ *
+ * An identified model compiled for fast evaluation. The coefficient matrix is dense,
+ * evaluating it directly costs every candidate product for every derivative. A plan
+ * keeps only the monomials in the support of the model, each computed once and shared
+ * by all derivatives that use it, and stores their coefficients as fixed width rows so
+ * the evaluation is one multiply and a vector of fused multiply-adds per monomial,
+ * without branches on the model structure.
+ *
+ * A plan has a fixed size and never allocates, it can be copied to another thread or
+ * compiled again for every window.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef MODEL_PLAN_H_
+#define MODEL_PLAN_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "workspace.h"
+#include <armadillo>
+#include <cstdint>
+
+#define PLAN_LANES 8 // Derivatives padded to a multiple of the SIMD width
+
+// ----------------------------------------------------------------------------------
+//   Model Plan Class
+// ----------------------------------------------------------------------------------
+/*
+ * Monomials are the products factors[first]*factors[second] with factors = {1, basis
+ * states}, so constant and linear candidates take the same path as the quadratic ones.
+ * Basis states are in candidate function order, x, y, z, psi, theta, phi, u0..u3, and
+ * derivatives in derivative_names order, p, q, r, u, v, w.
+ */
+class Model_Plan
+{
+    int num_monomials = 0;
+    int num_terms = 0; // Nonzero coefficients
+    uint8_t first[MAX_CANDIDATES];
+    uint8_t second[MAX_CANDIDATES];
+    uint8_t candidate[MAX_CANDIDATES]; // Row of the coefficient matrix each monomial came from
+    alignas(64) double coefficients[MAX_CANDIDATES][PLAN_LANES]; // [monomial][derivative], zero padded
+
+public:
+    Model_Plan();
+
+    void compile(const arma::mat &coefficients_);
+    void evaluate(const double *basis, double *derivatives) const;
+    void evaluate(const double *basis, int count, double *derivatives) const;
+
+    int get_monomials() const;
+    int get_terms() const;
+    int get_candidate(int monomial) const;
+    double flops() const;
+};
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * @file model_publisher.cpp
+ *
+ * @brief shared memory model publisher
+ *
+ * Sequence locked publication of the latest models in POSIX shared memory
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "model_publisher.h"
+#include <errno.h>
+#include <iostream>
+#include <cmath>
+
+static_assert(SHARED_MODEL_FEATURES == MAX_CANDIDATES && SHARED_MODEL_STATES == NUM_DERIVATIVES, "shared model layout out of date");
+static_assert(SHARED_MODEL_VALIDATION == NUM_VALIDATION_STATISTICS, "shared model layout out of date");
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Model_Publisher::
+Model_Publisher(std::string name_, const std::vector<std::string> &model_names, const std::vector<std::string> &feature_names,
+				const std::vector<std::string> &state_names)
+{
+	name = name_;
+	if(model_names.size() > SHARED_MODEL_MAX_MODELS || feature_names.size() != SHARED_MODEL_FEATURES || state_names.size() != SHARED_MODEL_STATES)
+	{
+		std::cerr << "Shared memory model " << name << " holds up to " << SHARED_MODEL_MAX_MODELS << " models of " << SHARED_MODEL_FEATURES
+				  << " features and " << SHARED_MODEL_STATES << " states\n";
+		throw EXIT_FAILURE;
+	}
+
+	// A segment left behind by a previous run is replaced, readers holding it keep the old mapping
+	shm_unlink(name.c_str());
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+	if(fd < 0 || ftruncate(fd, sizeof(Shared_Model_Segment)) != 0)
+	{
+		std::cerr << "Could not create shared memory model " << name << ": " << strerror(errno) << "\n";
+		if(fd >= 0)
+		{
+			close(fd);
+			shm_unlink(name.c_str());
+		}
+		throw EXIT_FAILURE;
+	}
+	void *mapping = mmap(nullptr, sizeof(Shared_Model_Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		std::cerr << "Could not map shared memory model " << name << ": " << strerror(errno) << "\n";
+		shm_unlink(name.c_str());
+		throw EXIT_FAILURE;
+	}
+
+	// The segment starts zeroed, the header is complete before a reader can see a nonzero sequence
+	segment = static_cast<Shared_Model_Segment *>(mapping);
+	segment->version = SHARED_MODEL_VERSION;
+	segment->num_models = model_names.size();
+	segment->num_features = SHARED_MODEL_FEATURES;
+	segment->num_states = SHARED_MODEL_STATES;
+	std::vector<const char *> names;
+	for(const std::string &feature : feature_names)
+	{
+		names.push_back(feature.c_str());
+	}
+	for(const std::string &state : state_names)
+	{
+		names.push_back(state.c_str());
+	}
+	segment->names_hash = shared_model_names_hash(names.data(), names.size());
+	for(size_t m = 0; m < model_names.size(); m++)
+	{
+		strncpy(segment->model_names[m], model_names[m].c_str(), SHARED_MODEL_NAME_LENGTH - 1);
+	}
+	segment->sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	segment->magic = SHARED_MODEL_MAGIC;
+}
+
+Model_Publisher::
+~Model_Publisher()
+{
+	if(segment != nullptr)
+	{
+		munmap(segment, sizeof(Shared_Model_Segment));
+		shm_unlink(name.c_str());
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Publication
+// ------------------------------------------------------------------------------
+// Publish every model of a window, coefficients have features as rows and states as columns
+// standard_errors has the same layout, or is empty if they are not computed
+void Model_Publisher::
+publish(uint64_t index, std::chrono::microseconds sample_time, std::chrono::steady_clock::time_point clear_time,
+		const std::vector<arma::mat> &coefficients, const std::vector<arma::mat> &standard_errors, const std::vector<Validation_Result> &validation)
+{
+	int64_t clear_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clear_time.time_since_epoch()).count();
+	int64_t publish_time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+	// Odd sequence, readers retry until the write is complete
+	uint64_t sequence = segment->sequence.load(std::memory_order_relaxed);
+	segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	for(size_t m = 0; m < segment->num_models && m < coefficients.size(); m++)
+	{
+		Shared_Model &model = segment->models[m];
+		model.window_index = index;
+		model.sample_time_us = sample_time.count();
+		model.clear_time_ns = clear_time_ns;
+		model.publish_time_ns = publish_time_ns;
+		memset(model.support, 0, sizeof(model.support));
+		for(int feature = 0; feature < SHARED_MODEL_FEATURES; feature++)
+		{
+			for(int state = 0; state < SHARED_MODEL_STATES; state++)
+			{
+				double coefficient = coefficients[m](feature, state);
+				int bit = feature*SHARED_MODEL_STATES + state;
+				model.coefficients[feature][state] = coefficient;
+				model.standard_errors[feature][state] = m < standard_errors.size() ? standard_errors[m](feature, state) : std::nan("");
+				model.support[bit/64] |= (uint64_t)(coefficient != 0) << (bit%64);
+			}
+		}
+		for(int i = 0; i < NUM_DERIVATIVES && m < validation.size(); i++)
+		{
+			model.validation[i] = validation[m].one_step[i];
+			model.validation[NUM_DERIVATIVES + i] = validation[m].multi_step[i];
+		}
+	}
+
+	segment->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+const std::string &Model_Publisher::
+get_name() const
+{
+	return name;
+}
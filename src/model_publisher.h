@@ -0,0 +1,50 @@
+/**
+ * @file model_publisher.h
+ *
+ * @brief shared memory model publisher definition
+ *
+ * Publishes the latest identified models of a vehicle in a POSIX shared memory segment,
+ * see shared_model.h for the layout and the reader
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef MODEL_PUBLISHER_H_
+#define MODEL_PUBLISHER_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "shared_model.h"
+#include "validation.h"
+#include <armadillo>
+#include <string>
+#include <vector>
+#include <chrono>
+
+// ----------------------------------------------------------------------------------
+//   Model Publisher Class
+// ----------------------------------------------------------------------------------
+/*
+ * Creates the segment on construction and removes it on destruction. publish() is a
+ * copy into the mapped segment under the sequence lock, it makes no system calls and
+ * does not allocate, so it runs on the regression stage right after the solves.
+ */
+class Model_Publisher
+{
+    std::string name;
+    Shared_Model_Segment *segment = nullptr;
+
+public:
+    Model_Publisher(std::string name_, const std::vector<std::string> &model_names, const std::vector<std::string> &feature_names,
+                    const std::vector<std::string> &state_names);
+    ~Model_Publisher();
+
+    void publish(uint64_t index, std::chrono::microseconds sample_time, std::chrono::steady_clock::time_point clear_time,
+                 const std::vector<arma::mat> &coefficients, const std::vector<arma::mat> &standard_errors,
+                 const std::vector<Validation_Result> &validation);
+    const std::string &get_name() const;
+};
+
+#endif
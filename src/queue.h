@@ -0,0 +1,136 @@
+/**
+ * @file queue.h
+ *
+ * @brief bounded queue definition
+ *
+ * Thread safe fixed capacity queue used to hand work between the stages of the
+ * system identification pipeline
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <utility>
+
+// ----------------------------------------------------------------------------------
+//   Bounded Queue Class
+// ----------------------------------------------------------------------------------
+/*
+ * Producers block on not_full while the queue holds capacity items, consumers block
+ * on not_empty while it is empty. Closing the queue releases every blocked thread,
+ * after which push fails and pop drains the remaining items before failing.
+ *
+ * Items live in a ring of capacity slots allocated by set_capacity, so handing an item
+ * through the queue moves it without allocating.
+ */
+template <typename T>
+class Bounded_Queue
+{
+    int capacity;
+    int high_water_mark = 0;
+    bool closed = false;
+
+    std::vector<T> slots; // Ring of capacity items
+    int head = 0; // Slot of the oldest item
+    int count = 0;
+    mutable std::mutex mtx;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+
+public:
+    Bounded_Queue(int capacity_ = 2) : capacity(capacity_ > 0 ? capacity_ : 1), slots(capacity) {}
+
+    // Blocks while the queue is full, returns false if the queue was closed
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> unique_lock(mtx);
+        not_full.wait(unique_lock, [this]{ return closed || count < capacity; });
+        if(closed)
+        {
+            return false;
+        }
+        slots[(head + count) % slots.size()] = std::move(item);
+        count++;
+        if(count > high_water_mark)
+        {
+            high_water_mark = count;
+        }
+        unique_lock.unlock();
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Blocks while the queue is empty, returns false once closed and drained
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> unique_lock(mtx);
+        not_empty.wait(unique_lock, [this]{ return closed || count > 0; });
+        if(count == 0)
+        {
+            return false;
+        }
+        item = std::move(slots[head]);
+        head = (head + 1) % slots.size();
+        count--;
+        unique_lock.unlock();
+        not_full.notify_one();
+        return true;
+    }
+
+    // Release all waiting producers and consumers
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+    void set_capacity(int capacity_)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        capacity_ = capacity_ > 0 ? capacity_ : 1;
+
+        // Queued items move to the front of the new ring, items beyond its capacity stay until popped
+        std::vector<T> resized(capacity_ > count ? capacity_ : count);
+        for(int i = 0; i < count; i++)
+        {
+            resized[i] = std::move(slots[(head + i) % slots.size()]);
+        }
+        slots.swap(resized);
+        head = 0;
+        capacity = capacity_;
+        not_full.notify_all();
+    }
+
+    // Current number of queued items
+    int depth() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return count;
+    }
+
+    // Largest depth observed since construction
+    int max_depth() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return high_water_mark;
+    }
+
+    int get_capacity() const
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        return capacity;
+    }
+};
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * @file recorder_dump.cpp
+ *
+ * @brief flight recorder extraction
+ *
+ * Prints the events held by a flight recorder file as CSV, oldest first
+ *
+ * usage: SINDy_recorder_dump <flight_recorder.bin> [events.csv]
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "flight_recorder.h"
+#include <iostream>
+#include <fstream>
+
+int main(int argc, char **argv)
+{
+	if(argc != 2 && argc != 3)
+	{
+		std::cout << "usage: SINDy_recorder_dump <flight recorder file> [csv output]\n";
+		return EXIT_FAILURE;
+	}
+
+	try
+	{
+		uint64_t start_time_us, start_steady_us;
+		std::vector<Recorded_Event> events = read_flight_recorder(argv[1], start_time_us, start_steady_us);
+
+		std::ofstream file;
+		if(argc == 3)
+		{
+			file.open(argv[2], std::ios_base::trunc);
+		}
+		std::ostream &csv = argc == 3 ? file : std::cout;
+
+		// Wall clock times are derived from the steady clock offset at the start of the recording
+		csv << "Sequence,Wall Time (us),Run Time (us),Vehicle,Event,Argument";
+		for(int i = 0; i < FLIGHT_RECORDER_VALUES; i++)
+		{
+			csv << ",Value " << i;
+		}
+		csv << "\n";
+		for(const Recorded_Event &event : events)
+		{
+			uint64_t run_time_us = event.time_us - start_steady_us;
+			csv << event.sequence - 1 << "," << start_time_us + run_time_us << "," << run_time_us << "," << (int)event.source << ","
+				<< recorder_event_name(event.type) << "," << event.argument;
+			for(float value : event.values)
+			{
+				csv << "," << value;
+			}
+			csv << "\n";
+		}
+		std::cerr << "Extracted " << events.size() << " events\n";
+	}
+	catch(int error)
+	{
+		return error;
+	}
+	return 0;
+}
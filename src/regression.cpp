@@ -13,6 +13,8 @@
 //   Includes
 // ------------------------------------------------------------------------------
 #include "regression.h"
+#include <cmath>
+#include <algorithm>
 
 // Ridge regression. Least squares when lambda = 0
 arma::vec ridge_regression(arma::mat candidate_functions, arma::rowvec state, float lambda)
@@ -25,4 +27,217 @@ arma::vec ridge_regression(arma::mat candidate_functions, arma::rowvec state, fl
 	arma::mat A = candidate_functions * candidate_functions.t() + lambda * arma::eye<arma::mat>(candidate_functions.n_rows, candidate_functions.n_rows);
 	arma::vec coefficients = arma::solve(A, candidate_functions*state.t());
 	return coefficients;
-}
\ No newline at end of file
+}
+
+// Ridge regression from the Gram matrix X*X' and projection X*y' of the candidate functions
+// Identical to ridge_regression, but the products are computed once and shared between regressions
+arma::vec ridge_regression_gram(arma::mat gram, arma::vec projection, float lambda)
+{
+	arma::mat A = gram + lambda * arma::eye<arma::mat>(gram.n_rows, gram.n_rows);
+	arma::vec coefficients = arma::solve(A, projection);
+	return coefficients;
+}
+
+// Ridge regression on the candidates listed in indexes, from the Gram matrix and column state of the projections
+// The reduced system gram(indexes, indexes) + lambda*I is assembled in system (num_indexes^2 doubles) and Cholesky
+// factored in place, the coefficients are written to coefficients. Nothing is allocated, so this is the regression
+// of the steady state compute loop. Returns false if the system is not positive definite, ie. lambda = 0 with
+// collinear candidates, where arma::solve has to fall back to an approximate solution
+bool ridge_regression_indexed(const arma::mat &gram, const arma::mat &projections, int state, const arma::uword *indexes, int num_indexes,
+							  float lambda, double *system, double *coefficients)
+{
+	int n = num_indexes;
+
+	// Lower triangle of the reduced system, column major
+	for(int column = 0; column < n; column++)
+	{
+		for(int row = column; row < n; row++)
+		{
+			system[row + column*n] = gram(indexes[row], indexes[column]) + (row == column ? lambda : 0);
+		}
+	}
+
+	// A = LL', L overwrites the lower triangle
+	for(int j = 0; j < n; j++)
+	{
+		double diagonal = system[j + j*n];
+		for(int k = 0; k < j; k++)
+		{
+			diagonal -= system[j + k*n]*system[j + k*n];
+		}
+		if(!(diagonal > 0))
+		{
+			return false;
+		}
+		diagonal = std::sqrt(diagonal);
+		system[j + j*n] = diagonal;
+		for(int i = j + 1; i < n; i++)
+		{
+			double value = system[i + j*n];
+			for(int k = 0; k < j; k++)
+			{
+				value -= system[i + k*n]*system[j + k*n];
+			}
+			system[i + j*n] = value/diagonal;
+		}
+	}
+
+	// Ly = b, then L'x = y
+	for(int i = 0; i < n; i++)
+	{
+		double value = projections(indexes[i], state);
+		for(int k = 0; k < i; k++)
+		{
+			value -= system[i + k*n]*coefficients[k];
+		}
+		coefficients[i] = value/system[i + i*n];
+	}
+	for(int i = n - 1; i >= 0; i--)
+	{
+		double value = coefficients[i];
+		for(int k = i + 1; k < n; k++)
+		{
+			value -= system[k + i*n]*coefficients[k];
+		}
+		coefficients[i] = value/system[i + i*n];
+	}
+	return true;
+}
+
+// Standard errors of the coefficients of ridge_regression_indexed, from its Cholesky factor still in system
+// The residual variance is |y - X'b|^2/(num_samples - num_indexes), expanded as y*y' - 2b'X*y' + b'X*X'b so it only
+// needs the Gram blocks and energy = y*y'. With A = X*X' + lambda*I the covariance of b is variance*A^-1 X*X' A^-1,
+// whose diagonal is variance*(A^-1 - lambda*A^-2), one column of A^-1 is solved into inverse per coefficient.
+// Returns false and leaves NaN if there are no degrees of freedom left
+bool ridge_standard_errors(const arma::mat &gram, const arma::mat &projections, int state, const arma::uword *indexes, int num_indexes,
+						   float lambda, const double *system, const double *coefficients, double energy, int num_samples, double *inverse,
+						   double *standard_errors)
+{
+	int n = num_indexes;
+	if(num_samples <= n)
+	{
+		std::fill(standard_errors, standard_errors + n, std::nan(""));
+		return false;
+	}
+
+	double residual = energy;
+	for(int i = 0; i < n; i++)
+	{
+		double fitted = 0;
+		for(int k = 0; k < n; k++)
+		{
+			fitted += gram(indexes[i], indexes[k])*coefficients[k];
+		}
+		residual += coefficients[i]*(fitted - 2*projections(indexes[i], state));
+	}
+	double variance = std::max(residual, 0.0)/(num_samples - n);
+
+	for(int column = 0; column < n; column++)
+	{
+		// Ly = e_column, the leading entries of y are zero, then L'x = y
+		for(int i = 0; i < n; i++)
+		{
+			double value = i == column ? 1 : 0;
+			for(int k = column; k < i; k++)
+			{
+				value -= system[i + k*n]*inverse[k];
+			}
+			inverse[i] = i < column ? 0 : value/system[i + i*n];
+		}
+		for(int i = n - 1; i >= 0; i--)
+		{
+			double value = inverse[i];
+			for(int k = i + 1; k < n; k++)
+			{
+				value -= system[k + i*n]*inverse[k];
+			}
+			inverse[i] = value/system[i + i*n];
+		}
+		double squared_norm = 0;
+		for(int i = 0; i < n; i++)
+		{
+			squared_norm += inverse[i]*inverse[i];
+		}
+		standard_errors[column] = std::sqrt(variance*std::max(inverse[column] - lambda*squared_norm, 0.0));
+	}
+	return true;
+}
+
+// Excitation of a window, the standard deviation along the least varied direction of the attitude and actuator states
+// Their covariance is taken from the Gram matrix, whose bias row holds the sums of the states: C = G/n - m*m', m = G(0, :)/n
+// Its smallest eigenvalue is found with cyclic Jacobi rotations on the stack, so the check neither allocates nor
+// touches the samples again. A state that hardly moves or states that only move together, like the four actuators
+// of a hover, both leave a direction without variance, along which no coefficient can be told apart from noise
+double window_excitation(const arma::mat &gram, int num_samples)
+{
+	assert(gram.n_rows >= EXCITATION_FIRST_CANDIDATE + NUM_EXCITATION_STATES);
+	if(num_samples < 2)
+	{
+		return 0;
+	}
+	const int n = NUM_EXCITATION_STATES;
+	double covariance[NUM_EXCITATION_STATES][NUM_EXCITATION_STATES];
+	double mean[NUM_EXCITATION_STATES];
+	for(int j = 0; j < n; j++)
+	{
+		mean[j] = gram(0, EXCITATION_FIRST_CANDIDATE + j)/num_samples;
+	}
+	for(int j = 0; j < n; j++)
+	{
+		for(int k = 0; k < n; k++)
+		{
+			covariance[j][k] = gram(EXCITATION_FIRST_CANDIDATE + j, EXCITATION_FIRST_CANDIDATE + k)/num_samples - mean[j]*mean[k];
+		}
+	}
+
+	// Each rotation zeroes one off-diagonal element, a few sweeps leave the eigenvalues on the diagonal
+	for(int sweep = 0; sweep < 16; sweep++)
+	{
+		double off_diagonal = 0, diagonal = 0;
+		for(int j = 0; j < n; j++)
+		{
+			diagonal += covariance[j][j]*covariance[j][j];
+			for(int k = j + 1; k < n; k++)
+			{
+				off_diagonal += covariance[j][k]*covariance[j][k];
+			}
+		}
+		if(off_diagonal <= 1e-30*diagonal)
+		{
+			break;
+		}
+		for(int p = 0; p < n; p++)
+		{
+			for(int q = p + 1; q < n; q++)
+			{
+				if(covariance[p][q] == 0)
+				{
+					continue;
+				}
+				double theta = (covariance[q][q] - covariance[p][p])/(2*covariance[p][q]);
+				double t = (theta >= 0 ? 1 : -1)/(std::fabs(theta) + std::sqrt(theta*theta + 1));
+				double c = 1/std::sqrt(t*t + 1);
+				double s = t*c;
+				for(int k = 0; k < n; k++)
+				{
+					double kp = covariance[k][p], kq = covariance[k][q];
+					covariance[k][p] = c*kp - s*kq;
+					covariance[k][q] = s*kp + c*kq;
+				}
+				for(int k = 0; k < n; k++)
+				{
+					double pk = covariance[p][k], qk = covariance[q][k];
+					covariance[p][k] = c*pk - s*qk;
+					covariance[q][k] = s*pk + c*qk;
+				}
+			}
+		}
+	}
+
+	double smallest = covariance[0][0];
+	for(int j = 1; j < n; j++)
+	{
+		smallest = std::min(smallest, covariance[j][j]);
+	}
+	return smallest > 0 ? std::sqrt(smallest) : 0;
+}
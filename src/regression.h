@@ -19,6 +19,18 @@
 #include "assert.h"
 #include <armadillo>
 
+// Candidates whose variation makes a window informative, psi, theta, phi and u0..u3
+// They follow the bias and x, y, z in the libraries of either order, see SID::compute_candidate_functions
+#define EXCITATION_FIRST_CANDIDATE 4
+#define NUM_EXCITATION_STATES 7
+
 arma::vec ridge_regression(arma::mat candidate_functions, arma::rowvec state, float lambda);
+arma::vec ridge_regression_gram(arma::mat gram, arma::vec projection, float lambda);
+bool ridge_regression_indexed(const arma::mat &gram, const arma::mat &projections, int state, const arma::uword *indexes, int num_indexes,
+                              float lambda, double *system, double *coefficients);
+bool ridge_standard_errors(const arma::mat &gram, const arma::mat &projections, int state, const arma::uword *indexes, int num_indexes,
+                           float lambda, const double *system, const double *coefficients, double energy, int num_samples, double *inverse,
+                           double *standard_errors);
+double window_excitation(const arma::mat &gram, int num_samples);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+/**
+ * @file ring.h
+ *
+ * @brief lock-free ring definition
+ *
+ * Bounded multi-producer multi-consumer ring of preallocated slots, used to hand
+ * records to background writer threads without locks or allocation
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef RING_H_
+#define RING_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------------
+//   Lock-free Ring Class
+// ----------------------------------------------------------------------------------
+/*
+ * Each slot carries a sequence number which tells producers and consumers whether it
+ * is free or filled for their current lap around the ring (D. Vyukov's bounded queue).
+ * Slots are written and read in place through callbacks, so a slot type holding
+ * buffers (eg. std::vector) keeps its capacity and is never reallocated once warmed up.
+ * Both operations fail instead of blocking when the ring is full or empty.
+ */
+template <typename T>
+class Lockfree_Ring
+{
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    std::vector<Slot> slots;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueue_position{0};
+    alignas(64) std::atomic<size_t> dequeue_position{0};
+
+    static size_t round_up(size_t capacity)
+    {
+        size_t size = 2;
+        while(size < capacity)
+        {
+            size <<= 1;
+        }
+        return size;
+    }
+
+public:
+    // Capacity is rounded up to a power of two
+    Lockfree_Ring(size_t capacity) : slots(round_up(capacity))
+    {
+        mask = slots.size() - 1;
+        for(size_t i = 0; i < slots.size(); i++)
+        {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    Lockfree_Ring(const Lockfree_Ring &) = delete;
+    Lockfree_Ring &operator=(const Lockfree_Ring &) = delete;
+
+    // Fill the next free slot in place with fill(T&), returns false if the ring is full
+    template <typename F>
+    bool try_push(F fill)
+    {
+        size_t position = enqueue_position.load(std::memory_order_relaxed);
+        Slot *slot;
+        while(true)
+        {
+            slot = &slots[position & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+            if(difference == 0)
+            {
+                if(enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if(difference < 0)
+            {
+                return false; // full
+            }
+            else
+            {
+                position = enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+        fill(slot->item);
+        slot->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Hand the oldest filled slot to consume(T&), returns false if the ring is empty
+    template <typename F>
+    bool try_pop(F consume)
+    {
+        size_t position = dequeue_position.load(std::memory_order_relaxed);
+        Slot *slot;
+        while(true)
+        {
+            slot = &slots[position & mask];
+            size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+            if(difference == 0)
+            {
+                if(dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if(difference < 0)
+            {
+                return false; // empty
+            }
+            else
+            {
+                position = dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+        consume(slot->item);
+        slot->sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate number of filled slots
+    size_t depth() const
+    {
+        size_t enqueued = enqueue_position.load(std::memory_order_relaxed);
+        size_t dequeued = dequeue_position.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    size_t capacity() const
+    {
+        return slots.size();
+    }
+};
+
+#endif
@@ -0,0 +1,201 @@
+/**
+ * @file scheduling.cpp
+ *
+ * @brief thread placement and scheduling
+ *
+ * Applies core affinity, scheduling policy and memory locking, reporting what was
+ * actually applied so that misconfiguration (eg. missing CAP_SYS_NICE) is visible at startup
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "scheduling.h"
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+
+// Parse a thread specification of the form <cpus>[:<policy>[:<priority>]]
+// eg. "3:fifo:80" pins to core 3 with SCHED_FIFO priority 80, "0,1" pins to cores 0 and 1,
+// "-:fifo:50" only changes the policy
+Thread_Settings parse_thread_settings(const std::string &spec)
+{
+	Thread_Settings settings;
+	settings.configured = true;
+
+	std::stringstream stream(spec);
+	std::string cpu_list, policy, priority;
+	std::getline(stream, cpu_list, ':');
+	std::getline(stream, policy, ':');
+	std::getline(stream, priority, ':');
+	std::string rest;
+	if(std::getline(stream, rest))
+	{
+		std::cout << "Invalid thread settings " << spec << ", use <cpus>[:<fifo|other>[:<priority>]]\n";
+		throw EXIT_FAILURE;
+	}
+
+	if(cpu_list != "-" && !cpu_list.empty())
+	{
+		// A trailing comma leaves an empty entry, which getline does not return
+		if(cpu_list.back() == ',')
+		{
+			std::cout << "Invalid cpu list " << cpu_list << " in " << spec << "\n";
+			throw EXIT_FAILURE;
+		}
+		std::stringstream cpu_stream(cpu_list);
+		std::string cpu;
+		while(std::getline(cpu_stream, cpu, ','))
+		{
+			char *end;
+			long value = strtol(cpu.c_str(), &end, 10);
+			if(cpu.empty() || *end != '\0' || value < 0 || value >= CPU_SETSIZE)
+			{
+				std::cout << "Invalid cpu " << cpu << " in " << spec << "\n";
+				throw EXIT_FAILURE;
+			}
+			settings.cpus.push_back(value);
+		}
+	}
+
+	if(policy == "fifo")
+	{
+		settings.policy = SCHED_FIFO;
+		settings.priority = 50;
+	}
+	else if(policy == "other" || policy.empty())
+	{
+		settings.policy = SCHED_OTHER;
+	}
+	else
+	{
+		std::cout << "Invalid scheduling policy " << policy << ", use fifo or other\n";
+		throw EXIT_FAILURE;
+	}
+
+	if(!priority.empty())
+	{
+		char *end;
+		settings.priority = strtol(priority.c_str(), &end, 10);
+		int min_priority = sched_get_priority_min(settings.policy);
+		int max_priority = sched_get_priority_max(settings.policy);
+		if(*end != '\0' || settings.priority < min_priority || settings.priority > max_priority)
+		{
+			std::cout << "Invalid priority " << priority << ", must be within " << min_priority << "-" << max_priority << "\n";
+			throw EXIT_FAILURE;
+		}
+	}
+	return settings;
+}
+
+// Apply affinity and scheduling policy to a thread, returns a line for the startup report
+std::string apply_thread_settings(pthread_t thread, const Thread_Settings &settings, const std::string &name)
+{
+	std::string report = name + ": ";
+	if(!settings.configured)
+	{
+		return report + "default scheduling";
+	}
+
+	if(!settings.cpus.empty())
+	{
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		for(int cpu : settings.cpus)
+		{
+			CPU_SET(cpu, &cpu_set);
+		}
+		int result = pthread_setaffinity_np(thread, sizeof(cpu_set), &cpu_set);
+		if(result != 0)
+		{
+			report += "affinity failed (" + std::string(strerror(result)) + "), ";
+		}
+	}
+
+	struct sched_param parameters;
+	parameters.sched_priority = settings.priority;
+	int result = pthread_setschedparam(thread, settings.policy, &parameters);
+	if(result != 0)
+	{
+		report += "policy failed (" + std::string(strerror(result)) + "), ";
+	}
+
+	// Report what the kernel actually applied rather than what was requested
+	cpu_set_t applied_cpus;
+	CPU_ZERO(&applied_cpus);
+	std::string cpus;
+	if(pthread_getaffinity_np(thread, sizeof(applied_cpus), &applied_cpus) == 0)
+	{
+		for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if(CPU_ISSET(cpu, &applied_cpus))
+			{
+				cpus += (cpus.empty() ? "" : ",") + std::to_string(cpu);
+			}
+		}
+	}
+	int applied_policy;
+	struct sched_param applied_parameters;
+	pthread_getschedparam(thread, &applied_policy, &applied_parameters);
+
+	report += "cpus " + cpus + ", ";
+	report += (applied_policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_OTHER");
+	report += " priority " + std::to_string(applied_parameters.sched_priority);
+	return report;
+}
+
+// Apply settings to the calling thread
+std::string apply_thread_settings(const Thread_Settings &settings, const std::string &name)
+{
+	return apply_thread_settings(pthread_self(), settings, name);
+}
+
+// Apply settings to the calling thread the first time it gets here
+// Used for threads created by libraries, such as the MAVSDK callback threads, whose handles we never see
+void apply_thread_settings_once(const Thread_Settings &settings, const std::string &name)
+{
+	static thread_local bool applied = false;
+	if(applied || !settings.configured)
+	{
+		return;
+	}
+	applied = true;
+	std::cout << apply_thread_settings(settings, name) << "\n";
+}
+
+// Lock all current and future pages so the pipeline never waits on a page fault
+std::string lock_process_memory()
+{
+	if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		return "memory: mlockall failed (" + std::string(strerror(errno)) + ")";
+	}
+	return "memory: locked";
+}
+
+std::string describe_thread_settings(const Thread_Settings &settings)
+{
+	if(!settings.configured)
+	{
+		return "default";
+	}
+	std::string description = "cpus ";
+	for(size_t i = 0; i < settings.cpus.size(); i++)
+	{
+		description += (i ? "," : "") + std::to_string(settings.cpus[i]);
+	}
+	if(settings.cpus.empty())
+	{
+		description += "any";
+	}
+	description += (settings.policy == SCHED_FIFO ? ", SCHED_FIFO" : ", SCHED_OTHER");
+	description += " priority " + std::to_string(settings.priority);
+	return description;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file scheduling.h
+ *
+ * @brief thread placement and scheduling definition
+ *
+ * Functions for pinning threads to cores, selecting their scheduling policy and
+ * locking process memory
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef SCHEDULING_H_
+#define SCHEDULING_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+
+// Placement and scheduling applied to a group of threads
+struct Thread_Settings {
+    std::vector<int> cpus; // Cores the thread may run on, empty leaves the affinity untouched
+    int policy = SCHED_OTHER; // SCHED_OTHER or SCHED_FIFO
+    int priority = 0; // 1-99 for SCHED_FIFO, must be 0 for SCHED_OTHER
+    bool configured = false; // False if nothing was requested for this group
+};
+
+// Settings for each thread group of the program
+struct Scheduling_Settings {
+    Thread_Settings compute; // SID preprocessing and regression stages
+    Thread_Settings workers; // SID logging stage and other helper threads
+    Thread_Settings ingestion; // MAVSDK telemetry callback threads inserting into the buffer
+    bool lock_memory = false; // mlockall current and future pages
+};
+
+Thread_Settings parse_thread_settings(const std::string &spec);
+std::string apply_thread_settings(pthread_t thread, const Thread_Settings &settings, const std::string &name);
+std::string apply_thread_settings(const Thread_Settings &settings, const std::string &name);
+void apply_thread_settings_once(const Thread_Settings &settings, const std::string &name);
+std::string lock_process_memory();
+std::string describe_thread_settings(const Thread_Settings &settings);
+
+#endif
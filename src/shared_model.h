@@ -0,0 +1,206 @@
+/**
+ * @file shared_model.h
+ *
+ * @brief shared memory model segment and reader
+ *
+ * Layout of the POSIX shared memory segment holding the latest identified models of a
+ * vehicle, and a header-only reader for co-located consumers such as a controller.
+ *
+ * The segment is guarded by a sequence lock. The publisher makes the sequence odd, writes
+ * the models and makes it even again, a reader copies a model and retries if the sequence
+ * was odd or moved meanwhile. Reading maps the segment once and then takes no locks and
+ * makes no system calls, a read is a copy of a few kilobytes.
+ *
+ * Only depends on the C++ standard library and POSIX, so it can be copied into other
+ * projects. Usage:
+ *
+ *   Shared_Model_Reader reader;
+ *   if(reader.open("/sindy_model_1")) { Shared_Model model; if(reader.read(0, model)) { ... } }
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef SHARED_MODEL_H_
+#define SHARED_MODEL_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <atomic>
+#include <cstdint>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SHARED_MODEL_MAGIC 0x4c444d59444e4953ULL // "SINDYMDL"
+#define SHARED_MODEL_VERSION 2
+#define SHARED_MODEL_FEATURES 66 // Second order candidate library
+#define SHARED_MODEL_STATES 6 // p, q, r, u, v, w
+#define SHARED_MODEL_VALIDATION 12 // One-step then multi-step RMS error of psi, theta, phi, x, y, z
+#define SHARED_MODEL_SUPPORT_WORDS ((SHARED_MODEL_FEATURES*SHARED_MODEL_STATES + 63)/64)
+#define SHARED_MODEL_MAX_MODELS 8
+#define SHARED_MODEL_NAME_LENGTH 32
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the sequence lock needs lock free 64 bit atomics");
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+// One model configuration of the latest window
+struct Shared_Model {
+    uint64_t window_index;
+    int64_t sample_time_us; // Time since the start of the publishing process at which the model was solved
+    int64_t clear_time_ns; // CLOCK_MONOTONIC time the window was taken from the buffer
+    int64_t publish_time_ns; // CLOCK_MONOTONIC time the model was published
+    uint64_t support[SHARED_MODEL_SUPPORT_WORDS]; // Bit feature*SHARED_MODEL_STATES + state is set for nonzero coefficients
+    double coefficients[SHARED_MODEL_FEATURES][SHARED_MODEL_STATES];
+    double standard_errors[SHARED_MODEL_FEATURES][SHARED_MODEL_STATES]; // NaN unless the publisher computes them, zero outside the support
+    double validation[SHARED_MODEL_VALIDATION]; // Error of the previous window's model on this window, NaN if not validated
+};
+
+struct Shared_Model_Segment {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t num_models;
+    uint32_t num_features;
+    uint32_t num_states;
+    uint64_t names_hash; // Hash of the candidate and state names, see shared_model_names_hash
+    char model_names[SHARED_MODEL_MAX_MODELS][SHARED_MODEL_NAME_LENGTH];
+    alignas(64) std::atomic<uint64_t> sequence; // Odd while the publisher writes, 0 before the first model
+    alignas(64) Shared_Model models[SHARED_MODEL_MAX_MODELS];
+};
+
+// FNV-1a over the names, each followed by a comma, candidates first and then states
+inline uint64_t shared_model_names_hash(const char *const *names, int count, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    for(int i = 0; i < count; i++)
+    {
+        for(const char *c = names[i]; *c != '\0'; c++)
+        {
+            hash = (hash ^ (uint8_t)*c)*0x100000001b3ULL;
+        }
+        hash = (hash ^ (uint8_t)',')*0x100000001b3ULL;
+    }
+    return hash;
+}
+
+inline bool shared_model_supported(const Shared_Model &model, int feature, int state)
+{
+    int bit = feature*SHARED_MODEL_STATES + state;
+    return (model.support[bit/64] >> (bit%64)) & 1;
+}
+
+// ----------------------------------------------------------------------------------
+//   Shared Model Reader Class
+// ----------------------------------------------------------------------------------
+class Shared_Model_Reader
+{
+    const Shared_Model_Segment *segment = nullptr;
+
+public:
+    Shared_Model_Reader() {}
+    ~Shared_Model_Reader() { close(); }
+    Shared_Model_Reader(const Shared_Model_Reader &) = delete;
+    Shared_Model_Reader &operator=(const Shared_Model_Reader &) = delete;
+
+    // Map the segment read only, fails if it does not exist or has another layout
+    bool open(const char *name)
+    {
+        close();
+        int fd = shm_open(name, O_RDONLY, 0);
+        if(fd < 0)
+        {
+            return false;
+        }
+        struct stat status;
+        void *mapping = MAP_FAILED;
+        if(fstat(fd, &status) == 0 && (size_t)status.st_size >= sizeof(Shared_Model_Segment))
+        {
+            mapping = mmap(nullptr, sizeof(Shared_Model_Segment), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if(mapping == MAP_FAILED)
+        {
+            return false;
+        }
+        segment = static_cast<const Shared_Model_Segment *>(mapping);
+        if(segment->magic != SHARED_MODEL_MAGIC || segment->version != SHARED_MODEL_VERSION)
+        {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close()
+    {
+        if(segment != nullptr)
+        {
+            munmap(const_cast<Shared_Model_Segment *>(segment), sizeof(Shared_Model_Segment));
+            segment = nullptr;
+        }
+    }
+
+    // Changes with every published window, compare against the last value to poll for new models
+    uint64_t sequence() const
+    {
+        return segment == nullptr ? 0 : segment->sequence.load(std::memory_order_acquire);
+    }
+
+    int num_models() const
+    {
+        return segment == nullptr ? 0 : segment->num_models;
+    }
+
+    uint64_t names_hash() const
+    {
+        return segment == nullptr ? 0 : segment->names_hash;
+    }
+
+    // Index of a model configuration by name, -1 if there is none
+    int find_model(const char *name) const
+    {
+        for(int m = 0; m < num_models(); m++)
+        {
+            if(strncmp(segment->model_names[m], name, SHARED_MODEL_NAME_LENGTH) == 0)
+            {
+                return m;
+            }
+        }
+        return -1;
+    }
+
+    // Copy the newest version of a model, false before the first window or if the publisher
+    // stayed in the middle of a write for all attempts, eg. because it died there
+    bool read(int model, Shared_Model &out, int attempts = 100000) const
+    {
+        if(model < 0 || model >= num_models())
+        {
+            return false;
+        }
+        for(int attempt = 0; attempt < attempts; attempt++)
+        {
+            uint64_t before = segment->sequence.load(std::memory_order_acquire);
+            if(before == 0)
+            {
+                return false;
+            }
+            if(before & 1)
+            {
+                continue;
+            }
+            memcpy(&out, &segment->models[model], sizeof(Shared_Model));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(segment->sequence.load(std::memory_order_relaxed) == before)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
@@ -10,30 +10,59 @@
 int setup(int argc, char **argv)
 {
 	using namespace std;
-	// Set program defaults
-	string autopilot_path = "udp://:14540";
-	string coefficient_logfile_directory = "../logs/coefficients.csv";
-	string debug_logfile_path = "../logs/mavlink_debug_log.csv";
-
-	buffer_mode mode = buffer_mode::length_mode;
-	int buffer_length = 100;
-	float ridge_regression_penalty = 0.1;
-	float stlsq_threshold = 0.1;
-	bool debug = false;
+	// Program defaults are set in Program_Settings
+	Program_Settings settings;
 
 	// Parse command line arguments
-	parse_commandline(argc, argv, autopilot_path, coefficient_logfile_directory, buffer_length, mode, ridge_regression_penalty,
-					  stlsq_threshold, debug, debug_logfile_path);
+	parse_commandline(argc, argv, settings);
+
+	// Startup report of the requested thread placement, the applied placement is printed as each thread starts
+	std::cout << "Scheduling:\n";
+	std::cout << "  compute threads: " << describe_thread_settings(settings.scheduling_settings.compute) << '\n';
+	std::cout << "  worker threads: " << describe_thread_settings(settings.scheduling_settings.workers) << '\n';
+	std::cout << "  ingestion threads: " << describe_thread_settings(settings.scheduling_settings.ingestion) << '\n';
+	if (settings.scheduling_settings.lock_memory)
+	{
+		std::cout << "  " << lock_process_memory() << '\n';
+	}
+
+	// In time mode the window period is known up front, otherwise the governor measures it
+	if (settings.mode == buffer_mode::time_mode && settings.governor_settings.window_period.count() == 0)
+	{
+		settings.governor_settings.window_period = std::chrono::seconds(settings.buffer_length);
+	}
 
 	// set a base time at which the telemetry items are timestamped
 	std::chrono::_V2::system_clock::time_point program_epoch = std::chrono::high_resolution_clock::now();
 
 	using namespace mavsdk;
 
+	// Debug log sink, declared ahead of the Mavsdk object so it outlives every log callback
+	Debug_Log_Sink debug_log(settings.debug_logfile_path, settings.debug_log_size, settings.debug_log_files);
+
+	// Flight recorder of the most recent telemetry and stage events, also declared ahead of the Mavsdk object
+	std::unique_ptr<Flight_Recorder> recorder;
+	if (!settings.recorder_path.empty())
+	{
+		recorder.reset(new Flight_Recorder(settings.recorder_path, settings.recorder_size));
+		std::cout << "Flight recorder: " << settings.recorder_path << ", last " << recorder->get_capacity() << " events\n";
+	}
+
+	// Span tracing, SIGUSR1 writes the trace while running and the process exit writes it again
+	if (!settings.trace_path.empty())
+	{
+#ifdef SINDY_TRACE
+		trace_start(settings.trace_path, settings.trace_size);
+		std::cout << "Tracing to " << settings.trace_path << ", kill -USR1 " << getpid() << " to write it now\n";
+#else
+		std::cout << "--trace ignored, rebuild with -DSINDY_TRACE=ON to compile in the spans\n";
+#endif
+	}
+
 	// Instantiate MAVSDK Object
 	Mavsdk mavsdk;
 	// Find autopilot system using UDP or Serial device path
-	ConnectionResult connection_result = mavsdk.add_any_connection(autopilot_path);
+	ConnectionResult connection_result = mavsdk.add_any_connection(settings.autopilot_path);
 
 	// make sure we have connected successfully to the autopilot
 	if (connection_result != ConnectionResult::Success)
@@ -41,14 +70,81 @@ int setup(int argc, char **argv)
 		std::cerr << "Connection failed: " << connection_result << '\n';
 	}
 
-	// Wait for system to connect
-	while (mavsdk.systems().size() == 0)
+	/*
+	 * Subscribe to mavlink logs
+	 *
+	 * The callback runs on the MAVSDK threads that also dispatch telemetry, so it only
+	 * copies the message into the sink's ring for its writer thread.
+	 *
+	 */
+	mavsdk::log::subscribe([&debug_log](mavsdk::log::Level level,	// message severity level
+										const std::string &message, // message text
+										const std::string &file,	// source file from which the message was sent
+										int line) {					// line number in the source file
+		debug_log.log(static_cast<int>(level), message);
+
+		// returning true from the callback disables printing the message to stdout
+		return level < mavsdk::log::Level::Warn;
+	});
+
+	/*
+	 * Instantiate the shared compute pool
+	 *
+	 * Every vehicle pipeline runs its STLSQ on this pool. Vehicles are served round-robin,
+	 * so the number of concurrent regressions stays bounded however many vehicles are seen.
+	 *
+	 */
+	Worker_Pool pool(settings.pool_size, settings.scheduling_settings.compute);
+
+	/*
+	 * Setup interrupt signal handler
+	 *
+	 * Responds to early exits signaled with Ctrl-C. The handler only raises a flag,
+	 * the flight loop then stops every vehicle pipeline and returns.
+	 *
+	 */
+	signal(SIGINT, quit_handler);
+
+	// SIGHUP reloads the configuration file into the running pipelines
+	if (!settings.config_path.empty())
+	{
+		signal(SIGHUP, reload_handler);
+	}
+
+	// Metrics endpoint, scrapes only read the counters and histograms the pipelines update
+	std::unique_ptr<Metrics_Server> metrics_server;
+	if (settings.metrics_port > 0)
 	{
-		std::this_thread::sleep_for(std::chrono::seconds(1));
+		metrics_server.reset(new Metrics_Server(settings.metrics_port));
+		metrics_server->add_source([&debug_log](std::string &out) {
+			write_counter(out, "sindy_debug_log_dropped_total", "", debug_log.get_dropped());
+		});
+		std::cout << "Serving metrics on http://127.0.0.1:" << settings.metrics_port << "/metrics\n";
 	}
 
-	// System got discovered.
-	std::shared_ptr<System> system = mavsdk.systems()[0];
+	// Run the main event loop, which discovers vehicles and starts their pipelines
+	flight_loop(mavsdk, settings, program_epoch, pool, recorder.get(), metrics_server.get());
+
+	// woot!
+	return 0;
+}
+
+// ------------------------------------------------------------------------------
+//   VEHICLE PIPELINES
+// ------------------------------------------------------------------------------
+
+// Create the buffer, identification and telemetry subscriptions for one vehicle
+std::unique_ptr<Vehicle_Pipeline> create_vehicle_pipeline(std::shared_ptr<mavsdk::System> system, Program_Settings &settings,
+														  std::chrono::_V2::system_clock::time_point program_epoch, Worker_Pool &pool,
+														  Flight_Recorder *recorder)
+{
+	using namespace mavsdk;
+
+	std::unique_ptr<Vehicle_Pipeline> pipeline(new Vehicle_Pipeline);
+	pipeline->system = system;
+	pipeline->system_id = system->get_system_id();
+	std::string vehicle_name = "Vehicle " + std::to_string(pipeline->system_id);
+	Pipeline_Config config = vehicle_config(settings, pipeline->system_id);
 
 	/*
 	 * Instantiate buffer objects
@@ -60,37 +156,130 @@ int setup(int argc, char **argv)
 	 * associated with a Mavlink type which is passed into the SID
 	 *
 	 */
-	Buffer input_buffer(buffer_length, mode);
+	pipeline->input_buffer.reset(new Buffer(settings.buffer_length, settings.mode));
+	Buffer &input_buffer = *pipeline->input_buffer;
+	input_buffer.set_gap_threshold(std::chrono::milliseconds(settings.gap_threshold_ms));
+	if (recorder != nullptr)
+	{
+		input_buffer.set_recorder(recorder, pipeline->system_id);
+	}
 
 	/*
 	 * Instantiate a system identification object
 	 *
-	 * This object takes data from the input buffer and implements the SINDy algorithm on it
-	 *
-	 */
-	SID SINDy(&input_buffer, program_epoch, stlsq_threshold, ridge_regression_penalty, coefficient_logfile_directory, debug);
-
-	/*
-	 * Setup interrupt signal handler
-	 *
-	 * Responds to early exits signaled with Ctrl-C.  The handler will command
-	 * to exit offboard mode if required, and close threads and the port.
-	 * The handler in this example needs references to the above objects.
+	 * This object takes data from the input buffer and implements the SINDy algorithm on it.
+	 * Each vehicle logs to its own coefficient file.
 	 *
 	 */
+	pipeline->SINDy.reset(new SID(&input_buffer, program_epoch, settings.stlsq_threshold, settings.ridge_regression_penalty,
+								  config.models[0].coefficient_logfile_path, settings.debug, settings.pipeline_depth, settings.governor_settings));
+	pipeline->SINDy->set_name(vehicle_name);
 
-	SINDy_quit = &SINDy;
-	signal(SIGINT, quit_handler);
+	// Additional model configurations share this vehicle's front-end, each logging to its own file
+	pipeline->SINDy->set_models(config.models);
+	pipeline->SINDy->set_fsync_interval(settings.fsync_interval);
+	pipeline->SINDy->set_keyframe_interval(settings.keyframe_interval);
+	if (!config.hdf5_path.empty())
+	{
+		pipeline->SINDy->set_hdf5_output(config.hdf5_path, settings.hdf5_states);
+	}
+	if (!settings.shared_model_name.empty())
+	{
+		pipeline->SINDy->set_shared_model(settings.shared_model_name + "_" + std::to_string(pipeline->system_id));
+	}
+	// The stream is always set up, so a destination given while running reaches the vehicle with its id and cap
+	pipeline->SINDy->set_coefficient_stream(config.stream_destination, pipeline->system_id, settings.stream_bandwidth);
+	pipeline->SINDy->set_thread_settings(settings.scheduling_settings.compute, settings.scheduling_settings.workers);
+	pipeline->SINDy->set_allocation_check(settings.assert_no_allocations);
+	pipeline->SINDy->set_standard_errors(settings.standard_errors);
+	pipeline->SINDy->set_min_excitation(settings.min_excitation);
+	if (settings.mode == buffer_mode::time_mode)
+	{
+		// Windows span the buffer length plus up to a second of clear time rounding, resampled at 200Hz
+		pipeline->SINDy->set_window_capacity((settings.buffer_length + 1)*200);
+	}
+	pipeline->SINDy->set_worker_pool(&pool);
+	if (recorder != nullptr)
+	{
+		pipeline->SINDy->set_recorder(recorder, pipeline->system_id);
+	}
 
 	// instantiate telemetry object
+	pipeline->telemetry.reset(new Telemetry{system});
+	Telemetry &telemetry = *pipeline->telemetry;
+	Thread_Settings ingestion_settings = settings.scheduling_settings.ingestion;
+
+	// Subscribe to telemetry sources, inserting into the buffer on every new telemetry item
+	// Each subscription dispatches a thread which listens for a new item, calling the lambda function when one is received
+	// Samples are stamped in microseconds since the program epoch, from the autopilot's timestamp where the message has one
+	pipeline->clock.reset(new Clock_Sync(settings.autopilot_timestamps));
+	Clock_Sync &clock = *pipeline->clock;
+	telemetry.subscribe_attitude_euler([&input_buffer, &clock, program_epoch, ingestion_settings](Telemetry::EulerAngle attitude)
+									   {
+		apply_thread_settings_once(ingestion_settings, "MAVSDK ingestion thread");
+        auto now = std::chrono::high_resolution_clock::now();
+		uint64_t arrival_time = std::chrono::duration_cast<std::chrono::microseconds>(now - program_epoch).count();
+		input_buffer.insert(attitude, clock.stamp(attitude.timestamp_us, arrival_time)); });
+
+	// MAVSDK passes no timestamp with the angular velocity and the actuator controls
+	telemetry.subscribe_attitude_angular_velocity_body([&input_buffer, &clock, program_epoch, ingestion_settings](Telemetry::AngularVelocityBody angular_velocity)
+													   {
+		apply_thread_settings_once(ingestion_settings, "MAVSDK ingestion thread");
+        auto now = std::chrono::high_resolution_clock::now();
+		uint64_t arrival_time = std::chrono::duration_cast<std::chrono::microseconds>(now - program_epoch).count();
+		input_buffer.insert(angular_velocity, clock.stamp(0, arrival_time)); });
+
+	telemetry.subscribe_odometry([&input_buffer, &clock, program_epoch, ingestion_settings](Telemetry::Odometry state)
+								 {
+		apply_thread_settings_once(ingestion_settings, "MAVSDK ingestion thread");
+        auto now = std::chrono::high_resolution_clock::now();
+		uint64_t arrival_time = std::chrono::duration_cast<std::chrono::microseconds>(now - program_epoch).count();
+		input_buffer.insert(state, clock.stamp(state.time_usec, arrival_time)); });
+
+	telemetry.subscribe_actuator_control_target([&input_buffer, &clock, program_epoch, ingestion_settings](Telemetry::ActuatorControlTarget actuator)
+												{
+		apply_thread_settings_once(ingestion_settings, "MAVSDK ingestion thread");
+        auto now = std::chrono::high_resolution_clock::now();
+		uint64_t arrival_time = std::chrono::duration_cast<std::chrono::microseconds>(now - program_epoch).count();
+		input_buffer.insert(actuator, clock.stamp(0, arrival_time)); });
+
+	return pipeline;
+}
+
+// The settings of one vehicle's pipeline, log files are derived per vehicle and per model
+Pipeline_Config vehicle_config(const Runtime_Config &config, uint8_t system_id)
+{
+	Pipeline_Config vehicle;
+	std::string vehicle_logfile_path = insert_path_suffix(config.coefficient_logfile_path, std::to_string(system_id));
+	if (config.models.empty())
+	{
+		// A single model from -t and -r
+		vehicle.models.push_back({"default", config.stlsq_threshold, config.ridge_regression_penalty, 2, vehicle_logfile_path});
+	}
+	for (Model_Config model : config.models)
+	{
+		model.coefficient_logfile_path = insert_path_suffix(vehicle_logfile_path, model.name);
+		vehicle.models.push_back(model);
+	}
+	vehicle.buffer_length = config.buffer_length;
+	vehicle.mode = config.mode;
+	vehicle.hdf5_path = config.hdf5_path.empty() ? "" : insert_path_suffix(config.hdf5_path, std::to_string(system_id));
+	vehicle.stream_destination = config.stream_destination;
+	vehicle.debug = config.debug;
+	vehicle.min_excitation = config.min_excitation;
+	return vehicle;
+}
 
-	Telemetry telemetry = Telemetry{system};
+void print_system_info(std::shared_ptr<mavsdk::System> system)
+{
+	using namespace mavsdk;
 	auto info = Info{system};
 
 	const Info::Identification &systemInformation = info.get_identification().second;
 	const Info::Product &systemProduct = info.get_product().second;
 	const Info::Version &systemVersion = info.get_version().second;
 
+	std::cout << " System id: " << static_cast<int>(system->get_system_id()) << '\n';
 	std::cout << " Hardware uid: " << systemInformation.hardware_uid << '\n';
 	std::cout << " Legacy Hardware uid: " << systemInformation.legacy_uid << '\n';
 
@@ -112,81 +301,275 @@ int setup(int argc, char **argv)
 			  << "  vendor_name: " << systemProduct.vendor_name << '\n'
 			  << "  product_id: " << systemProduct.product_id << '\n'
 			  << "  product_name: " << systemProduct.product_id << '\n';
+}
+
+// ------------------------------------------------------------------------------
+//   COMMANDS
+// ------------------------------------------------------------------------------
 
-	// Subscribe to mavlink logs
-	mavsdk::log::subscribe([debug_logfile_path](mavsdk::log::Level level,	// message severity level
-												const std::string &message, // message text
-												const std::string &file,	// source file from which the message was sent
-												int line) {					// line number in the source file
-		// process the log message in a way you like
-		log_mavlink_info(level, message, debug_logfile_path);
+void flight_loop(mavsdk::Mavsdk &mavsdk, Program_Settings &settings, std::chrono::_V2::system_clock::time_point program_epoch, Worker_Pool &pool,
+				 Flight_Recorder *recorder, Metrics_Server *metrics_server)
+{
+	using namespace mavsdk;
 
-		// returning true from the callback disables printing the message to stdout
-		return level < mavsdk::log::Level::Warn;
-	});
+	// One pipeline per discovered system id
+	// Guarded against the control socket, which changes the settings and the configuration of every pipeline
+	std::map<uint8_t, std::unique_ptr<Vehicle_Pipeline>> pipelines;
+	std::mutex pipelines_mutex;
 
-	// Subscribe to telemetry sources, inserting into the buffer on every new telemetry item
-	// Each subscription dispatches a thread which listens for a new item, calling the lambda function when one is received
-	telemetry.subscribe_attitude_euler([&input_buffer, program_epoch](Telemetry::EulerAngle attitude)
-									   {
-        auto now = std::chrono::high_resolution_clock::now();
-		uint64_t sample_time = std::chrono::duration_cast<std::chrono::milliseconds>(now - program_epoch).count();
-		input_buffer.insert(attitude, sample_time); });
+	std::unique_ptr<Control_Socket> control_socket;
+	if (!settings.control_path.empty())
+	{
+		control_socket.reset(new Control_Socket(settings.control_path, [&settings, &pipelines, &pipelines_mutex](const std::string &request)
+		{
+			std::lock_guard<std::mutex> lock(pipelines_mutex);
+			return reconfigure_pipelines(request, settings, pipelines);
+		}));
+		std::cout << "Taking configuration changes on " << settings.control_path << "\n";
+	}
 
-	telemetry.subscribe_attitude_angular_velocity_body([&input_buffer, program_epoch](Telemetry::AngularVelocityBody angular_velocity)
-													   {
-        auto now = std::chrono::high_resolution_clock::now();
-		uint64_t sample_time = std::chrono::duration_cast<std::chrono::milliseconds>(now - program_epoch).count();
-		input_buffer.insert(angular_velocity, sample_time); });
+	// Main event loop, runs until SIGINT
+	while (!quit_requested)
+	{
+		std::unique_lock<std::mutex> lock(pipelines_mutex);
 
-	telemetry.subscribe_odometry([&input_buffer, program_epoch](Telemetry::Odometry state)
-								 {
-        auto now = std::chrono::high_resolution_clock::now();
-		uint64_t sample_time = std::chrono::duration_cast<std::chrono::milliseconds>(now - program_epoch).count();
-		input_buffer.insert(state, sample_time); });
+		// SIGHUP reloads the configuration file
+		if (reload_requested)
+		{
+			reload_requested = 0;
+			std::cout << "Reloading " << settings.config_path << ": " << reconfigure_pipelines("reload", settings, pipelines);
+		}
 
-	telemetry.subscribe_actuator_control_target([&input_buffer, program_epoch](Telemetry::ActuatorControlTarget actuator)
-												{
-        auto now = std::chrono::high_resolution_clock::now();
-		uint64_t sample_time = std::chrono::duration_cast<std::chrono::milliseconds>(now - program_epoch).count();
-		input_buffer.insert(actuator, sample_time); });
+		// Systems which have appeared on the link since the last pass
+		std::vector<std::shared_ptr<System>> discovered;
+		for (std::shared_ptr<System> system : mavsdk.systems())
+		{
+			if (pipelines.count(system->get_system_id()) == 0)
+			{
+				discovered.push_back(system);
+			}
+		}
+		// The settings of the new pipelines, the control socket may change them while they are built
+		Program_Settings vehicle_settings = settings;
+		lock.unlock();
 
-	// Run the main event loop
-	flight_loop(system, telemetry, SINDy, input_buffer, coefficient_logfile_directory);
+		// Spawn a pipeline for each of them, the system info requests block until the vehicle answers
+		// so they run without the lock and do not hold up the control socket
+		for (std::shared_ptr<System> system : discovered)
+		{
+			uint8_t system_id = system->get_system_id();
+			std::cout << "Discovered system " << static_cast<int>(system_id) << '\n';
+			print_system_info(system);
+			std::unique_ptr<Vehicle_Pipeline> pipeline = create_vehicle_pipeline(system, vehicle_settings, program_epoch, pool, recorder);
 
-	// woot!
-	return 0;
+			if (metrics_server != nullptr)
+			{
+				SID *SINDy = pipeline->SINDy.get();
+				Buffer *input_buffer = pipeline->input_buffer.get();
+				Clock_Sync *clock = pipeline->clock.get();
+				std::string labels = "vehicle=\"" + std::to_string(system_id) + "\"";
+				metrics_server->add_source([SINDy, input_buffer, clock, labels](std::string &out)
+				{
+					SINDy->get_metrics().write(out, labels);
+					input_buffer->get_ingestion().write(out, labels);
+					clock->write(out, labels);
+				});
+			}
+
+			// Launch the identification pipeline, repeated calls are ignored while it is running
+			pipeline->SINDy->start();
+
+			lock.lock();
+			// A configuration change that arrived while the pipeline was built is applied to it as well
+			if (describe_config(settings) != describe_config(vehicle_settings))
+			{
+				std::string error;
+				std::shared_ptr<Pipeline_Config> config = pipeline->SINDy->prepare_reconfiguration(vehicle_config(settings, system_id), error);
+				if (!config || !pipeline->SINDy->reconfigure(config, error))
+				{
+					std::cout << "Vehicle " << static_cast<int>(system_id) << " keeps its start configuration: " << error << "\n";
+				}
+			}
+			pipelines[system_id] = std::move(pipeline);
+			lock.unlock();
+		}
+
+		// Top level state machine will go here
+		// Configuration changes are taken while the loop sleeps
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+	printf("\n");
+	printf("TERMINATING AT USER REQUEST\n");
+	printf("\n");
+
+	// The control socket refers to the pipelines as well
+	if (control_socket)
+	{
+		control_socket->stop();
+	}
+
+	// The metrics sources refer to the pipelines, which go out of scope here
+	if (metrics_server != nullptr)
+	{
+		metrics_server->stop();
+	}
+
+	// Windows already taken from the buffers are still solved and logged
+	for (auto &pipeline : pipelines)
+	{
+		try
+		{
+			pipeline.second->SINDy->stop();
+		}
+		catch (int error)
+		{
+			std::cerr << "Warning, could not stop the pipeline of vehicle " << static_cast<int>(pipeline.first) << "\n";
+		}
+	}
+	return;
 }
 
 // ------------------------------------------------------------------------------
-//   COMMANDS
+//   LIVE CONFIGURATION
 // ------------------------------------------------------------------------------
 
-void flight_loop(std::shared_ptr<mavsdk::System> system, mavsdk::Telemetry &telemetry, SID &SINDy, Buffer &input_buffer, std::string logfile_directory)
+// Handle a control request: "show", "reload" or "key = value" lines in the configuration file format
+// The change is checked against every pipeline without side effects before any of them opens its new outputs and takes it,
+// so a rejected change leaves every vehicle and its files as they were. Each pipeline then switches over at its next window boundary
+std::string reconfigure_pipelines(const std::string &request, Program_Settings &settings,
+								  std::map<uint8_t, std::unique_ptr<Vehicle_Pipeline>> &pipelines)
 {
-	using namespace mavsdk;
+	Runtime_Config config = settings;
+	std::string error;
+	bool changed = false;
+	bool model_penalties = false; // threshold or lambda given while models are configured
+	std::stringstream lines(request);
+	std::string line;
+	while (std::getline(lines, line))
+	{
+		line.erase(0, line.find_first_not_of(" \t"));
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		if (line == "show")
+		{
+			continue;
+		}
+		if (line == "reload")
+		{
+			if (settings.config_path.empty())
+			{
+				return "error: no configuration file, start with --config\n";
+			}
+			if (!load_config_file(settings.config_path, config, error))
+			{
+				return "error: " + error + "\n";
+			}
+			changed = true;
+			continue;
+		}
+		if (!apply_config_line(line, config, error))
+		{
+			return "error: " + error + "\n";
+		}
+		changed = changed || (!line.empty() && line[0] != '#');
+		std::string key = line.substr(0, line.find_first_of(" \t="));
+		model_penalties = model_penalties || (!config.models.empty() && (key == "threshold" || key == "lambda"));
+	}
+	if (!changed)
+	{
+		return describe_config(settings);
+	}
+	if (!validate_config(config, error))
+	{
+		return "error: " + error + "\n";
+	}
 
-	// Main event loop
-	while (1)
+	std::vector<std::shared_ptr<Pipeline_Config>> prepared;
+	for (auto &pipeline : pipelines)
 	{
-		SINDy.start();
-		// Top level state machine will go here
+		prepared.push_back(pipeline.second->SINDy->prepare_reconfiguration(vehicle_config(config, pipeline.first), error));
+		if (!prepared.back())
+		{
+			return "error: " + error + "\n";
+		}
 	}
-	printf("\n");
+	// Only an output that passed the checks but still failed to open, eg. a disk that filled up since, stops a vehicle here
+	std::string failures;
+	size_t next = 0;
+	for (auto &pipeline : pipelines)
+	{
+		if (!pipeline.second->SINDy->reconfigure(prepared[next++], error))
+		{
+			failures += (failures.empty() ? "" : ", ") + error;
+		}
+	}
+	// Vehicles discovered from now on start with the new settings, and deadlines like the running pipelines
+	if (config.buffer_length != settings.buffer_length || config.mode != settings.mode)
+	{
+		settings.governor_settings.window_period = config.mode == buffer_mode::time_mode ? std::chrono::milliseconds(std::chrono::seconds(config.buffer_length))
+																						: std::chrono::milliseconds(0);
+	}
+	// A reload can carry threshold or lambda as well, it is applied to the models like a request line
+	model_penalties = model_penalties || (!config.models.empty() && (config.stlsq_threshold != settings.stlsq_threshold ||
+																	 config.ridge_regression_penalty != settings.ridge_regression_penalty));
+	static_cast<Runtime_Config &>(settings) = config;
+	if (!failures.empty())
+	{
+		return "error: " + failures + ", the other vehicles take the change from their next window\n";
+	}
+	std::string reply = "ok, applied to " + std::to_string(pipelines.size()) + " vehicles from their next window";
+	if (model_penalties)
+	{
+		reply += ", threshold and lambda set on all " + std::to_string(config.models.size()) + " models";
+	}
+	return reply + "\n";
+}
 
-	return;
+// SIGHUP, the flight loop reloads the configuration file on its next pass
+void reload_handler(int sig)
+{
+	reload_requested = 1;
 }
 
 // ------------------------------------------------------------------------------
 //   Parse Command Line
 // ------------------------------------------------------------------------------
-void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::string &coefficient_logfile_path, int &buffer_length, buffer_mode &mode,
-					   float &stlsq_threshold, float &ridge_regression_penalty, bool &debug, std::string &debug_logfile_path)
+// Integer argument of an option, the whole argument has to be a number within [minimum, maximum]
+int parse_option_int(const char *option, const char *argument, int minimum, int maximum)
+{
+	int value;
+	if (!parse_int(argument, value) || value < minimum || value > maximum)
+	{
+		std::cout << "Invalid argument for " << option << " option: " << argument << ", expected an integer from " << minimum << " to " << maximum << "\n";
+		throw EXIT_FAILURE;
+	}
+	return value;
+}
+
+void parse_commandline(int argc, char **argv, Program_Settings &settings)
 {
 	using namespace std;
 	// string for command line usage
 	string commandline_usage = "usage: SID_offboard\nOptions:\n-p <Device Path>\n\tudp://[host][:port]\n\ttcp://[host][:port]\n\tserial://[path][:baudrate]\n";
-	commandline_usage += "-l <logfile directory>\n-b <buffer length>\n-m <buffer mode>\n\ttime or length\n-t <STLSQ threshold>\n-r <Ridge regression penalty>\n-d <debug output>\n";
+	commandline_usage += "-l <logfile directory>\n-b <buffer length>\n-m <buffer mode>\n\ttime or length\n-t <STLSQ threshold>\n-r <Ridge regression penalty>\n-d <debug output>\n-q <pipeline queue depth>\n--pool <compute pool workers>\n";
+	commandline_usage += "--fsync <records between fsync of the coefficient log, 0 to never fsync>\n";
+	commandline_usage += "--keyframe <windows between coefficient log keyframes, 0 for dense records>\n";
+	commandline_usage += "--recorder <flight recorder file, none to disable>\n--recorder-size <flight recorder size in KiB>\n";
+	commandline_usage += "--metrics-port <localhost port serving Prometheus metrics>\n";
+	commandline_usage += "--gap-threshold <ms between two messages of a telemetry stream counted as a gap>\n";
+	commandline_usage += "--trace <trace event JSON file, needs a SINDY_TRACE build>\n--trace-size <spans kept>\n";
+	commandline_usage += "--assert-no-alloc\n\tabort when a steady state window allocates in preprocessing or regression\n";
+	commandline_usage += "--standard-errors\n\tlog the standard error of every coefficient next to the coefficient log\n";
+	commandline_usage += "--min-excitation <smallest standard deviation of the attitude and actuators along any direction>\n\tskip less excited windows, 0 solves all\n";
+	commandline_usage += "--arrival-stamps\n\ttimestamp telemetry on arrival instead of mapping the autopilot timestamps\n";
+	commandline_usage += "--hdf5 <HDF5 log file>\n--hdf5-states\n\talso store the resampled states in the HDF5 log\n";
+	commandline_usage += "--shm <shared memory name>\n\tpublish the latest models in /dev/shm, eg. /sindy_model\n";
+	commandline_usage += "--udp <host:port>\n\tstream the coefficients to a ground station\n--udp-rate <bytes per second of each vehicle's stream, 0 for no cap>\n";
+	commandline_usage += "--debug-log-size <KiB before the debug log is rotated, 0 to never rotate>\n--debug-log-files <rotated debug logs kept>\n";
+	commandline_usage += "-M <name>:<threshold>:<lambda>[:<library order>]\n\tadditional model configuration, may be repeated\n";
+	commandline_usage += "--config <configuration file>\n\tsettings in key = value lines, reloaded on SIGHUP\n";
+	commandline_usage += "--control <unix socket path>\n\tshow and change the configuration while running\n";
+	commandline_usage += "-g <governor degradations>\n\tcomma separated list of skip, library, subsample, iterations\n-w <window period ms>\n";
+	commandline_usage += "--compute-sched, --worker-sched, --ingest-sched <cpus>[:<fifo|other>[:<priority>]]\n\tthread placement, eg. 3:fifo:80\n--mlock\n";
 	char *val;
 	// Read input arguments
 	for (int i = 1; i < argc; i++)
@@ -207,7 +590,7 @@ void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::
 			if (argc > i + 1)
 			{
 				i++;
-				autopilot_path = (argv[i]);
+				settings.autopilot_path = (argv[i]);
 			}
 			else
 			{
@@ -222,7 +605,43 @@ void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::
 			if (argc > i + 1)
 			{
 				i++;
-				coefficient_logfile_path = (argv[i]);
+				settings.coefficient_logfile_path = (argv[i]);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// configuration file, options after it override its settings
+		if (strcmp(argv[i], "--config") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.config_path = argv[i];
+				std::string error;
+				if (!load_config_file(settings.config_path, settings, error))
+				{
+					std::cout << "Invalid configuration: " << error << "\n";
+					throw EXIT_FAILURE;
+				}
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// control socket
+		if (strcmp(argv[i], "--control") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.control_path = argv[i];
 			}
 			else
 			{
@@ -237,7 +656,7 @@ void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::
 			if (argc > i + 1)
 			{
 				i++;
-				buffer_length = atoi(argv[i]);
+				settings.buffer_length = parse_option_int(argv[i - 1], argv[i], 1, INT_MAX);
 			}
 			else
 			{
@@ -255,11 +674,11 @@ void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::
 				string buffer_mode_string = (argv[i]);
 				if (buffer_mode_string == "length")
 				{
-					mode = buffer_mode::length_mode;
+					settings.mode = buffer_mode::length_mode;
 				}
 				else if (buffer_mode_string == "time")
 				{
-					mode = buffer_mode::time_mode;
+					settings.mode = buffer_mode::time_mode;
 				}
 				else
 				{
@@ -280,7 +699,11 @@ void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::
 			if (argc > i + 1)
 			{
 				i++;
-				stlsq_threshold = atoi(argv[i]);
+				if (!parse_float(argv[i], settings.stlsq_threshold))
+				{
+					std::cout << "Invalid argument for -t option: " << argv[i] << "\n";
+					throw EXIT_FAILURE;
+				}
 			}
 			else
 			{
@@ -295,7 +718,11 @@ void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::
 			if (argc > i + 1)
 			{
 				i++;
-				ridge_regression_penalty = atoi(argv[i]);
+				if (!parse_float(argv[i], settings.ridge_regression_penalty))
+				{
+					std::cout << "Invalid argument for -r option: " << argv[i] << "\n";
+					throw EXIT_FAILURE;
+				}
 			}
 			else
 			{
@@ -304,48 +731,400 @@ void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::
 			}
 		}
 
-		// debug option
-		if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0)
+		// pipeline queue depth
+		if (strcmp(argv[i], "-q") == 0 || strcmp(argv[i], "--queue") == 0)
 		{
-			debug = true;
 			if (argc > i + 1)
 			{
 				i++;
-				debug_logfile_path = argv[i];
+				settings.pipeline_depth = parse_option_int(argv[i - 1], argv[i], 1, INT_MAX);
 			}
 			else
 			{
-				// std::cout << commandline_usage;
+				std::cout << commandline_usage;
 				throw EXIT_FAILURE;
 			}
 		}
-	}
-	// end: for each input argument
 
-	// Done!
-	return;
-}
+		// model configurations
+		if (strcmp(argv[i], "-M") == 0 || strcmp(argv[i], "--model") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.models.push_back(parse_model_config(argv[i]));
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
 
-// ------------------------------------------------------------------------------
-//   Quit Signal Handler
-// ------------------------------------------------------------------------------
-// this function is called when you press Ctrl-C
-void quit_handler(int sig)
-{
-	printf("\n");
-	printf("TERMINATING AT USER REQUEST\n");
-	printf("\n");
+		// coefficient log fsync cadence
+		if (strcmp(argv[i], "--fsync") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.fsync_interval = parse_option_int(argv[i - 1], argv[i], 0, INT_MAX);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
 
-	// SID
-	try
-	{
-		SINDy_quit->stop();
+		// coefficient log keyframe cadence
+		if (strcmp(argv[i], "--keyframe") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.keyframe_interval = parse_option_int(argv[i - 1], argv[i], 0, INT_MAX);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// metrics endpoint
+		if (strcmp(argv[i], "--metrics-port") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.metrics_port = parse_option_int(argv[i - 1], argv[i], 0, 65535);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// telemetry gap threshold
+		if (strcmp(argv[i], "--gap-threshold") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.gap_threshold_ms = parse_option_int(argv[i - 1], argv[i], 1, INT_MAX);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// trace event output
+		if (strcmp(argv[i], "--trace") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.trace_path = argv[i];
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		if (strcmp(argv[i], "--trace-size") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.trace_size = parse_option_int(argv[i - 1], argv[i], 1, INT_MAX);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// flight recorder
+		if (strcmp(argv[i], "--recorder") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.recorder_path = strcmp(argv[i], "none") == 0 ? "" : argv[i];
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		if (strcmp(argv[i], "--recorder-size") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.recorder_size = (size_t)parse_option_int(argv[i - 1], argv[i], 1, INT_MAX)*1024;
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// columnar HDF5 log
+		if (strcmp(argv[i], "--hdf5") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.hdf5_path = argv[i];
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// shared memory publication of the latest models
+		if (strcmp(argv[i], "--shm") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.shared_model_name = argv[i];
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// UDP coefficient stream
+		if (strcmp(argv[i], "--udp") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.stream_destination = argv[i];
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		if (strcmp(argv[i], "--udp-rate") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.stream_bandwidth = parse_option_int(argv[i - 1], argv[i], 0, INT_MAX);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		if (strcmp(argv[i], "--hdf5-states") == 0)
+		{
+			settings.hdf5_states = true;
+		}
+
+		// debug log rotation
+		if (strcmp(argv[i], "--debug-log-size") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.debug_log_size = (size_t)parse_option_int(argv[i - 1], argv[i], 0, INT_MAX)*1024;
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		if (strcmp(argv[i], "--debug-log-files") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.debug_log_files = parse_option_int(argv[i - 1], argv[i], 1, INT_MAX);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// shared compute pool size
+		if (strcmp(argv[i], "--pool") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.pool_size = parse_option_int(argv[i - 1], argv[i], 1, INT_MAX);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// governor degradations, applied in the listed order under overrun
+		if (strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--governor") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.governor_settings.degradations = parse_degradations(argv[i]);
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// window period used for deadlines
+		if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--period") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				settings.governor_settings.window_period = std::chrono::milliseconds(parse_option_int(argv[i - 1], argv[i], 0, INT_MAX));
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// thread placement and scheduling
+		if (strcmp(argv[i], "--compute-sched") == 0 || strcmp(argv[i], "--worker-sched") == 0 || strcmp(argv[i], "--ingest-sched") == 0)
+		{
+			if (argc > i + 1)
+			{
+				Thread_Settings thread_settings = parse_thread_settings(argv[i + 1]);
+				if (strcmp(argv[i], "--compute-sched") == 0)
+				{
+					settings.scheduling_settings.compute = thread_settings;
+				}
+				else if (strcmp(argv[i], "--worker-sched") == 0)
+				{
+					settings.scheduling_settings.workers = thread_settings;
+				}
+				else
+				{
+					settings.scheduling_settings.ingestion = thread_settings;
+				}
+				i++;
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// allocation check of the compute loop
+		if (strcmp(argv[i], "--assert-no-alloc") == 0)
+		{
+			settings.assert_no_allocations = true;
+		}
+
+		// coefficient standard errors
+		if (strcmp(argv[i], "--standard-errors") == 0)
+		{
+			settings.standard_errors = true;
+		}
+
+		// information gating
+		if (strcmp(argv[i], "--min-excitation") == 0)
+		{
+			if (argc > i + 1)
+			{
+				i++;
+				if (!parse_float(argv[i], settings.min_excitation) || settings.min_excitation < 0)
+				{
+					std::cout << "Invalid argument for --min-excitation option: " << argv[i] << "\n";
+					throw EXIT_FAILURE;
+				}
+			}
+			else
+			{
+				std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
+
+		// timestamp telemetry on arrival
+		if (strcmp(argv[i], "--arrival-stamps") == 0)
+		{
+			settings.autopilot_timestamps = false;
+		}
+
+		// lock process memory
+		if (strcmp(argv[i], "--mlock") == 0)
+		{
+			settings.scheduling_settings.lock_memory = true;
+		}
+
+		// debug option
+		if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0)
+		{
+			settings.debug = true;
+			if (argc > i + 1)
+			{
+				i++;
+				settings.debug_logfile_path = argv[i];
+			}
+			else
+			{
+				// std::cout << commandline_usage;
+				throw EXIT_FAILURE;
+			}
+		}
 	}
-	catch (int error)
+	// end: for each input argument
+
+	// Options given after --config override it, so the settings are only checked once all are parsed
+	std::string error;
+	if (!validate_config(settings, error))
 	{
+		std::cout << "Invalid configuration: " << error << "\n";
+		throw EXIT_FAILURE;
 	}
-	// end program here
-	exit(0);
+
+	// Done!
+	return;
+}
+
+// ------------------------------------------------------------------------------
+//   Quit Signal Handler
+// ------------------------------------------------------------------------------
+// this function is called when you press Ctrl-C
+// Only sets a flag, the flight loop stops the pipelines on the main thread
+void quit_handler(int sig)
+{
+	quit_requested = 1;
 }
 
 // ------------------------------------------------------------------------------
@@ -1,11 +1,14 @@
 #include <iostream>
 #include <stdio.h>
 #include <cstdlib>
+#include <climits>
 #include <unistd.h>
 #include <cmath>
 #include <string.h>
 #include <inttypes.h>
 #include <fstream>
+#include <sstream>
+#include <mutex>
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
@@ -13,6 +16,8 @@
 #include <array>
 #include <chrono>
 #include<utility>
+#include <map>
+#include <memory>
 
 #include <mavsdk/mavsdk.h> // general mavlink header
 #include <mavsdk/plugins/telemetry/telemetry.h> // telemetry plugin
@@ -21,6 +26,16 @@
 #include "buffer.h"
 #include "system_identification.h"
 #include "logging.h"
+#include "debug_log_sink.h"
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "trace.h"
+#include "governor.h"
+#include "scheduling.h"
+#include "worker_pool.h"
+#include "config.h"
+#include "control_socket.h"
+#include "clock_sync.h"
 
 // Top state machine logic states
 enum system_states
@@ -31,17 +46,70 @@ enum system_states
 	FLIGHT_LOG_SID_CMD_STATE = 3 // Aircraft is armed and ready for flight, system identification with commands will occur
 };
 
+// Program options, defaults are overridden from the command line
+// The settings inherited from Runtime_Config can also be changed while running, see config.h
+struct Program_Settings : Runtime_Config {
+	std::string autopilot_path = "udp://:14540";
+	std::string debug_logfile_path = "../logs/mavlink_debug_log.csv";
+	std::string config_path; // Configuration file from --config, reloaded on SIGHUP and by the reload command
+	std::string control_path; // Unix socket taking configuration changes, disabled if empty
+	bool hdf5_states = false; // Store the resampled states in the HDF5 log
+	std::string shared_model_name; // POSIX shared memory segment of the latest models, per vehicle names are derived from it, disabled if empty
+	int stream_bandwidth = 16384; // Bytes per second of each vehicle's coefficient stream, unlimited if 0
+	std::string recorder_path = "../logs/flight_recorder.bin"; // Memory mapped flight recorder, disabled if empty
+	size_t recorder_size = 4*1024*1024; // Bytes, 64 per recorded event
+	int metrics_port = 0; // Localhost port of the Prometheus metrics endpoint, disabled if 0
+	int gap_threshold_ms = 100; // Inter-arrival time above which a telemetry stream counts a gap
+	std::string trace_path; // Chrome trace event output of the span tracing, disabled if empty
+	size_t trace_size = 65536; // Spans kept in the trace ring, 48 bytes each
+	bool assert_no_allocations = false; // Abort when a steady state window allocates
+	bool standard_errors = false; // Compute and log the standard error of every coefficient
+	bool autopilot_timestamps = true; // Place samples by their autopilot timestamps, see Clock_Sync, otherwise by arrival time
+	size_t debug_log_size = 10*1024*1024; // Bytes before the debug log is rotated
+	int debug_log_files = 3; // Debug log files kept, including the current one
+
+	int pipeline_depth = 2;
+	int pool_size = 2; // Worker threads shared by all vehicle pipelines
+	int fsync_interval = 10; // Coefficient log records between fsync calls
+	int keyframe_interval = 50; // Coefficient log windows between keyframes, 0 logs dense records
+
+	Governor_Settings governor_settings;
+	Scheduling_Settings scheduling_settings;
+};
+
+// Everything needed to identify one vehicle
+struct Vehicle_Pipeline {
+	std::shared_ptr<mavsdk::System> system;
+	uint8_t system_id;
+	std::unique_ptr<Clock_Sync> clock; // Maps the autopilot timestamps onto the host clock, used by the subscriptions
+	std::unique_ptr<Buffer> input_buffer;
+	std::unique_ptr<SID> SINDy;
+	std::unique_ptr<mavsdk::Telemetry> telemetry;
+};
+
 int main(int argc, char **argv);
 //Device connection and configuration
 int setup(int argc, char **argv);
+//Vehicle discovery
+std::unique_ptr<Vehicle_Pipeline> create_vehicle_pipeline(std::shared_ptr<mavsdk::System> system, Program_Settings &settings,
+														  std::chrono::_V2::system_clock::time_point program_epoch, Worker_Pool &pool,
+														  Flight_Recorder *recorder);
+Pipeline_Config vehicle_config(const Runtime_Config &config, uint8_t system_id);
+void print_system_info(std::shared_ptr<mavsdk::System> system);
 //Runtime command handling
-void flight_loop(std::shared_ptr<mavsdk::System> system, mavsdk::Telemetry &telemetry, SID &SINDy, Buffer &input_buffer, std::string logfile_directory);
-void parse_commandline(int argc, char **argv, std::string &autopilot_path, std::string &logfile_directory, int &buffer_length, buffer_mode &mode, 
-						float &stlsq_threshold, float &ridge_regression_penalty, bool &debug, std::string &debug_logfile_path);
+void flight_loop(mavsdk::Mavsdk &mavsdk, Program_Settings &settings, std::chrono::_V2::system_clock::time_point program_epoch, Worker_Pool &pool,
+				 Flight_Recorder *recorder, Metrics_Server *metrics_server);
+int parse_option_int(const char *option, const char *argument, int minimum, int maximum);
+void parse_commandline(int argc, char **argv, Program_Settings &settings);
+//Live configuration
+std::string reconfigure_pipelines(const std::string &request, Program_Settings &settings,
+								  std::map<uint8_t, std::unique_ptr<Vehicle_Pipeline>> &pipelines);
 //Interrupt handling
-SID *SINDy_quit;
 int system_state = GROUND_IDLE_STATE;
+volatile sig_atomic_t quit_requested = 0;
 void quit_handler( int sig );
+volatile sig_atomic_t reload_requested = 0;
+void reload_handler( int sig );
 
 //Filename creation
 char* generate_filename(int flights_since_reboot);
\ No newline at end of file
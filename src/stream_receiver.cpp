@@ -0,0 +1,123 @@
+/**
+ * @file stream_receiver.cpp
+ *
+ * @brief UDP coefficient stream receiver
+ *
+ * Decodes the coefficient stream of SINDy_offboard --udp, prints a line per datagram and
+ * optionally writes the decoded coefficients as CSV, one row per vehicle, model and window
+ *
+ * usage: SINDy_stream_receiver <port> [csv output]
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "coefficient_stream.h"
+#include <netinet/in.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <iostream>
+#include <fstream>
+
+static volatile sig_atomic_t time_to_exit = 0;
+
+static void handle_quit(int sig)
+{
+	time_to_exit = 1;
+}
+
+int main(int argc, char **argv)
+{
+	if(argc != 2 && argc != 3)
+	{
+		std::cout << "usage: SINDy_stream_receiver <port> [csv output]\n";
+		return EXIT_FAILURE;
+	}
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(atoi(argv[1]));
+	if(fd < 0 || bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		std::cerr << "Could not listen on port " << argv[1] << ": " << strerror(errno) << "\n";
+		return EXIT_FAILURE;
+	}
+	std::ofstream csv;
+	if(argc == 3)
+	{
+		csv.open(argv[2], std::ios_base::trunc);
+	}
+
+	// No SA_RESTART, so the blocking receive returns on Ctrl-C
+	struct sigaction action{};
+	action.sa_handler = handle_quit;
+	sigaction(SIGINT, &action, nullptr);
+	sigaction(SIGTERM, &action, nullptr);
+
+	Coefficient_Stream_Decoder decoder;
+	Streamed_Model model;
+	std::vector<char> datagram(65536);
+	uint64_t received = 0;
+	uint64_t received_bytes = 0;
+	while(!time_to_exit)
+	{
+		ssize_t length = recv(fd, datagram.data(), datagram.size(), 0);
+		if(length < 0)
+		{
+			continue;
+		}
+		received++;
+		received_bytes += length;
+		if(!decoder.decode(datagram.data(), length, model))
+		{
+			continue;
+		}
+
+		int supported = 0;
+		for(double coefficient : model.coefficients)
+		{
+			supported += coefficient != 0;
+		}
+		const char *types[] = {"keyframe", "delta", "support delta"};
+		std::cout << "Vehicle " << (int)model.vehicle << ", model " << (int)model.model << ", window " << model.window_index << ", sequence "
+				  << model.sequence << " (" << types[model.type] << ", " << length << " bytes";
+		if(model.lost > 0)
+		{
+			std::cout << ", " << model.lost << " lost";
+		}
+		std::cout << "): " << supported << " terms, timings";
+		for(float timing : model.timings)
+		{
+			std::cout << " " << timing;
+		}
+		std::cout << "us\n";
+
+		if(csv.is_open())
+		{
+			// Row-wise coefficients like the coefficient log, then the stage timings
+			csv << (int)model.vehicle << "," << (int)model.model << "," << model.window_index << "," << model.sample_time_us << ",";
+			for(double coefficient : model.coefficients)
+			{
+				csv << coefficient << ",";
+			}
+			for(float timing : model.timings)
+			{
+				csv << timing << ",";
+			}
+			csv << "\n";
+		}
+	}
+
+	std::cout << "Received " << received << " datagrams, " << received_bytes << " bytes, " << decoder.get_lost() << " lost, "
+			  << decoder.get_undecodable() << " without keyframe, " << decoder.get_malformed() << " malformed\n";
+	close(fd);
+	return 0;
+}
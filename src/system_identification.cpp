@@ -14,6 +14,9 @@
 // ------------------------------------------------------------------------------
 
 #include "system_identification.h"
+#include <stdlib.h>
+#include <sstream>
+#include <algorithm>
 
 void* start_SID_compute_thread(void *args);
 
@@ -26,7 +29,9 @@ SID()
 }
 
 SID::
-SID(Buffer *input_buffer_, std::chrono::_V2::system_clock::time_point program_epoch, float stlsq_threshold, float ridge_regression_penalty, std::string coefficient_logfile_path_, bool debug_)
+SID(Buffer *input_buffer_, std::chrono::_V2::system_clock::time_point program_epoch, float stlsq_threshold, float ridge_regression_penalty, std::string coefficient_logfile_path_, bool debug_,
+	int pipeline_depth, Governor_Settings governor_settings)
+	: governor(governor_settings)
 {
     input_buffer = input_buffer_;
 	STLSQ_threshold = stlsq_threshold;
@@ -35,218 +40,1139 @@ SID(Buffer *input_buffer_, std::chrono::_V2::system_clock::time_point program_ep
 	flight_number = 0;
 	epoch = program_epoch;
 	debug = debug_;
+	regression_queue.set_capacity(pipeline_depth);
+	logging_queue.set_capacity(pipeline_depth);
+	models.push_back({"default", stlsq_threshold, ridge_regression_penalty, 2, coefficient_logfile_path_});
 }
 
 SID::
 ~SID()
 {
+	// Stages must not outlive the object they run on
+	if(compute_thread.joinable())
+	{
+		stop();
+	}
 }
 
 void SID::
 start()
 {
-	compute_thread = std::thread(&SID::sindy_compute, this);
+	// Stages are only launched once, subsequent calls are ignored
+	if(compute_thread.joinable())
+	{
+		return;
+	}
+	std::cout << name << ": Performing sindy\n";
+	compute_status = true;
+	// The settings given before start are the first configuration, reconfigure() replaces it while running
+	std::shared_ptr<Pipeline_Config> initial = std::make_shared<Pipeline_Config>();
+	initial->models = models;
+	initial->hdf5_path = hdf5_path;
+	initial->stream_destination = stream_destination;
+	initial->debug = debug;
+	initial->min_excitation = min_excitation;
+	open_outputs(*initial, nullptr);
+	{
+		std::lock_guard<std::mutex> lock(config_mutex);
+		current_config = initial;
+		pending_config.reset();
+	}
+
+	if(!shared_model_name.empty())
+	{
+		std::vector<std::string> model_names;
+		for(const Model_Config &model : models)
+		{
+			model_names.push_back(model.name);
+		}
+		model_publisher.reset(new Model_Publisher(shared_model_name, model_names, candidate_names(), derivative_names()));
+	}
+
+	// Every window the stages and queues can hold at once, each with storage for the configured window length
+	// Later windows reuse them, so after the first window the compute loop runs without heap allocations
+	int num_windows = regression_queue.get_capacity() + logging_queue.get_capacity() + 3;
+	free_windows.set_capacity(num_windows);
+	for(int i = 0; i < num_windows; i++)
+	{
+		SID_Window window;
+		window.workspace.reserve(window_capacity);
+		window.coefficients.assign(models.size(), arma::mat(MAX_CANDIDATES, NUM_DERIVATIVES, arma::fill::zeros));
+		window.validation.assign(models.size(), Validation_Result());
+		if(compute_standard_errors)
+		{
+			window.standard_errors.assign(models.size(), arma::mat(MAX_CANDIDATES, NUM_DERIVATIVES, arma::fill::zeros));
+		}
+		free_windows.push(std::move(window));
+	}
+	stlsq_workspaces.assign(models.size(), STLSQ_Workspace(MAX_CANDIDATES));
+	model_iterations.assign(models.size(), 0);
+	model_allocations.assign(2*models.size(), Allocation_Count());
+	previous_models.assign(models.size(), Model_Plan());
+	previous_models_valid = false;
+
+	logging_thread = std::thread(&SID::logging_stage, this);
+	regression_thread = std::thread(&SID::regression_stage, this);
+	compute_thread = std::thread(&SID::preprocess_stage, this);
+
+	// Report the placement actually applied to each stage
+	std::cout << apply_thread_settings(compute_thread.native_handle(), compute_settings, name + " preprocessing thread") << "\n";
+	std::cout << apply_thread_settings(regression_thread.native_handle(), compute_settings, name + " regression thread") << "\n";
+	std::cout << apply_thread_settings(logging_thread.native_handle(), worker_settings, name + " logging thread") << "\n";
+}
+
+// Must be called before start(), STLSQ is then scheduled on the shared pool
+void SID::
+set_worker_pool(Worker_Pool *pool_)
+{
+	pool = pool_;
+	pool_client = pool->register_client();
+}
+
+void SID::
+set_name(std::string name_)
+{
+	name = name_;
+}
+
+// Must be called before start(), records between fsync calls of the coefficient logs
+void SID::
+set_fsync_interval(int fsync_interval_)
+{
+	fsync_interval = fsync_interval_;
+}
+
+// Must be called before start(), windows between keyframes of the coefficient logs, 0 logs dense records
+void SID::
+set_keyframe_interval(int keyframe_interval_)
+{
+	keyframe_interval = keyframe_interval_;
+}
+
+// Must be called before start(), adds a columnar HDF5 log holding every model of this pipeline
+void SID::
+set_hdf5_output(std::string path, bool include_states)
+{
+	hdf5_path = path;
+	hdf5_states = include_states;
+}
+
+// Must be called before start(), publishes the latest models of every window in a POSIX shared memory segment
+void SID::
+set_shared_model(std::string name)
+{
+	shared_model_name = name;
+}
+
+// Must be called before start(), streams the coefficients of every window over UDP to host:port within bandwidth bytes per second
+void SID::
+set_coefficient_stream(std::string destination, uint8_t vehicle, double bandwidth)
+{
+	stream_destination = destination;
+	stream_vehicle = vehicle;
+	stream_bandwidth = bandwidth;
+}
+
+// Must be called before start(), every solve also returns the standard errors of its coefficients
+void SID::
+set_standard_errors(bool enabled)
+{
+	compute_standard_errors = enabled;
+}
+
+// Must be called before start(), windows less excited than this are not solved, see window_excitation
+void SID::
+set_min_excitation(float min_excitation_)
+{
+	min_excitation = min_excitation_;
+}
+
+// Must be called before start(), stage events are recorded with the given vehicle id
+void SID::
+set_recorder(Flight_Recorder *recorder_, uint8_t source)
+{
+	recorder = recorder_;
+	recorder_source = source;
+}
+
+// Must be called before start(), window workspaces are sized for this many resampled samples
+// Longer windows grow the workspace of their slot, which is an allocation
+void SID::
+set_window_capacity(int samples)
+{
+	window_capacity = samples;
+}
+
+// Abort with a report when a steady state window allocates on the preprocessing or regression stage
+// The first window and windows that had to grow their workspace are not steady state
+void SID::
+set_allocation_check(bool enabled)
+{
+	assert_no_allocations = enabled;
+}
+
+// Must be called before start(), replaces the default model built from the constructor arguments
+void SID::
+set_models(std::vector<Model_Config> models_)
+{
+	if(!models_.empty())
+	{
+		models = models_;
+	}
+}
+
+// Must be called before start()
+void SID::
+set_thread_settings(Thread_Settings compute, Thread_Settings workers)
+{
+	compute_settings = compute;
+	worker_settings = workers;
+}
+
+// Open the outputs of a configuration, outputs with the same path as in the previous configuration are shared with it
+// Each model logs through its own background writer, the pipeline threads never touch the filesystem
+void SID::
+open_outputs(Pipeline_Config &config, const Pipeline_Config *previous)
+{
+	Pipeline_Outputs &outputs = config.outputs;
+	outputs.loggers.assign(config.models.size(), nullptr);
+	outputs.standard_error_loggers.assign(config.models.size(), nullptr);
+	for(size_t m = 0; m < config.models.size(); m++)
+	{
+		const std::string &path = config.models[m].coefficient_logfile_path;
+		if(previous != nullptr && previous->models[m].coefficient_logfile_path == path)
+		{
+			outputs.loggers[m] = previous->outputs.loggers[m];
+			outputs.standard_error_loggers[m] = previous->outputs.standard_error_loggers[m];
+			continue;
+		}
+		outputs.loggers[m].reset(new Coefficient_Logger(path, coefficient_log_header(), candidate_names().size(), derivative_names().size(),
+														model_statistic_names().size(), fsync_interval, keyframe_interval));
+		// Standard errors go to a second log per model in the same format, without the statistics
+		if(compute_standard_errors && !path.empty())
+		{
+			outputs.standard_error_loggers[m].reset(new Coefficient_Logger(insert_path_suffix(path, "stderr"), standard_error_log_header(),
+																		   candidate_names().size(), derivative_names().size(), 0, fsync_interval,
+																		   keyframe_interval));
+		}
+	}
+
+	if(previous != nullptr && previous->hdf5_path == config.hdf5_path)
+	{
+		outputs.hdf5_writer = previous->outputs.hdf5_writer;
+	}
+	else if(!config.hdf5_path.empty())
+	{
+		std::vector<std::string> model_names;
+		for(const Model_Config &model : config.models)
+		{
+			model_names.push_back(model.name);
+		}
+		// Window statistics, then the validation of every model
+		std::vector<std::string> statistic_names = window_statistic_names();
+		for(const Model_Config &model : config.models)
+		{
+			for(const std::string &statistic : validation_statistic_names())
+			{
+				statistic_names.push_back(model.name + " " + statistic);
+			}
+		}
+		outputs.hdf5_writer.reset(new Hdf5_Writer(config.hdf5_path, model_names, candidate_names(), derivative_names(), stage_timing_names(),
+												  statistic_names, hdf5_states));
+	}
+
+	if(previous != nullptr && previous->stream_destination == config.stream_destination)
+	{
+		outputs.streamer = previous->outputs.streamer;
+	}
+	else if(!config.stream_destination.empty())
+	{
+		outputs.streamer.reset(new Coefficient_Streamer(config.stream_destination, stream_vehicle, config.models.size(), stream_bandwidth));
+	}
+}
+
+// Check a configuration against the running pipeline, returns null with the reason if it can not be applied
+// Has no side effects, new outputs are only checked and are opened by reconfigure(), so a change to several
+// pipelines can be checked on all of them before any file is created or truncated
+std::shared_ptr<Pipeline_Config> SID::
+prepare_reconfiguration(const Pipeline_Config &requested, std::string &error)
+{
+	std::shared_ptr<const Pipeline_Config> latest = get_config();
+	if(!latest)
+	{
+		error = name + " is not running";
+		return nullptr;
+	}
+	// Windows, workspaces and logs are laid out for the models given at start
+	bool same_models = requested.models.size() == models.size();
+	for(size_t m = 0; same_models && m < models.size(); m++)
+	{
+		same_models = requested.models[m].name == models[m].name;
+	}
+	if(!same_models)
+	{
+		error = name + ": models can only be retuned while running, not added, removed or reordered";
+		return nullptr;
+	}
+	for(const Model_Config &model : requested.models)
+	{
+		if(model.coefficient_logfile_path.empty())
+		{
+			error = name + ": model " + model.name + " has no coefficient log";
+			return nullptr;
+		}
+	}
+	if(requested.buffer_length < 0)
+	{
+		error = name + ": buffer length must not be negative";
+		return nullptr;
+	}
+
+	// Outputs whose path did not change are shared, see open_outputs
+	for(size_t m = 0; m < requested.models.size(); m++)
+	{
+		const std::string &path = requested.models[m].coefficient_logfile_path;
+		if(path != latest->models[m].coefficient_logfile_path &&
+		   (!writable_path(path) || (compute_standard_errors && !writable_path(insert_path_suffix(path, "stderr")))))
+		{
+			error = name + ": can not write the coefficient log " + path;
+			return nullptr;
+		}
+	}
+	if(!requested.hdf5_path.empty() && requested.hdf5_path != latest->hdf5_path)
+	{
+#ifdef SINDY_USE_HDF5
+		if(!writable_path(requested.hdf5_path))
+		{
+			error = name + ": can not write the HDF5 log " + requested.hdf5_path;
+			return nullptr;
+		}
+#else
+		error = name + ": built without SINDY_USE_HDF5, no HDF5 log can be written";
+		return nullptr;
+#endif
+	}
+	if(!requested.stream_destination.empty() && requested.stream_destination != latest->stream_destination)
+	{
+		sockaddr_storage address;
+		socklen_t length;
+		std::string reason;
+		if(!resolve_stream_destination(requested.stream_destination, address, length, reason))
+		{
+			error = name + ": " + reason;
+			return nullptr;
+		}
+	}
+
+	std::shared_ptr<Pipeline_Config> config = std::make_shared<Pipeline_Config>(requested);
+	config->outputs = Pipeline_Outputs();
+	return config;
 }
 
+// Open the outputs of a configuration from prepare_reconfiguration() and apply it at the next window boundary
+// The preprocessing stage takes it before its next buffer clear, windows already taken finish with the configuration they started with
+// A configuration that has not been taken yet is replaced, outputs it shares a path with are kept open
+// Returns false with the reason if an output could not be opened, the pipeline then keeps its configuration
+bool SID::
+reconfigure(std::shared_ptr<Pipeline_Config> config, std::string &error)
+{
+	std::shared_ptr<const Pipeline_Config> latest = get_config();
+	try
+	{
+		open_outputs(*config, latest.get());
+	}
+	catch(int error_code)
+	{
+		error = name + ": could not open the new outputs";
+		return false;
+	}
+	std::lock_guard<std::mutex> lock(config_mutex);
+	pending_config = config;
+	return true;
+}
+
+// Latest configuration, including one waiting for the next window, null before start
+std::shared_ptr<const Pipeline_Config> SID::
+get_config() const
+{
+	std::lock_guard<std::mutex> lock(config_mutex);
+	return pending_config ? pending_config : current_config;
+}
+
+// First pipeline stage, waits on the input buffer and prepares the regression inputs
 void SID::
-sindy_compute()
+preprocess_stage()
 {
-	using namespace std;
-	cout << "Performing sindy\n";
-    compute_status = true;
-	arma::running_stat<double> stats;
-	initialize_logfile(coefficient_logfile_path); //Write header to coefficient logfile
+	TRACE_THREAD_NAME(name + " preprocessing");
+	uint64_t window_index = 0;
+	uint64_t uninformative_windows = 0; // Windows skipped for too little excitation
+	bool steady = false; // Set once the first window is through
+	Data_Buffer data; // Swapped with the input buffer, so both keep their capacity
+	SID_Window window;
+	Ingestion_Snapshot previous_ingestion = input_buffer->get_ingestion().snapshot();
     while ( ! time_to_exit )
 	{
+		// Blocks while every window is still in the later stages
+		if(!free_windows.pop(window))
+		{
+			break;
+		}
+		Allocation_Scope allocations;
+		window.index = window_index++;
+
+		// Window boundary, a new configuration applies from the window the buffer is collecting now
+		std::shared_ptr<const Pipeline_Config> next_config;
+		{
+			std::lock_guard<std::mutex> lock(config_mutex);
+			if(pending_config)
+			{
+				next_config = std::move(pending_config);
+				current_config = next_config;
+			}
+		}
+		if(next_config)
+		{
+			if(next_config->buffer_length > 0 && input_buffer->set_window(next_config->buffer_length, next_config->mode))
+			{
+				// Deadlines follow the new window, in length mode the period is measured again
+				governor.set_window_period(next_config->mode == buffer_mode::time_mode ? std::chrono::milliseconds(std::chrono::seconds(next_config->buffer_length))
+																					  : std::chrono::milliseconds(0));
+			}
+			std::cout << name << ": Configuration applied from window " << window.index << "\n";
+		}
+
 		auto t1 = std::chrono::high_resolution_clock::now();
-        Data_Buffer data = input_buffer->clear();
-		//std::cout << "Cleared Buffer\n";
+        input_buffer->clear(data);
 		auto t2 = std::chrono::high_resolution_clock::now();
-		Vehicle_States states = linear_interpolate(data, 200); // Resample input buffer and compute desired states
+		if(time_to_exit)
+		{
+			break;
+		}
+		window.clear_time = std::chrono::steady_clock::now();
+
+		// Stream health over the span of this window, taken for dropped windows as well so the next one starts here
+		Ingestion_Snapshot ingestion = input_buffer->get_ingestion().snapshot();
+		ingestion_statistics(previous_ingestion, ingestion, window.ingestion.data());
+		previous_ingestion = ingestion;
+
+		// A stream without samples can not be interpolated, drop the window instead of the process
+		if(data.find_min_length() == 0)
+		{
+			if(recorder != nullptr)
+			{
+				recorder->record(window_incomplete, recorder_source, window.index,
+								 {(float)data.attitude_time_us.size(), (float)data.angular_velocity_time_us.size(),
+								  (float)data.position_time_us.size(), (float)data.actuator_time_us.size()});
+			}
+			metrics.incomplete_windows.fetch_add(1, std::memory_order_relaxed);
+			if(current_config->debug)
+			{
+				std::cout << name << ": Window " << window.index << " is missing a telemetry stream, skipped\n";
+			}
+			free_windows.push(std::move(window));
+			continue;
+		}
+
+		// Ask the governor how much work this window can afford
+		window.decision = governor.window_ready(window.clear_time, regression_queue.depth());
+		if(window.decision.skip)
+		{
+			if(recorder != nullptr)
+			{
+				recorder->record(window_skipped, recorder_source, window.index, {(float)window.decision.level});
+			}
+			metrics.skipped_windows.fetch_add(1, std::memory_order_relaxed);
+			if(current_config->debug)
+			{
+				std::cout << name << ": Governor skipped window " << window.index << "\n";
+			}
+			free_windows.push(std::move(window));
+			continue;
+		}
+
+		SID_Workspace &workspace = window.workspace;
+		{
+			// Resample input buffer and compute desired states, the derivatives are resampled straight into the workspace
+			TRACE_SPAN_ARG("linear_interpolate", window.index);
+			window.workspace_grown = linear_interpolate(data, 200/window.decision.sample_rate_divisor, workspace);
+		}
 		auto t3 = std::chrono::high_resolution_clock::now();
-		//std::cout << "Interpolated Buffer\n";
-		arma::mat candidate_functions = compute_candidate_functions(states); //Generate Candidate Function
+		{
+			// Attitude to radians, body frame velocities and the aerodynamic states, before the library is built from them
+			TRACE_SPAN_ARG("transform_states", window.index);
+			transform_states(workspace, data.velocity_ned);
+		}
 		auto t4 = std::chrono::high_resolution_clock::now();
-		//std::cout << "Computed Candidates\n";
-		arma::mat derivatives = get_derivatives(states); //Get state derivatives for SINDy
+		{
+			TRACE_SPAN_ARG("candidate_functions", window.index);
+			workspace.num_features = candidate_count(window.decision.library_order);
+			arma::mat candidate_functions = workspace.candidate_functions();
+			compute_candidate_functions(workspace.basis_states(), window.decision.library_order, candidate_functions); //Generate Candidate Function
+		}
 		auto t5 = std::chrono::high_resolution_clock::now();
-		//std::cout << "Computed Derivatives\n";
-		arma::mat coefficients = STLSQ(derivatives, candidate_functions, STLSQ_threshold, lambda); //Run STLSQ
+		assert(workspace.derivatives().n_cols == workspace.candidate_functions().n_cols); // Check that number of samples in candidate functions and derivatives are equal
+		{
+			// Gram blocks are shared by every model, smaller libraries use their leading block
+			// The products are written straight into the workspace, which has exactly their size
+			TRACE_SPAN_ARG("gram", window.index);
+			arma::mat candidate_functions = workspace.candidate_functions();
+			arma::mat gram = workspace.gram();
+			arma::mat projections = workspace.projections();
+			gram = candidate_functions * candidate_functions.t();
+			projections = candidate_functions * workspace.derivatives().t();
+
+			// Squared norm of each derivative, the residual variance of the standard errors is taken from it and the Gram blocks
+			workspace.derivative_energy.fill(0);
+			const double *derivatives = workspace.derivative_storage.data();
+			for(int sample = 0; sample < workspace.num_samples; sample++)
+			{
+				for(int d = 0; d < NUM_DERIVATIVES; d++)
+				{
+					double value = derivatives[sample*NUM_DERIVATIVES + d];
+					workspace.derivative_energy[d] += value*value;
+				}
+			}
+		}
 		auto t6 = std::chrono::high_resolution_clock::now();
-		//std::cout << "Completed STLSQ\n";
 
-		assert(states.num_samples == candidate_functions.n_cols); // Check that number of samples are preserved after computing candidate functions
-		assert(candidate_functions.n_cols == derivatives.n_cols); // Check that number of samples in candidate functions and derivatives are equal
-		assert(candidate_functions.n_rows == coefficients.n_rows); // Check that number of features is equal in the candidate functions and solved coefficients
+		window.clear_buffer_time = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
+		window.interpolation_time = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2);
+		window.transform_time = std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3);
+		window.candidate_computation_time = std::chrono::duration_cast<std::chrono::microseconds>(t5 - t4);
+		window.gram_time = std::chrono::duration_cast<std::chrono::microseconds>(t6 - t5);
+		metrics.buffer_wait.record(std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1));
+		metrics.interpolation.record(window.interpolation_time);
+		metrics.transform.record(window.transform_time);
+		metrics.candidate_functions.record(window.candidate_computation_time);
+		metrics.gram.record(window.gram_time);
+		metrics.samples.fetch_add(workspace.num_samples, std::memory_order_relaxed);
+		if(recorder != nullptr)
+		{
+			recorder->record(preprocess_done, recorder_source, window.index,
+							 {(float)window.interpolation_time.count(), (float)window.candidate_computation_time.count(),
+							  (float)window.gram_time.count(), (float)workspace.num_samples, (float)window.transform_time.count()});
+		}
 
-    	auto clear_buffer_time = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1);
-    	auto interpolation_time = std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2);
-		auto candidate_computation_time = std::chrono::duration_cast<std::chrono::microseconds>(t4 - t3);
-		auto derivative_time = std::chrono::duration_cast<std::chrono::microseconds>(t5 - t4);
-		auto SINDy_time = std::chrono::duration_cast<std::chrono::microseconds>(t6 - t5);
+		window.preprocess_allocations = allocations.elapsed();
+		metrics.preprocess_allocations.record(window.preprocess_allocations.allocations, window.preprocess_allocations.bytes);
+		check_allocations("preprocessing", window, window.preprocess_allocations, steady && !window.workspace_grown);
+		steady = true;
 
-		std::chrono::microseconds coefficient_sample_time = std::chrono::duration_cast<std::chrono::microseconds>(t6 - epoch);
+		// A window that barely moves the attitude and actuators can not support a model, its solve would only fit noise
+		window.excitation = window_excitation(workspace.gram(), workspace.num_samples);
+		metrics.excitation.store(window.excitation, std::memory_order_relaxed);
+		if(window.excitation < current_config->min_excitation)
+		{
+			if(recorder != nullptr)
+			{
+				recorder->record(window_uninformative, recorder_source, window.index, {(float)window.excitation, current_config->min_excitation});
+			}
+			uninformative_windows++;
+			metrics.uninformative_windows.fetch_add(1, std::memory_order_relaxed);
+			if(current_config->debug)
+			{
+				std::cout << name << ": Window " << window.index << " is not informative, excitation " << window.excitation << " below "
+						  << current_config->min_excitation << ", skipped\n";
+			}
+			free_windows.push(std::move(window));
+			continue;
+		}
+		window.uninformative_windows = uninformative_windows;
+
+		// Blocks while the regression stage is still busy with earlier windows
+		window.config = current_config;
+		if(!regression_queue.push(std::move(window)))
+		{
+			break;
+		}
+	}
+	regression_queue.close();
+	return;
+}
 
-		stats(SINDy_time.count());
+// Second pipeline stage, solves for the model coefficients
+void SID::
+regression_stage()
+{
+	TRACE_THREAD_NAME(name + " regression");
+	SID_Window window;
+	bool steady = false; // Set once the first window is through
 
-		if(debug){
-			std::cout << "Buffer Clear: " << clear_buffer_time.count() << "ms\n";
-			std::cout << "Interpolation: " << interpolation_time.count() << "us\n";
-			std::cout << "Candidate Functions: " << candidate_computation_time.count() << "us\n";
-			std::cout << "Derivative Parse: " << derivative_time.count() << "us\n";
-			std::cout << "SINDy: " << SINDy_time.count() << "us\n";
-			std::cout << "SINDy Average: " << stats.mean() << "us\n";
-			std::cout << "SINDy: " << stats.stddev() << "us\n";
-			std::cout << "Buffer Size: " << states.num_samples << " samples\n";
-			coefficients.print();
+	// Each model solves into its own coefficient slot of the window with its own STLSQ workspace
+	// Items past the models validate the previous window's models on this window, next to the solves
+	// The two captures fit std::function's inline storage, it is built once and never allocates
+	std::function<void(size_t)> solve = [this, &window](size_t item){
+		Allocation_Scope allocations;
+		if(item < models.size())
+		{
+			solve_model(window, window.config->models[item], &model_iterations[item], stlsq_workspaces[item], window.coefficients[item],
+						compute_standard_errors ? &window.standard_errors[item] : nullptr);
+		}
+		else
+		{
+			validate_previous_model(window, item - models.size());
+		}
+		model_allocations[item] = allocations.elapsed();
+	};
+	while(regression_queue.pop(window))
+	{
+		TRACE_SPAN_ARG("regression", window.index);
+		Allocation_Scope allocations;
+		auto t1 = std::chrono::high_resolution_clock::now();
+		std::fill(model_iterations.begin(), model_iterations.end(), 0);
+		for(Validation_Result &validation : window.validation)
+		{
+			validation.clear();
+		}
+		size_t items = previous_models_valid ? 2*models.size() : models.size();
+		if(pool != nullptr)
+		{
+			// Fan the models out over the shared pool, other pipelines are served round-robin
+			pool->run(pool_client, solve, items);
+		}
+		else
+		{
+			for(size_t item = 0; item < items; item++)
+			{
+				solve(item);
+			}
+		}
+		auto t2 = std::chrono::high_resolution_clock::now();
+
+		// The models of this window are validated on the next one
+		for(size_t m = 0; m < models.size(); m++)
+		{
+			previous_models[m].compile(window.coefficients[m]);
+		}
+		previous_models_valid = true;
+
+		window.deadline_missed = governor.window_complete(window.clear_time, std::chrono::steady_clock::now());
+		window.deadline_misses = governor.get_deadline_misses();
+		window.skipped_windows = governor.get_skipped_windows();
+
+		window.SINDy_time = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1);
+		metrics.stlsq.record(window.SINDy_time);
+		for(int iterations : model_iterations)
+		{
+			metrics.stlsq_iterations.fetch_add(iterations, std::memory_order_relaxed);
+		}
+		if(window.deadline_missed)
+		{
+			metrics.deadline_misses.fetch_add(1, std::memory_order_relaxed);
+		}
+		window.sample_time = std::chrono::duration_cast<std::chrono::microseconds>(t2 - epoch);
+		if(model_publisher)
+		{
+			// Co-located consumers get the models before they are queued for logging
+			model_publisher->publish(window.index, window.sample_time, window.clear_time, window.coefficients, window.standard_errors, window.validation);
+		}
+		if(recorder != nullptr)
+		{
+			recorder->record(regression_done, recorder_source, window.index,
+							 {(float)window.SINDy_time.count(), (float)window.deadline_missed, (float)window.decision.level});
+		}
+
+		// Solves on the pool workers are counted on their threads
+		window.regression_allocations = allocations.elapsed();
+		for(size_t m = 0; pool != nullptr && m < items; m++)
+		{
+			window.regression_allocations.allocations += model_allocations[m].allocations;
+			window.regression_allocations.bytes += model_allocations[m].bytes;
+		}
+		metrics.regression_allocations.record(window.regression_allocations.allocations, window.regression_allocations.bytes);
+		check_allocations("regression", window, window.regression_allocations, steady && !window.workspace_grown);
+		steady = true;
+
+		if(!logging_queue.push(std::move(window)))
+		{
+			break;
+		}
+	}
+	logging_queue.close();
+	return;
+}
+
+// Final pipeline stage, writes out the coefficients
+void SID::
+logging_stage()
+{
+	TRACE_THREAD_NAME(name + " logging");
+	SID_Window window;
+	// Configuration of the last logged window, holds its outputs so outputs replaced by a reconfiguration are closed on this thread
+	std::shared_ptr<const Pipeline_Config> logged_config;
+	while(logging_queue.pop(window))
+	{
+		TRACE_SPAN_ARG("logging", window.index);
+		Allocation_Scope allocations;
+		auto logging_start = std::chrono::steady_clock::now();
+		Platform_Status platform = read_platform_status();
+		logged_config = std::move(window.config);
+		const std::vector<Model_Config> &window_models = logged_config->models;
+		const Pipeline_Outputs &outputs = logged_config->outputs;
+
+		if(logged_config->debug){
+			std::cout << name << " Window: " << window.index << "\n";
+			std::cout << "Buffer Clear: " << window.clear_buffer_time.count() << "ms\n";
+			std::cout << "Interpolation: " << window.interpolation_time.count() << "us\n";
+			std::cout << "Frame Transform: " << window.transform_time.count() << "us\n";
+			std::cout << "Candidate Functions: " << window.candidate_computation_time.count() << "us\n";
+			std::cout << "Gram Blocks: " << window.gram_time.count() << "us\n";
+			std::cout << "SINDy: " << window.SINDy_time.count() << "us\n";
+			std::cout << "SINDy p50/p99/max: " << metrics.stlsq.quantile(0.5) << "/" << metrics.stlsq.quantile(0.99) << "/" << metrics.stlsq.get_max() << "us\n";
+			std::cout << "Buffer Size: " << window.workspace.num_samples << " samples\n";
+			for(int stream = 0; stream < NUM_TELEMETRY_STREAMS; stream++)
+			{
+				const double *health = window.ingestion.data() + stream*NUM_STREAM_STATISTICS;
+				std::cout << "Stream " << telemetry_stream_name(stream) << ": " << health[0] << "Hz, jitter " << health[1] << "us, " << health[2]
+						  << " gaps, blocked " << health[3] << "ms, lock hold " << health[4] << "us\n";
+			}
+			std::cout << "Allocations: " << window.preprocess_allocations.allocations << " preprocessing, " << window.regression_allocations.allocations
+					  << " regression" << (window.workspace_grown ? " (workspace grown)" : "") << "\n";
+			std::cout << "Window Period: " << governor.get_window_period().count() << "us\n";
+			std::cout << "Deadline Misses: " << window.deadline_misses << (window.deadline_missed ? " (missed)" : "") << "\n";
+			std::cout << "Governor Level: " << window.decision.level << "\n";
+			std::cout << "Excitation: " << window.excitation << " (" << window.uninformative_windows << " windows skipped below "
+					  << logged_config->min_excitation << ")\n";
+			std::cout << "Regression Queue: " << regression_queue.depth() << "/" << regression_queue.get_capacity()
+					  << " (max " << regression_queue.max_depth() << ")\n";
+			std::cout << "Logging Queue: " << logging_queue.depth() << "/" << logging_queue.get_capacity()
+					  << " (max " << logging_queue.max_depth() << ")\n";
+			if(pool != nullptr)
+			{
+				std::cout << "Pool Pending: " << pool->pending(pool_client) << ", Completed: " << pool->completed(pool_client) << "\n";
+			}
+			for(size_t m = 0; m < window_models.size(); m++)
+			{
+				std::cout << window_models[m].name << " Log: " << outputs.loggers[m]->get_logged() << " written, " << outputs.loggers[m]->get_dropped()
+						  << " dropped\n";
+				window.coefficients[m].print(window_models[m].name + ":");
+				if(compute_standard_errors)
+				{
+					window.standard_errors[m].print(window_models[m].name + " standard errors:");
+				}
+				const Validation_Result &validation = window.validation[m];
+				if(validation.steps > 0)
+				{
+					std::cout << window_models[m].name << " Validation RMS (psi, theta, phi, x, y, z) over " << validation.steps << " steps\n  one-step:";
+					for(double error : validation.one_step)
+					{
+						std::cout << " " << error;
+					}
+					std::cout << "\n  multi-step:";
+					for(double error : validation.multi_step)
+					{
+						std::cout << " " << error;
+					}
+					std::cout << "\n";
+				}
+			}
+			if(outputs.streamer)
+			{
+				std::cout << "UDP Stream: " << outputs.streamer->get_sent() << " sent, " << outputs.streamer->get_sent_bytes() << " bytes, "
+						  << outputs.streamer->get_dropped() << " dropped\n";
+			}
+			if(outputs.hdf5_writer)
+			{
+				std::cout << "HDF5 Log: " << outputs.hdf5_writer->get_logged() << " written, " << outputs.hdf5_writer->get_dropped() << " dropped\n";
+			}
 		}
 
 		//Log Results
 
 		//log_buffer_to_csv(interpolated_telemetry, filename);
-		log_coeff(coefficients, coefficient_logfile_path, coefficient_sample_time);
-		//coefficients.save(arma::hdf5_name(logfile_directory + "Flight Number: " + to_string(flight_number)+".hdf5", "coefficients", arma::hdf5_opts::append));
+		std::vector<double> window_statistics = {(double)window.deadline_misses, (double)window.decision.level, (double)window.skipped_windows,
+												 platform.cpu_frequency_mhz, platform.cpu_temperature_c, window.excitation, (double)window.uninformative_windows};
+		window_statistics.insert(window_statistics.end(), window.ingestion.begin(), window.ingestion.end());
+		std::vector<double> model_statistics;
+		for(size_t m = 0; m < window_models.size(); m++)
+		{
+			// Each model logs its own validation after the window statistics
+			const Validation_Result &validation = window.validation[m];
+			model_statistics.assign(window_statistics.begin(), window_statistics.end());
+			model_statistics.insert(model_statistics.end(), validation.one_step.begin(), validation.one_step.end());
+			model_statistics.insert(model_statistics.end(), validation.multi_step.begin(), validation.multi_step.end());
+			if(!outputs.loggers[m]->log(window.coefficients[m], window.sample_time, model_statistics))
+			{
+				metrics.dropped_records.fetch_add(1, std::memory_order_relaxed);
+			}
+			if(outputs.standard_error_loggers[m] && !outputs.standard_error_loggers[m]->log(window.standard_errors[m], window.sample_time, {}))
+			{
+				metrics.dropped_records.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		// Same order as stage_timing_names
+		std::vector<double> timings = {(double)std::chrono::duration_cast<std::chrono::microseconds>(window.clear_buffer_time).count(),
+									   (double)window.interpolation_time.count(), (double)window.transform_time.count(), (double)window.candidate_computation_time.count(),
+									   (double)window.gram_time.count(), (double)window.SINDy_time.count()};
+		if(outputs.streamer)
+		{
+			outputs.streamer->publish(window.index, window.sample_time, window.coefficients, timings);
+		}
+		if(outputs.hdf5_writer)
+		{
+			Vehicle_States states;
+			if(hdf5_states)
+			{
+				states = resampled_states(window.workspace);
+			}
+			for(const Validation_Result &validation : window.validation)
+			{
+				window_statistics.insert(window_statistics.end(), validation.one_step.begin(), validation.one_step.end());
+				window_statistics.insert(window_statistics.end(), validation.multi_step.begin(), validation.multi_step.end());
+			}
+			if(!outputs.hdf5_writer->log(window.index, window.sample_time, window.clear_time, window.coefficients, timings, window_statistics, states))
+			{
+				metrics.dropped_records.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		if(recorder != nullptr)
+		{
+			recorder->record(window_logged, recorder_source, window.index, {(float)window_models.size()});
+		}
+		auto logging_end = std::chrono::steady_clock::now();
+		metrics.logging.record(std::chrono::duration_cast<std::chrono::microseconds>(logging_end - logging_start));
+		metrics.end_to_end.record(std::chrono::duration_cast<std::chrono::microseconds>(logging_end - window.clear_time));
+		metrics.windows.fetch_add(1, std::memory_order_relaxed);
+		Allocation_Count logging_allocations = allocations.elapsed();
+		metrics.logging_allocations.record(logging_allocations.allocations, logging_allocations.bytes);
+
+		// Back to preprocessing, the slot keeps its workspace and coefficient storage
+		free_windows.push(std::move(window));
 	}
+	free_windows.close();
 	compute_status = false;
 	return;
 }
 
+// Run STLSQ for one model configuration on the shared Gram blocks of a window
+// coefficients always has the full second order layout, reduced libraries leave the trailing rows at zero
+// standard_errors, if set, has the same layout
+void SID::
+solve_model(SID_Window &window, const Model_Config &model, int *iterations, STLSQ_Workspace &workspace, arma::mat &coefficients,
+			arma::mat *standard_errors)
+{
+	TRACE_SPAN_ARG("solve_model", window.index);
+	// A first order library is the leading block of the second order library
+	int order = std::min(model.library_order, window.decision.library_order);
+	int num_features = candidate_count(order);
+
+	STLSQ_gram(window.workspace.gram(), window.workspace.projections(), num_features, model.threshold, model.lambda, window.decision.max_iterations,
+			   iterations, workspace, coefficients, standard_errors, window.workspace.derivative_energy.data(), window.workspace.num_samples);
+}
+
+// Forward simulate the previous window's model over this window, runs on the pool next to the solves
+void SID::
+validate_previous_model(SID_Window &window, size_t model)
+{
+	TRACE_SPAN_ARG("validate_model", window.index);
+	auto start = std::chrono::steady_clock::now();
+	validate_model(previous_models[model], window.workspace, window.validation[model]);
+	metrics.validation.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start));
+}
+
+// Report a steady state window that allocated and abort, if the allocation check is enabled
 void SID::
-initialize_logfile(std::string filename)
+check_allocations(const char *stage, const SID_Window &window, const Allocation_Count &count, bool steady)
+{
+	if(!assert_no_allocations || !steady || count.allocations == 0)
+	{
+		return;
+	}
+	std::cerr << name << ": " << stage << " of window " << window.index << " made " << count.allocations << " heap allocations ("
+			  << count.bytes << " bytes) in steady state\n";
+	abort();
+}
+
+int SID::
+regression_queue_depth() const
+{
+	return regression_queue.depth();
+}
+
+const Pipeline_Metrics &SID::
+get_metrics() const
+{
+	return metrics;
+}
+
+const std::string &SID::
+get_name() const
+{
+	return name;
+}
+
+int SID::
+logging_queue_depth() const
+{
+	return logging_queue.depth();
+}
+
+// Names of the second order candidate functions, in the order compute_candidate_functions produces them
+std::vector<std::string> candidate_names()
 {
-	using namespace std;
-	ofstream myfile;
-    myfile.open (filename, ios_base::trunc);
 	//std::array<string, 11> first_order_candidates = {"1", "x", "y", "z", "psi", "theta", "phi", "u0", "u1", "u2", "u3"};
-	vector<string> second_order_candidates = {"1", "x", "y", "z", "psi", "theta", "phi", "u0", "u1", "u2", "u3",
-								"x^2", "xy", "xz", "xpsi", "xtheta", "xphi", "xu0", "xu1", "xu2", "xu3",
-								"y^2", "yz", "ypsi", "ytheta","yphi", "yu0", "yu1", "yu2", "yu3",
-								"z^2", "zpsi", "ztheta", "zphi","zu0", "zu1", "zu2", "zu3",
-								"psi^2","psitheta",	"psiphi", "psiu0", "psiu1", "psiu2", "psiu3", 							
-								"theta^2", "thetaphi", "thetau0", "thetau1", "thetau2", "thetau3",
-								"phi^2", "phiu0", "phiu1", "phiu2", "phiu3", 
-								"u0^2", "u0u1", "u0u2", "u0u3",
-								"u1^2", "u1u2", "u1u3",
-								"u2^2", "u2u3",
-								"u3^2"						
-								}; //would like to generate this programmatically at some point
-	
-	vector<string> states = {"p", "q", "r", "u", "v", "w"};
-
-	myfile << "Time (us)" << ",";
-	//Generate header and write to file
+	return {"1", "x", "y", "z", "psi", "theta", "phi", "u0", "u1", "u2", "u3",
+			"x^2", "xy", "xz", "xpsi", "xtheta", "xphi", "xu0", "xu1", "xu2", "xu3",
+			"y^2", "yz", "ypsi", "ytheta","yphi", "yu0", "yu1", "yu2", "yu3",
+			"z^2", "zpsi", "ztheta", "zphi","zu0", "zu1", "zu2", "zu3",
+			"psi^2","psitheta",	"psiphi", "psiu0", "psiu1", "psiu2", "psiu3",
+			"theta^2", "thetaphi", "thetau0", "thetau1", "thetau2", "thetau3",
+			"phi^2", "phiu0", "phiu1", "phiu2", "phiu3",
+			"u0^2", "u0u1", "u0u2", "u0u3",
+			"u1^2", "u1u2", "u1u3",
+			"u2^2", "u2u3",
+			"u3^2"
+			}; //would like to generate this programmatically at some point
+}
+
+// Number of candidate functions of a library order, order 1 is the leading block of order 2
+int candidate_count(int order)
+{
+	return order == 1 ? NUM_BASIS_STATES + 1 : MAX_CANDIDATES;
+}
+
+// Names of the identified states, in the order get_derivatives produces them
+std::vector<std::string> derivative_names()
+{
+	return {"p", "q", "r", "u", "v", "w"};
+}
+
+// Names of the per window statistics logged after the coefficients
+std::vector<std::string> window_statistic_names()
+{
+	//Governor state and platform status, then the health of every telemetry stream
+	std::vector<std::string> names = {"Deadline Misses", "Governor Level", "Skipped Windows", "CPU Frequency (MHz)", "CPU Temperature (C)",
+									  "Excitation", "Uninformative Windows"};
+	std::vector<std::string> ingestion = ingestion_statistic_names();
+	names.insert(names.end(), ingestion.begin(), ingestion.end());
+	return names;
+}
+
+// Names of the statistics logged after the coefficients of each model, the window statistics then its validation
+std::vector<std::string> model_statistic_names()
+{
+	std::vector<std::string> names = window_statistic_names();
+	std::vector<std::string> validation = validation_statistic_names();
+	names.insert(names.end(), validation.begin(), validation.end());
+	return names;
+}
+
+// Per stage durations stored in the HDF5 log, microseconds
+std::vector<std::string> stage_timing_names()
+{
+	return {"Buffer Clear", "Interpolation", "Frame Transform", "Candidate Functions", "Gram Blocks", "SINDy"};
+}
+
+// Header line of the standard error log, the coefficient columns without the statistics
+std::string standard_error_log_header()
+{
+	std::string header = "Time (us),";
+	for(const std::string &candidate : candidate_names())
+	{
+		for(const std::string &state : derivative_names())
+		{
+			header += candidate + "-" + state + ",";
+		}
+	}
+	return header;
+}
+
+// Header line of the coefficient log
+std::string coefficient_log_header()
+{
+	std::string header = "Time (us),";
 	//For each candidate, create a column which is the candidate multiplied by a state variable
-	for(auto candidate_iterator = second_order_candidates.begin(); candidate_iterator != second_order_candidates.end(); ++candidate_iterator)
+	for(const std::string &candidate : candidate_names())
 	{
-		for(auto state_iterator = states.begin(); state_iterator != states.end(); ++state_iterator)
+		for(const std::string &state : derivative_names())
 		{
-			myfile << *candidate_iterator << "-" << *state_iterator << ",";
+			header += candidate + "-" + state + ",";
 		}
 	}
-	myfile << "\n";
-	myfile.close();
+	for(const std::string &statistic : model_statistic_names())
+	{
+		header += statistic + ",";
+	}
+	return header;
 }
 
 // Returns indeces of vector which correspond to values which are above or below a threshold value
 arma::uvec SID::
-threshold_vector(arma::vec vector, float threshold, std::string mode)
-{
-    std::vector<uint> index;
-    if(mode == "below")
-    {
-        for(int i = 0; i < vector.size(); i++)
-        {
-            if(std::abs(vector(i)) < threshold)
-            {
-                index.push_back(i);
-            }
-        }
-    }
-    else if(mode == "above")
-    {
-        for(int i = 0; i < vector.size(); i++)
-        {
-            if(std::abs(vector(i)) > threshold)
-            {
-                index.push_back(i);
-            }
-        }        
-    }
-    arma::uvec thresholded_indexes = arma::conv_to<arma::uvec>::from(index);
-    return thresholded_indexes;
+threshold_vector(const arma::vec &vector, float threshold, const std::string &mode)
+{
+	bool below = mode == "below";
+	bool above = mode == "above";
+	auto selected = [&](double value){ return (below && std::abs(value) < threshold) || (above && std::abs(value) > threshold); };
+
+	// Count first, so the result is allocated once at its final size
+	arma::uword count = 0;
+	for(arma::uword i = 0; i < vector.n_elem; i++)
+	{
+		count += selected(vector(i));
+	}
+	arma::uvec thresholded_indexes(count);
+	arma::uword next = 0;
+	for(arma::uword i = 0; i < vector.n_elem; i++)
+	{
+		if(selected(vector(i)))
+		{
+			thresholded_indexes(next++) = i;
+		}
+	}
+	return thresholded_indexes;
 }
 
 // Sequentially thresholded least squares algorithm
+// If standard_errors is set it receives the standard error of every coefficient, zero for thresholded candidates
 arma::mat 
-SID::STLSQ(arma::mat states, arma::mat candidate_functions, float threshold, float lambda)
+SID::STLSQ(const arma::mat &states, const arma::mat &candidate_functions, float threshold, float lambda, int max_iterations, arma::mat *standard_errors)
 {
 	//states are row indexes
 	//features are row indexes
 	//time domain samples are column indexes
-	bool converged = false;
-	int iteration = 0;
-	int coefficientSize = 0;
-	int max_iterations = 10;
+	//The regressions only ever need the Gram matrix and projections of the states onto the candidates
+	arma::mat gram = candidate_functions * candidate_functions.t();
+	arma::mat projections = candidate_functions * states.t();
+	if(standard_errors == nullptr)
+	{
+		return STLSQ_gram(gram, projections, threshold, lambda, max_iterations);
+	}
 
-    //Normalize candidates with respect to stdev
-    //candidate_functions = candidate_functions/candidate_functions.max();
+	//The residual variance also needs the squared norm of each state
+	std::vector<double> energy(states.n_rows, 0);
+	for(arma::uword row = 0; row < states.n_rows; row++)
+	{
+		for(arma::uword column = 0; column < states.n_cols; column++)
+		{
+			energy[row] += states(row, column)*states(row, column);
+		}
+	}
+	arma::mat coefficients(gram.n_rows, projections.n_cols);
+	*standard_errors = arma::mat(gram.n_rows, projections.n_cols);
+	STLSQ_Workspace workspace(gram.n_rows);
+	STLSQ_gram(gram, projections, gram.n_rows, threshold, lambda, max_iterations, nullptr, workspace, coefficients, standard_errors, energy.data(),
+			   candidate_functions.n_cols);
+	return coefficients;
+}
 
+// Sequentially thresholded least squares on precomputed Gram blocks
+// gram is candidate_functions*candidate_functions' (features x features)
+// projections is candidate_functions*states' (features x states)
+arma::mat 
+SID::STLSQ_gram(const arma::mat &gram, const arma::mat &projections, float threshold, float lambda, int max_iterations, int *iterations)
+{
 	//To store result of STLSQ
-	arma::mat coefficients(candidate_functions.n_rows, states.n_rows);
-	
+	arma::mat coefficients(gram.n_rows, projections.n_cols);
+	STLSQ_Workspace workspace(gram.n_rows);
+	STLSQ_gram(gram, projections, gram.n_rows, threshold, lambda, max_iterations, iterations, workspace, coefficients);
+	return coefficients;
+}
+
+// STLSQ on the leading num_features block of the Gram blocks, in place in a preallocated workspace
+// Thresholding a candidate removes its row and column from the Gram matrix, so the cost of
+// each regression no longer depends on the number of samples in the window. The remaining
+// candidates are compacted in place and each reduced system is solved by a Cholesky factorization
+// in the workspace, so no call allocates unless a system is not positive definite.
+// Writes the leading num_features rows of coefficients and zeroes the rest.
+// If standard_errors is set, it is written in the same layout from the factor of the final regression of each
+// state, derivative_energy holds the squared norm of each state over the num_samples samples of the Gram blocks.
+void
+SID::STLSQ_gram(const arma::mat &gram, const arma::mat &projections, int num_features, float threshold, float lambda, int max_iterations,
+				int *iterations, STLSQ_Workspace &workspace, arma::mat &coefficients, arma::mat *standard_errors, const double *derivative_energy,
+				int num_samples)
+{
+	workspace.reserve(num_features);
+	arma::uword *coefficient_indexes = workspace.indexes.data();
+	double *loop_coefficients = workspace.solution.data();
+	coefficients.zeros();
+
+	if(standard_errors != nullptr)
+	{
+		standard_errors->zeros();
+	}
+
+	// Ridge regression on the candidates still in coefficient_indexes, into loop_coefficients
+	// Returns whether the Cholesky factor of the reduced system was left in the workspace
+	auto regress = [&](int state, int num_indexes)
+	{
+		if(ridge_regression_indexed(gram, projections, state, coefficient_indexes, num_indexes, lambda, workspace.system.data(), loop_coefficients))
+		{
+			return true;
+		}
+		// Not positive definite, Armadillo's solver finds an approximate solution
+		arma::uvec indexes(coefficient_indexes, num_indexes);
+		arma::vec state_projection = projections.col(state);
+		arma::vec solution = ridge_regression_gram(gram.submat(indexes, indexes), state_projection.elem(indexes), lambda);
+		std::copy(solution.begin(), solution.end(), loop_coefficients);
+		return false;
+	};
+
 	//Do STLSQ for each state
-	for(int i = 0; i < states.n_rows; i++)
+	for(int i = 0; i < (int)projections.n_cols; i++)
 	{
-        iteration = 0;
-        converged = false;
-		coefficientSize = 0;
+		TRACE_SPAN_ARG("stlsq_state", i);
+		int iteration = 0;
+		bool converged = false;
 
 		//Keep track of which candidate functions have been discarded, so we can match resulting coefficents to candidate functions
-		arma::uvec coefficient_indexes(candidate_functions.n_rows);
-		//For each state, fill the column with indexes 0 to number of candidate functions
-		for(int j = 0; j < candidate_functions.n_rows; j++)
+		int num_indexes = num_features;
+		for(int k = 0; k < num_features; k++)
 		{
-			coefficient_indexes(j) = j;
+			coefficient_indexes[k] = k;
 		}
-        arma::mat loop_candidate_functions = candidate_functions; //Keep copy since we will delete portions when thresholding
-		arma::rowvec state = states.row(i); //Get derivatives for current state
-		arma::vec loop_coefficients = ridge_regression(candidate_functions, state, lambda); //Initial regression on the candidate functions
-		coefficientSize = loop_coefficients.size();
+		bool factored = regress(i, num_indexes); //Initial regression on the candidate functions
 		//Do subsequent regressions until converged
 		while(!converged && iteration < max_iterations)
 		{
-			arma::uvec below_index = threshold_vector(loop_coefficients, threshold, "below"); //Find indexes of coefficients which are lower than the threshold value
-			coefficient_indexes.shed_rows(below_index); //Remove indexes which correspond to thresholded values
-            loop_candidate_functions.shed_rows(below_index); //Remove indexes which correspond to thresholded values
-			arma::uvec above_index = threshold_vector(loop_coefficients, threshold, "above"); //Find indexes of coefficients which are higher than the threshold value
-            loop_coefficients = ridge_regression(loop_candidate_functions, state, lambda); //Regress again on thresholded candidate functions
-			//Check if coefficient vector has changed in size since last iteration
-			if(coefficientSize == loop_coefficients.size())
+			TRACE_SPAN_ARG("stlsq_iteration", iteration);
+			//Remove indexes of coefficients which are lower than the threshold value
+			int kept = 0;
+			for(int k = 0; k < num_indexes; k++)
 			{
-				converged = true; //If thresholding hasn't shrunk the coefficient vector, we have converged
+				if(!(std::abs(loop_coefficients[k]) < threshold))
+				{
+					coefficient_indexes[kept++] = coefficient_indexes[k];
+				}
 			}
-			coefficientSize = loop_coefficients.size(); //update with size of coefficient vector
+			bool thresholded = kept < num_indexes;
+			num_indexes = kept;
+			if(num_indexes == 0)
+			{
+				break;
+			}
+			//Regress again on thresholded candidate functions
+			factored = regress(i, num_indexes);
+			converged = !thresholded; //If thresholding hasn't shrunk the coefficient vector, we have converged
 			iteration++; //Keep track of iteration number
 		}
 
-		if(loop_coefficients.size() == 0)
+		if(iterations != nullptr)
 		{
-			//fprintf(stderr, "Thresholding parameter set too high and removed all coefficients in state %d\n", i);
-			coefficients.col(i).zeros(); //Set all coefficients to zero and don't attempt to match indexes
-			break;
+			*iterations += iteration;
 		}
-		
+
 		//Match coefficients to their candidate functions
-		arma::vec state_coefficients = arma::zeros(candidate_functions.n_rows);
-        //std::assert(coefficient_indexes.n_rows == loop_coefficients.n_rows);
-		for(int k = 0; k < coefficient_indexes.n_rows; k++)
+		//Thresholding parameter set too high removes all coefficients in this state and leaves the column at zero
+		for(int k = 0; k < num_indexes; k++)
+		{
+			coefficients(coefficient_indexes[k], i) = loop_coefficients[k];
+		}
+
+		// The last regression was on the final active set, its factor gives the standard errors at the cost of one more solve per coefficient
+		if(standard_errors != nullptr && num_indexes > 0)
 		{
-			state_coefficients(coefficient_indexes(k)) = loop_coefficients(k);
+			double *errors = workspace.standard_errors.data();
+			if(!factored || !ridge_standard_errors(gram, projections, i, coefficient_indexes, num_indexes, lambda, workspace.system.data(),
+												   loop_coefficients, derivative_energy[i], num_samples, workspace.inverse.data(), errors))
+			{
+				std::fill(errors, errors + num_indexes, std::nan(""));
+			}
+			for(int k = 0; k < num_indexes; k++)
+			{
+				(*standard_errors)(coefficient_indexes[k], i) = errors[k];
+			}
 		}
-		//loop coefficients is too small for the coefficient matrix
-		coefficients.col(i) = state_coefficients; //Solution for current state
 	}
-	return coefficients;
 }
 
 // Compute 2nd order candidate functions given that states are rows, samples are columns
@@ -278,46 +1204,58 @@ compute_candidate_functions(arma::mat states)
 	return candidate_functions;
 }
 
+// Order 2 gives all pairwise products of the states and bias, order 1 only the leading bias products (ie. the states themselves)
 arma::mat SID::
-compute_candidate_functions(Vehicle_States states)
-{
-	//Compute desired candidate functions from input buffer
-	//Generate ones
-	arma::rowvec bias(states.num_samples);
-	bias.ones();
-	states.bias = bias;
-
-	//join states into matrix so we can iterate over them all
-	arma::mat state_matrix = arma::join_vert(states.bias, states.x);
-	state_matrix = arma::join_vert(state_matrix, states.y, states.z, states.psi);
-	state_matrix = arma::join_vert(state_matrix, states.theta, states.phi);
-	state_matrix = arma::join_vert(state_matrix, states.actuator0, states.actuator1);
-	state_matrix = arma::join_vert(state_matrix, states.actuator2, states.actuator3);
-
-	int num_features = state_matrix.n_rows*(state_matrix.n_rows+1)/2; //Compute total number of combinations of vehicle states
-	arma::mat candidate_functions(num_features, states.num_samples);
-	int candidate_index = 0; //Index to keep track of insertion into candidate functions
-	
+compute_candidate_functions(const Vehicle_States &states, int order)
+{
+	//join states into matrix so we can iterate over them all, the bias is added by the workspace version
+	arma::mat basis_states = arma::join_vert(states.x, states.y, states.z, states.psi);
+	basis_states = arma::join_vert(basis_states, states.theta, states.phi);
+	basis_states = arma::join_vert(basis_states, states.actuator0, states.actuator1);
+	basis_states = arma::join_vert(basis_states, states.actuator2, states.actuator3);
+
+	arma::mat candidate_functions(candidate_count(order), states.num_samples);
+	compute_candidate_functions(basis_states, order, candidate_functions);
+	return candidate_functions;
+}
+
+// Candidate functions of the basis states (x, y, z, psi, theta, phi, u0..u3 as rows) into candidate_functions,
+// which must already have candidate_count(order) rows and a column per sample. Does not allocate.
+void SID::
+compute_candidate_functions(const arma::mat &basis_states, int order, arma::mat &candidate_functions)
+{
+	assert(basis_states.n_rows == NUM_BASIS_STATES);
+	assert(candidate_functions.n_rows == (arma::uword)candidate_count(order));
+	assert(candidate_functions.n_cols == basis_states.n_cols);
+
+	int num_states = NUM_BASIS_STATES + 1; // Including the bias
+	int num_multipliers = order == 1 ? 1 : num_states; // Order 1 only multiplies by the bias
+	double states[NUM_BASIS_STATES + 1];
+	states[0] = 1;
+
 	//Compute second order combinations for each column
-	for(int i = 0; i <state_matrix.n_cols; i++)
+	for(int i = 0; i < (int)basis_states.n_cols; i++)
 	{
+		const double *basis = basis_states.colptr(i);
+		for(int j = 0; j < NUM_BASIS_STATES; j++)
+		{
+			states[j + 1] = basis[j];
+		}
+		double *candidates = candidate_functions.colptr(i);
+		int candidate_index = 0; //Index to keep track of insertion into candidate functions
 		//For each state, multiply by all others
-		for(int j = 0; j < state_matrix.n_rows; j++)
+		for(int j = 0; j < num_multipliers; j++)
 		{
-			for(int k = j; k < state_matrix.n_rows; k++)
+			for(int k = j; k < num_states; k++)
 			{
-				candidate_functions(candidate_index,i) = state_matrix(j,i)*state_matrix(k,i);
-				candidate_index++;
+				candidates[candidate_index++] = states[j]*states[k];
 			}
 		}
-		candidate_index = 0;
 	}
-	assert(candidate_functions.n_rows == num_features);
-	return candidate_functions;
 }
 
 arma::mat SID::
-get_derivatives(Vehicle_States states)
+get_derivatives(const Vehicle_States &states)
 {
 	arma::mat derivatives = arma::join_vert(states.p, states.q, states.r);
 	derivatives = arma::join_vert(derivatives, states.u, states.v, states.w);
@@ -348,14 +1286,91 @@ stop()
 	// --------------------------------------------------------------------------
 	//   CLOSE THREADS
 	// --------------------------------------------------------------------------
+	// signal exit, repeated calls return here
+	if(time_to_exit.exchange(true))
+	{
+		return;
+	}
 	printf("STOP SINDy THREAD\n");
 
-	// signal exit
-	time_to_exit = true;
+	// release the preprocessing stage from the buffer, it then closes the regression queue behind it
+	// windows already queued are still solved and logged, each stage closes its output once drained
+	if(input_buffer != nullptr)
+	{
+		input_buffer->shutdown();
+	}
 
 	// wait for exit
-	//compute_thread.join();
+	for(std::thread *stage : {&compute_thread, &regression_thread, &logging_thread})
+	{
+		if(stage->joinable())
+		{
+			stage->join();
+		}
+	}
+
+	// write out whatever the coefficient loggers still hold, nothing is logged anymore
+	// a configuration still waiting for a window is dropped, its outputs were never written
+	std::shared_ptr<const Pipeline_Config> config;
+	{
+		std::lock_guard<std::mutex> lock(config_mutex);
+		config = current_config;
+		pending_config.reset();
+	}
+	if(config)
+	{
+		for(auto &logger : config->outputs.loggers)
+		{
+			logger->stop();
+		}
+		for(auto &logger : config->outputs.standard_error_loggers)
+		{
+			if(logger)
+			{
+				logger->stop();
+			}
+		}
+		if(config->outputs.hdf5_writer)
+		{
+			config->outputs.hdf5_writer->stop();
+		}
+	}
 
 	// now the read and write threads are closed
 	printf("\n");
-}
\ No newline at end of file
+}
+
+// ------------------------------------------------------------------------------
+//   Model Configuration
+// ------------------------------------------------------------------------------
+// Parse a model specification of the form <name>:<threshold>:<lambda>[:<library order>]
+// eg. "sparse:0.5:0.1" or "linear:0.1:0.1:1"
+Model_Config parse_model_config(const std::string &spec)
+{
+	Model_Config model;
+	std::stringstream stream(spec);
+	std::string threshold, lambda, order;
+	std::getline(stream, model.name, ':');
+	std::getline(stream, threshold, ':');
+	std::getline(stream, lambda, ':');
+	std::getline(stream, order, ':');
+
+	char *threshold_end, *lambda_end;
+	model.threshold = strtof(threshold.c_str(), &threshold_end);
+	model.lambda = strtof(lambda.c_str(), &lambda_end);
+	if(model.name.empty() || threshold.empty() || lambda.empty() || *threshold_end != '\0' || *lambda_end != '\0')
+	{
+		std::cout << "Invalid model " << spec << ", use <name>:<threshold>:<lambda>[:<library order>]\n";
+		throw EXIT_FAILURE;
+	}
+	if(!order.empty())
+	{
+		model.library_order = atoi(order.c_str());
+		if(model.library_order != 1 && model.library_order != 2)
+		{
+			std::cout << "Invalid library order " << order << " for model " << model.name << ", use 1 or 2\n";
+			throw EXIT_FAILURE;
+		}
+	}
+	return model;
+}
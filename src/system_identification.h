@@ -19,42 +19,217 @@
 #include "regression.h"
 #include "interpolate.h"
 #include "logging.h"
+#include "queue.h"
+#include "governor.h"
+#include "scheduling.h"
+#include "worker_pool.h"
+#include "coefficient_logger.h"
+#include "hdf5_writer.h"
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "trace.h"
+#include "workspace.h"
+#include "frame_transform.h"
+#include "allocation_counter.h"
+#include "validation.h"
+#include "model_publisher.h"
+#include "coefficient_stream.h"
 #include <string>
 #include <math.h>
 #include <chrono>
 #include <armadillo>
 #include <thread>
 #include <array>
+#include <memory>
+#include <mutex>
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+
+// A model configuration solved on every window
+// All configurations share the resampled states, derivatives and Gram blocks of a window
+struct Model_Config {
+    std::string name;
+    float threshold; // STLSQ thresholding parameter
+    float lambda; // Ridge regression parameter
+    int library_order = 2; // 1 for linear candidates only, 2 for all pairwise products
+    std::string coefficient_logfile_path;
+};
+
+// Outputs of a pipeline configuration, unchanged outputs are shared with the configuration before it
+struct Pipeline_Outputs {
+    std::vector<std::shared_ptr<Coefficient_Logger>> loggers; // One per model
+    std::vector<std::shared_ptr<Coefficient_Logger>> standard_error_loggers; // One per model, null if disabled
+    std::shared_ptr<Hdf5_Writer> hdf5_writer; // Null if disabled
+    std::shared_ptr<Coefficient_Streamer> streamer; // Null if disabled
+};
+
+// Settings of a pipeline that can change while it runs, see SID::reconfigure
+// A window is processed with the configuration that was current when it was taken from the buffer
+struct Pipeline_Config {
+    std::vector<Model_Config> models; // Same names in the same order as at start, all other fields may change
+    int buffer_length = 0; // Samples or seconds per window, 0 leaves the buffer as it is
+    buffer_mode mode = buffer_mode::length_mode;
+    std::string hdf5_path; // Disabled if empty
+    std::string stream_destination; // Disabled if empty
+    bool debug = false;
+    float min_excitation = 0; // Windows with a smaller window_excitation are skipped, 0 solves every window
+    Pipeline_Outputs outputs; // Opened by the pipeline, not part of the request
+};
+
+// A single buffer window as it moves through the pipeline stages
+// Each stage fills in its results and timing before handing the window to the next stage
+// Windows are recycled, the logging stage hands each one back to preprocessing with its storage intact
+struct SID_Window {
+    uint64_t index; // Sequence number of the window since start
+    std::shared_ptr<const Pipeline_Config> config; // Set once the window is handed to regression, released after logging
+
+    SID_Workspace workspace; // Resampled states, candidate functions, derivatives and the Gram blocks shared by all models
+    bool workspace_grown = false; // The window was longer than any before it and enlarged the workspace
+    std::vector<arma::mat> coefficients; // One per model, features are rows, states are columns, always the full second order layout
+    std::vector<Validation_Result> validation; // One per model, prediction error of the previously solved models on this window
+    std::vector<arma::mat> standard_errors; // One per model if enabled, same layout as the coefficients, NaN where they are not available
+
+    std::chrono::microseconds sample_time; // Time since program epoch at which the coefficients were solved
+    std::chrono::steady_clock::time_point clear_time; // Time the window was taken from the buffer, the deadline is one window period later
+
+    Governor_Decision decision; // Degradations applied to this window
+    bool deadline_missed = false;
+    uint64_t deadline_misses = 0; // Total misses up to and including this window
+    uint64_t skipped_windows = 0; // Total windows dropped by the governor
+    double excitation = 0; // See window_excitation
+    uint64_t uninformative_windows = 0; // Total windows dropped for too little excitation
+    std::array<double, NUM_INGESTION_STATISTICS> ingestion{}; // Telemetry stream health since the previous window, see ingestion_statistic_names
+
+    std::chrono::milliseconds clear_buffer_time;
+    std::chrono::microseconds interpolation_time;
+    std::chrono::microseconds transform_time;
+    std::chrono::microseconds candidate_computation_time;
+    std::chrono::microseconds gram_time;
+    std::chrono::microseconds SINDy_time;
+
+    Allocation_Count preprocess_allocations;
+    Allocation_Count regression_allocations; // Including the model solves on the pool workers
+};
 
 // ----------------------------------------------------------------------------------
 //   System Identification Class
 // ----------------------------------------------------------------------------------
+/*
+ * The computation is split into three pipeline stages, each running on its own thread
+ *
+ * preprocess: buffer clear -> interpolation -> frame transform -> candidate functions -> derivatives -> Gram blocks
+ * regression: STLSQ of every model configuration
+ * logging: coefficient logging and debug output
+ *
+ * Stages are connected by bounded queues, so the next window is preprocessed while
+ * the current one is regressed and logged. Throughput is then set by the slowest stage.
+ */
 
 class SID
 {
 private:
-    Buffer *input_buffer;
-    bool time_to_exit = false;
-    bool debug;
-    std::thread compute_thread;
+    Buffer *input_buffer = nullptr;
+    std::atomic<bool> time_to_exit{false};
+    bool debug; // Initial debug setting, later the window's configuration decides
+    std::thread compute_thread; // preprocessing stage
+    std::thread regression_thread;
+    std::thread logging_thread;
     std::chrono::_V2::system_clock::time_point epoch;
 
+    Bounded_Queue<SID_Window> regression_queue; // preprocessed windows waiting for STLSQ
+    Bounded_Queue<SID_Window> logging_queue; // solved windows waiting to be logged
+    Bounded_Queue<SID_Window> free_windows; // logged windows waiting to be reused
+
+    Governor governor;
+
+    Thread_Settings compute_settings; // Applied to the preprocessing and regression stages
+    Thread_Settings worker_settings; // Applied to the logging stage
+
+    Worker_Pool *pool = nullptr; // Shared compute pool, STLSQ runs on the regression thread if unset
+    int pool_client = -1;
+    std::string name = "SID"; // Prefix for debug output, eg. the vehicle this pipeline identifies
+
+    std::vector<Model_Config> models; // Configurations solved on every window, as given at start
+    bool compute_standard_errors = false;
+    float min_excitation = 0; // Initial excitation threshold, later the window's configuration decides
+    int fsync_interval = 10; // Records between fsync calls of the coefficient logs
+    int keyframe_interval = 50; // Windows between keyframes of the coefficient logs
+    std::string hdf5_path; // Columnar HDF5 log of all models, disabled if empty
+    bool hdf5_states = false; // Also store the resampled states in the HDF5 log
+    std::string shared_model_name; // POSIX shared memory segment of the latest models, disabled if empty
+    std::unique_ptr<Model_Publisher> model_publisher;
+    std::string stream_destination; // host:port of the UDP coefficient stream, disabled if empty
+    uint8_t stream_vehicle = 0;
+    double stream_bandwidth = 0; // Bytes per second, unlimited if 0
+    Flight_Recorder *recorder = nullptr; // Stage events are recorded here if set
+    uint8_t recorder_source = 0;
+    Pipeline_Metrics metrics;
+
+    int window_capacity = 0; // Samples every window workspace is sized for at start
+    bool assert_no_allocations = false; // Abort on a steady state window that allocated
+    std::vector<STLSQ_Workspace> stlsq_workspaces; // One per model
+    std::vector<int> model_iterations; // STLSQ iterations of the current window, one per model
+    std::vector<Allocation_Count> model_allocations; // Allocations of the current window's model solves, then of its validations
+    std::vector<Model_Plan> previous_models; // Models of the last solved window, validated on the next one
+    bool previous_models_valid = false;
+
+    std::shared_ptr<const Pipeline_Config> current_config; // Handed to every window from now on, written by the preprocessing stage
+    std::shared_ptr<const Pipeline_Config> pending_config; // Taken by the preprocessing stage before its next buffer clear
+    mutable std::mutex config_mutex; // Guards both configurations
+
+    void open_outputs(Pipeline_Config &config, const Pipeline_Config *previous);
+    void solve_model(SID_Window &window, const Model_Config &model, int *iterations, STLSQ_Workspace &workspace, arma::mat &coefficients,
+                     arma::mat *standard_errors);
+    void validate_previous_model(SID_Window &window, size_t model);
+    void check_allocations(const char *stage, const SID_Window &window, const Allocation_Count &count, bool steady);
+
 public:
     SID();
-    SID(Buffer *input_buffer_, std::chrono::_V2::system_clock::time_point program_epoch, float stlsq_threshold, float ridge_regression_penalty, std::string coefficient_logfile_directory_, bool debug_);
+    SID(Buffer *input_buffer_, std::chrono::_V2::system_clock::time_point program_epoch, float stlsq_threshold, float ridge_regression_penalty, std::string coefficient_logfile_directory_, bool debug_,
+        int pipeline_depth = 2, Governor_Settings governor_settings = Governor_Settings());
     ~SID();
 
     void stop();
     void start();
+    void set_thread_settings(Thread_Settings compute, Thread_Settings workers);
+    void set_worker_pool(Worker_Pool *pool_);
+    void set_name(std::string name_);
+    void set_models(std::vector<Model_Config> models_);
+    void set_fsync_interval(int fsync_interval_);
+    void set_keyframe_interval(int keyframe_interval_);
+    void set_hdf5_output(std::string path, bool include_states);
+    void set_shared_model(std::string name);
+    void set_coefficient_stream(std::string destination, uint8_t vehicle, double bandwidth);
+    void set_standard_errors(bool enabled);
+    void set_min_excitation(float min_excitation_);
+    void set_recorder(Flight_Recorder *recorder_, uint8_t source);
+    void set_window_capacity(int samples);
+    void set_allocation_check(bool enabled);
+    std::shared_ptr<Pipeline_Config> prepare_reconfiguration(const Pipeline_Config &requested, std::string &error);
+    bool reconfigure(std::shared_ptr<Pipeline_Config> config, std::string &error);
+    std::shared_ptr<const Pipeline_Config> get_config() const;
     void handle_quit(int sig);
-    void sindy_compute();
-    arma::uvec threshold_vector(arma::vec vector, float threshold, std::string mode);
-    arma::mat compute_candidate_functions(Vehicle_States states);
+    void preprocess_stage();
+    void regression_stage();
+    void logging_stage();
+    arma::uvec threshold_vector(const arma::vec &vector, float threshold, const std::string &mode);
+    arma::mat compute_candidate_functions(const Vehicle_States &states, int order = 2);
     arma::mat compute_candidate_functions(arma::mat states);
-    arma::mat STLSQ(arma::mat states, arma::mat candidate_functions, float threshold, float lambda);
+    void compute_candidate_functions(const arma::mat &basis_states, int order, arma::mat &candidate_functions);
+    arma::mat STLSQ(const arma::mat &states, const arma::mat &candidate_functions, float threshold, float lambda, int max_iterations = 10,
+                    arma::mat *standard_errors = nullptr);
+    arma::mat STLSQ_gram(const arma::mat &gram, const arma::mat &projections, float threshold, float lambda, int max_iterations = 10, int *iterations = nullptr);
+    void STLSQ_gram(const arma::mat &gram, const arma::mat &projections, int num_features, float threshold, float lambda, int max_iterations,
+                    int *iterations, STLSQ_Workspace &workspace, arma::mat &coefficients, arma::mat *standard_errors = nullptr,
+                    const double *derivative_energy = nullptr, int num_samples = 0);
     arma::rowvec threshold(arma::vec coefficients, arma::mat candidate_functions, float threshold);
-    arma::mat get_derivatives(Vehicle_States states);
-    void initialize_logfile(std::string filename);
+    arma::mat get_derivatives(const Vehicle_States &states);
+    int regression_queue_depth() const;
+    const Pipeline_Metrics &get_metrics() const;
+    const std::string &get_name() const;
+    int logging_queue_depth() const;
 
     bool compute_status;
     std::atomic<bool> armed;
@@ -65,4 +240,14 @@ public:
     float lambda; //Ridge regression parameter
 };
 
+Model_Config parse_model_config(const std::string &spec);
+std::vector<std::string> candidate_names();
+std::vector<std::string> derivative_names();
+int candidate_count(int order);
+std::vector<std::string> window_statistic_names();
+std::vector<std::string> model_statistic_names();
+std::vector<std::string> stage_timing_names();
+std::string coefficient_log_header();
+std::string standard_error_log_header();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,270 @@
+/**
+ * @file trace.cpp
+ *
+ * @brief trace event spans
+ *
+ * Span ring shared by all threads and its Chrome trace event JSON export
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "trace.h"
+#include <sys/syscall.h>
+#include <signal.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <map>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+std::atomic<bool> trace_active{false};
+
+// The ring lives until the process exits, spans may still close on other threads during exit
+static Trace_Event *events = nullptr;
+static uint64_t capacity_mask = 0;
+static std::atomic<uint64_t> next_event{0};
+static uint64_t trace_epoch_ns = 0;
+
+// Guards everything below, only taken by the setup and dump paths
+static std::mutex trace_mutex;
+static std::string trace_path;
+static std::map<uint32_t, std::string> thread_names;
+static std::atomic<bool> dump_requested{false};
+
+static uint32_t current_thread()
+{
+	static thread_local uint32_t thread = syscall(SYS_gettid);
+	return thread;
+}
+
+uint64_t trace_now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ------------------------------------------------------------------------------
+//   Trace Span
+// ------------------------------------------------------------------------------
+Trace_Span::
+Trace_Span(const char *name_, uint64_t argument_)
+{
+	name = name_;
+	argument = argument_;
+	if(trace_active.load(std::memory_order_acquire))
+	{
+		start_ns = trace_now_ns();
+	}
+}
+
+Trace_Span::
+~Trace_Span()
+{
+	if(start_ns != 0)
+	{
+		trace_record(name, start_ns, trace_now_ns(), argument);
+	}
+}
+
+// Store a completed span in the next slot, safe to call from any thread
+void trace_record(const char *name, uint64_t start_ns, uint64_t end_ns, uint64_t argument)
+{
+	uint64_t sequence = next_event.fetch_add(1, std::memory_order_relaxed);
+	Trace_Event &event = events[sequence & capacity_mask];
+
+	// Readers skip the slot while it is rewritten
+	event.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	event.name = name;
+	event.start_ns = start_ns;
+	event.duration_ns = end_ns - start_ns;
+	event.argument = argument;
+	event.thread = current_thread();
+	event.sequence.store(sequence + 1, std::memory_order_release);
+}
+
+uint64_t trace_recorded()
+{
+	return next_event.load(std::memory_order_relaxed);
+}
+
+// ------------------------------------------------------------------------------
+//   Setup
+// ------------------------------------------------------------------------------
+static void dump_signal_handler(int sig)
+{
+	trace_request_dump();
+}
+
+// Dumps requested by the signal handler are written from this thread
+static void dump_watcher()
+{
+	while(true)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		if(dump_requested.exchange(false))
+		{
+			trace_dump();
+		}
+	}
+}
+
+// Start recording spans into a ring of the given number of events, rounded up to a power of two
+// The ring is only allocated by the first call, later calls just change the output path
+void trace_start(std::string path, size_t capacity)
+{
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	trace_path = path;
+	if(events == nullptr)
+	{
+		uint64_t size = 64;
+		while(size < capacity)
+		{
+			size *= 2;
+		}
+		events = new Trace_Event[size]();
+		capacity_mask = size - 1;
+		trace_epoch_ns = trace_now_ns();
+
+		// SIGUSR1 writes the current contents, the process exit writes the final ones
+		signal(SIGUSR1, dump_signal_handler);
+		atexit(trace_stop);
+		std::thread(dump_watcher).detach();
+	}
+	trace_active.store(true, std::memory_order_release);
+}
+
+// Stop recording and write the trace, does nothing if tracing is not running
+void trace_stop()
+{
+	if(!trace_active.exchange(false))
+	{
+		return;
+	}
+	trace_dump();
+}
+
+// Async signal safe
+void trace_request_dump()
+{
+	dump_requested.store(true);
+}
+
+// Name shown for the calling thread, threads without a name show their kernel name
+void trace_thread_name(std::string name)
+{
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	thread_names[current_thread()] = name;
+}
+
+// ------------------------------------------------------------------------------
+//   Chrome trace event export
+// ------------------------------------------------------------------------------
+static std::string json_string(const std::string &text)
+{
+	std::string escaped = "\"";
+	for(char c : text)
+	{
+		if(c == '"' || c == '\\')
+		{
+			escaped += '\\';
+			escaped += c;
+		}
+		else if((unsigned char)c >= 0x20)
+		{
+			escaped += c;
+		}
+	}
+	return escaped + "\"";
+}
+
+static std::string kernel_thread_name(uint32_t thread)
+{
+	std::ifstream comm("/proc/self/task/" + std::to_string(thread) + "/comm");
+	std::string name;
+	std::getline(comm, name);
+	return name.empty() ? "thread " + std::to_string(thread) : name;
+}
+
+// Write the spans currently in the ring, oldest first, returns false if the file could not be written
+bool trace_dump()
+{
+	std::lock_guard<std::mutex> lock(trace_mutex);
+	if(events == nullptr)
+	{
+		return false;
+	}
+
+	// Copy every complete slot, a slot rewritten during the copy changes its sequence and is dropped
+	struct Span_Copy {
+		const char *name;
+		uint64_t start_ns, duration_ns, argument;
+		uint32_t thread;
+	};
+	std::vector<Span_Copy> spans;
+	for(uint64_t slot = 0; slot <= capacity_mask; slot++)
+	{
+		Trace_Event &event = events[slot];
+		uint64_t sequence = event.sequence.load(std::memory_order_acquire);
+		if(sequence == 0)
+		{
+			continue;
+		}
+		Span_Copy span = {event.name, event.start_ns, event.duration_ns, event.argument, event.thread};
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(event.sequence.load(std::memory_order_relaxed) != sequence)
+		{
+			continue;
+		}
+		spans.push_back(span);
+	}
+	std::sort(spans.begin(), spans.end(), [](const Span_Copy &a, const Span_Copy &b){ return a.start_ns < b.start_ns; });
+
+	// Write beside the target and rename, a viewer never sees a half written file
+	std::string temporary_path = trace_path + ".tmp";
+	FILE *file = fopen(temporary_path.c_str(), "w");
+	if(file == nullptr)
+	{
+		std::cerr << "Could not write trace " << trace_path << "\n";
+		return false;
+	}
+	int pid = getpid();
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"SINDy\"}}", pid);
+	std::map<uint32_t, bool> named;
+	for(const Span_Copy &span : spans)
+	{
+		if(!named[span.thread])
+		{
+			named[span.thread] = true;
+			auto registered = thread_names.find(span.thread);
+			std::string name = registered != thread_names.end() ? registered->second : kernel_thread_name(span.thread);
+			fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":%s}}", pid, span.thread,
+					json_string(name).c_str());
+		}
+		// Complete events, timestamps in microseconds since trace_start
+		fprintf(file, ",\n{\"name\":%s,\"cat\":\"sindy\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"arg\":%llu}}",
+				json_string(span.name).c_str(), (span.start_ns - trace_epoch_ns)/1000.0, span.duration_ns/1000.0, pid, span.thread,
+				(unsigned long long)span.argument);
+	}
+	fprintf(file, "\n]}\n");
+	bool written = fflush(file) == 0;
+	written = fclose(file) == 0 && written;
+	if(!written || rename(temporary_path.c_str(), trace_path.c_str()) != 0)
+	{
+		std::cerr << "Could not write trace " << trace_path << "\n";
+		return false;
+	}
+	std::cout << "Trace: " << spans.size() << " spans written to " << trace_path << "\n";
+	return true;
+}
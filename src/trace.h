@@ -0,0 +1,87 @@
+/**
+ * @file trace.h
+ *
+ * @brief trace event spans definition
+ *
+ * Scoped spans around buffer inserts and clears, the SID stages and every STLSQ iteration,
+ * stored in a lock free ring and written out in the Chrome trace event format, which
+ * chrome://tracing and ui.perfetto.dev open directly
+ *
+ * The TRACE_ macros only expand to code when built with -DSINDY_TRACE, otherwise the
+ * instrumented functions compile exactly as before. When built in, a span costs two clock
+ * reads and a handful of stores, and a single relaxed load while tracing is not started.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+// One completed span, name must be a string literal since only the pointer is stored
+struct Trace_Event {
+    std::atomic<uint64_t> sequence; // Event number + 1, 0 while the slot is written
+    const char *name;
+    uint64_t start_ns; // Steady clock
+    uint64_t duration_ns;
+    uint64_t argument;
+    uint32_t thread; // Kernel thread id
+};
+
+extern std::atomic<bool> trace_active;
+
+// ----------------------------------------------------------------------------------
+//   Trace Span Class
+// ----------------------------------------------------------------------------------
+// Records the time between construction and destruction, if tracing was started
+class Trace_Span
+{
+    const char *name;
+    uint64_t argument;
+    uint64_t start_ns = 0;
+
+public:
+    Trace_Span(const char *name_, uint64_t argument_ = 0);
+    ~Trace_Span();
+
+    Trace_Span(const Trace_Span &) = delete;
+    Trace_Span &operator=(const Trace_Span &) = delete;
+};
+
+void trace_start(std::string path, size_t capacity);
+void trace_stop();
+bool trace_dump();
+void trace_request_dump();
+void trace_thread_name(std::string name);
+void trace_record(const char *name, uint64_t start_ns, uint64_t end_ns, uint64_t argument);
+uint64_t trace_now_ns();
+uint64_t trace_recorded();
+
+// ------------------------------------------------------------------------------
+//   Instrumentation macros
+// ------------------------------------------------------------------------------
+#define TRACE_CONCATENATE_(a, b) a##b
+#define TRACE_CONCATENATE(a, b) TRACE_CONCATENATE_(a, b)
+
+#ifdef SINDY_TRACE
+#define TRACE_SPAN(name) Trace_Span TRACE_CONCATENATE(trace_span_, __LINE__)(name)
+#define TRACE_SPAN_ARG(name, argument) Trace_Span TRACE_CONCATENATE(trace_span_, __LINE__)(name, argument)
+#define TRACE_THREAD_NAME(name) trace_thread_name(name)
+#else
+#define TRACE_SPAN(name) do {} while(0)
+#define TRACE_SPAN_ARG(name, argument) do {} while(0)
+#define TRACE_THREAD_NAME(name) do {} while(0)
+#endif
+
+#endif
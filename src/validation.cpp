@@ -0,0 +1,223 @@
+/**
+ * @file validation.cpp
+ *
+ * @brief model validation
+ *
+ * RK4 forward simulation of identified models and their prediction errors
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "validation.h"
+#include <cmath>
+#include <limits>
+
+#define NUM_INTEGRATED_STATES 6 // x, y, z, psi, theta, phi
+#define NUM_INPUTS (NUM_BASIS_STATES - NUM_INTEGRATED_STATES) // u0..u3
+
+// Attitude rows of the basis after transform_states, roll, pitch and yaw in radians
+#define ROLL_STATE 3
+#define PITCH_STATE 4
+#define YAW_STATE 5
+
+// Basis state whose error is reported for each derivative, p, q, r turn the attitude and u, v, w move the position
+static const int integrated_state[NUM_DERIVATIVES] = {3, 4, 5, 0, 1, 2};
+
+// ------------------------------------------------------------------------------
+//   Validation Result
+// ------------------------------------------------------------------------------
+Validation_Result::
+Validation_Result()
+{
+	clear();
+}
+
+// Mark the result as not validated
+void Validation_Result::
+clear()
+{
+	one_step.fill(std::numeric_limits<double>::quiet_NaN());
+	multi_step.fill(std::numeric_limits<double>::quiet_NaN());
+	steps = 0;
+}
+
+// ------------------------------------------------------------------------------
+//   Forward simulation
+// ------------------------------------------------------------------------------
+// Rates of the integrated states, states and rates are in basis order
+// The model predicts body rates and body velocities, the Euler angle kinematics and the body to NED
+// rotation at the current attitude turn them into rates of the attitude and the NED position
+static void state_rates(const Model_Plan &model, const double *states, const double *inputs, double *rates)
+{
+	double basis[NUM_BASIS_STATES];
+	for(int i = 0; i < NUM_INTEGRATED_STATES; i++)
+	{
+		basis[i] = states[i];
+	}
+	for(int i = 0; i < NUM_INPUTS; i++)
+	{
+		basis[NUM_INTEGRATED_STATES + i] = inputs[i];
+	}
+	double derivatives[NUM_DERIVATIVES];
+	model.evaluate(basis, derivatives);
+	double p = derivatives[0], q = derivatives[1], r = derivatives[2];
+	double u = derivatives[3], v = derivatives[4], w = derivatives[5];
+
+	double sin_phi = std::sin(states[ROLL_STATE]), cos_phi = std::cos(states[ROLL_STATE]);
+	double sin_theta = std::sin(states[PITCH_STATE]), cos_theta = std::cos(states[PITCH_STATE]);
+	double sin_psi = std::sin(states[YAW_STATE]), cos_psi = std::cos(states[YAW_STATE]);
+
+	// Singular at a pitch of 90 degrees, a free run through it ends as diverged
+	double yaw_rate = (q*sin_phi + r*cos_phi)/cos_theta;
+	rates[ROLL_STATE] = p + sin_theta*yaw_rate;
+	rates[PITCH_STATE] = q*cos_phi - r*sin_phi;
+	rates[YAW_STATE] = yaw_rate;
+
+	// ZYX body to NED rotation, the transpose of the one in transform_states
+	rates[0] = cos_theta*cos_psi*u + (sin_phi*sin_theta*cos_psi - cos_phi*sin_psi)*v + (cos_phi*sin_theta*cos_psi + sin_phi*sin_psi)*w;
+	rates[1] = cos_theta*sin_psi*u + (sin_phi*sin_theta*sin_psi + cos_phi*cos_psi)*v + (cos_phi*sin_theta*sin_psi - sin_phi*cos_psi)*w;
+	rates[2] = -sin_theta*u + sin_phi*cos_theta*v + cos_phi*cos_theta*w;
+}
+
+// Prediction error of a basis state, attitude errors are wrapped to [-pi, pi]
+static double state_error(int state, double predicted, double measured)
+{
+	double error = predicted - measured;
+	return state >= ROLL_STATE ? std::remainder(error, 2*M_PI) : error;
+}
+
+// One RK4 step of length dt seconds, the inputs are linear between the two samples
+static void rk4_step(const Model_Plan &model, const double *states, const double *inputs, const double *next_inputs, double dt, double *next)
+{
+	double midpoint_inputs[NUM_INPUTS];
+	for(int i = 0; i < NUM_INPUTS; i++)
+	{
+		midpoint_inputs[i] = 0.5*(inputs[i] + next_inputs[i]);
+	}
+
+	double k1[NUM_INTEGRATED_STATES], k2[NUM_INTEGRATED_STATES], k3[NUM_INTEGRATED_STATES], k4[NUM_INTEGRATED_STATES];
+	double stage[NUM_INTEGRATED_STATES];
+	state_rates(model, states, inputs, k1);
+	for(int i = 0; i < NUM_INTEGRATED_STATES; i++)
+	{
+		stage[i] = states[i] + 0.5*dt*k1[i];
+	}
+	state_rates(model, stage, midpoint_inputs, k2);
+	for(int i = 0; i < NUM_INTEGRATED_STATES; i++)
+	{
+		stage[i] = states[i] + 0.5*dt*k2[i];
+	}
+	state_rates(model, stage, midpoint_inputs, k3);
+	for(int i = 0; i < NUM_INTEGRATED_STATES; i++)
+	{
+		stage[i] = states[i] + dt*k3[i];
+	}
+	state_rates(model, stage, next_inputs, k4);
+	for(int i = 0; i < NUM_INTEGRATED_STATES; i++)
+	{
+		next[i] = states[i] + dt/6*(k1[i] + 2*k2[i] + 2*k3[i] + k4[i]);
+	}
+}
+
+static bool finite_sample(const double *basis)
+{
+	for(int i = 0; i < NUM_BASIS_STATES; i++)
+	{
+		if(!std::isfinite(basis[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Integrate the model over the resampled window and compare against the measured states
+// Does not allocate, so it can run on the pool next to the STLSQ solves
+void validate_model(const Model_Plan &model, const SID_Workspace &workspace, Validation_Result &result)
+{
+	result.clear();
+	const double *basis = workspace.basis_storage.data();
+	const double *time_us = workspace.time_storage.data();
+
+	// Resampling leaves NaN where a stream does not cover the window, only the span covered by all of them is used
+	int first = 0;
+	int last = workspace.num_samples - 1;
+	while(first <= last && !finite_sample(basis + first*NUM_BASIS_STATES))
+	{
+		first++;
+	}
+	while(last > first && !finite_sample(basis + last*NUM_BASIS_STATES))
+	{
+		last--;
+	}
+	if(last <= first)
+	{
+		return;
+	}
+
+	double one_step_error[NUM_DERIVATIVES] = {0};
+	double multi_step_error[NUM_DERIVATIVES] = {0};
+	double free_run[NUM_INTEGRATED_STATES];
+	double predicted[NUM_INTEGRATED_STATES];
+	for(int i = 0; i < NUM_INTEGRATED_STATES; i++)
+	{
+		free_run[i] = basis[first*NUM_BASIS_STATES + i];
+	}
+	bool diverged = false;
+
+	for(int sample = first; sample < last; sample++)
+	{
+		const double *current = basis + sample*NUM_BASIS_STATES;
+		const double *next = current + NUM_BASIS_STATES;
+		double dt = (time_us[sample + 1] - time_us[sample])*1e-6;
+
+		rk4_step(model, current, current + NUM_INTEGRATED_STATES, next + NUM_INTEGRATED_STATES, dt, predicted);
+		for(int d = 0; d < NUM_DERIVATIVES; d++)
+		{
+			double error = state_error(integrated_state[d], predicted[integrated_state[d]], next[integrated_state[d]]);
+			one_step_error[d] += error*error;
+		}
+
+		if(diverged)
+		{
+			continue;
+		}
+		rk4_step(model, free_run, current + NUM_INTEGRATED_STATES, next + NUM_INTEGRATED_STATES, dt, predicted);
+		for(int i = 0; i < NUM_INTEGRATED_STATES; i++)
+		{
+			free_run[i] = predicted[i];
+			diverged = diverged || !std::isfinite(predicted[i]);
+		}
+		for(int d = 0; d < NUM_DERIVATIVES; d++)
+		{
+			double error = state_error(integrated_state[d], free_run[integrated_state[d]], next[integrated_state[d]]);
+			multi_step_error[d] += error*error;
+		}
+	}
+
+	result.steps = last - first;
+	for(int d = 0; d < NUM_DERIVATIVES; d++)
+	{
+		result.one_step[d] = std::sqrt(one_step_error[d]/result.steps);
+		result.multi_step[d] = diverged ? std::numeric_limits<double>::infinity() : std::sqrt(multi_step_error[d]/result.steps);
+	}
+}
+
+// Names of the validation statistics, errors are named after the integrated state
+std::vector<std::string> validation_statistic_names()
+{
+	std::vector<std::string> names;
+	for(std::string horizon : {"One-Step", "Multi-Step"})
+	{
+		for(std::string state : {"psi", "theta", "phi", "x", "y", "z"})
+		{
+			names.push_back(horizon + " RMS " + state);
+		}
+	}
+	return names;
+}
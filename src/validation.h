@@ -0,0 +1,51 @@
+/**
+ * @file validation.h
+ *
+ * @brief model validation definition
+ *
+ * Forward simulation of an identified model over a window it was not fitted on.
+ *
+ * The derivatives p, q, r are the body rates and u, v, w the body velocities, they are
+ * turned into rates of the attitude through the Euler angle kinematics and into rates of
+ * the NED position x, y, z through the rotation at the current attitude. The actuators are
+ * inputs taken from the window. A fixed-step RK4 integrates the model from every sample to
+ * the next (one-step error) and from the first sample over the whole window (multi-step
+ * error), both are root mean square errors per integrated state. The model is evaluated
+ * through its compiled plan, only the monomials in its support are computed.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef VALIDATION_H_
+#define VALIDATION_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "workspace.h"
+#include "model_plan.h"
+#include <array>
+#include <vector>
+#include <string>
+
+#define NUM_VALIDATION_STATISTICS (2*NUM_DERIVATIVES) // One-step and multi-step error per state
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+// Prediction error of a model on one window, in the order of validation_statistic_names
+struct Validation_Result {
+    std::array<double, NUM_DERIVATIVES> one_step; // From every sample to the next
+    std::array<double, NUM_DERIVATIVES> multi_step; // Free run from the first sample, infinite if the model diverged
+    int steps = 0; // Integration steps compared, 0 if the window was not validated
+
+    Validation_Result();
+
+    void clear();
+};
+
+void validate_model(const Model_Plan &model, const SID_Workspace &workspace, Validation_Result &result);
+std::vector<std::string> validation_statistic_names();
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * @file worker_pool.cpp
+ *
+ * @brief shared compute pool
+ *
+ * Round-robin task scheduling across identification pipelines
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "worker_pool.h"
+#include "trace.h"
+#include <iostream>
+#include <memory>
+
+// ------------------------------------------------------------------------------
+//   Con/De structors
+// ------------------------------------------------------------------------------
+Worker_Pool::
+Worker_Pool(int num_workers, Thread_Settings settings)
+{
+	if(num_workers < 1)
+	{
+		num_workers = 1;
+	}
+	for(int i = 0; i < num_workers; i++)
+	{
+		workers.push_back(std::thread(&Worker_Pool::worker, this));
+		std::cout << apply_thread_settings(workers.back().native_handle(), settings, "Pool worker " + std::to_string(i)) << "\n";
+	}
+}
+
+Worker_Pool::
+~Worker_Pool()
+{
+	stop();
+}
+
+// Clients must be registered before any pipeline runs a batch
+int Worker_Pool::
+register_client()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	clients.push_back(Client());
+	return clients.size() - 1;
+}
+
+// Call task(0) to task(count - 1) on the pool and wait for all of them
+// One batch per client at a time, the client's own thread is the only caller
+void Worker_Pool::
+run(int client, const std::function<void(size_t)> &task, size_t count)
+{
+	std::unique_lock<std::mutex> unique_lock(mtx);
+	if(time_to_exit)
+	{
+		unique_lock.unlock();
+		for(size_t i = 0; i < count; i++)
+		{
+			task(i);
+		}
+		return;
+	}
+	clients[client].batch = &task;
+	clients[client].batch_next = 0;
+	clients[client].batch_size = count;
+	clients[client].batch_remaining = count;
+	not_empty.notify_all();
+	batch_done.wait(unique_lock, [this, client]{ return clients[client].batch_remaining == 0; });
+	clients[client].batch = nullptr;
+	clients[client].batch_size = 0;
+}
+
+void Worker_Pool::
+worker()
+{
+	TRACE_THREAD_NAME("pool worker");
+	std::unique_lock<std::mutex> unique_lock(mtx);
+	while(true)
+	{
+		// Find the next client with pending work, starting after the one served last
+		int selected = -1;
+		for(size_t i = 0; i < clients.size(); i++)
+		{
+			int candidate = (next_client + i) % clients.size();
+			if(clients[candidate].batch_next < clients[candidate].batch_size)
+			{
+				selected = candidate;
+				break;
+			}
+		}
+
+		if(selected < 0)
+		{
+			if(time_to_exit)
+			{
+				return;
+			}
+			not_empty.wait(unique_lock);
+			continue;
+		}
+
+		next_client = (selected + 1) % clients.size();
+		// The caller of run() is blocked until the last call of its batch returns
+		size_t index = clients[selected].batch_next++;
+		const std::function<void(size_t)> *batch = clients[selected].batch;
+		unique_lock.unlock();
+		(*batch)(index);
+		unique_lock.lock();
+		clients[selected].completed++;
+		if(--clients[selected].batch_remaining == 0)
+		{
+			batch_done.notify_all();
+		}
+	}
+}
+
+// Finish the started batches and join the workers
+void Worker_Pool::
+stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		time_to_exit = true;
+	}
+	not_empty.notify_all();
+	for(auto &worker_thread : workers)
+	{
+		if(worker_thread.joinable())
+		{
+			worker_thread.join();
+		}
+	}
+}
+
+// Calls of the client's current batch that have not returned yet, including the running ones
+int Worker_Pool::
+pending(int client)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return clients[client].batch_remaining;
+}
+
+uint64_t Worker_Pool::
+completed(int client)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return clients[client].completed;
+}
+
+int Worker_Pool::
+size() const
+{
+	return workers.size();
+}
@@ -0,0 +1,72 @@
+/**
+ * @file worker_pool.h
+ *
+ * @brief shared compute pool definition
+ *
+ * A fixed set of worker threads shared by several identification pipelines,
+ * serving the pipelines round-robin so that no vehicle starves the others
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef WORKER_POOL_H_
+#define WORKER_POOL_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include "scheduling.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------------
+//   Worker Pool Class
+// ----------------------------------------------------------------------------------
+/*
+ * Every client (one per vehicle pipeline) hands the workers a batch of indexed calls with
+ * run(). Workers take the next call from the client after the one served last, so each
+ * client with pending work gets an equal share of the pool. Batches need no futures or
+ * task copies and so do not allocate.
+ */
+class Worker_Pool
+{
+    struct Client {
+        uint64_t completed = 0;
+
+        // Batch of run(), calls batch_next..batch_size-1 are still to be started
+        const std::function<void(size_t)> *batch = nullptr;
+        size_t batch_next = 0;
+        size_t batch_size = 0;
+        size_t batch_remaining = 0;
+    };
+
+    int next_client = 0; // Round-robin position
+    bool time_to_exit = false;
+
+    std::vector<Client> clients;
+    std::vector<std::thread> workers;
+    std::mutex mtx;
+    std::condition_variable not_empty;
+    std::condition_variable batch_done;
+
+    void worker();
+
+public:
+    Worker_Pool(int num_workers, Thread_Settings settings);
+    ~Worker_Pool();
+
+    int register_client();
+    void run(int client, const std::function<void(size_t)> &task, size_t count);
+    void stop();
+
+    int pending(int client);
+    uint64_t completed(int client);
+    int size() const;
+};
+
+#endif
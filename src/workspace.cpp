@@ -0,0 +1,122 @@
+/**
+ * @file workspace.cpp
+ *
+ * @brief compute workspace
+ *
+ * Preallocated storage of the compute loop and its aliasing views
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+
+#include "workspace.h"
+
+// ------------------------------------------------------------------------------
+//   SID Workspace
+// ------------------------------------------------------------------------------
+SID_Workspace::
+SID_Workspace(int capacity_)
+{
+	// The Gram blocks only depend on the library, they are sized once for the largest one
+	gram_storage.resize(MAX_CANDIDATES*MAX_CANDIDATES);
+	projection_storage.resize(MAX_CANDIDATES*NUM_DERIVATIVES);
+	reserve(capacity_);
+}
+
+// Make room for windows of up to the given number of samples, returns true if the storage had to grow
+bool SID_Workspace::
+reserve(int samples)
+{
+	if(samples <= capacity)
+	{
+		return false;
+	}
+	capacity = samples;
+	time_storage.resize(capacity);
+	basis_storage.resize(capacity*NUM_BASIS_STATES);
+	derivative_storage.resize(capacity*NUM_DERIVATIVES);
+	aero_storage.resize(capacity*NUM_AERO_STATES);
+	transform_storage.resize(capacity*NUM_TRANSFORM_ROWS);
+	candidate_storage.resize(capacity*MAX_CANDIDATES);
+	return true;
+}
+
+// Set the length of the current window, returns true if the storage had to grow
+bool SID_Workspace::
+resize(int samples)
+{
+	bool grown = reserve(samples);
+	num_samples = samples;
+	return grown;
+}
+
+// The views are strict aliases, an expression of the wrong size is an error instead of a reallocation
+arma::rowvec SID_Workspace::
+time_us()
+{
+	return arma::rowvec(time_storage.data(), num_samples, false, true);
+}
+
+arma::mat SID_Workspace::
+basis_states()
+{
+	return arma::mat(basis_storage.data(), NUM_BASIS_STATES, num_samples, false, true);
+}
+
+arma::mat SID_Workspace::
+derivatives()
+{
+	return arma::mat(derivative_storage.data(), NUM_DERIVATIVES, num_samples, false, true);
+}
+
+// One of alpha, beta, airspeed, see transform_states
+arma::rowvec SID_Workspace::
+aero_state(int state)
+{
+	return arma::rowvec(aero_storage.data() + state*capacity, num_samples, false, true);
+}
+
+arma::mat SID_Workspace::
+candidate_functions()
+{
+	return arma::mat(candidate_storage.data(), num_features, num_samples, false, true);
+}
+
+arma::mat SID_Workspace::
+gram()
+{
+	return arma::mat(gram_storage.data(), num_features, num_features, false, true);
+}
+
+arma::mat SID_Workspace::
+projections()
+{
+	return arma::mat(projection_storage.data(), num_features, NUM_DERIVATIVES, false, true);
+}
+
+// ------------------------------------------------------------------------------
+//   STLSQ Workspace
+// ------------------------------------------------------------------------------
+STLSQ_Workspace::
+STLSQ_Workspace(int num_features)
+{
+	reserve(num_features);
+}
+
+void STLSQ_Workspace::
+reserve(int num_features)
+{
+	if((int)indexes.size() >= num_features)
+	{
+		return;
+	}
+	indexes.resize(num_features);
+	system.resize(num_features*num_features);
+	solution.resize(num_features);
+	inverse.resize(num_features);
+	standard_errors.resize(num_features);
+}
@@ -0,0 +1,78 @@
+/**
+ * @file workspace.h
+ *
+ * @brief compute workspace definition
+ *
+ * Storage for the intermediate results of the SINDy compute loop. Each window slot of
+ * the pipeline owns one workspace, sized at startup and only grown by a window longer
+ * than any before it. The stages read and write the workspace through Armadillo
+ * matrices that alias its storage, so a steady state window does not touch the heap.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+#ifndef WORKSPACE_H_
+#define WORKSPACE_H_
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <armadillo>
+#include <vector>
+#include <array>
+
+#define NUM_BASIS_STATES 10 // x, y, z, psi, theta, phi, u0..u3, the bias is implicit
+#define NUM_DERIVATIVES 6 // p, q, r, u, v, w
+#define MAX_CANDIDATES ((NUM_BASIS_STATES + 1)*(NUM_BASIS_STATES + 2)/2) // Second order library
+#define NUM_AERO_STATES 3 // alpha, beta, airspeed
+#define NUM_TRANSFORM_ROWS 12 // Scratch rows of the frame transformation, angles, their sines and cosines, velocities
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+// Intermediate results of one window, every matrix has one column per sample
+struct SID_Workspace {
+    int capacity = 0; // Samples the storage holds
+    int num_samples = 0; // Samples of the current window
+    int num_features = 0; // Candidate functions of the current window
+
+    std::vector<double> time_storage; // [sample], host time [us]
+    std::vector<double> basis_storage; // [sample][basis state]
+    std::vector<double> derivative_storage; // [sample][derivative]
+    std::vector<double> aero_storage; // [aero state][sample], each state is one contiguous row of capacity samples
+    std::vector<double> transform_storage; // [row][sample], same layout as aero_storage
+    std::vector<double> candidate_storage; // [sample][feature]
+    std::vector<double> gram_storage; // [feature][feature]
+    std::vector<double> projection_storage; // [derivative][feature]
+    std::array<double, NUM_DERIVATIVES> derivative_energy{}; // Sum of squares of each derivative, for the residual variance of the solves
+
+    SID_Workspace(int capacity_ = 0);
+
+    bool reserve(int samples);
+    bool resize(int samples);
+
+    // Views of the current window, valid until the next resize
+    arma::rowvec time_us();
+    arma::mat basis_states();
+    arma::mat derivatives();
+    arma::rowvec aero_state(int state);
+    arma::mat candidate_functions();
+    arma::mat gram();
+    arma::mat projections();
+};
+
+// Scratch space of one STLSQ solve, one per model so the models can run in parallel
+struct STLSQ_Workspace {
+    std::vector<arma::uword> indexes; // Candidates still in the regression
+    std::vector<double> system; // Reduced Gram matrix plus ridge term, Cholesky factored in place
+    std::vector<double> solution; // Coefficients of the remaining candidates
+    std::vector<double> inverse; // One column of the inverse of the factored system
+    std::vector<double> standard_errors; // Of the remaining candidates, if requested
+
+    STLSQ_Workspace(int num_features = MAX_CANDIDATES);
+
+    void reserve(int num_features);
+};
+
+#endif
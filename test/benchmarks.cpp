@@ -0,0 +1,519 @@
+/**
+ * @file benchmarks.cpp
+ *
+ * @brief SINDy kernel microbenchmarks
+ *
+ * Times the numerical kernels of the pipeline over a sweep of window lengths, state
+ * counts and polynomial degrees. Every case reports the time per call and per sample,
+ * the heap allocations per call and the achieved GFLOP/s, and the results can be written
+ * as CSV or JSON so runs on the development machine and the companion computer can be
+ * compared side by side.
+ *
+ * Allocations are counted by the process wide allocation counter of allocation_counter.h,
+ * which needs glibc, on other C libraries the allocation columns read zero.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <armadillo>
+#include "regression.h"
+#include "system_identification.h"
+#include "interpolate.h"
+#include "allocation_counter.h"
+#include "model_plan.h"
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+struct Benchmark_Settings {
+    double min_batch_time = 0.05; // [s] Each timed batch repeats the kernel at least this long
+    int batches = 5; // Median of the batches is reported
+    std::vector<int> window_lengths = {250, 1000, 4000}; // Samples per window
+    std::vector<int> state_counts = {3, 6, 10}; // States of the generic libraries
+    std::vector<int> degrees = {1, 2};
+    std::string csv_path;
+    std::string json_path;
+};
+
+struct Benchmark_Result {
+    std::string kernel;
+    int samples; // Window samples, or vector elements for threshold_vector
+    int states;
+    int degree;
+    int features;
+    uint64_t repetitions;
+    double ns_per_call;
+    double ns_per_sample;
+    double allocations_per_call;
+    double bytes_per_call;
+    double gflops; // From the nominal flop count of the kernel, 0 where it is memory bound
+};
+
+// Keeps the compiler from discarding the kernel results
+static volatile double sink;
+
+// ------------------------------------------------------------------------------
+//   Synthetic inputs
+// ------------------------------------------------------------------------------
+// Telemetry streams at their usual PX4 rates covering a window of the given length
+Data_Buffer synthetic_buffer(int samples, int sample_rate)
+{
+	Data_Buffer data;
+	uint64_t duration_ms = (uint64_t)samples*1000/sample_rate + 1;
+	for(uint64_t t = 0; t <= duration_ms; t += 4) // 250 Hz attitude and rates
+	{
+		data.attitude_time_us.push_back(t*1000);
+		data.roll.push_back(0.1*180/M_PI*sin(0.002*t)); // [deg] like the attitude telemetry
+		data.pitch.push_back(0.1*180/M_PI*cos(0.003*t));
+		data.yaw.push_back(0.001*180/M_PI*t);
+		data.angular_velocity_time_us.push_back((t + 1)*1000);
+		data.rollspeed.push_back(0.2*cos(0.002*t));
+		data.pitchspeed.push_back(-0.3*sin(0.003*t));
+		data.yawspeed.push_back(0.001);
+	}
+	for(uint64_t t = 0; t <= duration_ms; t += 10) // 100 Hz odometry
+	{
+		data.position_time_us.push_back(t*1000);
+		data.x.push_back(0.01*t);
+		data.y.push_back(sin(0.001*t));
+		data.z.push_back(-10);
+		data.x_m_s.push_back(10);
+		data.y_m_s.push_back(cos(0.001*t));
+		data.z_m_s.push_back(0);
+	}
+	for(uint64_t t = 0; t <= duration_ms; t += 5) // 200 Hz actuator controls
+	{
+		data.actuator_time_us.push_back((t + 2)*1000);
+		data.actuator0.push_back(0.5 + 0.1*sin(0.01*t));
+		data.actuator1.push_back(0.5 + 0.1*cos(0.01*t));
+		data.actuator2.push_back(0.5);
+		data.actuator3.push_back(0.5 - 0.1*sin(0.01*t));
+	}
+	return data;
+}
+
+// Smooth, linearly independent states, rows are states and columns samples
+arma::mat synthetic_states(int states, int samples)
+{
+	arma::mat result(states, samples);
+	for(int i = 0; i < states; i++)
+	{
+		for(int j = 0; j < samples; j++)
+		{
+			result(i, j) = sin(0.01*(i + 1)*j + i) + 0.1*i;
+		}
+	}
+	return result;
+}
+
+// Derivatives that depend on two candidates each plus noise, so STLSQ has to threshold
+arma::mat synthetic_derivatives(const arma::mat &candidates, int states)
+{
+	arma::mat derivatives(states, candidates.n_cols);
+	for(int i = 0; i < states; i++)
+	{
+		derivatives.row(i) = 2.0*candidates.row((i + 1) % candidates.n_rows) - 0.5*candidates.row(candidates.n_rows - 1)
+							 + 0.001*arma::randn<arma::rowvec>(candidates.n_cols);
+	}
+	return derivatives;
+}
+
+// ------------------------------------------------------------------------------
+//   Measurement
+// ------------------------------------------------------------------------------
+Benchmark_Result measure(const Benchmark_Settings &settings, std::string kernel, int samples, int states, int degree, int features,
+						 double flops, std::function<void()> run)
+{
+	run(); // Warm up caches and let Armadillo size its buffers
+
+	// One counted call, the kernels are deterministic so every call allocates alike
+	Allocation_Scope scope;
+	run();
+	Allocation_Count counted = scope.elapsed();
+	uint64_t allocations = counted.allocations;
+	uint64_t bytes = counted.bytes;
+
+	// Calibrate the repetitions so a batch outlasts the clock resolution
+	uint64_t repetitions = 1;
+	while(true)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for(uint64_t i = 0; i < repetitions; i++)
+		{
+			run();
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if(elapsed.count() >= settings.min_batch_time || repetitions >= (1u << 24))
+		{
+			break;
+		}
+		repetitions *= 2;
+	}
+
+	std::vector<double> batch_ns;
+	for(int batch = 0; batch < settings.batches; batch++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for(uint64_t i = 0; i < repetitions; i++)
+		{
+			run();
+		}
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		batch_ns.push_back(elapsed.count()/repetitions);
+	}
+	std::sort(batch_ns.begin(), batch_ns.end());
+
+	Benchmark_Result result;
+	result.kernel = kernel;
+	result.samples = samples;
+	result.states = states;
+	result.degree = degree;
+	result.features = features;
+	result.repetitions = repetitions;
+	result.ns_per_call = batch_ns[batch_ns.size()/2];
+	result.ns_per_sample = result.ns_per_call/samples;
+	result.allocations_per_call = allocations;
+	result.bytes_per_call = bytes;
+	result.gflops = flops/result.ns_per_call; // flop/ns == GFLOP/s
+	return result;
+}
+
+// ------------------------------------------------------------------------------
+//   Machine description
+// ------------------------------------------------------------------------------
+std::string cpu_model()
+{
+	// x86 reports "model name", the Raspberry Pi "Model" and older ARM kernels "Hardware"
+	std::ifstream cpuinfo("/proc/cpuinfo");
+	std::string line, model;
+	while(std::getline(cpuinfo, line))
+	{
+		for(const char *key : {"model name", "Model", "Hardware"})
+		{
+			if(model.empty() && line.compare(0, strlen(key), key) == 0 && line.find(':') != std::string::npos)
+			{
+				model = line.substr(line.find(':') + 2);
+			}
+		}
+	}
+	return model.empty() ? "unknown" : model;
+}
+
+std::vector<std::pair<std::string, std::string>> machine_description()
+{
+	utsname system;
+	uname(&system);
+	char hostname[256] = "";
+	gethostname(hostname, sizeof(hostname) - 1);
+	return {{"host", hostname},
+			{"arch", system.machine},
+			{"kernel_release", system.release},
+			{"cpu", cpu_model()},
+			{"cores", std::to_string(sysconf(_SC_NPROCESSORS_ONLN))},
+			{"compiler", __VERSION__},
+			{"armadillo", arma::arma_version::as_string()}};
+}
+
+// ------------------------------------------------------------------------------
+//   Output
+// ------------------------------------------------------------------------------
+std::string json_escape(const std::string &text)
+{
+	std::string escaped;
+	for(char c : text)
+	{
+		if(c == '"' || c == '\\')
+		{
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+void write_csv(const std::string &path, const std::vector<std::pair<std::string, std::string>> &machine, const std::vector<Benchmark_Result> &results)
+{
+	std::ofstream out(path);
+	if(!out)
+	{
+		std::cerr << "Could not open " << path << "\n";
+		throw EXIT_FAILURE;
+	}
+	// Machine description as leading comment lines, most CSV readers skip them
+	for(auto &entry : machine)
+	{
+		out << "# " << entry.first << ": " << entry.second << "\n";
+	}
+	out << "kernel,samples,states,degree,features,repetitions,ns_per_call,ns_per_sample,allocations_per_call,bytes_per_call,gflops\n";
+	for(auto &result : results)
+	{
+		out << result.kernel << "," << result.samples << "," << result.states << "," << result.degree << "," << result.features << ","
+			<< result.repetitions << "," << result.ns_per_call << "," << result.ns_per_sample << "," << result.allocations_per_call << ","
+			<< result.bytes_per_call << "," << result.gflops << "\n";
+	}
+}
+
+void write_json(const std::string &path, const std::vector<std::pair<std::string, std::string>> &machine, const std::vector<Benchmark_Result> &results)
+{
+	std::ofstream out(path);
+	if(!out)
+	{
+		std::cerr << "Could not open " << path << "\n";
+		throw EXIT_FAILURE;
+	}
+	out << "{\n  \"machine\": {";
+	for(size_t i = 0; i < machine.size(); i++)
+	{
+		out << (i ? ", " : "") << "\"" << machine[i].first << "\": \"" << json_escape(machine[i].second) << "\"";
+	}
+	out << "},\n  \"results\": [\n";
+	for(size_t i = 0; i < results.size(); i++)
+	{
+		const Benchmark_Result &result = results[i];
+		out << "    {\"kernel\": \"" << result.kernel << "\", \"samples\": " << result.samples << ", \"states\": " << result.states
+			<< ", \"degree\": " << result.degree << ", \"features\": " << result.features << ", \"repetitions\": " << result.repetitions
+			<< ", \"ns_per_call\": " << result.ns_per_call << ", \"ns_per_sample\": " << result.ns_per_sample
+			<< ", \"allocations_per_call\": " << result.allocations_per_call << ", \"bytes_per_call\": " << result.bytes_per_call
+			<< ", \"gflops\": " << result.gflops << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	out << "  ]\n}\n";
+}
+
+void print_result(const Benchmark_Result &result)
+{
+	printf("%-22s %7d %6d %6d %8d %14.0f %12.2f %10.0f %12.0f %8.3f\n", result.kernel.c_str(), result.samples, result.states, result.degree,
+		   result.features, result.ns_per_call, result.ns_per_sample, result.allocations_per_call, result.bytes_per_call, result.gflops);
+	fflush(stdout);
+}
+
+// ------------------------------------------------------------------------------
+//   Parse Command Line
+// ------------------------------------------------------------------------------
+std::vector<int> parse_list(const char *text)
+{
+	std::vector<int> values;
+	std::string list(text);
+	size_t start = 0;
+	while(start < list.size())
+	{
+		size_t end = list.find(',', start);
+		if(end == std::string::npos)
+		{
+			end = list.size();
+		}
+		values.push_back(atoi(list.substr(start, end - start).c_str()));
+		start = end + 1;
+	}
+	return values;
+}
+
+void parse_commandline(int argc, char **argv, Benchmark_Settings &settings)
+{
+	const char *commandline_usage = "usage: SINDy_benchmarks [--quick] [--csv <file>] [--json <file>] [--samples <n,n,..>] [--states <n,n,..>] [--degrees <1,2>]";
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0)
+		{
+			printf("%s\n", commandline_usage);
+			throw EXIT_SUCCESS;
+		}
+		// Shorter batches and windows, for a smoke test on slow targets
+		if(strcmp(argv[i], "--quick") == 0)
+		{
+			settings.min_batch_time = 0.01;
+			settings.batches = 3;
+			settings.window_lengths = {250, 1000};
+		}
+		else if(i + 1 < argc && strcmp(argv[i], "--csv") == 0)
+		{
+			settings.csv_path = argv[++i];
+		}
+		else if(i + 1 < argc && strcmp(argv[i], "--json") == 0)
+		{
+			settings.json_path = argv[++i];
+		}
+		else if(i + 1 < argc && strcmp(argv[i], "--samples") == 0)
+		{
+			settings.window_lengths = parse_list(argv[++i]);
+		}
+		else if(i + 1 < argc && strcmp(argv[i], "--states") == 0)
+		{
+			settings.state_counts = parse_list(argv[++i]);
+		}
+		else if(i + 1 < argc && strcmp(argv[i], "--degrees") == 0)
+		{
+			settings.degrees = parse_list(argv[++i]);
+		}
+		else
+		{
+			printf("%s\n", commandline_usage);
+			throw EXIT_FAILURE;
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int run_benchmarks(int argc, char **argv)
+{
+	Benchmark_Settings settings;
+	parse_commandline(argc, argv, settings);
+
+	auto machine = machine_description();
+	for(auto &entry : machine)
+	{
+		printf("%-16s %s\n", entry.first.c_str(), entry.second.c_str());
+	}
+	printf("\n%-22s %7s %6s %6s %8s %14s %12s %10s %12s %8s\n", "kernel", "samples", "states", "degree", "features", "ns/call",
+		   "ns/sample", "allocs", "bytes", "GFLOP/s");
+
+	std::vector<Benchmark_Result> results;
+	auto add = [&results](Benchmark_Result result)
+	{
+		print_result(result);
+		results.push_back(result);
+	};
+
+	SID sid;
+	const int sample_rate = 200; // [Hz] Resampling rate of the pipeline
+	const float threshold = 0.1;
+	const float lambda = 0;
+	for(int samples : settings.window_lengths)
+	{
+		// Resampling of the raw telemetry, 16 interpolated channels
+		Data_Buffer data = synthetic_buffer(samples, sample_rate);
+		Vehicle_States vehicle_states = linear_interpolate(data, sample_rate);
+		add(measure(settings, "linear_interpolate", vehicle_states.num_samples, 16, 0, 0, 0,
+					[&](){ sink = linear_interpolate(data, sample_rate).num_samples; }));
+
+		// The library of the vehicle states that the pipeline identifies
+		for(int degree : settings.degrees)
+		{
+			int features = sid.compute_candidate_functions(vehicle_states, degree).n_rows;
+			add(measure(settings, "vehicle_candidates", vehicle_states.num_samples, 11, degree, features, (double)features*vehicle_states.num_samples,
+						[&](){ sink = sid.compute_candidate_functions(vehicle_states, degree)(0, 0); }));
+		}
+
+		// Evaluation of an identified vehicle model, compiled plan against the dense coefficients
+		SID_Workspace workspace;
+		linear_interpolate(data, sample_rate, workspace);
+
+		// Unit conversion, NED to body rotation and aerodynamic states, the resampled window is restored before every call
+		std::vector<double> resampled_basis = workspace.basis_storage;
+		std::vector<double> resampled_derivatives = workspace.derivative_storage;
+		add(measure(settings, "transform_states", workspace.num_samples, 6, 0, 0, 0,
+					[&](){
+						std::copy(resampled_basis.begin(), resampled_basis.end(), workspace.basis_storage.begin());
+						std::copy(resampled_derivatives.begin(), resampled_derivatives.end(), workspace.derivative_storage.begin());
+						transform_states(workspace, true);
+						sink = workspace.aero_storage[0];
+					}));
+		arma::mat vehicle_library = sid.compute_candidate_functions(vehicle_states, 2);
+		arma::mat model = sid.STLSQ(sid.get_derivatives(vehicle_states), vehicle_library, threshold, lambda);
+		Model_Plan plan;
+		plan.compile(model);
+		int evaluations = workspace.num_samples;
+		std::vector<double> predicted(evaluations*NUM_DERIVATIVES);
+		add(measure(settings, "model_plan", evaluations, NUM_BASIS_STATES, 2, plan.get_monomials(), plan.flops()*evaluations,
+					[&](){
+						plan.evaluate(workspace.basis_storage.data(), evaluations, predicted.data());
+						sink = predicted[0];
+					}));
+		add(measure(settings, "dense_model", evaluations, NUM_BASIS_STATES, 2, vehicle_library.n_rows,
+					(double)vehicle_library.n_rows*(1 + 2*NUM_DERIVATIVES)*evaluations,
+					[&](){ sink = (model.t()*sid.compute_candidate_functions(vehicle_states, 2))(0, 0); }));
+
+		// Information gate on the Gram matrix of the window, independent of its length
+		arma::mat vehicle_gram = vehicle_library*vehicle_library.t();
+		add(measure(settings, "window_excitation", vehicle_states.num_samples, NUM_EXCITATION_STATES, 2, vehicle_library.n_rows, 0,
+					[&](){ sink = window_excitation(vehicle_gram, vehicle_states.num_samples); }));
+
+		for(int states : settings.state_counts)
+		{
+			arma::mat state_matrix = synthetic_states(states, samples);
+			arma::mat full_library = sid.compute_candidate_functions(state_matrix);
+			add(measure(settings, "candidate_functions", samples, states, 2, full_library.n_rows, (double)full_library.n_rows*samples,
+						[&](){ sink = sid.compute_candidate_functions(state_matrix)(0, 0); }));
+
+			for(int degree : settings.degrees)
+			{
+				// A first order library is the leading block of the second order one, as in solve_model
+				arma::mat candidates = degree == 1 ? arma::mat(full_library.rows(0, states)) : full_library;
+				arma::mat derivatives = synthetic_derivatives(candidates, states);
+				double F = candidates.n_rows;
+				double S = derivatives.n_rows;
+				double N = samples;
+				double factorization = 2.0/3.0*F*F*F; // LU of the F x F system
+
+				add(measure(settings, "gram", samples, states, degree, candidates.n_rows, 2*F*F*N + 2*F*S*N,
+							[&](){
+								arma::mat gram = candidates*candidates.t();
+								arma::mat projections = candidates*derivatives.t();
+								sink = gram(0, 0) + projections(0, 0);
+							}));
+
+				arma::rowvec state = derivatives.row(0);
+				add(measure(settings, "ridge_regression", samples, states, degree, candidates.n_rows, 2*F*F*N + 2*F*N + factorization,
+							[&](){ sink = ridge_regression(candidates, state, lambda)(0); }));
+
+				arma::mat gram = candidates*candidates.t();
+				arma::mat projections = candidates*derivatives.t();
+				int iterations = 0;
+				sid.STLSQ_gram(gram, projections, threshold, lambda, 10, &iterations);
+				double regressions = S + iterations; // One initial and one per iteration and state, at most F x F each
+				add(measure(settings, "stlsq_gram", samples, states, degree, candidates.n_rows, regressions*factorization,
+							[&](){ sink = sid.STLSQ_gram(gram, projections, threshold, lambda)(0, 0); }));
+				add(measure(settings, "stlsq", samples, states, degree, candidates.n_rows, 2*F*F*N + 2*F*S*N + regressions*factorization,
+							[&](){ sink = sid.STLSQ(derivatives, candidates, threshold, lambda)(0, 0); }));
+			}
+		}
+	}
+
+	// Thresholding only depends on the library size
+	for(int states : settings.state_counts)
+	{
+		int features = (states + 1)*(states + 2)/2;
+		arma::vec coefficients = arma::linspace<arma::vec>(-1, 1, features);
+		add(measure(settings, "threshold_vector", features, states, 2, features, 0,
+					[&](){ sink = sid.threshold_vector(coefficients, threshold, "below").n_elem; }));
+	}
+
+	if(!settings.csv_path.empty())
+	{
+		write_csv(settings.csv_path, machine, results);
+	}
+	if(!settings.json_path.empty())
+	{
+		write_json(settings.json_path, machine, results);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	try
+	{
+		return run_benchmarks(argc, argv);
+	}
+	catch(int error)
+	{
+		return error;
+	}
+}
@@ -0,0 +1,457 @@
+/**
+ * @file harness.cpp
+ *
+ * @brief end to end pipeline harness
+ *
+ * Drives Buffer -> SID stages -> coefficient log in process with synthetic telemetry of a
+ * known system, measures sustained throughput, window latency, drops and the error of
+ * the identified coefficients, and compares them with a recorded baseline
+ *
+ * The inputs are piecewise linear random signals with knots every 20 ms, and the outputs
+ * are linear in the inputs. With the default stream rates every sample time falls on a
+ * 20 ms grid of knots, so resampling is exact and the library is well conditioned: the
+ * identified coefficients should match the true ones to float precision.
+ *
+ * @author Stefan Bichlmaier, <bichlmaier.stef@gmail.com>
+ *
+ */
+
+// ------------------------------------------------------------------------------
+//   Includes
+// ------------------------------------------------------------------------------
+#include <armadillo>
+#include "buffer.h"
+#include "system_identification.h"
+#include "coefficient_logger.h"
+#include "worker_pool.h"
+#include "metrics.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#define KNOT_SPACING_MS 20
+#define NUM_INPUTS 10 // x, y, z, psi, theta, phi, u0..u3, the linear candidates after the bias
+
+// ------------------------------------------------------------------------------
+//   Data structures
+// ------------------------------------------------------------------------------
+struct Harness_Settings {
+    double duration = 10; // [s] Wall time the telemetry is generated for
+    double speedup = 0; // Simulated seconds per wall second, 0 inserts as fast as the pipeline accepts
+    std::vector<double> rates = {250, 250, 100, 200}; // [Hz] Attitude, angular velocity, odometry, actuator streams
+    int buffer_length = 500;
+    int pipeline_depth = 2;
+    int pool_size = 2;
+    float threshold = 0.1;
+    float lambda = 0.01;
+    std::string log_path = "harness_coefficients.bin";
+    std::string baseline_path; // Compared against if it exists, recorded otherwise
+    double tolerance = 0.2; // Allowed relative throughput loss
+    double latency_tolerance = 0.5; // Allowed relative growth of the p99 window latency
+    double max_coefficient_error = 1e-2; // Largest allowed coefficient error in any window
+};
+
+struct Harness_Result {
+    std::map<std::string, double> values; // Written to and compared with the baseline
+};
+
+// ------------------------------------------------------------------------------
+//   Known system
+// ------------------------------------------------------------------------------
+// Deterministic uniform value in [-1, 1] for knot k of input i
+double knot_value(int input, uint64_t knot)
+{
+	uint64_t z = knot*NUM_INPUTS + input + 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27))*0x94d049bb133111ebull;
+	z = z ^ (z >> 31);
+	return (z >> 11)*(2.0/9007199254740992.0) - 1.0;
+}
+
+// Value of every input at t, linear between the knots
+std::vector<double> known_inputs(double t_ms)
+{
+	std::vector<double> inputs(NUM_INPUTS);
+	uint64_t knot = t_ms/KNOT_SPACING_MS;
+	double fraction = (t_ms - knot*KNOT_SPACING_MS)/KNOT_SPACING_MS;
+	for(int i = 0; i < NUM_INPUTS; i++)
+	{
+		inputs[i] = (1 - fraction)*knot_value(i, knot) + fraction*knot_value(i, knot + 1);
+	}
+	return inputs;
+}
+
+// True coefficients in the layout of candidate_names() x derivative_names()
+arma::mat known_coefficients()
+{
+	std::vector<std::string> candidates = candidate_names();
+	std::vector<std::string> states = derivative_names();
+	arma::mat coefficients(candidates.size(), states.size(), arma::fill::zeros);
+	auto set = [&](std::string candidate, std::string state, double value)
+	{
+		int row = std::find(candidates.begin(), candidates.end(), candidate) - candidates.begin();
+		int column = std::find(states.begin(), states.end(), state) - states.begin();
+		coefficients(row, column) = value;
+	};
+	set("u0", "p", 0.8);
+	set("psi", "p", -0.5);
+	set("u1", "q", 0.6);
+	set("theta", "q", -0.4);
+	set("u2", "r", 0.3);
+	set("phi", "r", 0.2);
+	set("1", "u", 5);
+	set("u3", "u", 2);
+	set("y", "v", -0.5);
+	set("z", "w", 0.7);
+	return coefficients;
+}
+
+// Outputs p, q, r, u, v, w of the known system, only linear candidates are used
+std::vector<double> known_outputs(const std::vector<double> &inputs, const arma::mat &coefficients)
+{
+	std::vector<double> outputs(coefficients.n_cols);
+	for(size_t s = 0; s < coefficients.n_cols; s++)
+	{
+		outputs[s] = coefficients(0, s);
+		for(int i = 0; i < NUM_INPUTS; i++)
+		{
+			outputs[s] += coefficients(i + 1, s)*inputs[i];
+		}
+	}
+	return outputs;
+}
+
+// ------------------------------------------------------------------------------
+//   Telemetry generation
+// ------------------------------------------------------------------------------
+// Inserts the four streams in timestamp order from one thread, like the MAVSDK receive thread
+uint64_t generate_telemetry(Buffer &buffer, const Harness_Settings &settings, const arma::mat &coefficients, std::atomic<bool> &time_to_exit)
+{
+	double period_ms[4];
+	uint64_t count[4] = {0, 0, 0, 0};
+	for(int stream = 0; stream < 4; stream++)
+	{
+		period_ms[stream] = 1000.0/settings.rates[stream];
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	while(!time_to_exit)
+	{
+		int stream = 0;
+		for(int i = 1; i < 4; i++)
+		{
+			if(count[i]*period_ms[i] < count[stream]*period_ms[stream])
+			{
+				stream = i;
+			}
+		}
+		double t_ms = std::round(count[stream]*period_ms[stream]);
+		count[stream]++;
+		if(settings.speedup > 0)
+		{
+			std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t)(t_ms*1000/settings.speedup)));
+		}
+
+		std::vector<double> inputs = known_inputs(t_ms);
+		std::vector<double> outputs = known_outputs(inputs, coefficients);
+		uint64_t timestamp = t_ms*1000; // [us], like the clock synchronized subscriptions
+		if(stream == 0)
+		{
+			mavsdk::Telemetry::EulerAngle attitude;
+			// The autopilot reports degrees, the pipeline identifies in radians
+			attitude.roll_deg = inputs[3]*180/M_PI;
+			attitude.pitch_deg = inputs[4]*180/M_PI;
+			attitude.yaw_deg = inputs[5]*180/M_PI;
+			buffer.insert(attitude, timestamp);
+		}
+		else if(stream == 1)
+		{
+			mavsdk::Telemetry::AngularVelocityBody rates;
+			rates.roll_rad_s = outputs[0];
+			rates.pitch_rad_s = outputs[1];
+			rates.yaw_rad_s = outputs[2];
+			buffer.insert(rates, timestamp);
+		}
+		else if(stream == 2)
+		{
+			mavsdk::Telemetry::Odometry odometry;
+			odometry.child_frame_id = mavsdk::Telemetry::Odometry::MavFrame::BodyNed;
+			odometry.position_body.x_m = inputs[0];
+			odometry.position_body.y_m = inputs[1];
+			odometry.position_body.z_m = inputs[2];
+			odometry.velocity_body.x_m_s = outputs[3];
+			odometry.velocity_body.y_m_s = outputs[4];
+			odometry.velocity_body.z_m_s = outputs[5];
+			buffer.insert(odometry, timestamp);
+		}
+		else
+		{
+			mavsdk::Telemetry::ActuatorControlTarget actuators;
+			actuators.controls = {(float)inputs[6], (float)inputs[7], (float)inputs[8], (float)inputs[9]};
+			buffer.insert(actuators, timestamp);
+		}
+	}
+	return count[0] + count[1] + count[2] + count[3];
+}
+
+// ------------------------------------------------------------------------------
+//   Run
+// ------------------------------------------------------------------------------
+Harness_Result run_harness(const Harness_Settings &settings)
+{
+	arma::mat truth = known_coefficients();
+	std::remove(settings.log_path.c_str());
+
+	Buffer buffer(settings.buffer_length, buffer_mode::length_mode);
+	Worker_Pool pool(settings.pool_size, Thread_Settings());
+	SID sid(&buffer, std::chrono::high_resolution_clock::now(), settings.threshold, settings.lambda, settings.log_path, false, settings.pipeline_depth);
+	sid.set_name("harness");
+	sid.set_worker_pool(&pool);
+	sid.start();
+
+	std::atomic<bool> time_to_exit{false};
+	uint64_t inserted = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([&]{ inserted = generate_telemetry(buffer, settings, truth, time_to_exit); });
+	std::this_thread::sleep_for(std::chrono::duration<double>(settings.duration));
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// Stopping the SID releases the producer if it waits on a full buffer
+	time_to_exit = true;
+	sid.stop();
+	producer.join();
+
+	const Pipeline_Metrics &metrics = sid.get_metrics();
+	Harness_Result result;
+	result.values["samples_per_second"] = inserted/elapsed.count();
+	result.values["resampled_samples_per_second"] = metrics.samples/elapsed.count();
+	result.values["windows_per_second"] = metrics.windows/elapsed.count();
+	result.values["window_latency_p50_us"] = metrics.end_to_end.quantile(0.5);
+	result.values["window_latency_p90_us"] = metrics.end_to_end.quantile(0.9);
+	result.values["window_latency_p99_us"] = metrics.end_to_end.quantile(0.99);
+	result.values["window_latency_max_us"] = metrics.end_to_end.get_max();
+	result.values["stlsq_p99_us"] = metrics.stlsq.quantile(0.99);
+	result.values["dropped_records"] = metrics.dropped_records;
+	result.values["skipped_windows"] = metrics.skipped_windows;
+	result.values["incomplete_windows"] = metrics.incomplete_windows;
+
+	// Every logged window against the true coefficients
+	Coefficient_Reader reader(settings.log_path);
+	uint64_t sample_time_us;
+	arma::mat coefficients;
+	std::vector<double> statistics;
+	double error_sum = 0, error_max = 0;
+	int windows = 0, support_errors = 0;
+	while(reader.next(sample_time_us, coefficients, statistics))
+	{
+		arma::mat error = arma::abs(coefficients - truth);
+		error_sum += std::sqrt(arma::accu(error % error)/error.n_elem);
+		error_max = std::max(error_max, (double)error.max());
+		for(size_t i = 0; i < truth.n_elem; i++)
+		{
+			support_errors += (coefficients(i) != 0) != (truth(i) != 0);
+		}
+		windows++;
+	}
+	result.values["logged_windows"] = windows;
+	result.values["coefficient_rms_error"] = windows > 0 ? error_sum/windows : 0;
+	result.values["coefficient_max_error"] = error_max;
+	result.values["support_errors"] = support_errors;
+	std::remove(settings.log_path.c_str());
+	return result;
+}
+
+// ------------------------------------------------------------------------------
+//   Baseline
+// ------------------------------------------------------------------------------
+std::map<std::string, double> read_baseline(const std::string &path)
+{
+	std::map<std::string, double> baseline;
+	std::ifstream file(path);
+	std::string key;
+	double value;
+	while(file >> key >> value)
+	{
+		baseline[key] = value;
+	}
+	return baseline;
+}
+
+void write_baseline(const std::string &path, const Harness_Result &result)
+{
+	std::ofstream file(path);
+	if(!file)
+	{
+		std::cerr << "Could not write baseline " << path << "\n";
+		throw EXIT_FAILURE;
+	}
+	for(auto &entry : result.values)
+	{
+		file << entry.first << " " << entry.second << "\n";
+	}
+}
+
+// Returns the failed checks, empty if the run is within tolerance
+std::vector<std::string> compare(const Harness_Settings &settings, const Harness_Result &result, const std::map<std::string, double> &baseline)
+{
+	std::vector<std::string> failures;
+	auto value = [&result](const char *key){ return result.values.at(key); };
+	if(value("logged_windows") == 0)
+	{
+		failures.push_back("no window was logged");
+	}
+	if(value("dropped_records") > 0)
+	{
+		failures.push_back("coefficient records were dropped");
+	}
+	if(value("coefficient_max_error") > settings.max_coefficient_error)
+	{
+		failures.push_back("coefficient error above " + std::to_string(settings.max_coefficient_error));
+	}
+	if(baseline.count("samples_per_second") && value("samples_per_second") < (1 - settings.tolerance)*baseline.at("samples_per_second"))
+	{
+		failures.push_back("throughput regressed more than " + std::to_string((int)(100*settings.tolerance)) + "%");
+	}
+	if(baseline.count("window_latency_p99_us") && value("window_latency_p99_us") > (1 + settings.latency_tolerance)*baseline.at("window_latency_p99_us"))
+	{
+		failures.push_back("p99 window latency grew more than " + std::to_string((int)(100*settings.latency_tolerance)) + "%");
+	}
+	return failures;
+}
+
+// ------------------------------------------------------------------------------
+//   Parse Command Line
+// ------------------------------------------------------------------------------
+void parse_commandline(int argc, char **argv, Harness_Settings &settings)
+{
+	const char *commandline_usage = "usage: SINDy_harness [--duration <s>] [--speedup <x, 0 unpaced>] [--rates <attitude,rates,odometry,actuators Hz>]\n"
+									"  [--buffer <samples>] [--depth <n>] [--pool <n>] [-t <threshold>] [-r <lambda>]\n"
+									"  [--baseline <file>] [--tolerance <fraction>] [--latency-tolerance <fraction>] [--max-error <value>]";
+	for(int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if(has_value && strcmp(argv[i], "--duration") == 0)
+		{
+			settings.duration = strtod(argv[++i], nullptr);
+		}
+		else if(has_value && strcmp(argv[i], "--speedup") == 0)
+		{
+			settings.speedup = strtod(argv[++i], nullptr);
+		}
+		else if(has_value && strcmp(argv[i], "--rates") == 0)
+		{
+			char *position = argv[++i];
+			for(int stream = 0; stream < 4; stream++)
+			{
+				settings.rates[stream] = strtod(position, &position);
+				if(*position == ',')
+				{
+					position++;
+				}
+			}
+		}
+		else if(has_value && strcmp(argv[i], "--buffer") == 0)
+		{
+			settings.buffer_length = atoi(argv[++i]);
+		}
+		else if(has_value && strcmp(argv[i], "--depth") == 0)
+		{
+			settings.pipeline_depth = atoi(argv[++i]);
+		}
+		else if(has_value && strcmp(argv[i], "--pool") == 0)
+		{
+			settings.pool_size = atoi(argv[++i]);
+		}
+		else if(has_value && strcmp(argv[i], "-t") == 0)
+		{
+			settings.threshold = strtof(argv[++i], nullptr);
+		}
+		else if(has_value && strcmp(argv[i], "-r") == 0)
+		{
+			settings.lambda = strtof(argv[++i], nullptr);
+		}
+		else if(has_value && strcmp(argv[i], "--baseline") == 0)
+		{
+			settings.baseline_path = argv[++i];
+		}
+		else if(has_value && strcmp(argv[i], "--tolerance") == 0)
+		{
+			settings.tolerance = strtod(argv[++i], nullptr);
+		}
+		else if(has_value && strcmp(argv[i], "--latency-tolerance") == 0)
+		{
+			settings.latency_tolerance = strtod(argv[++i], nullptr);
+		}
+		else if(has_value && strcmp(argv[i], "--max-error") == 0)
+		{
+			settings.max_coefficient_error = strtod(argv[++i], nullptr);
+		}
+		else
+		{
+			std::cout << commandline_usage << "\n";
+			throw EXIT_FAILURE;
+		}
+	}
+	for(double rate : settings.rates)
+	{
+		if(rate <= 0)
+		{
+			std::cout << "Stream rates must be positive\n";
+			throw EXIT_FAILURE;
+		}
+	}
+}
+
+// ------------------------------------------------------------------------------
+//   Main
+// ------------------------------------------------------------------------------
+int main(int argc, char **argv)
+{
+	try
+	{
+		Harness_Settings settings;
+		parse_commandline(argc, argv, settings);
+		Harness_Result result = run_harness(settings);
+
+		std::map<std::string, double> baseline;
+		if(!settings.baseline_path.empty())
+		{
+			baseline = read_baseline(settings.baseline_path);
+		}
+		for(auto &entry : result.values)
+		{
+			printf("%-30s %14.6g", entry.first.c_str(), entry.second);
+			if(baseline.count(entry.first))
+			{
+				printf("   baseline %14.6g", baseline[entry.first]);
+			}
+			printf("\n");
+		}
+
+		std::vector<std::string> failures = compare(settings, result, baseline);
+		for(const std::string &failure : failures)
+		{
+			std::cout << "FAIL: " << failure << "\n";
+		}
+		// The first passing run on a machine records its baseline
+		if(failures.empty() && !settings.baseline_path.empty() && baseline.empty())
+		{
+			write_baseline(settings.baseline_path, result);
+			std::cout << "Baseline recorded in " << settings.baseline_path << "\n";
+		}
+		return failures.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	catch(int error)
+	{
+		return error;
+	}
+}
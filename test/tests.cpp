@@ -3,10 +3,35 @@
 #include "regression.h"
 #include "system_identification.h"
 #include "interpolate.h"
+#include "queue.h"
+#include "governor.h"
+#include "worker_pool.h"
+#include "coefficient_logger.h"
+#include "debug_log_sink.h"
+#include "flight_recorder.h"
+#include "metrics.h"
+#include "trace.h"
+#include "validation.h"
+#include "frame_transform.h"
+#include "clock_sync.h"
+#include "model_plan.h"
+#include "model_publisher.h"
+#include "coefficient_stream.h"
+#include "config.h"
+#include "control_socket.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fstream>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <netinet/in.h>
 //To integrate ODEs to verify STLSQ
 #include <boost/array.hpp>
 #include <boost/numeric/odeint.hpp>
 #include <math.h>
+#include <random>
+#include <future>
 
 TEST_CASE( "Regression of linear inputs is 1") {
     arma::mat x(1,100);
@@ -70,20 +95,20 @@ TEST_CASE( "Size limiting of data buffer" ) {
     for(int i = 0; i < 100; i++)
     {
         attitude_test_input.push_back(1);
-        attitude_test_time.push_back(i);
+        attitude_test_time.push_back(i*1000);
         if(i >= 10 && i <= 90)
         {
-            angular_velocity_test_time.push_back(i);
+            angular_velocity_test_time.push_back(i*1000);
             angular_velocity_test_input.push_back(i);
         }
         if(i >= 20 && i <= 80)
         {
-            position_velocity_test_time.push_back(i);
+            position_velocity_test_time.push_back(i*1000);
             position_test_input.push_back(i);
         }
         if(i >= 30 && i <= 70)
         {
-            actuator_test_time.push_back(i);
+            actuator_test_time.push_back(i*1000);
             actuator_test_input.push_back(i);
         }
     }
@@ -92,32 +117,32 @@ TEST_CASE( "Size limiting of data buffer" ) {
     test_buffer.actuator1 = actuator_test_input;
     test_buffer.actuator2 = actuator_test_input;
     test_buffer.actuator3 = actuator_test_input;
-    test_buffer.actuator_output_ms = actuator_test_time;
+    test_buffer.actuator_time_us = actuator_test_time;
 
     test_buffer.pitchspeed = angular_velocity_test_input;
     test_buffer.rollspeed = angular_velocity_test_input;
     test_buffer.yawspeed = angular_velocity_test_input;
-    test_buffer.angular_velocity_time_boot_ms = angular_velocity_test_time;
+    test_buffer.angular_velocity_time_us = angular_velocity_test_time;
 
     test_buffer.roll = attitude_test_input;
     test_buffer.pitch = attitude_test_input;
     test_buffer.yaw = attitude_test_input;
-    test_buffer.attitude_time_boot_ms = attitude_test_time;
+    test_buffer.attitude_time_us = attitude_test_time;
 
     test_buffer.x = position_test_input;
     test_buffer.y = position_test_input;
     test_buffer.z = position_test_input;
-    test_buffer.position_time_boot_ms = position_velocity_test_time;
+    test_buffer.position_time_us = position_velocity_test_time;
 
     test_buffer.x_m_s = position_test_input;
     test_buffer.y_m_s = position_test_input;
     test_buffer.z_m_s = position_test_input;
-    test_buffer.position_time_boot_ms = position_velocity_test_time;
+    test_buffer.position_time_us = position_velocity_test_time;
 
     Vehicle_States test_result = linear_interpolate(test_buffer, 1000);
     REQUIRE(test_result.num_samples == 40); //Check that limiting the range to latest and earliest samples works
-    REQUIRE(test_result.time_boot_ms.front() == 30); //Check that first sample time is correct
-    REQUIRE(test_result.time_boot_ms.back() == 70); //Check that last sample time is correct
+    REQUIRE(test_result.time_us.front() == 30000); //Check that first sample time is correct
+    REQUIRE(test_result.time_us.back() == 70000); //Check that last sample time is correct
 }
 
 TEST_CASE( "STLSQ of lorenz system") {
@@ -243,4 +268,1126 @@ TEST_CASE( "STLSQ of linear system") {
     //Verify results are correct to the nearest integer. This should be reproducible
     REQUIRE(std::round(test_result(2,0)) == -2.0);
     REQUIRE(std::round(test_result(1,1)) == 1.0);
-}
\ No newline at end of file
+}
+
+TEST_CASE( "STLSQ standard errors match the least squares covariance") {
+    // y = 0.5 + 2x with a deterministic disturbance, the z candidate is thresholded away
+    int num_samples = 400;
+    arma::mat candidate_functions(3, num_samples);
+    arma::mat states(1, num_samples);
+    for(int i = 0; i < num_samples; i++)
+    {
+        double x = sin(0.1*i);
+        candidate_functions(0, i) = 1;
+        candidate_functions(1, i) = x;
+        candidate_functions(2, i) = cos(0.37*i);
+        states(0, i) = 0.5 + 2*x + 0.05*sin(12.9898*i*i);
+    }
+
+    SID test_sindy;
+    for(float lambda : {0.0f, 0.5f})
+    {
+        arma::mat standard_errors;
+        arma::mat coefficients = test_sindy.STLSQ(states, candidate_functions, 0.1, lambda, 10, &standard_errors);
+        REQUIRE(coefficients(2, 0) == 0);
+        REQUIRE(standard_errors(2, 0) == 0);
+
+        // Covariance of the ridge estimate on the final active set, variance*A^-1 X*X' A^-1 with A = X*X' + lambda*I
+        arma::mat active = candidate_functions.rows(0, 1);
+        arma::mat gram = active*active.t();
+        arma::mat inverse = arma::inv(gram + lambda*arma::eye<arma::mat>(2, 2));
+        arma::mat residual = states - coefficients.rows(0, 1).t()*active;
+        double variance = arma::accu(arma::square(residual))/(num_samples - 2);
+        arma::mat covariance = variance*inverse*gram*inverse;
+        REQUIRE(fabs(standard_errors(0, 0) - sqrt(covariance(0, 0))) < 1e-9);
+        REQUIRE(fabs(standard_errors(1, 0) - sqrt(covariance(1, 1))) < 1e-9);
+        REQUIRE(standard_errors(1, 0) > 0);
+    }
+}
+
+TEST_CASE( "Steady state windows do not allocate") {
+    // One second of every stream at 250Hz, staggered so each one is interpolated
+    Data_Buffer data;
+    for(int i = 0; i < 250; i++)
+    {
+        uint64_t t = 4*i;
+        data.attitude_time_us.push_back(t*1000);
+        data.roll.push_back(std::sin(0.011*t));
+        data.pitch.push_back(std::cos(0.017*t));
+        data.yaw.push_back(std::sin(0.005*t + 1));
+        data.angular_velocity_time_us.push_back((t + 1)*1000);
+        data.rollspeed.push_back(0.8*std::sin(0.011*t) + 0.1);
+        data.pitchspeed.push_back(-0.4*std::cos(0.017*t));
+        data.yawspeed.push_back(0.3*std::sin(0.023*t));
+        data.position_time_us.push_back((t + 2)*1000);
+        data.x.push_back(std::sin(0.003*t));
+        data.y.push_back(std::cos(0.007*t));
+        data.z.push_back(std::sin(0.013*t + 2));
+        data.x_m_s.push_back(std::cos(0.003*t));
+        data.y_m_s.push_back(-0.5*std::cos(0.007*t));
+        data.z_m_s.push_back(0.7*std::sin(0.013*t + 2));
+        data.actuator_time_us.push_back((t + 3)*1000);
+        data.actuator0.push_back(std::sin(0.019*t));
+        data.actuator1.push_back(std::cos(0.029*t));
+        data.actuator2.push_back(std::sin(0.031*t + 1));
+        data.actuator3.push_back(std::cos(0.037*t + 2));
+    }
+
+    data.velocity_ned = true;
+
+    // The second pass over the same window reuses the workspace and must not touch the heap
+    SID test_sindy;
+    SID_Workspace workspace;
+    STLSQ_Workspace stlsq_workspace;
+    arma::mat coefficients(MAX_CANDIDATES, NUM_DERIVATIVES);
+    Allocation_Count second_pass;
+    bool grown[2];
+    for(int pass = 0; pass < 2; pass++)
+    {
+        Allocation_Scope allocations;
+        grown[pass] = linear_interpolate(data, 200, workspace);
+        transform_states(workspace, data.velocity_ned);
+        workspace.num_features = candidate_count(2);
+        arma::mat candidate_functions = workspace.candidate_functions();
+        test_sindy.compute_candidate_functions(workspace.basis_states(), 2, candidate_functions);
+        arma::mat gram = workspace.gram();
+        arma::mat projections = workspace.projections();
+        gram = candidate_functions * candidate_functions.t();
+        projections = candidate_functions * workspace.derivatives().t();
+        test_sindy.STLSQ_gram(gram, projections, MAX_CANDIDATES, 0.1, 0.1, 10, nullptr, stlsq_workspace, coefficients);
+        second_pass = allocations.elapsed();
+    }
+    REQUIRE(grown[0]);
+    REQUIRE(!grown[1]);
+    if(allocation_counting())
+    {
+        REQUIRE(second_pass.allocations == 0);
+    }
+
+    // Same coefficients as the allocating path
+    Vehicle_States states = linear_interpolate(data, 200);
+    REQUIRE(states.num_samples == workspace.num_samples);
+    arma::mat reference = test_sindy.STLSQ(test_sindy.get_derivatives(states), test_sindy.compute_candidate_functions(states, 2), 0.1, 0.1);
+    REQUIRE(arma::approx_equal(coefficients, reference, "absdiff", 1e-6));
+}
+
+TEST_CASE( "Frame transformation of a resampled window") {
+    // Trigonometric kernels against libm over several turns and every quadrant
+    std::vector<double> angles, sines(401), cosines(401);
+    for(int i = 0; i <= 400; i++)
+    {
+        angles.push_back(-10 + 0.05*i);
+    }
+    sincos_row(angles.data(), angles.size(), sines.data(), cosines.data());
+    for(size_t i = 0; i < angles.size(); i++)
+    {
+        REQUIRE(std::fabs(sines[i] - std::sin(angles[i])) < 1e-14);
+        REQUIRE(std::fabs(cosines[i] - std::cos(angles[i])) < 1e-14);
+    }
+    std::vector<double> y = {0, 0, 1, -1, 1, -1, 3, -0.2, 1e-3, -5}, x = {0, -1, 0, 0, 1, -1, -0.5, 4, -2, 1e-3}, atan2s(10);
+    atan2_row(y.data(), x.data(), y.size(), atan2s.data());
+    for(size_t i = 0; i < y.size(); i++)
+    {
+        REQUIRE(std::fabs(atan2s[i] - std::atan2(y[i], x[i])) < 1e-13);
+    }
+
+    // A window of known attitude [deg] and body velocities, reported in NED
+    SID_Workspace workspace;
+    int samples = 50;
+    workspace.resize(samples);
+    std::vector<double> body(3*samples);
+    for(int i = 0; i < samples; i++)
+    {
+        double roll = 20*std::sin(0.1*i), pitch = 10*std::cos(0.07*i), yaw = -170 + 7*i;
+        double u = 15 + std::sin(0.2*i), v = 0.5*std::cos(0.3*i), w = 1 - 0.05*i;
+        double sphi = std::sin(roll*M_PI/180), cphi = std::cos(roll*M_PI/180);
+        double stheta = std::sin(pitch*M_PI/180), ctheta = std::cos(pitch*M_PI/180);
+        double spsi = std::sin(yaw*M_PI/180), cpsi = std::cos(yaw*M_PI/180);
+        double *basis = workspace.basis_storage.data() + i*NUM_BASIS_STATES;
+        double *derivatives = workspace.derivative_storage.data() + i*NUM_DERIVATIVES;
+        basis[3] = roll;
+        basis[4] = pitch;
+        basis[5] = yaw;
+        derivatives[3] = ctheta*cpsi*u + (sphi*stheta*cpsi - cphi*spsi)*v + (cphi*stheta*cpsi + sphi*spsi)*w;
+        derivatives[4] = ctheta*spsi*u + (sphi*stheta*spsi + cphi*cpsi)*v + (cphi*stheta*spsi - sphi*cpsi)*w;
+        derivatives[5] = -stheta*u + sphi*ctheta*v + cphi*ctheta*w;
+        body[3*i] = u;
+        body[3*i + 1] = v;
+        body[3*i + 2] = w;
+    }
+    transform_states(workspace, true);
+    for(int i = 0; i < samples; i++)
+    {
+        const double *basis = workspace.basis_storage.data() + i*NUM_BASIS_STATES;
+        const double *derivatives = workspace.derivative_storage.data() + i*NUM_DERIVATIVES;
+        double u = body[3*i], v = body[3*i + 1], w = body[3*i + 2];
+        REQUIRE(std::fabs(basis[4] - 10*std::cos(0.07*i)*M_PI/180) < 1e-12);
+        REQUIRE(std::fabs(derivatives[3] - u) < 1e-9);
+        REQUIRE(std::fabs(derivatives[4] - v) < 1e-9);
+        REQUIRE(std::fabs(derivatives[5] - w) < 1e-9);
+        REQUIRE(std::fabs(workspace.aero_storage[aero_alpha*workspace.capacity + i] - std::atan2(w, u)) < 1e-9);
+        REQUIRE(std::fabs(workspace.aero_storage[aero_beta*workspace.capacity + i] - std::atan2(v, std::sqrt(u*u + w*w))) < 1e-9);
+        REQUIRE(std::fabs(workspace.aero_storage[aero_airspeed*workspace.capacity + i] - std::sqrt(u*u + v*v + w*w)) < 1e-9);
+    }
+
+    // Body frame velocities are left as they are
+    std::vector<double> resampled = workspace.derivative_storage;
+    transform_states(workspace, false);
+    REQUIRE(workspace.derivative_storage == resampled);
+}
+
+TEST_CASE( "Window excitation from the Gram matrix") {
+    SID test_sindy;
+    int samples = 400;
+    arma::mat basis = arma::randn<arma::mat>(NUM_BASIS_STATES, samples);
+    basis.rows(0, 2) *= 20; // Positions are not part of the excitation
+    basis.rows(3, 5) *= 0.05; // [rad]
+    basis.rows(6, 9) = 0.5 + 0.1*basis.rows(6, 9);
+    arma::mat candidate_functions(MAX_CANDIDATES, samples);
+    test_sindy.compute_candidate_functions(basis, 2, candidate_functions);
+    arma::mat gram = candidate_functions*candidate_functions.t();
+
+    // Least varied direction of the attitude and actuators, from the samples
+    arma::mat states = basis.rows(EXCITATION_FIRST_CANDIDATE - 1, EXCITATION_FIRST_CANDIDATE + NUM_EXCITATION_STATES - 2);
+    arma::vec mean = arma::mean(states, 1);
+    arma::vec eigenvalues = arma::eig_sym(states*states.t()/samples - mean*mean.t());
+    double excitation = window_excitation(gram, samples);
+    REQUIRE(std::abs(excitation - std::sqrt(eigenvalues.min())) < 1e-9);
+    REQUIRE(excitation > 0.03);
+
+    // Hover, the attitude is held and the actuators only change thrust together, the smaller library has the same leading block
+    basis.rows(3, 5) *= 0.01;
+    arma::rowvec thrust = basis.row(6);
+    for(int u = 7; u < 10; u++)
+    {
+        basis.row(u) = thrust + 1e-4*arma::randn<arma::rowvec>(samples);
+    }
+    arma::mat linear_candidates(candidate_count(1), samples);
+    test_sindy.compute_candidate_functions(basis, 1, linear_candidates);
+    REQUIRE(window_excitation(linear_candidates*linear_candidates.t(), samples) < 1e-3);
+    REQUIRE(window_excitation(gram, 1) == 0);
+}
+
+TEST_CASE( "Compiled model plan matches the dense model") {
+    SID test_sindy;
+    arma::mat basis = arma::randn<arma::mat>(NUM_BASIS_STATES, 50);
+    arma::mat candidate_functions(MAX_CANDIDATES, basis.n_cols);
+    test_sindy.compute_candidate_functions(basis, 2, candidate_functions);
+
+    // Sparse support with monomials shared between derivatives
+    arma::mat coefficients(MAX_CANDIDATES, NUM_DERIVATIVES, arma::fill::zeros);
+    coefficients(0, 0) = 0.5; // 1
+    coefficients(4, 0) = -1.5; // psi
+    coefficients(4, 3) = 2; // psi, shared
+    coefficients(17, 1) = 0.25; // xu0
+    coefficients(17, 5) = -0.75; // xu0, shared
+    coefficients(65, 2) = 3; // u3^2
+    Model_Plan plan;
+    plan.compile(coefficients);
+    REQUIRE(plan.get_monomials() == 4);
+    REQUIRE(plan.get_terms() == 6);
+    REQUIRE(plan.get_candidate(2) == 17);
+
+    arma::mat dense = coefficients.t()*candidate_functions;
+    std::vector<double> derivatives(basis.n_cols*NUM_DERIVATIVES);
+    plan.evaluate(basis.memptr(), basis.n_cols, derivatives.data());
+    for(arma::uword i = 0; i < basis.n_cols; i++)
+    {
+        for(int d = 0; d < NUM_DERIVATIVES; d++)
+        {
+            REQUIRE(std::abs(derivatives[i*NUM_DERIVATIVES + d] - dense(d, i)) < 1e-12);
+        }
+    }
+
+    // An empty model evaluates to zero
+    plan.compile(arma::mat(MAX_CANDIDATES, NUM_DERIVATIVES, arma::fill::zeros));
+    REQUIRE(plan.get_monomials() == 0);
+    double single[NUM_DERIVATIVES];
+    plan.evaluate(basis.colptr(0), single);
+    REQUIRE(single[5] == 0);
+}
+
+TEST_CASE( "Forward simulation scores identified models") {
+    // Banked and pitched, the body rates turn the yaw at a constant rate while roll and pitch hold
+    // u = 2 u0 under a constant input is rotated into NED at the current attitude, 5ms samples
+    int num_samples = 200;
+    double roll = 0.3, pitch = 0.2, yaw = 0.5, turn_rate = 0.4;
+    SID_Workspace workspace(num_samples);
+    workspace.resize(num_samples);
+    for(int i = 0; i < num_samples; i++)
+    {
+        double t = i*0.005;
+        double heading = yaw + turn_rate*t;
+        double *basis = workspace.basis_storage.data() + i*NUM_BASIS_STATES;
+        std::fill(basis, basis + NUM_BASIS_STATES, 0.0);
+        workspace.time_storage[i] = t*1e6;
+        basis[0] = 2*std::cos(pitch)*(std::sin(heading) - std::sin(yaw))/turn_rate; // x
+        basis[1] = -2*std::cos(pitch)*(std::cos(heading) - std::cos(yaw))/turn_rate; // y
+        basis[2] = -2*std::sin(pitch)*t; // z
+        basis[3] = roll;
+        basis[4] = pitch;
+        basis[5] = heading;
+        basis[6] = 1; // u0
+    }
+
+    arma::mat coefficients(MAX_CANDIDATES, NUM_DERIVATIVES, arma::fill::zeros);
+    coefficients(0, 0) = -turn_rate*std::sin(pitch); // p
+    coefficients(0, 1) = turn_rate*std::cos(pitch)*std::sin(roll); // q
+    coefficients(0, 2) = turn_rate*std::cos(pitch)*std::cos(roll); // r
+    coefficients(7, 3) = 2; // u0 -> u
+    Model_Plan model;
+    model.compile(coefficients);
+    REQUIRE(model.get_terms() == 4);
+
+    Validation_Result result;
+    validate_model(model, workspace, result);
+    REQUIRE(result.steps == num_samples - 1);
+    for(int d = 0; d < NUM_DERIVATIVES; d++)
+    {
+        REQUIRE(result.one_step[d] < 1e-9);
+        REQUIRE(result.multi_step[d] < 1e-8);
+    }
+
+    // A wrong yaw rate is caught one step ahead and grows over the free run
+    coefficients(0, 2) *= 2;
+    model.compile(coefficients);
+    validate_model(model, workspace, result);
+    REQUIRE(result.one_step[2] > 1e-4);
+    REQUIRE(result.multi_step[2] > result.one_step[2]);
+    REQUIRE(result.multi_step[3] > 1e-4);
+    REQUIRE(validation_statistic_names().size() == NUM_VALIDATION_STATISTICS);
+}
+
+TEST_CASE( "Shared memory readers see whole models") {
+    std::string name = "/sindy_test_model_" + std::to_string(getpid());
+    Shared_Model_Reader reader;
+    REQUIRE_FALSE(reader.open(name.c_str()));
+    {
+        Model_Publisher publisher(name, {"default", "linear"}, candidate_names(), derivative_names());
+        REQUIRE(reader.open(name.c_str()));
+        REQUIRE(reader.num_models() == 2);
+        REQUIRE(reader.find_model("linear") == 1);
+        Shared_Model model;
+        REQUIRE_FALSE(reader.read(0, model));
+
+        std::vector<arma::mat> coefficients(2, arma::mat(MAX_CANDIDATES, NUM_DERIVATIVES, arma::fill::zeros));
+        std::vector<Validation_Result> validation(2);
+        coefficients[1](17, 5) = -0.75;
+        validation[1].one_step[0] = 0.5;
+        publisher.publish(3, std::chrono::microseconds(1000), std::chrono::steady_clock::now(), coefficients, {}, validation);
+        REQUIRE(reader.sequence() == 2);
+        REQUIRE(reader.read(1, model));
+        REQUIRE(model.window_index == 3);
+        REQUIRE(model.coefficients[17][5] == -0.75);
+        REQUIRE(shared_model_supported(model, 17, 5));
+        REQUIRE_FALSE(shared_model_supported(model, 17, 4));
+        REQUIRE(model.validation[0] == 0.5);
+        REQUIRE(std::isnan(model.standard_errors[17][5]));
+
+        // Every coefficient of a window carries its index, a torn read would mix two windows
+        std::atomic<bool> done{false};
+        std::thread writer([&]{
+            for(uint64_t window = 4; window < 2000; window++)
+            {
+                coefficients[0].fill(window);
+                publisher.publish(window, std::chrono::microseconds(window), std::chrono::steady_clock::now(), coefficients, {}, validation);
+            }
+            done = true;
+        });
+        int torn = 0;
+        while(!done)
+        {
+            if(reader.read(0, model))
+            {
+                for(int feature = 0; feature < SHARED_MODEL_FEATURES; feature++)
+                {
+                    torn += model.coefficients[feature][0] != model.window_index;
+                }
+            }
+        }
+        writer.join();
+        REQUIRE(torn == 0);
+        REQUIRE(reader.read(0, model));
+        REQUIRE(model.window_index == 1999);
+    }
+    // The segment is removed with the publisher
+    Shared_Model_Reader late_reader;
+    REQUIRE_FALSE(late_reader.open(name.c_str()));
+}
+
+TEST_CASE( "Coefficient stream decodes keyframes and deltas on loopback") {
+    int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    REQUIRE(bind(receiver, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0);
+    REQUIRE(getsockname(receiver, reinterpret_cast<sockaddr *>(&address), &length) == 0);
+    timeval timeout{1, 0};
+    setsockopt(receiver, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    std::string destination = "127.0.0.1:" + std::to_string(ntohs(address.sin_port));
+
+    Coefficient_Streamer streamer(destination, 7, 1, 0, 4);
+    Coefficient_Stream_Decoder decoder;
+    std::vector<char> datagram(65536);
+    Streamed_Model model;
+    auto receive = [&]{
+        ssize_t received = recv(receiver, datagram.data(), datagram.size(), 0);
+        REQUIRE(received > 0);
+        return decoder.decode(datagram.data(), received, model);
+    };
+    std::vector<arma::mat> coefficients(1, arma::mat(MAX_CANDIDATES, NUM_DERIVATIVES, arma::fill::zeros));
+    std::vector<double> timings = {1000, 20, 30, 40, 50, 60};
+
+    coefficients[0](4, 0) = 1.25;
+    coefficients[0](17, 5) = -0.5;
+    streamer.publish(0, std::chrono::microseconds(100), coefficients, timings);
+    REQUIRE(receive());
+    REQUIRE(model.type == stream_keyframe);
+    REQUIRE(model.vehicle == 7);
+    REQUIRE(model.timings.size() == 6);
+    REQUIRE(model.timings[5] == 60);
+    REQUIRE(model.coefficients[4*NUM_DERIVATIVES] == 1.25);
+    REQUIRE(model.coefficients[17*NUM_DERIVATIVES + 5] == -0.5);
+
+    // Small moves are quantized deltas, a new term sends the support along
+    coefficients[0](4, 0) = 1.2512345;
+    streamer.publish(1, std::chrono::microseconds(200), coefficients, timings);
+    REQUIRE(receive());
+    REQUIRE(model.type == stream_delta);
+    REQUIRE(fabs(model.coefficients[4*NUM_DERIVATIVES] - 1.2512345) < 1e-5);
+    coefficients[0](65, 2) = 0.01;
+    streamer.publish(2, std::chrono::microseconds(300), coefficients, timings);
+    REQUIRE(receive());
+    REQUIRE(model.type == stream_support_delta);
+    REQUIRE(fabs(model.coefficients[65*NUM_DERIVATIVES + 2] - 0.01) < 1e-5);
+    REQUIRE(model.window_index == 2);
+
+    // The support differs from the keyframe until the keyframe interval has passed
+    streamer.publish(3, std::chrono::microseconds(400), coefficients, timings);
+    REQUIRE(receive());
+    REQUIRE(model.type == stream_support_delta);
+    streamer.publish(4, std::chrono::microseconds(500), coefficients, timings);
+    REQUIRE(receive());
+    REQUIRE(model.type == stream_keyframe);
+
+    // A lost datagram is reported and the next delta still decodes
+    streamer.publish(5, std::chrono::microseconds(600), coefficients, timings);
+    REQUIRE(recv(receiver, datagram.data(), datagram.size(), 0) > 0);
+    coefficients[0](17, 5) = -0.49;
+    streamer.publish(6, std::chrono::microseconds(700), coefficients, timings);
+    REQUIRE(receive());
+    REQUIRE(model.type == stream_delta);
+    REQUIRE(model.lost == 1);
+    REQUIRE(decoder.get_lost() == 1);
+    REQUIRE(fabs(model.coefficients[17*NUM_DERIVATIVES + 5] + 0.49) < 1e-5);
+
+    // Moves too large for a delta go out as keyframes
+    coefficients[0](4, 0) = 100;
+    streamer.publish(7, std::chrono::microseconds(800), coefficients, timings);
+    REQUIRE(receive());
+    REQUIRE(model.type == stream_keyframe);
+    REQUIRE(model.coefficients[4*NUM_DERIVATIVES] == 100);
+    REQUIRE(streamer.get_dropped() == 0);
+
+    // The bandwidth cap drops what does not fit
+    Coefficient_Streamer capped(destination, 7, 1, 200);
+    for(int window = 0; window < 10; window++)
+    {
+        capped.publish(window, std::chrono::microseconds(window), coefficients, timings);
+    }
+    REQUIRE(capped.get_sent() >= 1);
+    REQUIRE(capped.get_sent_bytes() <= 200);
+    REQUIRE(capped.get_dropped() > 0);
+    close(receiver);
+}
+
+TEST_CASE( "Buffer shutdown releases blocked inserts and clear") {
+    Buffer buffer(2, buffer_mode::length_mode);
+    mavsdk::Telemetry::EulerAngle attitude{};
+    buffer.insert(attitude, 0);
+    buffer.insert(attitude, 1);
+
+    // The buffer is full, a third insert waits for a clear that never comes
+    std::atomic<bool> returned{false};
+    std::thread producer([&]{ buffer.insert(attitude, 2); returned = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(!returned);
+
+    buffer.shutdown();
+    producer.join();
+    REQUIRE(returned);
+    REQUIRE(buffer.clear().find_max_length() == 0);
+}
+
+TEST_CASE( "Buffer window changes while a producer waits") {
+    Buffer buffer(2, buffer_mode::length_mode);
+    mavsdk::Telemetry::EulerAngle attitude{};
+    buffer.insert(attitude, 0);
+    buffer.insert(attitude, 1);
+
+    // A longer window lets the blocked producer continue
+    std::atomic<bool> returned{false};
+    std::thread producer([&]{ buffer.insert(attitude, 2); returned = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    REQUIRE(!returned);
+    REQUIRE(buffer.set_window(3, buffer_mode::length_mode));
+    producer.join();
+    REQUIRE(returned);
+    REQUIRE(!buffer.set_window(3, buffer_mode::length_mode));
+
+    // A shorter window than the samples already collected is handed out whole
+    REQUIRE(buffer.set_window(1, buffer_mode::length_mode));
+    REQUIRE(buffer.clear().attitude_time_us.size() == 3);
+}
+
+TEST_CASE( "Buffer keeps each stream's timestamps ascending") {
+    Buffer buffer(4, buffer_mode::length_mode);
+    mavsdk::Telemetry::EulerAngle attitude{};
+    buffer.insert(attitude, 2000);
+    buffer.insert(attitude, 1500); // The clock estimate stepped back between two samples
+    buffer.insert(attitude, 3000);
+    std::vector<uint64_t> times = buffer.clear().attitude_time_us;
+    REQUIRE(times == std::vector<uint64_t>{2000, 2000, 3000});
+}
+
+TEST_CASE( "Clock synchronization maps autopilot timestamps onto the host clock") {
+    // The autopilot booted 8s before the program, its crystal runs 50ppm slow, samples take 0.5 to 3.5ms to arrive
+    const double offset = -8e6, drift = 50e-6, min_delay = 500;
+    auto host_time = [&](double autopilot_us){ return autopilot_us + offset + drift*(autopilot_us - 10e6); };
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> jitter(0, 3000);
+
+    Clock_Sync clock;
+    double worst_error = 0;
+    uint64_t last_arrival = 0;
+    for(uint64_t autopilot_us = 10000000; autopilot_us <= 40000000; autopilot_us += 4000) // 30s at 250Hz
+    {
+        last_arrival = std::llround(host_time(autopilot_us) + min_delay + jitter(generator));
+        uint64_t stamped = clock.stamp(autopilot_us, last_arrival);
+        REQUIRE(stamped <= last_arrival);
+        if(autopilot_us > 30000000)
+        {
+            // Once the envelope holds all of its segments the stamp is the sample time plus the smallest delay
+            worst_error = std::max(worst_error, std::fabs(stamped - (host_time(autopilot_us) + min_delay)));
+        }
+    }
+    Clock_Estimate estimate = clock.get_estimate();
+    REQUIRE(estimate.synchronized);
+    REQUIRE(worst_error < 100);
+    REQUIRE(std::fabs(estimate.drift - drift) < 5e-6);
+
+    // Samples without a timestamp are moved back by the mean delay above the envelope
+    REQUIRE(estimate.delay_us > 1000);
+    REQUIRE(estimate.delay_us < 2000);
+    REQUIRE(clock.stamp(0, last_arrival) == (uint64_t)std::llround(last_arrival - estimate.delay_us));
+
+    // A rebooted autopilot restarts the estimate
+    clock.stamp(2000000, last_arrival + 4000);
+    estimate = clock.get_estimate();
+    REQUIRE(estimate.resets == 1);
+    REQUIRE(!estimate.synchronized);
+
+    std::string out;
+    clock.write(out, "vehicle=\"1\"");
+    REQUIRE(out.find("sindy_clock_resets_total{vehicle=\"1\"} 1") != std::string::npos);
+
+    // Disabled, the arrival time is used as it is
+    Clock_Sync arrival_clock(false);
+    REQUIRE(arrival_clock.stamp(123, 4567) == 4567);
+}
+
+TEST_CASE( "Buffer records the ingestion health of each stream") {
+    Buffer buffer(3, buffer_mode::length_mode);
+    buffer.set_gap_threshold(std::chrono::milliseconds(20));
+    mavsdk::Telemetry::EulerAngle attitude{};
+    Ingestion_Snapshot start = buffer.get_ingestion().snapshot();
+
+    // Two regular messages, then one after a gap
+    buffer.insert(attitude, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    buffer.insert(attitude, 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    buffer.insert(attitude, 45);
+
+    // The buffer is full, the next insert waits for the clear
+    std::thread producer([&]{ buffer.insert(attitude, 46); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    Data_Buffer data;
+    buffer.clear(data);
+    producer.join();
+
+    const Stream_Health &stream = buffer.get_ingestion().streams[attitude_stream];
+    REQUIRE(stream.messages == 4);
+    REQUIRE(stream.gaps >= 1);
+    REQUIRE(stream.blocked.get_count() == 1);
+    REQUIRE(stream.blocked_ns >= 20000000);
+    REQUIRE(stream.lock_hold.get_count() == 4);
+    REQUIRE(buffer.get_ingestion().streams[odometry_stream].messages == 0);
+
+    // Per window statistics are the difference of two snapshots
+    double statistics[NUM_INGESTION_STATISTICS];
+    ingestion_statistics(start, buffer.get_ingestion().snapshot(), statistics);
+    REQUIRE(statistics[attitude_stream*NUM_STREAM_STATISTICS] > 0);
+    REQUIRE(statistics[attitude_stream*NUM_STREAM_STATISTICS + 1] > 0);
+    REQUIRE(statistics[attitude_stream*NUM_STREAM_STATISTICS + 2] == stream.gaps);
+    REQUIRE(statistics[attitude_stream*NUM_STREAM_STATISTICS + 3] >= 20);
+    REQUIRE(statistics[odometry_stream*NUM_STREAM_STATISTICS] == 0);
+    REQUIRE(ingestion_statistic_names().size() == NUM_INGESTION_STATISTICS);
+
+    std::string out;
+    buffer.get_ingestion().write(out, "vehicle=\"1\"");
+    REQUIRE(out.find("sindy_ingest_messages_total{vehicle=\"1\",stream=\"attitude\"} 4\n") != std::string::npos);
+}
+
+TEST_CASE( "Bounded queue preserves order and releases on close") {
+    Bounded_Queue<int> queue(2);
+
+    REQUIRE(queue.push(1));
+    REQUIRE(queue.push(2));
+    REQUIRE(queue.depth() == 2);
+    REQUIRE(queue.max_depth() == 2);
+
+    int item = 0;
+    REQUIRE(queue.pop(item));
+    REQUIRE(item == 1);
+
+    //Closing drains remaining items before failing
+    queue.close();
+    REQUIRE_FALSE(queue.push(3));
+    REQUIRE(queue.pop(item));
+    REQUIRE(item == 2);
+    REQUIRE_FALSE(queue.pop(item));
+}
+
+TEST_CASE( "Thread settings are parsed from the command line spec") {
+    Thread_Settings pinned = parse_thread_settings("3:fifo:80");
+    REQUIRE(pinned.configured);
+    REQUIRE(pinned.cpus == std::vector<int>{3});
+    REQUIRE(pinned.policy == SCHED_FIFO);
+    REQUIRE(pinned.priority == 80);
+
+    // FIFO without a priority runs at 50, a CPU list alone keeps the default policy
+    Thread_Settings cores = parse_thread_settings("0,1,2");
+    REQUIRE(cores.cpus == std::vector<int>{0, 1, 2});
+    REQUIRE(cores.policy == SCHED_OTHER);
+    REQUIRE(cores.priority == 0);
+    REQUIRE(parse_thread_settings("1:fifo").priority == 50);
+    REQUIRE(parse_thread_settings("2:other").policy == SCHED_OTHER);
+
+    // "-" changes the policy without pinning
+    Thread_Settings unpinned = parse_thread_settings("-:fifo:10");
+    REQUIRE(unpinned.cpus.empty());
+    REQUIRE(unpinned.priority == 10);
+
+    REQUIRE_THROWS_AS(parse_thread_settings("a"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("1,,2"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("1,"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("-1"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("100000"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("1:rr"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("1:fifo:0"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("1:fifo:100"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("1:fifo:8x"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("1:other:5"), int);
+    REQUIRE_THROWS_AS(parse_thread_settings("1:fifo:80:2"), int);
+}
+
+TEST_CASE( "Governor escalates on missed deadlines and recovers with slack") {
+    Governor_Settings settings;
+    settings.degradations = parse_degradations("iterations,library");
+    settings.window_period = std::chrono::milliseconds(100);
+    settings.recovery_windows = 2;
+    Governor governor(settings);
+
+    auto t0 = std::chrono::steady_clock::now();
+    REQUIRE(governor.window_ready(t0, 0).level == 0);
+
+    //Two overruns apply both degradations
+    REQUIRE(governor.window_complete(t0, t0 + std::chrono::milliseconds(150)));
+    REQUIRE(governor.window_complete(t0, t0 + std::chrono::milliseconds(150)));
+    Governor_Decision decision = governor.window_ready(t0, 0);
+    REQUIRE(decision.level == 2);
+    REQUIRE(decision.max_iterations == settings.reduced_iterations);
+    REQUIRE(decision.library_order == 1);
+    REQUIRE(governor.get_deadline_misses() == 2);
+
+    //Windows finishing well within the deadline relax one level at a time
+    REQUIRE_FALSE(governor.window_complete(t0, t0 + std::chrono::milliseconds(10)));
+    REQUIRE_FALSE(governor.window_complete(t0, t0 + std::chrono::milliseconds(10)));
+    REQUIRE(governor.get_level() == 1);
+}
+
+TEST_CASE( "Worker pool serves clients round-robin") {
+    Worker_Pool pool(1, Thread_Settings());
+    int client_a = pool.register_client();
+    int client_b = pool.register_client();
+
+    //The first call of client a holds the only worker until both batches are waiting
+    std::promise<void> gate;
+    std::shared_future<void> gate_open = gate.get_future().share();
+    std::vector<int> order;
+    std::function<void(size_t)> batch_a = [&](size_t index){
+        if(index == 0)
+        {
+            gate_open.wait();
+            return;
+        }
+        order.push_back(client_a);
+    };
+    std::function<void(size_t)> batch_b = [&](size_t index){ order.push_back(client_b); };
+    auto wait_pending = [&pool](int client, int count){
+        while(pool.pending(client) != count)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    };
+
+    std::thread pipeline_a([&]{ pool.run(client_a, batch_a, 3); });
+    wait_pending(client_a, 3);
+    std::thread pipeline_b([&]{ pool.run(client_b, batch_b, 2); });
+    wait_pending(client_b, 2);
+    gate.set_value();
+    pipeline_a.join();
+    pipeline_b.join();
+    REQUIRE(pool.pending(client_a) == 0);
+    REQUIRE(pool.pending(client_b) == 0);
+
+    pool.stop();
+
+    //Batches of two calls each must be interleaved
+    REQUIRE(order.size() == 4);
+    for(size_t i = 1; i < order.size(); i++)
+    {
+        REQUIRE(order[i] != order[i-1]);
+    }
+    REQUIRE(pool.completed(client_a) == 3);
+    REQUIRE(pool.completed(client_b) == 2);
+
+    //A stopped pool runs the batch on the calling thread
+    int calls = 0;
+    pool.run(client_a, [&calls](size_t){ calls++; }, 2);
+    REQUIRE(calls == 2);
+}
+
+TEST_CASE( "Binary coefficient log round trip") {
+    std::string filename = "test_coefficients.bin";
+    arma::mat coefficients(3, 2);
+    for(int i = 0; i < coefficients.n_elem; i++)
+    {
+        coefficients(i) = i*0.5;
+    }
+
+    {
+        Coefficient_Logger logger(filename, "Time (us),a,b,c,d,e,f,s,", 3, 2, 1, 1);
+        for(int window = 0; window < 10; window++)
+        {
+            REQUIRE(logger.log(coefficients*window, std::chrono::microseconds(window*1000), {(double)window}));
+        }
+        logger.stop();
+        REQUIRE(logger.get_logged() == 10);
+        REQUIRE(logger.get_dropped() == 0);
+    }
+
+    Coefficient_Reader reader(filename);
+    REQUIRE(reader.get_header() == "Time (us),a,b,c,d,e,f,s,");
+    uint64_t sample_time_us;
+    arma::mat read_coefficients;
+    std::vector<double> statistics;
+    int windows = 0;
+    while(reader.next(sample_time_us, read_coefficients, statistics))
+    {
+        REQUIRE(sample_time_us == windows*1000);
+        REQUIRE(arma::approx_equal(read_coefficients, coefficients*windows, "absdiff", 1e-12));
+        REQUIRE(statistics.at(0) == windows);
+        windows++;
+    }
+    REQUIRE(windows == 10);
+    std::remove(filename.c_str());
+}
+
+TEST_CASE( "Sparse coefficient log reconstructs dense windows and seeks to keyframes") {
+    std::string filename = "test_coefficients_sparse.bin";
+    std::string dense_filename = "test_coefficients_dense.bin";
+    // 66x6 like the second order library, a few supported terms that drift and occasionally change
+    std::vector<arma::mat> windows;
+    for(int window = 0; window < 23; window++)
+    {
+        arma::mat coefficients(66, 6, arma::fill::zeros);
+        for(int term = 0; term < 20; term++)
+        {
+            coefficients((term*7) % 66, term % 6) = 1.0 + term + 0.001*window;
+        }
+        if(window % 5 == 0)
+        {
+            coefficients(65, 5) = -0.25*window;
+        }
+        windows.push_back(coefficients);
+    }
+
+    uint64_t sparse_bytes, dense_bytes;
+    {
+        Coefficient_Logger sparse(filename, "header", 66, 6, 1, 0, 10);
+        Coefficient_Logger dense(dense_filename, "header", 66, 6, 1, 0, 0);
+        for(int window = 0; window < windows.size(); window++)
+        {
+            REQUIRE(sparse.log(windows[window], std::chrono::microseconds(window*1000), {(double)window}));
+            REQUIRE(dense.log(windows[window], std::chrono::microseconds(window*1000), {(double)window}));
+        }
+        sparse.stop();
+        dense.stop();
+        sparse_bytes = sparse.get_bytes_written();
+        dense_bytes = dense.get_bytes_written();
+    }
+    REQUIRE(sparse_bytes*5 < dense_bytes);
+
+    Coefficient_Reader reader(filename);
+    REQUIRE(reader.get_keyframe_interval() == 10);
+    uint64_t sample_time_us;
+    arma::mat coefficients;
+    std::vector<double> statistics;
+    int window = 0;
+    while(reader.next(sample_time_us, coefficients, statistics))
+    {
+        REQUIRE(sample_time_us == window*1000);
+        REQUIRE(arma::approx_equal(coefficients, windows[window], "absdiff", 0.0));
+        REQUIRE(statistics.at(0) == window);
+        window++;
+    }
+    REQUIRE(window == windows.size());
+
+    // Windows 10 to 19 are decoded from the keyframe at window 10
+    REQUIRE(reader.seek(15000));
+    REQUIRE(reader.next(sample_time_us, coefficients, statistics));
+    REQUIRE(sample_time_us == 10000);
+    REQUIRE(arma::approx_equal(coefficients, windows[10], "absdiff", 0.0));
+    REQUIRE(reader.next(sample_time_us, coefficients, statistics));
+    REQUIRE(arma::approx_equal(coefficients, windows[11], "absdiff", 0.0));
+
+    std::remove(filename.c_str());
+    std::remove(dense_filename.c_str());
+}
+
+TEST_CASE( "Debug log sink rotates its files") {
+    std::string filename = "test_debug_log.csv";
+    std::remove(filename.c_str());
+    std::remove((filename + ".1").c_str());
+    std::remove((filename + ".2").c_str());
+    {
+        // 40 byte messages against a 1 KiB limit rotate several times, only two files are kept
+        Debug_Log_Sink sink(filename, 1024, 2, 16);
+        std::string message(40, 'x');
+        int queued = 0;
+        for(int i = 0; i < 200; i++)
+        {
+            if(sink.log(1, message))
+            {
+                queued++;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        sink.stop();
+        REQUIRE(sink.get_logged() == queued);
+        REQUIRE(sink.get_logged() + sink.get_dropped() == 200);
+        REQUIRE(sink.get_rotations() > 0);
+    }
+    std::ifstream current(filename);
+    std::ifstream rotated(filename + ".1");
+    std::ifstream removed(filename + ".2");
+    REQUIRE(current.good());
+    REQUIRE(rotated.good());
+    REQUIRE(!removed.good());
+    std::string line;
+    std::getline(rotated, line);
+    REQUIRE(line.substr(0, 2) == "1,");
+    std::remove(filename.c_str());
+    std::remove((filename + ".1").c_str());
+}
+
+TEST_CASE( "Flight recorder keeps the latest events after the process dies") {
+    std::string filename = "test_flight_recorder.bin";
+    // The child records more events than fit and dies without unmapping or syncing
+    pid_t child = fork();
+    if(child == 0)
+    {
+        Flight_Recorder recorder(filename, 64*100);
+        for(uint64_t i = 0; i < 250; i++)
+        {
+            recorder.record(insert_attitude, 1, i, {(float)i, 2.0f*i});
+        }
+        recorder.record(window_incomplete, 1, 7, {0, 10, 10, 10});
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    REQUIRE(WIFEXITED(status));
+
+    uint64_t start_time_us, start_steady_us;
+    std::vector<Recorded_Event> events = read_flight_recorder(filename, start_time_us, start_steady_us);
+    REQUIRE(events.size() == 100);
+    REQUIRE(events.front().argument == 151);
+    REQUIRE(events.front().values[1] == 302.0f);
+    REQUIRE(events.back().type == window_incomplete);
+    REQUIRE(events.back().argument == 7);
+    REQUIRE(recorder_event_name(events.back().type) == "window_incomplete");
+    for(size_t i = 1; i < events.size(); i++)
+    {
+        REQUIRE(events[i].sequence == events[i - 1].sequence + 1);
+        REQUIRE(events[i].time_us >= events[i - 1].time_us);
+    }
+    std::remove(filename.c_str());
+    std::remove((filename + ".1").c_str());
+}
+
+TEST_CASE( "Latency histogram quantiles stay within the bucket resolution") {
+    Latency_Histogram histogram;
+    REQUIRE(histogram.quantile(0.5) == 0);
+    for(uint64_t value = 1; value <= 10000; value++)
+    {
+        histogram.record(value);
+    }
+    REQUIRE(histogram.get_count() == 10000);
+    REQUIRE(histogram.get_max() == 10000);
+    REQUIRE(histogram.get_sum() == 10000*10001/2);
+    REQUIRE(std::abs((double)histogram.quantile(0.5) - 5000) < 0.07*5000);
+    REQUIRE(std::abs((double)histogram.quantile(0.99) - 9900) < 0.07*9900);
+    REQUIRE(histogram.quantile(1.0) == 10000);
+
+    Pipeline_Metrics metrics;
+    metrics.stlsq.record(std::chrono::microseconds(250));
+    metrics.windows++;
+    std::string out;
+    metrics.write(out, "vehicle=\"1\"");
+    REQUIRE(out.find("sindy_stlsq_us{vehicle=\"1\",quantile=\"0.99\"} 250\n") != std::string::npos);
+    REQUIRE(out.find("sindy_windows_total{vehicle=\"1\"} 1\n") != std::string::npos);
+}
+
+TEST_CASE( "Trace spans are exported as Chrome trace events") {
+    std::string filename = "test_trace.json";
+    auto read_trace = [&filename]()
+    {
+        std::ifstream file(filename);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        return contents.str();
+    };
+    auto count = [](const std::string &text, const std::string &pattern)
+    {
+        int found = 0;
+        for(size_t position = text.find(pattern); position != std::string::npos; position = text.find(pattern, position + 1))
+        {
+            found++;
+        }
+        return found;
+    };
+
+    trace_start(filename, 64);
+    trace_thread_name("test main");
+    {
+        Trace_Span outer("outer", 7);
+        Trace_Span inner("inner");
+    }
+    std::thread other([]{ Trace_Span span("other_thread"); });
+    other.join();
+    REQUIRE(trace_dump());
+    std::string trace = read_trace();
+    REQUIRE(trace.find("{\"name\":\"outer\",\"cat\":\"sindy\",\"ph\":\"X\"") != std::string::npos);
+    REQUIRE(trace.find("\"args\":{\"arg\":7}") != std::string::npos);
+    REQUIRE(trace.find("\"args\":{\"name\":\"test main\"}") != std::string::npos);
+    REQUIRE(count(trace, "\"ph\":\"X\"") == 3);
+    REQUIRE(count(trace, "\"name\":\"thread_name\"") == 2);
+
+    // The ring keeps the latest spans once it wraps
+    for(int i = 0; i < 200; i++)
+    {
+        Trace_Span span("wrap", i);
+    }
+    REQUIRE(trace_dump());
+    trace = read_trace();
+    REQUIRE(count(trace, "\"ph\":\"X\"") == 64);
+    REQUIRE(trace.find("\"name\":\"outer\"") == std::string::npos);
+    REQUIRE(trace.find("\"args\":{\"arg\":199}") != std::string::npos);
+
+    trace_stop();
+    uint64_t recorded = trace_recorded();
+    {
+        Trace_Span span("after_stop");
+    }
+    REQUIRE(trace_recorded() == recorded);
+    std::remove(filename.c_str());
+}
+
+#ifdef SINDY_USE_HDF5
+TEST_CASE( "HDF5 writer appends windows to chunked datasets") {
+    std::string filename = "test_sindy.h5";
+    Vehicle_States states;
+    states.num_samples = 4;
+    states.u = arma::rowvec(4, arma::fill::ones);
+    {
+        Hdf5_Writer writer(filename, {"default", "linear"}, {"1", "u", "v"}, {"p", "q"}, {"stage"}, {"statistic"}, true);
+        for(int window = 0; window < 20; window++)
+        {
+            std::vector<arma::mat> coefficients = {arma::mat(3, 2, arma::fill::ones)*window, arma::mat(3, 2, arma::fill::zeros)};
+            REQUIRE(writer.log(window, std::chrono::microseconds(5000), std::chrono::steady_clock::now(), coefficients,
+                               {(double)window}, {2.0*window}, states));
+        }
+        writer.stop();
+        REQUIRE(writer.get_logged() == 20);
+    }
+
+    hid_t file = H5Fopen(filename.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+    REQUIRE(file >= 0);
+    hid_t dataset = H5Dopen2(file, "coefficients", H5P_DEFAULT);
+    hid_t space = H5Dget_space(dataset);
+    hsize_t dims[4];
+    REQUIRE(H5Sget_simple_extent_ndims(space) == 4);
+    H5Sget_simple_extent_dims(space, dims, nullptr);
+    REQUIRE(dims[0] == 20);
+    REQUIRE(dims[1] == 2);
+    REQUIRE(dims[2] == 3);
+    REQUIRE(dims[3] == 2);
+    std::vector<double> coefficients(20*2*3*2);
+    H5Dread(dataset, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, coefficients.data());
+    REQUIRE(coefficients[17*12] == 17);
+    REQUIRE(coefficients[17*12 + 6] == 0);
+    REQUIRE(H5Aexists(dataset, "feature_names") > 0);
+    H5Sclose(space);
+    H5Dclose(dataset);
+
+    dataset = H5Dopen2(file, "states/u", H5P_DEFAULT);
+    space = H5Dget_space(dataset);
+    H5Sget_simple_extent_dims(space, dims, nullptr);
+    REQUIRE(dims[0] == 80);
+    H5Sclose(space);
+    H5Dclose(dataset);
+    H5Fclose(file);
+    std::remove(filename.c_str());
+}
+#endif
+
+TEST_CASE( "Configuration changes are validated before they apply") {
+    float value = 0;
+    REQUIRE(parse_float("0.05", value));
+    REQUIRE(value == 0.05f);
+    REQUIRE(!parse_float("0.05x", value));
+    REQUIRE(!parse_float("", value));
+    int length = 0;
+    REQUIRE(parse_int("150", length));
+    REQUIRE(length == 150);
+    REQUIRE(!parse_int("1.5", length));
+
+    Runtime_Config config;
+    config.models.push_back(parse_model_config("sparse:0.5:0.1"));
+    std::stringstream file("# tuned on the bench\nthreshold = 0.25\nmodel = sparse:0.7:0.2:1\nbuffer = 150 # samples\nmode = time\nudp = none\nexcitation = 0.02\n");
+    std::string error;
+    REQUIRE(parse_config(file, config, error));
+    REQUIRE(config.stlsq_threshold == 0.25f);
+    REQUIRE(config.models.size() == 1);
+    REQUIRE(config.models[0].threshold == 0.7f);
+    REQUIRE(config.models[0].library_order == 1);
+    REQUIRE(config.buffer_length == 150);
+    REQUIRE(config.mode == buffer_mode::time_mode);
+    REQUIRE(config.min_excitation == 0.02f);
+    REQUIRE(validate_config(config, error));
+
+    // Configured models are solved with their own penalties, so a global one is set on each of them
+    REQUIRE(apply_config_line("lambda = 0.15", config, error));
+    REQUIRE(config.ridge_regression_penalty == 0.15f);
+    REQUIRE(config.models[0].lambda == 0.15f);
+    REQUIRE(config.models[0].threshold == 0.7f);
+
+    // An invalid line names itself and leaves the setting as it was
+    std::stringstream invalid("lambda = 0.3\nlambda = fast\n");
+    REQUIRE(!parse_config(invalid, config, error));
+    REQUIRE(error.find("line 2") != std::string::npos);
+    REQUIRE(config.ridge_regression_penalty == 0.3f);
+    REQUIRE(!apply_config_line("window = 3", config, error));
+    REQUIRE(apply_config_line("buffer = 0", config, error));
+    REQUIRE(!validate_config(config, error));
+    config.buffer_length = 150;
+    REQUIRE(apply_config_line("excitation = -0.1", config, error));
+    REQUIRE(!validate_config(config, error));
+    config.min_excitation = 0.02;
+
+    // What show prints reads back as the same configuration
+    Runtime_Config copy;
+    std::stringstream shown(describe_config(config));
+    REQUIRE(parse_config(shown, copy, error));
+    REQUIRE(describe_config(copy) == describe_config(config));
+
+    // Floats keep every digit, a change below the sixth one still shows and reads back exactly
+    config.stlsq_threshold = 0.123456789f;
+    std::string before = describe_config(config);
+    config.stlsq_threshold = std::nextafter(config.stlsq_threshold, 1.0f);
+    REQUIRE(describe_config(config) != before);
+    std::stringstream precise(describe_config(config));
+    REQUIRE(parse_config(precise, copy, error));
+    REQUIRE(copy.stlsq_threshold == config.stlsq_threshold);
+
+    // Requests on the control socket reach the handler, a blank line ends them
+    std::string path = "test_sindy_control.sock";
+    Control_Socket control(path, [](const std::string &request) { return "got " + request; });
+    auto send_request = [&](const std::string &request) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        REQUIRE(connect(fd, (sockaddr *)&address, sizeof(address)) == 0);
+        REQUIRE(send(fd, request.data(), request.size(), 0) == (ssize_t)request.size());
+        char reply[256];
+        ssize_t received = recv(fd, reply, sizeof(reply), MSG_WAITALL);
+        close(fd);
+        return std::string(reply, received > 0 ? received : 0);
+    };
+    REQUIRE(send_request("threshold = 0.2\n\n") == "got threshold = 0.2\n");
+    REQUIRE(send_request("\n") == "got ");
+    control.stop();
+    REQUIRE(access(path.c_str(), F_OK) != 0);
+}
+
+TEST_CASE( "A change rejected by one pipeline leaves the logs of the others untouched") {
+    // Both vehicles move to new coefficient logs, the directory of the second one does not exist
+    std::string first_log = "test_reconfigure_1.bin";
+    std::string moved_log = "test_reconfigure_1_moved.bin";
+    std::string second_log = "test_reconfigure_2.bin";
+    std::ofstream(moved_log) << "previous flight";
+    auto read_file = [](const std::string &name) {
+        std::ifstream file(name, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    };
+
+    Buffer first_buffer(100, buffer_mode::length_mode);
+    Buffer second_buffer(100, buffer_mode::length_mode);
+    SID first(&first_buffer, std::chrono::high_resolution_clock::now(), 0.1, 0.1, first_log, false);
+    SID second(&second_buffer, std::chrono::high_resolution_clock::now(), 0.1, 0.1, second_log, false);
+    first.start();
+    second.start();
+
+    Pipeline_Config first_request = *first.get_config();
+    first_request.models[0].coefficient_logfile_path = moved_log;
+    Pipeline_Config second_request = *second.get_config();
+    second_request.models[0].coefficient_logfile_path = "test_missing_directory/" + second_log;
+    std::string error;
+    std::shared_ptr<Pipeline_Config> prepared = first.prepare_reconfiguration(first_request, error);
+    REQUIRE(prepared);
+    REQUIRE_FALSE(second.prepare_reconfiguration(second_request, error));
+    REQUIRE(error.find("test_missing_directory") != std::string::npos);
+
+    // The checks opened nothing, so dropping the change like the control socket does keeps the existing log
+    prepared.reset();
+    REQUIRE(read_file(moved_log) == "previous flight");
+    REQUIRE(first.get_config()->models[0].coefficient_logfile_path == first_log);
+
+    // Taking the change opens the new log
+    prepared = first.prepare_reconfiguration(first_request, error);
+    REQUIRE(first.reconfigure(prepared, error));
+    REQUIRE(first.get_config()->models[0].coefficient_logfile_path == moved_log);
+    REQUIRE(read_file(moved_log).compare(0, 7, COEFFICIENT_LOG_MAGIC) == 0);
+
+    first.stop();
+    second.stop();
+    for(const std::string &name : {first_log, moved_log, second_log})
+    {
+        std::remove(name.c_str());
+    }
+}